@@ -0,0 +1,93 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_AVL_TYPES(X) \
+    X(int, int, AInt, cmp_int)
+
+#define REGISTER_ZTREE_ADAPTIVE_TYPES(X) \
+    X(int, int, SpInt, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 20)
+#define N_OPS   4000000
+#define BUCKETS 20
+
+// Approximate Zipf(1.1): rank bucket b holds ranks [2^b, 2^(b+1)) and is picked with weight 2^(-0.1 b),
+// so each rank in it has weight ~2^(-1.1 b). Ranks are scattered over the key space by a multiplicative hash.
+static int *make_probes(int skewed)
+{
+    double cdf[BUCKETS], w = 1.0, total = 0.0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        total += w;
+        cdf[b] = total;
+        w *= 0.93303299153680741598; /* 2^-0.1 */
+    }
+    int *q = malloc(N_OPS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        uint64_t r = bench_rand(&seed);
+        uint32_t rank = (uint32_t)(r % N_KEYS);
+        if (skewed)
+        {
+            double u = (double)(r >> 11) * (1.0 / 9007199254740992.0) * total;
+            int b = 0;
+            while (b < BUCKETS - 1 && u > cdf[b])
+            {
+                b++;
+            }
+            rank = ((uint32_t)1 << b) - 1 + (uint32_t)(bench_rand(&seed) % ((uint64_t)1 << b));
+        }
+        q[i] = (int)((rank * 2654435761u) & (N_KEYS - 1));
+    }
+    return q;
+}
+
+#define BENCH_FINDS(Name, label, probes)                                                       \
+    do                                                                                         \
+    {                                                                                          \
+        ztree_##Name t = ztree_init(Name);                                                     \
+        for (int k = 0; k < N_KEYS; k++)                                                       \
+        {                                                                                      \
+            ztree_insert(&t, (int)(((uint32_t)k * 2246822519u) & (N_KEYS - 1)), k);            \
+        }                                                                                      \
+        double t0 = bench_now();                                                               \
+        for (size_t i = 0; i < N_OPS; i++)                                                     \
+        {                                                                                      \
+            ztree_node_##Name *n = ztree_find(&t, probes[i]);                                  \
+            check += n ? n->value : 0;                                                         \
+        }                                                                                      \
+        BENCH_REPORT(label, (size_t)N_OPS, bench_now() - t0);                                  \
+        ztree_clear(&t);                                                                       \
+    } while (0)
+
+static void bench_probes(const char *title, const int *probes)
+{
+    long long check = 0;
+    printf("=> %s\n", title);
+    BENCH_FINDS(Int, "red-black ztree_find", probes);
+    BENCH_FINDS(AInt, "AVL ztree_find", probes);
+    BENCH_FINDS(SpInt, "adaptive ztree_find", probes);
+    printf("  (checksum %lld)\n", check);
+}
+
+int main(void)
+{
+    int *zipf = make_probes(1);
+    int *uniform = make_probes(0);
+    bench_probes("Skewed finds (~Zipf 1.1, 1M keys)", zipf);
+    bench_probes("Uniform finds (1M keys)", uniform);
+    free(zipf);
+    free(uniform);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_AVL_TYPES(X) \
+    X(int, int, AInt, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS 1000000
+#define N_OPS  4000000
+
+// Sums node depths (root = 1) and tracks the deepest one.
+#define DEPTH_WALK(Name)                                                                      \
+    static void depth_##Name(ztree_node_##Name *n, size_t d, size_t *sum, size_t *max)        \
+    {                                                                                         \
+        for (; n; n = n->right, d++)                                                          \
+        {                                                                                     \
+            *sum += d;                                                                        \
+            *max = (d > *max) ? d : *max;                                                     \
+            depth_##Name(n->left, d + 1, sum, max);                                           \
+        }                                                                                     \
+    }
+DEPTH_WALK(Int)
+DEPTH_WALK(AInt)
+
+#define BENCH_POLICY(Name, label, keys, probes)                                                \
+    do                                                                                         \
+    {                                                                                          \
+        ztree_##Name t = ztree_init(Name);                                                     \
+        double t0 = bench_now();                                                               \
+        for (size_t i = 0; i < N_KEYS; i++)                                                    \
+        {                                                                                      \
+            ztree_insert(&t, keys[i], (int)i);                                                 \
+        }                                                                                      \
+        BENCH_REPORT(label " insert", (size_t)N_KEYS, bench_now() - t0);                       \
+        size_t sum = 0, max = 0;                                                               \
+        depth_##Name(t.root, 1, &sum, &max);                                                   \
+        printf("  %-28s avg depth %.2f, height %zu\n", label, (double)sum / t.size, max);      \
+        t0 = bench_now();                                                                      \
+        for (size_t i = 0; i < N_OPS; i++)                                                     \
+        {                                                                                      \
+            ztree_node_##Name *n = ztree_find(&t, probes[i]);                                  \
+            check += n ? n->value : 0;                                                         \
+        }                                                                                      \
+        BENCH_REPORT(label " find", (size_t)N_OPS, bench_now() - t0);                          \
+        t0 = bench_now();                                                                      \
+        for (size_t i = 0; i < N_KEYS; i += 2)                                                 \
+        {                                                                                      \
+            ztree_remove(&t, keys[i]);                                                         \
+        }                                                                                      \
+        BENCH_REPORT(label " remove (half)", (size_t)N_KEYS / 2, bench_now() - t0);            \
+        ztree_clear(&t);                                                                       \
+    } while (0)
+
+static void bench_keys(const char *title, const int *keys, const int *probes)
+{
+    long long check = 0;
+    printf("=> %s\n", title);
+    BENCH_POLICY(Int, "red-black", keys, probes);
+    BENCH_POLICY(AInt, "AVL", keys, probes);
+    printf("  (checksum %lld)\n", check);
+}
+
+int main(void)
+{
+    int *random = malloc(N_KEYS * sizeof(int));
+    int *ascending = malloc(N_KEYS * sizeof(int));
+    int *probes = malloc(N_OPS * sizeof(int));
+    uint64_t seed = 42;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        random[i] = (int)(bench_rand(&seed) % (4 * N_KEYS));
+        ascending[i] = (int)i * 4;
+    }
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        probes[i] = (int)(bench_rand(&seed) % (4 * N_KEYS));
+    }
+
+    bench_keys("Random inserts, uniform finds", random, probes);
+    bench_keys("Ascending inserts, uniform finds", ascending, probes);
+
+    free(random);
+    free(ascending);
+    free(probes);
+    return 0;
+}
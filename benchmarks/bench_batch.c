@@ -0,0 +1,86 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define TREE_SIZE 1000000
+
+static void fill(ztree_Int *t, uint64_t *seed)
+{
+    while (t->size < TREE_SIZE)
+    {
+        ztree_insert(t, (int)(bench_rand(seed) % (TREE_SIZE * 4)), 0);
+    }
+}
+
+static void make_ops(ztree_op_Int *ops, size_t n, uint64_t *seed)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        ops[i].key = (int)(bench_rand(seed) % (TREE_SIZE * 4));
+        ops[i].value = (int)i;
+        ops[i].op = (i & 1) ? ZTREE_OP_REMOVE : ZTREE_OP_INSERT;
+    }
+}
+
+int main(void)
+{
+    static const size_t sizes[] = { 10000, 100000, 1000000 };
+    printf("=> Batch apply vs per-key loop (tree of %d keys)\n", TREE_SIZE);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t n = sizes[s];
+        ztree_op_Int *ops = (ztree_op_Int *)malloc(n * sizeof(*ops));
+        uint64_t seed = 42;
+        char label[64];
+
+        ztree_Int loop = ztree_init(Int);
+        fill(&loop, &seed);
+        make_ops(ops, n, &seed);
+        double t0 = bench_now();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (ZTREE_OP_INSERT == ops[i].op)
+            {
+                ztree_insert(&loop, ops[i].key, ops[i].value);
+            }
+            else
+            {
+                ztree_remove(&loop, ops[i].key);
+            }
+        }
+        double t_loop = bench_now() - t0;
+        snprintf(label, sizeof(label), "loop      (%zu ops)", n);
+        BENCH_REPORT(label, n, t_loop);
+
+        seed = 42;
+        ztree_Int batch = ztree_init(Int);
+        fill(&batch, &seed);
+        make_ops(ops, n, &seed);
+        t0 = bench_now();
+        ztree_apply_batch(&batch, ops, n);
+        double t_batch = bench_now() - t0;
+        snprintf(label, sizeof(label), "batch     (%zu ops)", n);
+        BENCH_REPORT(label, n, t_batch);
+        printf("  %-34s %10.2fx\n", "speedup", t_loop / t_batch);
+
+        if (loop.size != batch.size)
+        {
+            printf("  size mismatch: %zu vs %zu\n", loop.size, batch.size);
+            return 1;
+        }
+        ztree_clear(&loop);
+        ztree_clear(&batch);
+        free(ops);
+    }
+    return 0;
+}
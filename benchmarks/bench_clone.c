@@ -0,0 +1,78 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 20)
+#define REPS    5
+
+static long long scan(ztree_Int *t)
+{
+    long long sum = 0;
+    ztree_node_Int *it;
+    ztree_foreach(t, it)
+    {
+        sum += it->value;
+    }
+    (void)it;
+    return sum;
+}
+
+int main(void)
+{
+    ztree_Int src = ztree_init(Int);
+    uint64_t seed = 7;
+    while (src.size < N_KEYS)
+    {
+        int k = (int)(bench_rand(&seed) >> 33);
+        ztree_insert(&src, k, k);
+    }
+    long long expect = scan(&src);
+
+    printf("=> Copying a map of %d random keys\n", N_KEYS);
+    ztree_Int copy = ztree_init(Int);
+    double t0 = bench_now();
+    for (int r = 0; r < REPS; r++)
+    {
+        ztree_clear(&copy);
+        ztree_node_Int *it;
+        ztree_foreach(&src, it)
+        {
+            ztree_insert(&copy, it->key, it->value);
+        }
+        (void)it;
+    }
+    BENCH_REPORT("insert every entry", (size_t)N_KEYS * REPS, bench_now() - t0);
+    t0 = bench_now();
+    long long check = 0;
+    for (int r = 0; r < REPS; r++)
+    {
+        check += scan(&copy) - expect;
+    }
+    BENCH_REPORT("  then scan the copy", (size_t)N_KEYS * REPS, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int r = 0; r < REPS; r++)
+    {
+        ztree_clone(&copy, &src);
+    }
+    BENCH_REPORT("ztree_clone", (size_t)N_KEYS * REPS, bench_now() - t0);
+    t0 = bench_now();
+    for (int r = 0; r < REPS; r++)
+    {
+        check += scan(&copy) - expect;
+    }
+    BENCH_REPORT("  then scan the copy", (size_t)N_KEYS * REPS, bench_now() - t0);
+
+    ztree_clear(&copy);
+    ztree_clear(&src);
+    return check ? 1 : 0;
+}
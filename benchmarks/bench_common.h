@@ -0,0 +1,29 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// xorshift64*: cheap, reproducible keys without pulling in rand()'s global state.
+static inline uint64_t bench_rand(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return *s * 2685821657736338717ULL;
+}
+
+#define BENCH_REPORT(label, n, secs) \
+    printf("  %-34s %10.2f ns/op  (%8.2f Mops/s)\n", label, (secs) * 1e9 / (double)(n), (double)(n) / (secs) / 1e6)
+
+#endif
@@ -0,0 +1,77 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_COMPACT_TYPES(X) \
+    X(int, int, CInt, cmp_int)
+
+#define REGISTER_ZTREE_INDEX_TYPES(X) \
+    X(int, int, IInt, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS 1000000
+
+// Same workload on every layout: random inserts, lookups, a full scan, then removal of every key.
+#define BENCH_LAYOUT(Name, label, SCAN)                                                         \
+    do                                                                                          \
+    {                                                                                           \
+        printf("=> %s (%zu-byte nodes)\n", label, sizeof(ztree_node_##Name));                   \
+        ztree_##Name t = ztree_init(Name);                                                      \
+        uint64_t seed = 42;                                                                     \
+        double t0 = bench_now();                                                                \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_insert(&t, keys[i], (int)i);                                                  \
+        }                                                                                       \
+        BENCH_REPORT("insert (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        long long sum = 0;                                                                      \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_node_##Name *n = ztree_find(&t, keys[bench_rand(&seed) % N_KEYS]);            \
+            sum += n ? n->value : 0;                                                            \
+        }                                                                                       \
+        BENCH_REPORT("find (hit)", (size_t)N_KEYS, bench_now() - t0);                           \
+        t0 = bench_now();                                                                       \
+        SCAN;                                                                                   \
+        BENCH_REPORT("full scan", t.size, bench_now() - t0);                                    \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_remove(&t, keys[i]);                                                          \
+        }                                                                                       \
+        BENCH_REPORT("remove (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        printf("  (checksum %lld)\n", sum);                                                     \
+    } while (0)
+
+int main(void)
+{
+    int *keys = malloc(N_KEYS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (int)(bench_rand(&seed) >> 33);
+    }
+
+    BENCH_LAYOUT(Int, "Parent-pointer layout",
+                 ztree_foreach(&t, it) { sum += it->key; });
+
+    ztree_cursor_CInt c;
+    BENCH_LAYOUT(CInt, "Compact layout",
+                 c = ztree_cursor_init(&t); ztree_cursor_foreach(&c, it) { sum += it->key; });
+
+    ztree_cursor_IInt ic;
+    BENCH_LAYOUT(IInt, "Index layout",
+                 ic = ztree_cursor_init(&t); ztree_cursor_foreach(&ic, it) { sum += it->key; });
+
+    free(keys);
+    return 0;
+}
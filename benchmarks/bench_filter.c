@@ -0,0 +1,82 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+static uint64_t hash_int(const int *k)
+{
+    return (uint64_t)(unsigned)*k * 0x9E3779B97F4A7C15ULL;
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_FILTERED_TYPES(X) \
+    X(int, int, BInt, cmp_int, hash_int)
+
+#include "ztree.h"
+
+#define N_KEYS 1000000
+
+// Even keys are stored and odd keys probed, so every lookup in the miss loop is absent.
+#define BENCH_LAYOUT(Name, label)                                                               \
+    do                                                                                          \
+    {                                                                                           \
+        printf("=> %s\n", label);                                                               \
+        ztree_##Name t = ztree_init(Name);                                                      \
+        uint64_t seed = 42;                                                                     \
+        double t0 = bench_now();                                                                \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_insert(&t, keys[i], (int)i);                                                  \
+        }                                                                                       \
+        BENCH_REPORT("insert (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        long long sum = 0;                                                                      \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            sum += NULL != ztree_find(&t, keys[bench_rand(&seed) % N_KEYS] | 1);                \
+        }                                                                                       \
+        BENCH_REPORT("find (miss)", (size_t)N_KEYS, bench_now() - t0);                          \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            sum += NULL != ztree_find(&t, keys[bench_rand(&seed) % N_KEYS]);                    \
+        }                                                                                       \
+        BENCH_REPORT("find (hit)", (size_t)N_KEYS, bench_now() - t0);                           \
+        ztree_clear(&t);                                                                        \
+        printf("  (checksum %lld)\n", sum);                                                     \
+    } while (0)
+
+int main(void)
+{
+    int *keys = malloc(N_KEYS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (int)(bench_rand(&seed) >> 33) & ~1;
+    }
+
+    BENCH_LAYOUT(Int, "No filter");
+    BENCH_LAYOUT(BInt, "Counting Bloom filter");
+
+    ztree_BInt t = ztree_init(BInt);
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_insert(&t, keys[i], 0);
+    }
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_find(&t, keys[i] | 1);
+    }
+    ztree_filter_stats st = ztree_stats(&t);
+    printf("  filter: %zu misses, %.2f%% rejected before descent, %.3f%% false positives\n", st.lookups,
+           100.0 * (double)st.rejected / (double)st.lookups, 100.0 * (double)st.false_positives / (double)st.lookups);
+    ztree_clear(&t);
+
+    free(keys);
+    return 0;
+}
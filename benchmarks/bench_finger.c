@@ -0,0 +1,104 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS 1000000
+#define N_OPS  2000000
+
+// Probes walk the key space in small steps (a few ranks apart), or jump anywhere.
+static int *make_stream(int local)
+{
+    int *q = malloc(N_OPS * sizeof(int));
+    uint64_t seed = 99;
+    int k = N_KEYS;
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        uint64_t r = bench_rand(&seed);
+        k = local ? k + (int)(r % 17) - 6 : (int)(r % (2 * N_KEYS));
+        k = (k >= 2 * N_KEYS) ? k - 2 * N_KEYS : k;
+        q[i] = k;
+    }
+    return q;
+}
+
+// The tree holds the even keys below 2 * N_KEYS; insert timings rebuild it in stream order.
+static void bench_stream(const char *label, const int *q)
+{
+    printf("=> %s\n", label);
+    ztree_Int t = ztree_init(Int);
+    ztree_cursor_Int c = ztree_cursor_init(&t);
+    long long sum = 0;
+
+    double t0 = bench_now();
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_insert(&t, q[i], (int)i);
+    }
+    BENCH_REPORT("ztree_insert", (size_t)N_KEYS, bench_now() - t0);
+    ztree_clear(&t);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_cursor_insert(&c, q[i], (int)i);
+    }
+    BENCH_REPORT("ztree_cursor_insert", (size_t)N_KEYS, bench_now() - t0);
+    ztree_clear(&t);
+
+    for (int k = 0; k < 2 * N_KEYS; k += 2)
+    {
+        ztree_insert(&t, k, k);
+    }
+    c = ztree_cursor_init(&t);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        ztree_node_Int *n = ztree_find(&t, q[i]);
+        sum += n ? n->value : 0;
+    }
+    BENCH_REPORT("ztree_find", (size_t)N_OPS, bench_now() - t0);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        ztree_node_Int *n = ztree_cursor_find(&c, q[i]);
+        sum -= n ? n->value : 0;
+    }
+    BENCH_REPORT("ztree_cursor_find", (size_t)N_OPS, bench_now() - t0);
+
+    t0 = bench_now();
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        ztree_node_Int *n = ztree_lower_bound(&t, q[i]);
+        sum += n ? n->key : 0;
+    }
+    BENCH_REPORT("ztree_lower_bound", (size_t)N_OPS, bench_now() - t0);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_OPS; i++)
+    {
+        ztree_node_Int *n = ztree_cursor_seek(&c, q[i]);
+        sum -= n ? n->key : 0;
+    }
+    BENCH_REPORT("ztree_cursor_seek", (size_t)N_OPS, bench_now() - t0);
+
+    ztree_clear(&t);
+    printf("  (checksum %lld, expect 0)\n", sum);
+}
+
+int main(void)
+{
+    int *local = make_stream(1);
+    int *uniform = make_stream(0);
+    bench_stream("Local stream (steps of -6..+10 keys)", local);
+    bench_stream("Uniform stream", uniform);
+    free(local);
+    free(uniform);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 18)
+#define ROUNDS  8
+
+// Re-bucketing: every round moves each entry from one generation to the other, in key order.
+int main(void)
+{
+    ztree_Int from = ztree_init(Int), to = ztree_init(Int);
+    uint64_t seed = 3;
+    while (from.size < N_KEYS)
+    {
+        int k = (int)(bench_rand(&seed) >> 33);
+        ztree_insert(&from, k, k);
+    }
+
+    printf("=> Moving %d entries between two maps, %d times\n", N_KEYS, ROUNDS);
+    double t0 = bench_now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        int k, v;
+        while (Z_OK == ztree_pop_min(&from, &k, &v))
+        {
+            ztree_insert(&to, k, v);
+        }
+        ztree_Int swap = from;
+        from = to;
+        to = swap;
+    }
+    BENCH_REPORT("pop_min + ztree_insert", (size_t)N_KEYS * ROUNDS, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        while (from.leftmost)
+        {
+            ztree_insert_node(&to, ztree_extract_node(&from, from.leftmost));
+        }
+        ztree_Int swap = from;
+        from = to;
+        to = swap;
+    }
+    BENCH_REPORT("ztree_extract_node + insert_node", (size_t)N_KEYS * ROUNDS, bench_now() - t0);
+
+    int ok = (N_KEYS == from.size && 0 == to.size);
+    ztree_clear(&from);
+    ztree_clear(&to);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+static uint64_t hash_int(const int *k)
+{
+    return (uint64_t)(unsigned)*k * 0x9E3779B97F4A7C15ULL;
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_HASHED_TYPES(X) \
+    X(int, int, HInt, cmp_int, hash_int)
+
+#include "ztree.h"
+
+#define N_KEYS 1000000
+
+// 90% exact lookups, 10% ordered probes: the mix the hash index is meant for.
+#define BENCH_LAYOUT(Name, label)                                                               \
+    do                                                                                          \
+    {                                                                                           \
+        printf("=> %s (%zu-byte nodes)\n", label, sizeof(ztree_node_##Name));                   \
+        ztree_##Name t = ztree_init(Name);                                                      \
+        uint64_t seed = 42;                                                                     \
+        double t0 = bench_now();                                                                \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_insert(&t, keys[i], (int)i);                                                  \
+        }                                                                                       \
+        BENCH_REPORT("insert (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        long long sum = 0;                                                                      \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_node_##Name *n = ztree_find(&t, keys[bench_rand(&seed) % N_KEYS]);            \
+            sum += n ? n->value : 0;                                                            \
+        }                                                                                       \
+        BENCH_REPORT("find (hit)", (size_t)N_KEYS, bench_now() - t0);                           \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            uint64_t r = bench_rand(&seed);                                                     \
+            ztree_node_##Name *n = (r % 10) ? ztree_find(&t, keys[(r >> 8) % N_KEYS])           \
+                                            : ztree_lower_bound(&t, (int)(r >> 33));            \
+            sum += n ? n->value : 0;                                                            \
+        }                                                                                       \
+        BENCH_REPORT("90% find / 10% lower_bound", (size_t)N_KEYS, bench_now() - t0);           \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_remove(&t, keys[i]);                                                          \
+        }                                                                                       \
+        BENCH_REPORT("remove (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        ztree_clear(&t);                                                                        \
+        printf("  (checksum %lld)\n", sum);                                                     \
+    } while (0)
+
+int main(void)
+{
+    int *keys = malloc(N_KEYS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (int)(bench_rand(&seed) >> 33);
+    }
+
+    BENCH_LAYOUT(Int, "Tree only");
+    BENCH_LAYOUT(HInt, "Tree + hash index");
+
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define ZTREE_PARALLEL
+#include "ztree.h"
+
+#define N_KEYS  (1 << 20)
+#define ROUNDS  32
+
+// Stands in for real per-entry work (hashing, scoring): enough that the tree walk itself is not the cost.
+static void visit(ztree_node_Int *n, void *ctx)
+{
+    uint64_t h = (uint64_t)(unsigned)n->value;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        h = (h ^ (h >> 29)) * 0xBF58476D1CE4E5B9ULL;
+    }
+    __atomic_fetch_xor((uint64_t *)ctx, h, __ATOMIC_RELAXED);
+}
+
+int main(void)
+{
+    ztree_Int t = ztree_init(Int);
+    uint64_t seed = 1;
+    while (t.size < N_KEYS)
+    {
+        int k = (int)(bench_rand(&seed) >> 33);
+        ztree_insert(&t, k, k);
+    }
+
+    printf("=> Full pass with per-entry work (%d random keys)\n", N_KEYS);
+    uint64_t expect = 0;
+    ztree_node_Int *it;
+    double t0 = bench_now();
+    ztree_foreach(&t, it)
+    {
+        visit(it, &expect);
+    }
+    (void)it;
+    BENCH_REPORT("ztree_foreach", (size_t)N_KEYS, bench_now() - t0);
+
+    static const size_t counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        uint64_t check = 0;
+        char label[64];
+        t0 = bench_now();
+        ztree_parallel_foreach(&t, visit, &check, counts[c]);
+        snprintf(label, sizeof(label), "ztree_parallel_foreach, %2zu threads", counts[c]);
+        BENCH_REPORT(label, (size_t)N_KEYS, bench_now() - t0);
+        if (check != expect)
+        {
+            printf("  checksum mismatch\n");
+            return 1;
+        }
+    }
+
+    // The split itself: about 8 * k short random descents instead of a walk over every node.
+    ztree_range_Int ranges[128];
+    size_t n = 0;
+    t0 = bench_now();
+    for (int i = 0; i < 1000; i++)
+    {
+        n += ztree_partition(&t, 128, ranges);
+    }
+    BENCH_REPORT("ztree_partition, k = 128", (size_t)1000, bench_now() - t0);
+    ztree_clear(&t);
+    return n == 128000 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_COMPACT_TYPES(X) \
+    X(int, int, CInt, cmp_int)
+
+#define REGISTER_ZTREE_PERSISTENT_TYPES(X) \
+    X(int, int, PInt, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS    1000000
+#define N_UPDATES 200000
+
+static size_t private_nodes(ztree_node_PInt *n)
+{
+    return (n && 1 == n->refs) ? 1 + private_nodes(n->left) + private_nodes(n->right) : 0;
+}
+
+int main(void)
+{
+    int *keys = malloc(N_KEYS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (int)(bench_rand(&seed) >> 33);
+    }
+
+    printf("=> Random inserts (%d keys)\n", N_KEYS);
+    ztree_CInt c = ztree_init(CInt);
+    double t0 = bench_now();
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_insert(&c, keys[i], (int)i);
+    }
+    BENCH_REPORT("compact map", (size_t)N_KEYS, bench_now() - t0);
+    ztree_PInt p = ztree_init(PInt);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        ztree_insert(&p, keys[i], (int)i);
+    }
+    BENCH_REPORT("persistent map", (size_t)N_KEYS, bench_now() - t0);
+
+    printf("=> Snapshot, then %d updates that each copy a path\n", N_UPDATES);
+    t0 = bench_now();
+    ztree_PInt snap = ztree_snapshot(&p);
+    BENCH_REPORT("ztree_snapshot", (size_t)1, bench_now() - t0);
+    ztree_PInt last = ztree_snapshot(&p);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_UPDATES; i++)
+    {
+        // Re-snapshot every so often, so most updates land on shared paths.
+        if (0 == i % 1000)
+        {
+            ztree_clear(&last);
+            last = ztree_snapshot(&p);
+        }
+        ztree_insert(&p, keys[bench_rand(&seed) % N_KEYS], -1);
+    }
+    BENCH_REPORT("update under snapshots", (size_t)N_UPDATES, bench_now() - t0);
+    t0 = bench_now();
+    for (size_t i = 0; i < N_UPDATES; i++)
+    {
+        ztree_insert(&c, keys[bench_rand(&seed) % N_KEYS], -1);
+    }
+    BENCH_REPORT("compact update (in place)", (size_t)N_UPDATES, bench_now() - t0);
+    ztree_clear(&last);
+    printf("  nodes not shared with the first snapshot: %zu of %zu\n", private_nodes(p.root), p.size);
+
+    long long sum = 0;
+    ztree_cursor_PInt cur = ztree_cursor_init(&snap);
+    t0 = bench_now();
+    ztree_cursor_foreach(&cur, it)
+    {
+        sum += it->value;
+    }
+    BENCH_REPORT("full scan of the first snapshot", snap.size, bench_now() - t0);
+    printf("  (checksum %lld)\n", sum);
+
+    ztree_clear(&snap);
+    ztree_clear(&p);
+    ztree_clear(&c);
+    free(keys);
+    return 0;
+}
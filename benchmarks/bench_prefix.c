@@ -0,0 +1,78 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int str_cmp(const char **a, const char **b)
+{
+    return strcmp(*a, *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(const char*, int, Str, str_cmp)
+
+#define REGISTER_ZTREE_PREFIX_TYPES(X) \
+    X(const char*, int, PStr, str_cmp, ztree_prefix_cstr)
+
+#include "ztree.h"
+
+#define N_KEYS 500000
+
+// String keys are separately allocated, so every full comparison is a pointer chase out of the node.
+#define BENCH_LAYOUT(Name, label, words)                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        printf("=> %s\n", label);                                                               \
+        ztree_##Name t = ztree_init(Name);                                                      \
+        uint64_t seed = 42;                                                                     \
+        double t0 = bench_now();                                                                \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_insert(&t, words[i], (int)i);                                                 \
+        }                                                                                       \
+        BENCH_REPORT("insert (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        long long sum = 0;                                                                      \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_node_##Name *n = ztree_find(&t, words[bench_rand(&seed) % N_KEYS]);           \
+            sum += n ? n->value : 0;                                                            \
+        }                                                                                       \
+        BENCH_REPORT("find (hit)", (size_t)N_KEYS, bench_now() - t0);                           \
+        ztree_clear(&t);                                                                        \
+        printf("  (checksum %lld)\n", sum);                                                     \
+    } while (0)
+
+static char **make_words(const char *fmt, uint64_t seed)
+{
+    char **words = malloc(N_KEYS * sizeof(char *));
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        words[i] = malloc(32);
+        snprintf(words[i], 32, fmt, (unsigned long long)(bench_rand(&seed) >> 20));
+    }
+    return words;
+}
+
+static void free_words(char **words)
+{
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        free(words[i]);
+    }
+    free(words);
+}
+
+int main(void)
+{
+    // Hex identifiers differ within the first 8 bytes; the dotted names share a 12-byte prefix.
+    char **ids = make_words("%013llx", 7);
+    BENCH_LAYOUT(Str, "Plain layout, distinct prefixes", ids);
+    BENCH_LAYOUT(PStr, "Prefix layout, distinct prefixes", ids);
+    free_words(ids);
+
+    char **names = make_words("module.path.%llu", 7);
+    BENCH_LAYOUT(Str, "Plain layout, shared prefix", names);
+    BENCH_LAYOUT(PStr, "Prefix layout, shared prefix", names);
+    free_words(names);
+    return 0;
+}
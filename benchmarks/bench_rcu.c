@@ -0,0 +1,135 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_SYNC_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_RCU_TYPES(X) \
+    X(int, int, RInt, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 16)
+#define N_OPS   2000000
+#define MAX_THR 32
+
+static ztree_sync_Int locked_map;
+static ztree_RInt rcu_map;
+static int stop_writer;
+
+typedef struct
+{
+    int rcu;
+    size_t ops;
+    uint64_t seed;
+    long long check;
+} worker;
+
+static void *read_loop(void *arg)
+{
+    worker *w = (worker *)arg;
+    ztree_rcu_reader *r = w->rcu ? ztree_rcu_register(&rcu_map) : NULL;
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        int k = (int)(bench_rand(&w->seed) % N_KEYS), v = 0;
+        if (r)
+        {
+            ztree_rcu_read_lock(r);
+            ztree_node_RInt *n = ztree_find(&rcu_map, k);
+            v = n ? n->value : 0;
+            ztree_rcu_read_unlock(r);
+        }
+        else
+        {
+            ztree_sync_find(&locked_map, k, &v);
+        }
+        w->check += v;
+    }
+    if (r)
+    {
+        ztree_rcu_unregister(r);
+    }
+    return NULL;
+}
+
+// One thread rewriting values for as long as the readers run.
+static void *write_loop(void *arg)
+{
+    int rcu = *(int *)arg;
+    uint64_t seed = 42;
+    while (!__atomic_load_n(&stop_writer, __ATOMIC_ACQUIRE))
+    {
+        int k = (int)(bench_rand(&seed) % N_KEYS) & ~1;
+        if (rcu)
+        {
+            ztree_insert(&rcu_map, k, k);
+        }
+        else
+        {
+            ztree_sync_insert(&locked_map, k, k);
+        }
+    }
+    return NULL;
+}
+
+static void bench_readers(int rcu, int with_writer, size_t ops)
+{
+    static const int counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int n = counts[c];
+        pthread_t th[MAX_THR], wt;
+        worker w[MAX_THR];
+        stop_writer = 0;
+        if (with_writer)
+        {
+            pthread_create(&wt, NULL, write_loop, &rcu);
+        }
+        double t0 = bench_now();
+        for (int i = 0; i < n; i++)
+        {
+            w[i] = (worker){ rcu, ops / (size_t)n, (uint64_t)i * 7919 + 1, 0 };
+            pthread_create(&th[i], NULL, read_loop, &w[i]);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(th[i], NULL);
+        }
+        double elapsed = bench_now() - t0;
+        if (with_writer)
+        {
+            __atomic_store_n(&stop_writer, 1, __ATOMIC_RELEASE);
+            pthread_join(wt, NULL);
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s, %2d readers", rcu ? "ztree RCU" : "ztree_sync", n);
+        BENCH_REPORT(label, ops, elapsed);
+    }
+}
+
+int main(void)
+{
+    locked_map = ztree_sync_init(Int);
+    rcu_map = ztree_init(RInt);
+    for (int k = 0; k < N_KEYS; k += 2)
+    {
+        ztree_sync_insert(&locked_map, k, k);
+        ztree_insert(&rcu_map, k, k);
+    }
+    printf("=> Read-only finds (%d keys, %d finds split over the readers)\n", N_KEYS, N_OPS);
+    bench_readers(0, 0, N_OPS);
+    bench_readers(1, 0, N_OPS);
+    // Readers stall behind the lock here, so this phase runs a tenth of the finds.
+    printf("=> %d finds with one writer updating values throughout\n", N_OPS / 10);
+    bench_readers(0, 1, N_OPS / 10);
+    bench_readers(1, 1, N_OPS / 10);
+    ztree_sync_clear(&locked_map);
+    ztree_clear(&rcu_map);
+    return 0;
+}
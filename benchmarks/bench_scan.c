@@ -0,0 +1,69 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define TREE_SIZE   1000000
+#define FULL_SCANS  10
+#define RANGES      100000
+#define RANGE_LEN   64
+
+int main(void)
+{
+#ifdef ZTREE_THREADED
+    printf("=> Scans (threaded layout, %zu-byte nodes)\n", sizeof(ztree_node_Int));
+#else
+    printf("=> Scans (parent-pointer layout, %zu-byte nodes)\n", sizeof(ztree_node_Int));
+#endif
+    uint64_t seed = 7;
+    ztree_Int t = ztree_init(Int);
+    while (t.size < TREE_SIZE)
+    {
+        int k = (int)(bench_rand(&seed) % (TREE_SIZE * 4));
+        ztree_insert(&t, k, k);
+    }
+
+    long long sum = 0;
+    double t0 = bench_now();
+    for (int r = 0; r < FULL_SCANS; r++)
+    {
+        ztree_foreach(&t, it)
+        {
+            sum += it->value;
+        }
+    }
+    BENCH_REPORT("full scan (forward)", (size_t)FULL_SCANS * TREE_SIZE, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int r = 0; r < FULL_SCANS; r++)
+    {
+        ztree_foreach_reverse(&t, it)
+        {
+            sum -= it->value;
+        }
+    }
+    BENCH_REPORT("full scan (reverse)", (size_t)FULL_SCANS * TREE_SIZE, bench_now() - t0);
+
+    t0 = bench_now();
+    for (int r = 0; r < RANGES; r++)
+    {
+        ztree_node_Int *n = ztree_lower_bound(&t, (int)(bench_rand(&seed) % (TREE_SIZE * 4)));
+        for (int i = 0; n && i < RANGE_LEN; i++, n = ztree_next(n))
+        {
+            sum += n->key;
+        }
+    }
+    BENCH_REPORT("ranged scan (lower_bound + 64)", (size_t)RANGES * RANGE_LEN, bench_now() - t0);
+
+    printf("  (checksum %lld)\n", sum);
+    ztree_clear(&t);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_SHARDED_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS   (1 << 20)
+#define N_OPS    1000000
+#define N_SHARDS 32
+#define MAX_THR  32
+
+// Baseline: a single tree behind one mutex, the layout the shards replace.
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static ztree_Int plain;
+static ztree_sharded_Int map;
+
+typedef struct
+{
+    int locked;
+    size_t ops;
+    uint64_t seed;
+} worker;
+
+static void *run(void *arg)
+{
+    worker *w = (worker *)arg;
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        int k = (int)(bench_rand(&w->seed) % N_KEYS);
+        if (w->locked)
+        {
+            pthread_mutex_lock(&big_lock);
+            ztree_insert(&plain, k, k);
+            pthread_mutex_unlock(&big_lock);
+        }
+        else
+        {
+            ztree_sharded_insert(&map, k, k);
+        }
+    }
+    return NULL;
+}
+
+static void bench_threads(int locked)
+{
+    static const int counts[] = { 1, 2, 4, 8, 16, 32 };
+    int bounds[N_SHARDS - 1];
+    for (int i = 0; i < N_SHARDS - 1; i++)
+    {
+        bounds[i] = (i + 1) * (N_KEYS / N_SHARDS);
+    }
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int n = counts[c];
+        pthread_t th[MAX_THR];
+        worker w[MAX_THR];
+        plain = ztree_init(Int);
+        ztree_sharded_init(&map, bounds, N_SHARDS - 1);
+        double t0 = bench_now();
+        for (int i = 0; i < n; i++)
+        {
+            w[i] = (worker){ locked, N_OPS / (size_t)n, (uint64_t)i * 7919 + 1 };
+            pthread_create(&th[i], NULL, run, &w[i]);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(th[i], NULL);
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s, %2d threads", locked ? "mutex + ztree" : "ztree_sharded", n);
+        BENCH_REPORT(label, (size_t)N_OPS, bench_now() - t0);
+        ztree_clear(&plain);
+        ztree_sharded_clear(&map);
+    }
+}
+
+int main(void)
+{
+    printf("=> Random inserts (%d keys, %d ops split over the threads, %d shards)\n", N_KEYS, N_OPS, N_SHARDS);
+    bench_threads(1);
+    bench_threads(0);
+
+    // Sequential ingest into an unbounded map piles into one shard until a rebalance spreads it out.
+    ztree_sharded_init(&map, NULL, 0);
+    for (int k = 0; k < N_OPS; k++)
+    {
+        ztree_sharded_insert(&map, k, k);
+    }
+    double t0 = bench_now();
+    int changes = ztree_sharded_rebalance(&map);
+    printf("=> Rebalance of a %d-key single shard (target %zu shards)\n", N_OPS, map.target);
+    char label[64];
+    snprintf(label, sizeof(label), "rebalance (%d splits, %zu shards)", changes, map.nshards);
+    BENCH_REPORT(label, (size_t)N_OPS, bench_now() - t0);
+    ztree_sharded_clear(&map);
+    return 0;
+}
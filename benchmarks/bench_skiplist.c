@@ -0,0 +1,132 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_SKIPLIST_TYPES(X) \
+    X(int, int, Skip, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 16)
+#define N_OPS   1000000
+#define MAX_THR 32
+
+// Baseline: a red-black tree behind one mutex. Write-heavy mixes leave it little to gain from more threads.
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static ztree_Int plain;
+static ztree_Skip skip;
+
+typedef struct
+{
+    int locked;
+    int write_pct;
+    size_t ops;
+    uint64_t seed;
+    long long check;
+} worker;
+
+static void *run(void *arg)
+{
+    worker *w = (worker *)arg;
+    ztree_rcu_reader *reader = w->locked ? NULL : ztree_rcu_register(&skip);
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        uint64_t r = bench_rand(&w->seed);
+        int k = (int)(r % N_KEYS), v = 0;
+        int op = (int)((r >> 32) % 100);
+        if (w->locked)
+        {
+            pthread_mutex_lock(&big_lock);
+            if (op < w->write_pct / 2)
+            {
+                ztree_insert(&plain, k, k);
+            }
+            else if (op < w->write_pct)
+            {
+                ztree_remove(&plain, k);
+            }
+            else
+            {
+                ztree_node_Int *n = ztree_find(&plain, k);
+                v = n ? n->value : 0;
+            }
+            pthread_mutex_unlock(&big_lock);
+        }
+        else
+        {
+            ztree_rcu_read_lock(reader);
+            if (op < w->write_pct / 2)
+            {
+                ztree_insert(&skip, k, k);
+            }
+            else if (op < w->write_pct)
+            {
+                ztree_remove(&skip, k);
+            }
+            else
+            {
+                ztree_node_Skip *n = ztree_find(&skip, k);
+                v = n ? n->value : 0;
+            }
+            ztree_rcu_read_unlock(reader);
+        }
+        w->check += v;
+    }
+    if (reader)
+    {
+        ztree_rcu_unregister(reader);
+    }
+    return NULL;
+}
+
+static void bench_threads(int locked, int write_pct)
+{
+    static const int counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int n = counts[c];
+        pthread_t th[MAX_THR];
+        worker w[MAX_THR];
+        double t0 = bench_now();
+        for (int i = 0; i < n; i++)
+        {
+            w[i] = (worker){ locked, write_pct, N_OPS / (size_t)n, (uint64_t)i * 7919 + 1, 0 };
+            pthread_create(&th[i], NULL, run, &w[i]);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(th[i], NULL);
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s, %2d threads", locked ? "mutex + ztree" : "ztree skiplist", n);
+        BENCH_REPORT(label, (size_t)N_OPS, bench_now() - t0);
+    }
+}
+
+int main(void)
+{
+    plain = ztree_init(Int);
+    skip = ztree_init(Skip);
+    for (int k = 0; k < N_KEYS; k += 2)
+    {
+        ztree_insert(&plain, k, k);
+        ztree_insert(&skip, k, k);
+    }
+    printf("=> 50%% writes: inserts and removes (%d keys, %d ops split over the threads)\n", N_KEYS, N_OPS);
+    bench_threads(1, 50);
+    bench_threads(0, 50);
+    printf("=> 90%% writes\n");
+    bench_threads(1, 90);
+    bench_threads(0, 90);
+    ztree_clear(&plain);
+    ztree_clear(&skip);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "bench_common.h"
+#include <stdlib.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_SMALL_TYPES(X) \
+    X(int, int, SmInt, cmp_int, 16)
+
+#include "ztree.h"
+
+#define N_MAPS   (1 << 16)
+#define PER_MAP  8
+#define LOOKUPS  (1 << 23)
+
+// Many tiny per-session maps: build them, then look up random keys in random maps.
+int main(void)
+{
+    ztree_Int *trees = (ztree_Int*)malloc(N_MAPS * sizeof(*trees));
+    ztree_SmInt *small = (ztree_SmInt*)malloc(N_MAPS * sizeof(*small));
+    if (!trees || !small)
+    {
+        return 1;
+    }
+
+    printf("=> %d maps of %d entries, %d lookups\n", N_MAPS, PER_MAP, LOOKUPS);
+    uint64_t seed = 11;
+    double t0 = bench_now();
+    for (int m = 0; m < N_MAPS; m++)
+    {
+        trees[m] = ztree_init(Int);
+        for (int i = 0; i < PER_MAP; i++)
+        {
+            ztree_insert(&trees[m], (int)(bench_rand(&seed) % 64), i);
+        }
+    }
+    BENCH_REPORT("ztree_insert (red-black)", (size_t)N_MAPS * PER_MAP, bench_now() - t0);
+
+    seed = 11;
+    t0 = bench_now();
+    for (int m = 0; m < N_MAPS; m++)
+    {
+        small[m] = ztree_init(SmInt);
+        for (int i = 0; i < PER_MAP; i++)
+        {
+            ztree_insert(&small[m], (int)(bench_rand(&seed) % 64), i);
+        }
+    }
+    BENCH_REPORT("ztree_insert (small, N = 16)", (size_t)N_MAPS * PER_MAP, bench_now() - t0);
+
+    long hits = 0;
+    seed = 5;
+    t0 = bench_now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        uint64_t r = bench_rand(&seed);
+        hits += NULL != ztree_find(&trees[r % N_MAPS], (int)((r >> 32) % 64));
+    }
+    BENCH_REPORT("ztree_find (red-black)", LOOKUPS, bench_now() - t0);
+
+    seed = 5;
+    t0 = bench_now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        uint64_t r = bench_rand(&seed);
+        hits -= NULL != ztree_find(&small[r % N_MAPS], (int)((r >> 32) % 64));
+    }
+    BENCH_REPORT("ztree_find (small, N = 16)", LOOKUPS, bench_now() - t0);
+
+    for (int m = 0; m < N_MAPS; m++)
+    {
+        ztree_clear(&trees[m]);
+        ztree_clear(&small[m]);
+    }
+    free(trees);
+    free(small);
+    return 0 == hits ? 0 : 1;
+}
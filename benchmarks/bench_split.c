@@ -0,0 +1,80 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+// A cold payload large enough that inline storage spreads the search keys over many cache lines.
+typedef struct
+{
+    int id;
+    char blob[252];
+} record;
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, record, Rec, cmp_int)
+
+#define REGISTER_ZTREE_SPLIT_TYPES(X) \
+    X(int, record, SRec, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS 500000
+
+// Lookups only read keys on the way down; the payload is touched once per hit.
+#define BENCH_LAYOUT(Name, label)                                                               \
+    do                                                                                          \
+    {                                                                                           \
+        printf("=> %s (%zu-byte nodes)\n", label, sizeof(ztree_node_##Name));                   \
+        ztree_##Name t = ztree_init(Name);                                                      \
+        record r;                                                                               \
+        memset(&r, 0, sizeof(r));                                                               \
+        uint64_t seed = 42;                                                                     \
+        double t0 = bench_now();                                                                \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            r.id = (int)i;                                                                      \
+            ztree_insert(&t, keys[i], r);                                                       \
+        }                                                                                       \
+        BENCH_REPORT("insert (random)", (size_t)N_KEYS, bench_now() - t0);                      \
+        long long sum = 0;                                                                      \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            ztree_node_##Name *n = ztree_find(&t, keys[bench_rand(&seed) % N_KEYS]);            \
+            sum += n ? ztree_value(&t, n)->id : 0;                                              \
+        }                                                                                       \
+        BENCH_REPORT("find (hit)", (size_t)N_KEYS, bench_now() - t0);                           \
+        t0 = bench_now();                                                                       \
+        for (size_t i = 0; i < N_KEYS; i++)                                                     \
+        {                                                                                       \
+            sum += NULL != ztree_find(&t, (int)(bench_rand(&seed) >> 33) | 1);                  \
+        }                                                                                       \
+        BENCH_REPORT("find (mixed)", (size_t)N_KEYS, bench_now() - t0);                         \
+        t0 = bench_now();                                                                       \
+        ztree_foreach(&t, it) { sum += it->key; }                                               \
+        BENCH_REPORT("key scan", t.size, bench_now() - t0);                                     \
+        t0 = bench_now();                                                                       \
+        ztree_clear(&t);                                                                        \
+        BENCH_REPORT("clear", (size_t)N_KEYS, bench_now() - t0);                                \
+        printf("  (checksum %lld)\n", sum);                                                     \
+    } while (0)
+
+int main(void)
+{
+    int *keys = malloc(N_KEYS * sizeof(int));
+    uint64_t seed = 7;
+    for (size_t i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (int)(bench_rand(&seed) >> 33);
+    }
+
+    BENCH_LAYOUT(Rec, "Inline values");
+    BENCH_LAYOUT(SRec, "Split layout (values in slab)");
+
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "bench_common.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_SYNC_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#include "ztree.h"
+
+#define N_KEYS  (1 << 16)
+#define N_OPS   2000000
+#define MAX_THR 32
+
+// The usual hand-rolled alternative: one mutex serializing every reader and writer.
+static pthread_mutex_t big_lock = PTHREAD_MUTEX_INITIALIZER;
+static ztree_sync_Int map;
+
+typedef struct
+{
+    int locked;
+    int write_pct;
+    size_t ops;
+    uint64_t seed;
+    long long check;
+} worker;
+
+static void *run(void *arg)
+{
+    worker *w = (worker *)arg;
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        uint64_t r = bench_rand(&w->seed);
+        int k = (int)(r % N_KEYS), v = 0;
+        int write = (int)((r >> 32) % 100) < w->write_pct;
+        if (w->locked)
+        {
+            pthread_mutex_lock(&big_lock);
+            if (write)
+            {
+                ztree_insert(&map.tree, k, k);
+            }
+            else
+            {
+                ztree_node_Int *n = ztree_find(&map.tree, k);
+                v = n ? n->value : 0;
+            }
+            pthread_mutex_unlock(&big_lock);
+        }
+        else if (write)
+        {
+            ztree_sync_insert(&map, k, k);
+        }
+        else
+        {
+            ztree_sync_find(&map, k, &v);
+        }
+        w->check += v;
+    }
+    return NULL;
+}
+
+static void bench_threads(int locked, int write_pct)
+{
+    static const int counts[] = { 1, 2, 4, 8, 16, 32 };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        int n = counts[c];
+        pthread_t th[MAX_THR];
+        worker w[MAX_THR];
+        double t0 = bench_now();
+        for (int i = 0; i < n; i++)
+        {
+            w[i] = (worker){ locked, write_pct, N_OPS / (size_t)n, (uint64_t)i * 7919 + 1, 0 };
+            pthread_create(&th[i], NULL, run, &w[i]);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(th[i], NULL);
+        }
+        char label[64];
+        snprintf(label, sizeof(label), "%s, %2d threads", locked ? "mutex + ztree" : "ztree_sync", n);
+        BENCH_REPORT(label, (size_t)N_OPS, bench_now() - t0);
+    }
+}
+
+int main(void)
+{
+    map = ztree_sync_init(Int);
+    for (int k = 0; k < N_KEYS; k += 2)
+    {
+        ztree_sync_insert(&map, k, k);
+    }
+    printf("=> Read-only finds (%d keys, %d ops split over the threads)\n", N_KEYS, N_OPS);
+    bench_threads(1, 0);
+    bench_threads(0, 0);
+    printf("=> 95%% finds, 5%% inserts\n");
+    bench_threads(1, 5);
+    bench_threads(0, 5);
+    ztree_sync_clear(&map);
+    return 0;
+}
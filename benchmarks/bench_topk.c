@@ -0,0 +1,53 @@
+#include "bench_common.h"
+
+static int cmp_int(const int *a, const int *b)
+{
+    return (*a > *b) - (*a < *b);
+}
+
+#define REGISTER_ZTREE_TYPES(X) \
+    X(int, int, Int, cmp_int)
+
+#define REGISTER_ZTREE_TOPK_TYPES(X) \
+    X(int, int, Top, cmp_int)
+
+#include "ztree.h"
+
+#define N_SCORES (1 << 24)
+#define K        100
+
+// Best K scores out of a random stream: insert-and-trim against the bounded map.
+int main(void)
+{
+    printf("=> Keeping the best %d of %d random scores\n", K, N_SCORES);
+    ztree_Int t = ztree_init(Int);
+    uint64_t seed = 17;
+    double t0 = bench_now();
+    for (int i = 0; i < N_SCORES; i++)
+    {
+        ztree_insert(&t, (int)(bench_rand(&seed) >> 33), i);
+        if (t.size > K)
+        {
+            ztree_remove_node(&t, ztree_min(&t));
+        }
+    }
+    BENCH_REPORT("ztree_insert + remove min", N_SCORES, bench_now() - t0);
+
+    ztree_topk_Top b = ztree_topk_init(Top, K);
+    seed = 17;
+    t0 = bench_now();
+    for (int i = 0; i < N_SCORES; i++)
+    {
+        ztree_topk_insert(&b, (int)(bench_rand(&seed) >> 33), i);
+    }
+    BENCH_REPORT("ztree_topk_insert", N_SCORES, bench_now() - t0);
+
+    int ok = (t.size == b.tree.size);
+    for (ztree_node_Int *a = ztree_min(&t); ok && a; a = ztree_next(a))
+    {
+        ok = (NULL != ztree_find(&b.tree, a->key));
+    }
+    ztree_clear(&t);
+    ztree_topk_clear(&b);
+    return ok ? 0 : 1;
+}
@@ -26,21 +26,158 @@
 #ifdef __cplusplus
 #include <iostream>
 #include <stdexcept>
+#include <new>
 #include <iterator>
 #include <utility>
 #include <type_traits>
 
 namespace z_tree {
-    template <typename K, typename V> class map;
-    template <typename K, typename V> class map_iterator;
+    template <typename K, typename V, typename Traits> class map;
+    template <typename K, typename V, typename Traits> class map_iterator;
+    template <typename K, typename V> class multimap;
+    template <typename K> class set;
 
     template <typename K, typename V>
     struct traits 
     {
         static_assert(0 == sizeof(K), "No ztree implementation registered for this Key/Value pair.");
     };
+
+    template <typename K, typename V>
+    struct split_traits
+    {
+        static_assert(0 == sizeof(K), "No split ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct prefix_traits
+    {
+        static_assert(0 == sizeof(K), "No prefix-cached ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct hashed_traits
+    {
+        static_assert(0 == sizeof(K), "No hashed ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct filtered_traits
+    {
+        static_assert(0 == sizeof(K), "No filtered ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct avl_traits
+    {
+        static_assert(0 == sizeof(K), "No AVL ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct adaptive_traits
+    {
+        static_assert(0 == sizeof(K), "No adaptive ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V, size_t N>
+    struct small_traits
+    {
+        static_assert(0 == sizeof(K), "No small ztree implementation registered for this Key/Value/size.");
+    };
+
+    template <typename K, typename V>
+    struct sync_traits
+    {
+        static_assert(0 == sizeof(K), "No sync ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct topk_traits
+    {
+        static_assert(0 == sizeof(K), "No top-K ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct sharded_traits
+    {
+        static_assert(0 == sizeof(K), "No sharded ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct rcu_traits
+    {
+        static_assert(0 == sizeof(K), "No RCU ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct skiplist_traits
+    {
+        static_assert(0 == sizeof(K), "No skiplist ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct multimap_traits
+    {
+        static_assert(0 == sizeof(K), "No ztree multimap implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K>
+    struct set_traits
+    {
+        static_assert(0 == sizeof(K), "No zset implementation registered for this Key type.");
+    };
+
+    template <typename K, typename V>
+    struct compact_traits
+    {
+        static_assert(0 == sizeof(K), "No compact ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct persistent_traits
+    {
+        static_assert(0 == sizeof(K), "No persistent ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V>
+    struct index_traits
+    {
+        static_assert(0 == sizeof(K), "No index ztree implementation registered for this Key/Value pair.");
+    };
+
+    template <typename K, typename V, size_t Cap>
+    struct fixed_traits
+    {
+        static_assert(0 == sizeof(K), "No fixed ztree implementation registered for this Key/Value/capacity.");
+    };
+
+    template <typename K, typename V>
+    struct entry_proxy
+    {
+        const K *k;
+        V *v;
+        const K &key() const
+        { 
+            return *k;
+        }
+
+        V &value() const
+        {
+            return *v;
+        }
+        const K &first() const
+        {
+            return *k;
+        }
+
+        V &second() const
+        {
+            return *v;
+        }
+    };
     
-template <typename K, typename V>
+template <typename K, typename V,
+              typename Traits = traits<typename std::remove_const<K>::type, typename std::remove_const<V>::type>>
     class map_iterator 
     {
      public:
@@ -50,32 +187,10 @@ template <typename K, typename V>
         using iterator_category = std::bidirectional_iterator_tag;
         using difference_type = ptrdiff_t;
 
-        using Traits = traits<typename std::remove_const<K>::type, typename std::remove_const<V>::type>;
         using CNode = typename Traits::node_type;
         using CTree = typename Traits::tree_type;
 
-        struct EntryProxy 
-        {
-            CNode *node;
-            const K &key() const
-            { 
-                return node->key;
-            }
-
-            V &value() const
-            {
-                return node->value;
-            }
-            const K &first() const
-            {
-                return node->key;
-            }
-
-            V &second() const
-            {
-                return node->value;
-            }
-        };
+        using EntryProxy = entry_proxy<K, V>;
 
         explicit map_iterator(CNode *p, const CTree *t) : current(p), tree(t) {}
 
@@ -86,17 +201,17 @@ template <typename K, typename V>
 
         V &value() const
         {
-            return current->value;
+            return *operator->();
         }
 
         EntryProxy operator*() const
         {
-            return EntryProxy{current};
+            return EntryProxy{&current->key, operator->()};
         }
 
         V *operator->() const
         {
-            return &current->value;
+            return Traits::value(const_cast<CTree*>(tree), current);
         }
 
         bool operator==(const map_iterator &other) const
@@ -131,16 +246,92 @@ template <typename K, typename V>
      private:
         CNode *current;
         const CTree *tree;
-        friend class map<K, V>;
+        friend class map<K, V, Traits>;
+        friend class multimap<K, V>;
     };
 
-    template <typename K, typename V>
+    template <typename K, typename V, typename Traits>
+    class map_node_handle
+    {
+        using CNode = typename Traits::node_type;
+     public:
+        map_node_handle() : node(nullptr) {}
+
+        ~map_node_handle()
+        {
+            reset();
+        }
+
+        map_node_handle(const map_node_handle&) = delete;
+        map_node_handle &operator=(const map_node_handle&) = delete;
+
+        map_node_handle(map_node_handle &&other) noexcept : node(other.node)
+        {
+            other.node = nullptr;
+        }
+
+        map_node_handle &operator=(map_node_handle &&other) noexcept
+        {
+            if (this != &other)
+            {
+                reset();
+                node = other.node;
+                other.node = nullptr;
+            }
+            return *this;
+        }
+
+        bool empty() const
+        {
+            return nullptr == node;
+        }
+
+        explicit operator bool() const
+        {
+            return nullptr != node;
+        }
+
+        const K &key() const
+        {
+            return node->key;
+        }
+
+        V &mapped() const
+        {
+            return node->value;
+        }
+
+     private:
+        explicit map_node_handle(CNode *n) : node(n) {}
+
+        void reset()
+        {
+            if (node)
+            {
+                Traits::free_node(node);
+                node = nullptr;
+            }
+        }
+
+        CNode *node;
+        friend class map<K, V, Traits>;
+    };
+
+    template <typename K, typename V, typename Traits = traits<K, V>>
     class map 
     {
-        using Traits = traits<K, V>;
         using CTree = typename Traits::tree_type;
      public:
-        using iterator = map_iterator<K, V>;
+        using iterator = map_iterator<K, V, Traits>;
+        using node_type = map_node_handle<K, V, Traits>;
+
+        struct insert_return_type
+        {
+            iterator position;
+            bool inserted;
+            node_type node;
+        };
+
         CTree inner;
 
         map()
@@ -153,8 +344,24 @@ template <typename K, typename V>
             Traits::clear(&inner);
         }
 
-        map(const map&) = delete;
-        map &operator=(const map&) = delete;
+        map(const map &other)
+        {
+            inner = Traits::init();
+            if (Z_OK != Traits::clone(&inner, &other.inner))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        map &operator=(const map &other)
+        {
+            if (this != &other)
+            {
+                map copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
 
         map(map &&other) noexcept : inner(other.inner)
         {
@@ -188,14 +395,14 @@ template <typename K, typename V>
         iterator erase(iterator pos)
         {
             iterator next = pos; ++next;
-            Traits::remove(&inner, pos.key());
+            Traits::remove_node(&inner, pos.current);
             return next;
         }
 
         V *find(K k)
         {
             auto *n = Traits::find(&inner, k);
-            return n ? &n->value : nullptr; 
+            return n ? Traits::value(&inner, n) : nullptr; 
         }
         
         V &operator[](const K &k)
@@ -203,10 +410,30 @@ template <typename K, typename V>
             auto *n = Traits::find(&inner, k);
             if (!n)
             { 
-                Traits::insert(&inner, k, V{}); 
+                insert(k, V{}); 
                 n = Traits::find(&inner, k); 
             }
-            return n->value;
+            return *Traits::value(&inner, n);
+        }
+
+        std::pair<K, V> pop_min()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_min(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::map::pop_min on empty map");
+            }
+            return out;
+        }
+
+        std::pair<K, V> pop_max()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_max(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::map::pop_max on empty map");
+            }
+            return out;
         }
 
         iterator lower_bound(const K &k)
@@ -214,6 +441,81 @@ template <typename K, typename V>
             return iterator(Traits::lower_bound(&inner, k), &inner);
         }
 
+        node_type extract(const K &k)
+        {
+            return node_type(Traits::extract(&inner, k));
+        }
+
+        node_type extract(iterator pos)
+        {
+            node_type nh(Traits::extract_node(&inner, pos.current));
+            if (!nh)
+            {
+                throw std::bad_alloc();
+            }
+            return nh;
+        }
+
+        insert_return_type insert(node_type &&nh)
+        {
+            if (!nh)
+            {
+                return insert_return_type{end(), false, node_type()};
+            }
+            if (Z_OK == Traits::insert_node(&inner, nh.node))
+            {
+                iterator pos(nh.node, &inner);
+                nh.node = nullptr;
+                return insert_return_type{pos, true, node_type()};
+            }
+            iterator pos(Traits::find(&inner, nh.node->key), &inner);
+            return insert_return_type{pos, false, std::move(nh)};
+        }
+
+        void merge(map &other)
+        {
+            if (this == &other)
+            {
+                return;
+            }
+            for (auto *n = Traits::min(&other.inner); n;)
+            {
+                auto *next = Traits::next(n);
+                if (!Traits::find(&inner, n->key))
+                {
+                    auto *moved = Traits::extract_node(&other.inner, n);
+                    if (!moved)
+                    {
+                        throw std::bad_alloc();
+                    }
+                    Traits::insert_node(&inner, moved);
+                }
+                n = next;
+            }
+        }
+
+#   ifdef ZTREE_PARALLEL
+        template <typename F>
+        void parallel_for_each(F f, size_t nthreads)
+        {
+            struct call
+            {
+                CTree *tree;
+                F *f;
+
+                static void run(typename Traits::node_type *n, void *ctx)
+                {
+                    call *c = static_cast<call*>(ctx);
+                    (*c->f)(static_cast<const K&>(n->key), *Traits::value(c->tree, n));
+                }
+            } c{&inner, &f};
+            if (Z_OK != Traits::parallel_foreach(&inner, &call::run, &c, nthreads))
+            {
+                throw std::invalid_argument("z_tree::map::parallel_for_each needs at least one thread");
+            }
+        }
+#   endif
+
         iterator begin()
         {
             return iterator(Traits::min(&inner), &inner);
@@ -239,610 +541,8075 @@ template <typename K, typename V>
             Traits::clear(&inner);
         }
     };
-}
-extern "C" {
-#endif
 
-// Allocator overrides.
-#ifndef ZTREE_MALLOC
-#   define ZTREE_MALLOC(sz)      Z_MALLOC(sz)
-#endif
+    template <typename K, typename V>
+    using split_map = map<K, V, split_traits<K, V>>;
 
-#ifndef ZTREE_CALLOC
-#   define ZTREE_CALLOC(n, sz)   Z_CALLOC(n, sz)
-#endif
+    template <typename K, typename V>
+    using prefix_map = map<K, V, prefix_traits<K, V>>;
 
-#ifndef ZTREE_REALLOC
-#   define ZTREE_REALLOC(p, sz)  Z_REALLOC(p, sz)
-#endif
+    template <typename K, typename V>
+    using hashed_map = map<K, V, hashed_traits<K, V>>;
 
-#ifndef ZTREE_FREE
-#   define ZTREE_FREE(p)         Z_FREE(p)
-#endif
+    template <typename K, typename V>
+    using filtered_map = map<K, V, filtered_traits<K, V>>;
 
-typedef enum 
-{ 
-    ZTREE_RED, 
-    ZTREE_BLACK 
-} ztree_color;
+    template <typename K, typename V>
+    using avl_map = map<K, V, avl_traits<K, V>>;
 
-#ifdef __cplusplus
-#   define ZTREE_NEW_NODE(Type, n)  Type *n = new Type()
-#   define ZTREE_FREE_NODE(n)       delete n
-#else
-    
-#   define ZTREE_NEW_NODE(Type, n)                      \
-        Type *n = (Type*)ZTREE_MALLOC(sizeof(Type));    \
-        if (n)                                          \
-        {                                               \
-            n->parent = n->left = n->right = NULL;      \
+    template <typename K, typename V>
+    using adaptive_map = map<K, V, adaptive_traits<K, V>>;
+
+    template <typename K, typename V, size_t N>
+    using small_map = map<K, V, small_traits<K, V, N>>;
+
+    template <typename K, typename V>
+    class multimap
+    {
+        using Traits = multimap_traits<K, V>;
+        using CTree = typename Traits::tree_type;
+     public:
+        using iterator = map_iterator<K, V, Traits>;
+        CTree inner;
+
+        multimap()
+        {
+            inner = Traits::init();
         }
 
-#   define ZTREE_FREE_NODE(n)       ZTREE_FREE(n)
-#endif
+        ~multimap()
+        {
+            Traits::clear(&inner);
+        }
 
-#define ZTREE_GENERATE_IMPL(Key, Val, Name, Cmp)                                                                \
-                                                                                                                \
-    typedef struct ztree_node_##Name                                                                            \
-    {                                                                                                           \
-        Key key;                                                                                                \
-        Val value;                                                                                              \
-        ztree_color color;                                                                                      \
-        struct ztree_node_##Name *parent, *left, *right;                                                        \
-    } ztree_node_##Name;                                                                                        \
-                                                                                                                \
-    typedef struct                                                                                              \
+        multimap(const multimap&) = delete;
+        multimap &operator=(const multimap&) = delete;
+
+        multimap(multimap &&other) noexcept : inner(other.inner)
+        {
+            other.inner = Traits::init();
+        }
+
+        multimap &operator=(multimap &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Traits::clear(&inner);
+                inner = other.inner;
+                other.inner = Traits::init();
+            }
+            return *this;
+        }
+
+        // Always adds an entry; equal keys keep their insertion order.
+        void insert(K k, V v)
+        {
+            if (0 != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        // Removes every entry with key `k` and returns how many there were.
+        size_t erase(K k)
+        {
+            size_t n = inner.size;
+            Traits::remove(&inner, k);
+            return n - inner.size;
+        }
+
+        iterator erase(iterator pos)
+        {
+            iterator next = pos; ++next;
+            Traits::remove_node(&inner, pos.current);
+            return next;
+        }
+
+        iterator find(K k)
+        {
+            return iterator(Traits::find(&inner, k), &inner);
+        }
+
+        size_t count(K k)
+        {
+            return Traits::count(&inner, k);
+        }
+
+        std::pair<iterator, iterator> equal_range(K k)
+        {
+            typename Traits::node_type *first, *last;
+            Traits::equal_range(&inner, k, &first, &last);
+            return std::make_pair(iterator(first, &inner), iterator(last, &inner));
+        }
+
+        iterator lower_bound(const K &k)
+        {
+            return iterator(Traits::lower_bound(&inner, k), &inner);
+        }
+
+        iterator upper_bound(const K &k)
+        {
+            return iterator(Traits::upper_bound(&inner, k), &inner);
+        }
+
+        std::pair<K, V> pop_min()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_min(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::multimap::pop_min on empty map");
+            }
+            return out;
+        }
+
+        std::pair<K, V> pop_max()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_max(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::multimap::pop_max on empty map");
+            }
+            return out;
+        }
+
+        iterator begin()
+        {
+            return iterator(Traits::min(&inner), &inner);
+        }
+
+        iterator end()
+        {
+            return iterator(nullptr, &inner);
+        }
+
+        size_t size() const
+        {
+            return inner.size;
+        }
+
+        bool empty() const
+        {
+            return 0 == inner.size;
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+    template <typename K>
+    class set_iterator
+    {
+     public:
+        using value_type = K;
+        using reference = const K&;
+        using pointer = const K*;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = ptrdiff_t;
+
+        using Traits = set_traits<K>;
+        using CNode = typename Traits::node_type;
+        using CTree = typename Traits::tree_type;
+
+        explicit set_iterator(CNode *p, const CTree *t) : current(p), tree(t) {}
+
+        const K &operator*() const
+        {
+            return current->key;
+        }
+
+        const K *operator->() const
+        {
+            return &current->key;
+        }
+
+        bool operator==(const set_iterator &other) const
+        {
+            return current == other.current;
+        }
+
+        bool operator!=(const set_iterator &other) const
+        {
+            return current != other.current;
+        }
+
+        set_iterator &operator++()
+        {
+            current = Traits::next(current);
+            return *this;
+        }
+
+        set_iterator &operator--()
+        {
+            current = current ? Traits::prev(current) : Traits::max(const_cast<CTree*>(tree));
+            return *this;
+        }
+
+     private:
+        CNode *current;
+        const CTree *tree;
+        friend class set<K>;
+    };
+
+    template <typename K>
+    class set
+    {
+        using Traits = set_traits<K>;
+        using CTree = typename Traits::tree_type;
+     public:
+        using iterator = set_iterator<K>;
+        CTree inner;
+
+        set()
+        {
+            inner = Traits::init();
+        }
+
+        ~set()
+        {
+            Traits::clear(&inner);
+        }
+
+        set(const set&) = delete;
+        set &operator=(const set&) = delete;
+
+        set(set &&other) noexcept : inner(other.inner)
+        {
+            other.inner = Traits::init();
+        }
+
+        set &operator=(set &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Traits::clear(&inner);
+                inner = other.inner;
+                other.inner = Traits::init();
+            }
+            return *this;
+        }
+
+        // Returns true if the key was added, false if it was already present.
+        bool insert(K k)
+        {
+            int rc = Traits::insert(&inner, k);
+            if (Z_ENOMEM == rc)
+            {
+                throw std::bad_alloc();
+            }
+            return Z_OK == rc;
+        }
+
+        bool erase(K k)
+        {
+            return Z_OK == Traits::erase(&inner, k);
+        }
+
+        iterator erase(iterator pos)
+        {
+            iterator next = pos; ++next;
+            Traits::remove_node(&inner, pos.current);
+            return next;
+        }
+
+        bool contains(K k)
+        {
+            return Traits::contains(&inner, k);
+        }
+
+        size_t count(K k)
+        {
+            return Traits::contains(&inner, k) ? 1 : 0;
+        }
+
+        iterator find(K k)
+        {
+            return iterator(Traits::find(&inner, k), &inner);
+        }
+
+        K pop_min()
+        {
+            K out;
+            if (Z_OK != Traits::pop_min(&inner, &out))
+            {
+                throw std::out_of_range("z_tree::set::pop_min on empty set");
+            }
+            return out;
+        }
+
+        K pop_max()
+        {
+            K out;
+            if (Z_OK != Traits::pop_max(&inner, &out))
+            {
+                throw std::out_of_range("z_tree::set::pop_max on empty set");
+            }
+            return out;
+        }
+
+        iterator lower_bound(const K &k)
+        {
+            return iterator(Traits::lower_bound(&inner, k), &inner);
+        }
+
+        iterator begin()
+        {
+            return iterator(Traits::min(&inner), &inner);
+        }
+
+        iterator end()
+        {
+            return iterator(nullptr, &inner);
+        }
+
+        size_t size() const
+        {
+            return inner.size;
+        }
+
+        bool empty() const
+        {
+            return 0 == inner.size;
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+    // Iterator for the layouts whose nodes cannot reach their parent; it walks a C cursor.
+    template <typename K, typename V, typename Traits>
+    class cursor_map_iterator
+    {
+     public:
+        using value_type = V;
+        using reference = V&;
+        using pointer = V*;
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = ptrdiff_t;
+
+        using CNode = typename Traits::node_type;
+        using CCursor = typename Traits::cursor_type;
+        using EntryProxy = entry_proxy<K, V>;
+
+        explicit cursor_map_iterator(const CCursor &c) : cursor(c) {}
+
+        const K &key() const
+        {
+            return node()->key;
+        }
+
+        V &value() const
+        {
+            return node()->value;
+        }
+
+        EntryProxy operator*() const
+        {
+            return EntryProxy{&node()->key, &node()->value};
+        }
+
+        V *operator->() const
+        {
+            return &node()->value;
+        }
+
+        bool operator==(const cursor_map_iterator &other) const
+        {
+            return node() == other.node();
+        }
+
+        bool operator!=(const cursor_map_iterator &other) const
+        {
+            return node() != other.node();
+        }
+
+        cursor_map_iterator &operator++()
+        {
+            Traits::cursor_next(&cursor);
+            return *this;
+        }
+
+        cursor_map_iterator &operator--()
+        {
+            Traits::cursor_prev(&cursor);
+            return *this;
+        }
+
+     private:
+        CCursor cursor;
+
+        CNode *node() const
+        {
+            return Traits::cursor_get(const_cast<CCursor*>(&cursor));
+        }
+    };
+
+    template <typename K, typename V, typename Traits>
+    class cursor_map
+    {
+        using CTree = typename Traits::tree_type;
+     public:
+        using iterator = cursor_map_iterator<K, V, Traits>;
+        CTree inner;
+
+        cursor_map()
+        {
+            inner = Traits::init();
+        }
+
+        ~cursor_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        cursor_map(const cursor_map&) = delete;
+        cursor_map &operator=(const cursor_map&) = delete;
+
+        cursor_map(cursor_map &&other) noexcept : inner(other.inner)
+        {
+            other.inner = Traits::init();
+        }
+
+        cursor_map &operator=(cursor_map &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Traits::clear(&inner);
+                inner = other.inner;
+                other.inner = Traits::init();
+            }
+            return *this;
+        }
+
+        void insert(K k, V v)
+        {
+            if (0 != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        void erase(K k)
+        {
+            Traits::remove(&inner, k);
+        }
+
+        iterator erase(iterator pos)
+        {
+            // The successor's cursor state may not survive the removal, so re-seek it.
+            iterator next = pos; ++next;
+            if (next == end())
+            {
+                Traits::remove(&inner, pos.key());
+                return end();
+            }
+            K next_key = next.key();
+            Traits::remove(&inner, pos.key());
+            return lower_bound(next_key);
+        }
+
+        V *find(K k)
+        {
+            auto *n = Traits::find(&inner, k);
+            return n ? &n->value : nullptr;
+        }
+
+        V &operator[](const K &k)
+        {
+            auto *n = Traits::find(&inner, k);
+            if (!n)
+            {
+                insert(k, V{});
+                n = Traits::find(&inner, k);
+            }
+            return n->value;
+        }
+
+        std::pair<K, V> pop_min()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_min(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::cursor_map::pop_min on empty map");
+            }
+            return out;
+        }
+
+        std::pair<K, V> pop_max()
+        {
+            std::pair<K, V> out;
+            if (Z_OK != Traits::pop_max(&inner, &out.first, &out.second))
+            {
+                throw std::out_of_range("z_tree::cursor_map::pop_max on empty map");
+            }
+            return out;
+        }
+
+        iterator lower_bound(const K &k)
+        {
+            auto c = Traits::cursor_init(&inner);
+            Traits::cursor_seek(&c, k);
+            return iterator(c);
+        }
+
+        iterator begin()
+        {
+            auto c = Traits::cursor_init(&inner);
+            Traits::cursor_first(&c);
+            return iterator(c);
+        }
+
+        iterator end()
+        {
+            return iterator(Traits::cursor_init(&inner));
+        }
+
+        size_t size() const
+        {
+            return inner.size;
+        }
+
+        bool empty() const
+        {
+            return 0 == inner.size;
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+    template <typename K, typename V>
+    using compact_map = cursor_map<K, V, compact_traits<K, V>>;
+
+    template <typename K, typename V>
+    using index_map = cursor_map<K, V, index_traits<K, V>>;
+
+    template <typename K, typename V, size_t Cap>
+    using fixed_map = cursor_map<K, V, fixed_traits<K, V, Cap>>;
+
+    // Copying a persistent_map is an O(1) snapshot: both maps share every node, and each copies only the path
+    // it changes afterwards. Nodes may be shared, so lookups hand out const values only.
+    template <typename K, typename V>
+    class persistent_map
+    {
+        using Traits = persistent_traits<K, V>;
+        using CTree = typename Traits::tree_type;
+     public:
+        CTree inner;
+
+        persistent_map() : inner(Traits::init()) {}
+
+        ~persistent_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        persistent_map(const persistent_map &other) : inner(Traits::snapshot(&other.inner)) {}
+
+        persistent_map &operator=(const persistent_map &other)
+        {
+            if (this != &other)
+            {
+                Traits::clear(&inner);
+                inner = Traits::snapshot(&other.inner);
+            }
+            return *this;
+        }
+
+        persistent_map(persistent_map &&other) noexcept : inner(other.inner)
+        {
+            other.inner = Traits::init();
+        }
+
+        persistent_map &operator=(persistent_map &&other) noexcept
+        {
+            if (this != &other)
+            {
+                Traits::clear(&inner);
+                inner = other.inner;
+                other.inner = Traits::init();
+            }
+            return *this;
+        }
+
+        persistent_map snapshot() const
+        {
+            return *this;
+        }
+
+        void insert(const K &k, const V &v)
+        {
+            if (Z_OK != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        bool erase(const K &k)
+        {
+            return Z_OK == Traits::take(&inner, k, nullptr);
+        }
+
+        const V *find(const K &k)
+        {
+            auto *n = Traits::find(&inner, k);
+            return n ? &n->value : nullptr;
+        }
+
+        // Calls f(key, value) in key order. Take a snapshot first to keep scanning while the map changes.
+        template <typename F>
+        void for_each(F f)
+        {
+            auto c = Traits::cursor_init(&inner);
+            for (auto *n = Traits::cursor_first(&c); n; n = Traits::cursor_next(&c))
+            {
+                f(static_cast<const K&>(n->key), static_cast<const V&>(n->value));
+            }
+        }
+
+        size_t size() const
+        {
+            return inner.size;
+        }
+
+        bool empty() const
+        {
+            return 0 == inner.size;
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+}
+extern "C" {
+#endif
+
+// Allocator overrides.
+#ifndef ZTREE_MALLOC
+#   define ZTREE_MALLOC(sz)      Z_MALLOC(sz)
+#endif
+
+#ifndef ZTREE_CALLOC
+#   define ZTREE_CALLOC(n, sz)   Z_CALLOC(n, sz)
+#endif
+
+#ifndef ZTREE_REALLOC
+#   define ZTREE_REALLOC(p, sz)  Z_REALLOC(p, sz)
+#endif
+
+#ifndef ZTREE_FREE
+#   define ZTREE_FREE(p)         Z_FREE(p)
+#endif
+
+typedef enum 
+{ 
+    ZTREE_RED, 
+    ZTREE_BLACK 
+} ztree_color;
+
+typedef enum
+{
+    ZTREE_OP_INSERT,
+    ZTREE_OP_REMOVE
+} ztree_op_kind;
+
+// Batches at least size / RATIO ops long are merged by rebuilding the tree in one pass.
+#ifndef ZTREE_BATCH_REBUILD_RATIO
+#   define ZTREE_BATCH_REBUILD_RATIO 8
+#endif
+
+#ifdef __cplusplus
+#   define ZTREE_NEW_NODE(Type, n)  Type *n = new Type()
+#   define ZTREE_FREE_NODE(n)       delete n
+#else
+    
+#   define ZTREE_NEW_NODE(Type, n)  Type *n = (Type*)ZTREE_MALLOC(sizeof(Type))
+
+#   define ZTREE_FREE_NODE(n)       ZTREE_FREE(n)
+#endif
+
+// Nodes whose size is only known at run time (skiplist towers) are constructed in raw ZTREE_MALLOC memory.
+#ifdef __cplusplus
+#   define ZTREE__NEW_SIZED(Type, mem)  ((mem) ? new (mem) Type() : (Type*)NULL)
+#   define ZTREE__FREE_SIZED(Type, n)   ((n)->~Type(), ZTREE_FREE(n))
+#else
+#   define ZTREE__NEW_SIZED(Type, mem)  ((Type*)(mem))
+#   define ZTREE__FREE_SIZED(Type, n)   ZTREE_FREE(n)
+#endif
+
+// A clone copy-constructs all of its nodes side by side in one block (see ZTREE__GENERATE_CLONE); releasing
+// one of them only destroys it in place.
+#ifdef __cplusplus
+#   define ZTREE__COPY_NODE(Type, dst, src) new (dst) Type(*(src))
+#   define ZTREE__DROP_NODE(Type, n)        (n)->~Type()
+#else
+#   define ZTREE__COPY_NODE(Type, dst, src) (*(dst) = *(src))
+#   define ZTREE__DROP_NODE(Type, n)        ((void)0)
+#endif
+
+// Cache hint for walks whose next nodes are known a few steps ahead of the loads that need them.
+#if defined(__GNUC__) || defined(__clang__)
+#   define ZTREE__PREFETCH(p)               __builtin_prefetch(p)
+#else
+#   define ZTREE__PREFETCH(p)               ((void)0)
+#endif
+
+// Default counters per key in a filtered tree's Bloom filter: 8 gives roughly a 2% false-positive rate, 10
+// about 1%, 16 about 0.05%. Each counter is one byte; ztree_tune_filter changes the rate of a single tree.
+#ifndef ZTREE_FILTER_BITS_PER_KEY
+#   define ZTREE_FILTER_BITS_PER_KEY 10
+#endif
+
+// Finds on a node of an adaptive tree before it is splayed to the root. Lower keeps hot keys closer to the
+// root but rotates more; 1 makes every find a splay.
+#ifndef ZTREE_SPLAY_HITS
+#   define ZTREE_SPLAY_HITS 8
+#endif
+
+// Deepest path a stack-based cursor or path-copying update can record (red-black height <= 2*log2(n+1)).
+#ifndef ZTREE_CURSOR_DEPTH
+#   define ZTREE_CURSOR_DEPTH 96
+#endif
+
+// Index layout (opt-in): nodes live in a tree-owned array and link through 32-bit slots.
+#define ZTREE_NIL       ((uint32_t)0xFFFFFFFFu)
+#define ZTREE_INDEX_MAX ((size_t)0xFFFFFFFEu)
+
+// Top-K maps: status for an entry that a full map turns away. Positive like Z_FOUND, since it is not an error.
+#define ZTREE_REJECTED 2
+
+// Threaded layout (opt-in): every node also links its in-order neighbours, so next/prev is one load.
+#ifdef ZTREE_THREADED
+#   define ZTREE__THREAD_FIELDS(Node)       struct Node *pred, *succ;
+#   define ZTREE__THREAD_ROOT(z)            ((z)->pred = (z)->succ = NULL)
+#   define ZTREE__THREAD_LEFT_OF(y, z)                          \
+        ((z)->succ = (y), (z)->pred = (y)->pred,                \
+         ((y)->pred ? (void)((y)->pred->succ = (z)) : (void)0), \
+         (y)->pred = (z))
+#   define ZTREE__THREAD_RIGHT_OF(y, z)                         \
+        ((z)->pred = (y), (z)->succ = (y)->succ,                \
+         ((y)->succ ? (void)((y)->succ->pred = (z)) : (void)0), \
+         (y)->succ = (z))
+#   define ZTREE__THREAD_DETACH(z)                                       \
+        (((z)->pred ? (void)((z)->pred->succ = (z)->succ) : (void)0),    \
+         ((z)->succ ? (void)((z)->succ->pred = (z)->pred) : (void)0))
+#   define ZTREE__THREAD_CHAIN(n, link)                                  \
+        ((n)->succ = (link), ((link) ? (void)((link)->pred = (n)) : (void)0))
+#   define ZTREE__THREAD_LINKS              1
+#   define ZTREE__THREAD_SUCC(n)            ((n)->succ)
+#   define ZTREE__THREAD_PRED(n)            ((n)->pred)
+#else
+#   define ZTREE__THREAD_FIELDS(Node)
+#   define ZTREE__THREAD_ROOT(z)            ((void)0)
+#   define ZTREE__THREAD_LEFT_OF(y, z)      ((void)0)
+#   define ZTREE__THREAD_RIGHT_OF(y, z)     ((void)0)
+#   define ZTREE__THREAD_DETACH(z)          ((void)0)
+#   define ZTREE__THREAD_CHAIN(n, link)     ((void)0)
+#   define ZTREE__THREAD_LINKS              0
+#   define ZTREE__THREAD_SUCC(n)            NULL
+#   define ZTREE__THREAD_PRED(n)            NULL
+#endif
+
+// Random descents per subtree when ztree_partition weighs it; more samples give more even ranges.
+#ifndef ZTREE_PARTITION_SAMPLES
+#   define ZTREE_PARTITION_SAMPLES 4
+#endif
+
+// Parallel traversal (opt-in): ztree_parallel_foreach runs a full pass over pthreads. Each thread count is
+// split into GRAIN ranges per thread, which threads draw from a shared counter to even out uneven work.
+#ifdef ZTREE_PARALLEL
+#include <pthread.h>
+#   ifndef ZTREE_PARALLEL_GRAIN
+#       define ZTREE_PARALLEL_GRAIN 4
+#   endif
+#   define ZTREE__GENERATE_PARALLEL(Name)   ZTREE__GENERATE_PARALLEL_FOREACH(Name)
+#else
+#   define ZTREE__GENERATE_PARALLEL(Name)
+#endif
+
+// Balance hooks for the parent-linked core: the per-node balancing field, its state on a fresh leaf, and the
+// lookups a plain map pairs with the policy. SPLAY finds may rotate the tree (see ZTREE_GENERATE_ADAPTIVE_IMPL).
+#define ZTREE__RB_NODE_FIELDS            ztree_color color;
+#define ZTREE__RB_FRESH(z)               ((z)->color = ZTREE_RED)
+#define ZTREE__RB_SEARCH                 ZTREE__GENERATE_UNIQUE_SEARCH
+#define ZTREE__AVL_NODE_FIELDS           signed char balance;
+#define ZTREE__AVL_FRESH(z)              ((z)->balance = 0)
+#define ZTREE__AVL_SEARCH                ZTREE__GENERATE_UNIQUE_SEARCH
+#define ZTREE__SPLAY_NODE_FIELDS         unsigned hits;
+#define ZTREE__SPLAY_FRESH(z)            ((z)->hits = 0)
+#define ZTREE__SPLAY_SEARCH              ZTREE__GENERATE_ADAPTIVE_SEARCH
+
+// Payload hooks for the parent-linked core, selected by its Layout argument: extra tree fields, releasing one
+// node, setting up or resetting whatever the tree owns besides its nodes, and for a clone, copying that state
+// up front (returns Z_OK or Z_ENOMEM) and taking in each copied node. PLAIN nodes carry values inline.
+#define ZTREE__PLAIN_FIELDS(Name)
+#define ZTREE__PLAIN_DROP(Name, t, n)    ztree__release_##Name(t, n)
+#define ZTREE__PLAIN_INIT(Name, t)       ((void)0)
+#define ZTREE__PLAIN_RESET(Name, t)      ((void)0)
+#define ZTREE__PLAIN_COPY(Name, t, src)  Z_OK
+#define ZTREE__PLAIN_ADOPT(Name, t, n)   ((void)0)
+
+// SPLIT nodes keep only a slot handle; values live in the tree's slab (see ZTREE_GENERATE_SPLIT_IMPL).
+#define ZTREE__SPLIT_FIELDS(Name)        ztree_slab_##Name slab;
+#define ZTREE__SPLIT_DROP(Name, t, n)    (ztree__slab_free_##Name(&(t)->slab, (n)->slot), ztree__release_##Name(t, n))
+#define ZTREE__SPLIT_INIT(Name, t)       ztree__slab_init_##Name(&(t)->slab)
+#define ZTREE__SPLIT_RESET(Name, t)      ztree__slab_reset_##Name(&(t)->slab)
+#define ZTREE__SPLIT_COPY(Name, t, src)  ztree__slab_copy_##Name(&(t)->slab, &(src)->slab)
+#define ZTREE__SPLIT_ADOPT(Name, t, n)   ((void)0)
+
+// HASH trees also keep every node in a hash index (see ZTREE_GENERATE_HASHED_IMPL); dropping a node unhooks it.
+#define ZTREE__HASH_FIELDS(Name)         ztree_hidx_##Name index;
+#define ZTREE__HASH_DROP(Name, t, n)     (ztree__hidx_erase_##Name(&(t)->index, n), ztree__release_##Name(t, n))
+#define ZTREE__HASH_INIT(Name, t)        ztree__hidx_init_##Name(&(t)->index)
+#define ZTREE__HASH_RESET(Name, t)       ztree__hidx_reset_##Name(&(t)->index)
+#define ZTREE__HASH_COPY(Name, t, src)   ztree__hidx_size_like_##Name(&(t)->index, &(src)->index)
+#define ZTREE__HASH_ADOPT(Name, t, n)    (ztree__hidx_place_##Name(&(t)->index, n), (t)->index.count++)
+
+// FILTER trees keep a counting Bloom filter of their keys (see ZTREE_GENERATE_FILTERED_IMPL).
+#define ZTREE__FILTER_FIELDS(Name)       ztree_filter filter;
+#define ZTREE__FILTER_DROP(Name, t, n)   (ztree__filter_drop_##Name(&(t)->filter, n), ztree__release_##Name(t, n))
+#define ZTREE__FILTER_INIT(Name, t)      ztree__filter_init(&(t)->filter)
+#define ZTREE__FILTER_RESET(Name, t)     ztree__filter_reset(&(t)->filter)
+#define ZTREE__FILTER_COPY(Name, t, src) ztree__filter_copy(&(t)->filter, &(src)->filter)
+#define ZTREE__FILTER_ADOPT(Name, t, n)  ((void)0)
+
+// Ownership hooks for the path-balancing code: Own(Name, t, parent, n) returns a node the update may write,
+// linked under `parent` in place of `n`. Compact trees own every node; copy-on-write trees copy shared ones.
+#define ZTREE__KEEP_NODE(Name, t, parent, n)   (n)
+#define ZTREE__COW_OWN(Name, t, parent, n)     ztree__cow_own_##Name(t, parent, n)
+
+// Version hooks for the copy-on-write core, selected by its Policy argument: whether a node may be visible to
+// readers, stamping a fresh or copied node, and releasing a replaced or unlinked one. RCU nodes carry the epoch
+// they were written in; replaced ones are retired until no reader is left in that epoch, while an unlinked node
+// is always a private copy by then and can be freed at once.
+#define ZTREE__RCU_SHARED(t, n)                ((n)->stamp != (t)->epoch.epoch)
+#define ZTREE__RCU_FRESH(t, n)                 ((n)->stamp = (t)->epoch.epoch)
+#define ZTREE__RCU_COPIED(Name, t, old, n)     (ZTREE__RCU_FRESH(t, n), ztree__rcu_retire_##Name(t, old))
+#define ZTREE__RCU_DISCARD(Name, t, n)         ZTREE_FREE_NODE(n)
+
+// PERSIST nodes are reference counted: one reference per parent pointer, tree root or snapshot root. A node is
+// shared while it has more than one, and a copy takes references to the children it inherits.
+#define ZTREE__PERSIST_SHARED(t, n)            (1 != __atomic_load_n(&(n)->refs, __ATOMIC_ACQUIRE))
+#define ZTREE__PERSIST_FRESH(t, n)             ((n)->refs = 1)
+#define ZTREE__PERSIST_COPIED(Name, t, old, n) ztree__persist_copied_##Name(old, n)
+#define ZTREE__PERSIST_DISCARD(Name, t, n)     ZTREE_FREE_NODE(n)
+
+// Prefix function for `const char*` keys: the first 8 bytes packed big-endian and zero-padded, so integer
+// order matches strcmp order and equal prefixes are the only case that needs the full comparison.
+static inline uint64_t ztree_prefix_cstr(const char *const *k)
+{
+    const unsigned char *s = (const unsigned char *)*k;
+    uint64_t p = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        p <<= 8;
+        if (*s)
+        {
+            p |= *s++;
+        }
+    }
+    return p;
+}
+
+// Hash function for `const char*` keys (64-bit FNV-1a).
+static inline uint64_t ztree_hash_cstr(const char *const *k)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *s = (const unsigned char *)*k; *s; s++)
+    {
+        h = (h ^ *s) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Lookup counters of a filtered tree: `rejected` lookups skipped the descent (an empty tree rejects every key),
+// `false_positives` passed the filter but found nothing. Only ztree_find counts; removals and takes do not.
+typedef struct
+{
+    size_t lookups, rejected, false_positives;
+} ztree_filter_stats;
+
+// Counting Bloom filter with saturating 8-bit counters; a counter that reaches 255 is never decremented.
+typedef struct
+{
+    uint8_t *counters;
+    size_t mask;
+    unsigned bits_per_key;
+    ztree_filter_stats stats;
+} ztree_filter;
+
+static inline void ztree__filter_init(ztree_filter *f)
+{
+    f->counters = NULL;
+    f->mask = 0;
+    f->bits_per_key = ZTREE_FILTER_BITS_PER_KEY;
+    f->stats.lookups = f->stats.rejected = f->stats.false_positives = 0;
+}
+
+static inline void ztree__filter_reset(ztree_filter *f)
+{
+    unsigned bits_per_key = f->bits_per_key;
+    ZTREE_FREE(f->counters);
+    ztree__filter_init(f);
+    f->bits_per_key = bits_per_key;
+}
+
+static inline int ztree__filter_copy(ztree_filter *f, const ztree_filter *src)
+{
+    ztree__filter_init(f);
+    f->bits_per_key = src->bits_per_key;
+    if (src->counters)
+    {
+        f->counters = (uint8_t *)ZTREE_MALLOC(src->mask + 1);
+        if (!f->counters)
+        {
+            return Z_ENOMEM;
+        }
+        memcpy(f->counters, src->counters, src->mask + 1);
+        f->mask = src->mask;
+    }
+    f->stats = src->stats;
+    return Z_OK;
+}
+
+static inline unsigned ztree__filter_hashes(const ztree_filter *f)
+{
+    unsigned k = (f->bits_per_key * 69 + 50) / 100;
+    return (k < 1) ? 1 : (k > 16) ? 16 : k;
+}
+
+// Double hashing: probe i lands on h + i * step with an odd step, so the probes of one key never coincide.
+static inline size_t ztree__filter_slot(const ztree_filter *f, uint64_t h, unsigned i)
+{
+    return (size_t)(h + i * ((h >> 32) | 1)) & f->mask;
+}
+
+static inline int ztree__filter_test(const ztree_filter *f, uint64_t h)
+{
+    if (!f->counters)
+    {
+        return 1;
+    }
+    for (unsigned i = 0, n = ztree__filter_hashes(f); i < n; i++)
+    {
+        if (0 == f->counters[ztree__filter_slot(f, h, i)])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void ztree__filter_add(ztree_filter *f, uint64_t h)
+{
+    if (!f->counters)
+    {
+        return;
+    }
+    for (unsigned i = 0, n = ztree__filter_hashes(f); i < n; i++)
+    {
+        uint8_t *c = &f->counters[ztree__filter_slot(f, h, i)];
+        *c += (*c < 255);
+    }
+}
+
+static inline void ztree__filter_sub(ztree_filter *f, uint64_t h)
+{
+    if (!f->counters)
+    {
+        return;
+    }
+    for (unsigned i = 0, n = ztree__filter_hashes(f); i < n; i++)
+    {
+        uint8_t *c = &f->counters[ztree__filter_slot(f, h, i)];
+        *c -= (*c < 255 && *c > 0);
+    }
+}
+
+static inline int ztree__filter_wants_grow(const ztree_filter *f, size_t keys)
+{
+    return !f->counters || keys * f->bits_per_key > f->mask + 1;
+}
+
+// Replaces the counters with an empty table sized for twice `keys`; the caller re-adds every key.
+static inline int ztree__filter_alloc(ztree_filter *f, size_t keys)
+{
+    size_t cap = 64;
+    while (cap < 2 * keys * f->bits_per_key)
+    {
+        cap *= 2;
+    }
+    uint8_t *counters = (uint8_t *)ZTREE_CALLOC(cap, 1);
+    if (!counters)
+    {
+        return Z_ENOMEM;
+    }
+    ZTREE_FREE(f->counters);
+    f->counters = counters;
+    f->mask = cap - 1;
+    return Z_OK;
+}
+
+// Red-black balancing for the parent-linked core: insert/delete fixups, unlinking and balanced rebuilds.
+#define ZTREE__GENERATE_RB_BALANCE(Name)                                                                        \
+                                                                                                                \
+    static inline void ztree__fix_ins_##Name(ztree_##Name *t, ztree_node_##Name *z)                             \
+    {                                                                                                           \
+        while (z->parent && ZTREE_RED == z->parent->color)                                                      \
+        {                                                                                                       \
+            if (z->parent == z->parent->parent->left)                                                           \
+            {                                                                                                   \
+                ztree_node_##Name *y = z->parent->parent->right;                                                \
+                if (y && ZTREE_RED == y->color)                                                                 \
+                {                                                                                               \
+                    z->parent->color = ZTREE_BLACK;                                                             \
+                    y->color = ZTREE_BLACK;                                                                     \
+                    z->parent->parent->color = ZTREE_RED;                                                       \
+                    z = z->parent->parent;                                                                      \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    if (z == z->parent->right)                                                                  \
+                    {                                                                                           \
+                        z = z->parent;                                                                          \
+                        ztree__rot_l_##Name(t, z);                                                              \
+                    }                                                                                           \
+                    z->parent->color = ZTREE_BLACK;                                                             \
+                    z->parent->parent->color = ZTREE_RED;                                                       \
+                    ztree__rot_r_##Name(t, z->parent->parent);                                                  \
+                }                                                                                               \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree_node_##Name *y = z->parent->parent->left;                                                 \
+                if (y && ZTREE_RED == y->color)                                                                 \
+                {                                                                                               \
+                    z->parent->color = ZTREE_BLACK;                                                             \
+                    y->color = ZTREE_BLACK;                                                                     \
+                    z->parent->parent->color = ZTREE_RED;                                                       \
+                    z = z->parent->parent;                                                                      \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    if (z == z->parent->left)                                                                   \
+                    {                                                                                           \
+                        z = z->parent;                                                                          \
+                        ztree__rot_r_##Name(t, z);                                                              \
+                    }                                                                                           \
+                    z->parent->color = ZTREE_BLACK;                                                             \
+                    z->parent->parent->color = ZTREE_RED;                                                       \
+                    ztree__rot_l_##Name(t, z->parent->parent);                                                  \
+                }                                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        t->root->color = ZTREE_BLACK;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_del_##Name(ztree_##Name *t, ztree_node_##Name *x, ztree_node_##Name *p)       \
+    {                                                                                                           \
+        while (x != t->root && (!x || x->color == ZTREE_BLACK))                                                 \
+        {                                                                                                       \
+            if (x == p->left)                                                                                   \
+            {                                                                                                   \
+                ztree_node_##Name *w = p->right;                                                                \
+                if (ZTREE_RED == w->color)                                                                      \
+                {                                                                                               \
+                    w->color = ZTREE_BLACK;                                                                     \
+                    p->color = ZTREE_RED;                                                                       \
+                    ztree__rot_l_##Name(t, p);                                                                  \
+                    w = p->right;                                                                               \
+                }                                                                                               \
+                if ((!w->left || ZTREE_BLACK == w->left->color) &&                                              \
+                    (!w->right || ZTREE_BLACK == w->right->color))                                              \
+                    {                                                                                           \
+                    w->color = ZTREE_RED;                                                                       \
+                    x = p;                                                                                      \
+                    p = x->parent;                                                                              \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    if (!w->right || ZTREE_BLACK == w->right->color)                                            \
+                    {                                                                                           \
+                        if (w->left)                                                                            \
+                        {                                                                                       \
+                            w->left->color = ZTREE_BLACK;                                                       \
+                        }                                                                                       \
+                        w->color = ZTREE_RED;                                                                   \
+                        ztree__rot_r_##Name(t, w);                                                              \
+                        w = p->right;                                                                           \
+                    }                                                                                           \
+                    w->color = p->color;                                                                        \
+                    p->color = ZTREE_BLACK;                                                                     \
+                    if (w->right)                                                                               \
+                    {                                                                                           \
+                        w->right->color = ZTREE_BLACK;                                                          \
+                    }                                                                                           \
+                    ztree__rot_l_##Name(t, p);                                                                  \
+                    x = t->root;                                                                                \
+                }                                                                                               \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree_node_##Name *w = p->left;                                                                 \
+                if (ZTREE_RED == w->color)                                                                      \
+                {                                                                                               \
+                    w->color = ZTREE_BLACK;                                                                     \
+                    p->color = ZTREE_RED;                                                                       \
+                    ztree__rot_r_##Name(t, p);                                                                  \
+                    w = p->left;                                                                                \
+                }                                                                                               \
+                if ((!w->right || ZTREE_BLACK == w->right->color) &&                                            \
+                    (!w->left || ZTREE_BLACK == w->left->color))                                                \
+                {                                                                                               \
+                    w->color = ZTREE_RED;                                                                       \
+                    x = p;                                                                                      \
+                    p = x->parent;                                                                              \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    if (!w->left || ZTREE_BLACK == w->left->color)                                              \
+                    {                                                                                           \
+                        if (w->right)                                                                           \
+                        {                                                                                       \
+                            w->right->color = ZTREE_BLACK;                                                      \
+                        }                                                                                       \
+                        w->color = ZTREE_RED;                                                                   \
+                        ztree__rot_l_##Name(t, w);                                                              \
+                        w = p->left;                                                                            \
+                    }                                                                                           \
+                    w->color = p->color;                                                                        \
+                    p->color = ZTREE_BLACK;                                                                     \
+                    if (w->left)                                                                                \
+                    {                                                                                           \
+                        w->left->color = ZTREE_BLACK;                                                           \
+                    }                                                                                           \
+                    ztree__rot_r_##Name(t, p);                                                                  \
+                    x = t->root;                                                                                \
+                }                                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        if (x)                                                                                                  \
+        {                                                                                                       \
+            x->color = ZTREE_BLACK;                                                                             \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__unlink_##Name(ztree_##Name *t, ztree_node_##Name *z)                              \
+    {                                                                                                           \
+        if (z == t->leftmost)                                                                                   \
+        {                                                                                                       \
+            t->leftmost = ztree_next_##Name(z);                                                                 \
+        }                                                                                                       \
+        if (z == t->rightmost)                                                                                  \
+        {                                                                                                       \
+            t->rightmost = ztree_prev_##Name(z);                                                                \
+        }                                                                                                       \
+        ZTREE__THREAD_DETACH(z);                                                                                \
+        ztree_node_##Name *y = z, *x;                                                                           \
+        ztree_node_##Name *x_parent = NULL;                                                                     \
+        ztree_color y_orig_color = y->color;                                                                    \
+        if (!z->left)                                                                                           \
+        {                                                                                                       \
+            x = z->right;                                                                                       \
+            x_parent = z->parent;                                                                               \
+            ztree__transplant_##Name(t, z, z->right);                                                           \
+        }                                                                                                       \
+        else if (!z->right)                                                                                     \
+        {                                                                                                       \
+            x = z->left;                                                                                        \
+            x_parent = z->parent;                                                                               \
+            ztree__transplant_##Name(t, z, z->left);                                                            \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            y = z->right;                                                                                       \
+            while (y->left)                                                                                     \
+            {                                                                                                   \
+                y = y->left;                                                                                    \
+            }                                                                                                   \
+            y_orig_color = y->color;                                                                            \
+            x = y->right;                                                                                       \
+            if (y->parent == z)                                                                                 \
+            {                                                                                                   \
+                x_parent = y;                                                                                   \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                x_parent = y->parent;                                                                           \
+                ztree__transplant_##Name(t, y, y->right);                                                       \
+                y->right = z->right;                                                                            \
+                y->right->parent = y;                                                                           \
+            }                                                                                                   \
+            ztree__transplant_##Name(t, z, y);                                                                  \
+            y->left = z->left;                                                                                  \
+            y->left->parent = y;                                                                                \
+            y->color = z->color;                                                                                \
+        }                                                                                                       \
+        if (ZTREE_BLACK == y_orig_color)                                                                        \
+        {                                                                                                       \
+            ztree__fix_del_##Name(t, x, x_parent);                                                              \
+        }                                                                                                       \
+        t->size--;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__build_##Name(ztree_node_##Name **list, size_t n, int depth,         \
+                                                         int red_depth, ztree_node_##Name *parent)              \
+    {                                                                                                           \
+        if (0 == n)                                                                                             \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        size_t half = (n - 1) / 2;                                                                              \
+        ztree_node_##Name *left = ztree__build_##Name(list, half, depth + 1, red_depth, NULL);                  \
+        ztree_node_##Name *root = *list;                                                                        \
+        *list = root->left;                                                                                     \
+        ZTREE__THREAD_CHAIN(root, *list);                                                                       \
+        root->parent = parent;                                                                                  \
+        root->left = left;                                                                                      \
+        if (left)                                                                                               \
+        {                                                                                                       \
+            left->parent = root;                                                                                \
+        }                                                                                                       \
+        root->right = ztree__build_##Name(list, n - 1 - half, depth + 1, red_depth, root);                      \
+        root->color = (depth == red_depth) ? ZTREE_RED : ZTREE_BLACK;                                           \
+        return root;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rebuild_##Name(ztree_##Name *t, ztree_node_##Name *list, size_t n)                \
+    {                                                                                                           \
+        /* `list` is chained through `left`. Every level above the last is full, so only the last is red. */    \
+        int red_depth = 0;                                                                                      \
+        while (((size_t)2 << red_depth) - 1 <= n)                                                               \
+        {                                                                                                       \
+            red_depth++;                                                                                        \
+        }                                                                                                       \
+        t->leftmost = list;                                                                                     \
+        if (list)                                                                                               \
+        {                                                                                                       \
+            ZTREE__THREAD_ROOT(list);                                                                           \
+        }                                                                                                       \
+        t->root = ztree__build_##Name(&list, n, 0, red_depth, NULL);                                            \
+        t->rightmost = t->root;                                                                                 \
+        while (t->rightmost && t->rightmost->right)                                                             \
+        {                                                                                                       \
+            t->rightmost = t->rightmost->right;                                                                 \
+        }                                                                                                       \
+        t->size = n;                                                                                            \
+    }
+
+// AVL balancing: every node keeps height(right) - height(left) in -1..1, so trees stay within ~1.44 log2 n.
+#define ZTREE__GENERATE_AVL_BALANCE(Name)                                                                       \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__avl_fix_##Name(ztree_##Name *t, ztree_node_##Name *p)               \
+    {                                                                                                           \
+        /* `p` is off balance by two; rotate and return the new subtree root with updated balance factors. */   \
+        int s = (p->balance > 0) ? 1 : -1;                                                                      \
+        ztree_node_##Name *c = (s > 0) ? p->right : p->left;                                                    \
+        if (c->balance * s >= 0)                                                                                \
+        {                                                                                                       \
+            if (s > 0)                                                                                          \
+            {                                                                                                   \
+                ztree__rot_l_##Name(t, p);                                                                      \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree__rot_r_##Name(t, p);                                                                      \
+            }                                                                                                   \
+            if (0 == c->balance)                                                                                \
+            {                                                                                                   \
+                p->balance = (signed char)s;                                                                    \
+                c->balance = (signed char)-s;                                                                   \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                p->balance = c->balance = 0;                                                                    \
+            }                                                                                                   \
+            return c;                                                                                           \
+        }                                                                                                       \
+        ztree_node_##Name *g = (s > 0) ? c->left : c->right;                                                    \
+        if (s > 0)                                                                                              \
+        {                                                                                                       \
+            ztree__rot_r_##Name(t, c);                                                                          \
+            ztree__rot_l_##Name(t, p);                                                                          \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            ztree__rot_l_##Name(t, c);                                                                          \
+            ztree__rot_r_##Name(t, p);                                                                          \
+        }                                                                                                       \
+        p->balance = (signed char)((g->balance == s) ? -s : 0);                                                 \
+        c->balance = (signed char)((g->balance == -s) ? s : 0);                                                 \
+        g->balance = 0;                                                                                         \
+        return g;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_ins_##Name(ztree_##Name *t, ztree_node_##Name *z)                             \
+    {                                                                                                           \
+        for (ztree_node_##Name *p = z->parent; p; z = p, p = p->parent)                                         \
+        {                                                                                                       \
+            p->balance += (z == p->left) ? -1 : 1;                                                              \
+            if (0 == p->balance)                                                                                \
+            {                                                                                                   \
+                return;                                                                                         \
+            }                                                                                                   \
+            if (2 == p->balance || -2 == p->balance)                                                            \
+            {                                                                                                   \
+                ztree__avl_fix_##Name(t, p);                                                                    \
+                return;                                                                                         \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_del_##Name(ztree_##Name *t, ztree_node_##Name *p, int left)                   \
+    {                                                                                                           \
+        /* The `left` (or right) subtree of `p` just got one level shorter. */                                  \
+        while (p)                                                                                               \
+        {                                                                                                       \
+            p->balance += left ? 1 : -1;                                                                        \
+            ztree_node_##Name *n = p;                                                                           \
+            if (2 == p->balance || -2 == p->balance)                                                            \
+            {                                                                                                   \
+                n = ztree__avl_fix_##Name(t, p);                                                                \
+            }                                                                                                   \
+            else if (0 != p->balance)                                                                           \
+            {                                                                                                   \
+                return;                                                                                         \
+            }                                                                                                   \
+            if (0 != n->balance || !n->parent)                                                                  \
+            {                                                                                                   \
+                return;                                                                                         \
+            }                                                                                                   \
+            left = (n == n->parent->left);                                                                      \
+            p = n->parent;                                                                                      \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__unlink_##Name(ztree_##Name *t, ztree_node_##Name *z)                              \
+    {                                                                                                           \
+        if (z == t->leftmost)                                                                                   \
+        {                                                                                                       \
+            t->leftmost = ztree_next_##Name(z);                                                                 \
+        }                                                                                                       \
+        if (z == t->rightmost)                                                                                  \
+        {                                                                                                       \
+            t->rightmost = ztree_prev_##Name(z);                                                                \
+        }                                                                                                       \
+        ZTREE__THREAD_DETACH(z);                                                                                \
+        ztree_node_##Name *p;                                                                                   \
+        int left;                                                                                               \
+        if (!z->left || !z->right)                                                                              \
+        {                                                                                                       \
+            p = z->parent;                                                                                      \
+            left = p && z == p->left;                                                                           \
+            ztree__transplant_##Name(t, z, z->left ? z->left : z->right);                                       \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            ztree_node_##Name *y = z->right;                                                                    \
+            while (y->left)                                                                                     \
+            {                                                                                                   \
+                y = y->left;                                                                                    \
+            }                                                                                                   \
+            if (y->parent == z)                                                                                 \
+            {                                                                                                   \
+                p = y;                                                                                          \
+                left = 0;                                                                                       \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                p = y->parent;                                                                                  \
+                left = 1;                                                                                       \
+                ztree__transplant_##Name(t, y, y->right);                                                       \
+                y->right = z->right;                                                                            \
+                y->right->parent = y;                                                                           \
+            }                                                                                                   \
+            ztree__transplant_##Name(t, z, y);                                                                  \
+            y->left = z->left;                                                                                  \
+            y->left->parent = y;                                                                                \
+            y->balance = z->balance;                                                                            \
+        }                                                                                                       \
+        ztree__fix_del_##Name(t, p, left);                                                                      \
+        t->size--;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__build_##Name(ztree_node_##Name **list, size_t n,                    \
+                                                         ztree_node_##Name *parent, int *height)                \
+    {                                                                                                           \
+        if (0 == n)                                                                                             \
+        {                                                                                                       \
+            *height = 0;                                                                                        \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        int lh, rh;                                                                                             \
+        size_t half = (n - 1) / 2;                                                                              \
+        ztree_node_##Name *left = ztree__build_##Name(list, half, NULL, &lh);                                   \
+        ztree_node_##Name *root = *list;                                                                        \
+        *list = root->left;                                                                                     \
+        ZTREE__THREAD_CHAIN(root, *list);                                                                       \
+        root->parent = parent;                                                                                  \
+        root->left = left;                                                                                      \
+        if (left)                                                                                               \
+        {                                                                                                       \
+            left->parent = root;                                                                                \
+        }                                                                                                       \
+        root->right = ztree__build_##Name(list, n - 1 - half, root, &rh);                                       \
+        root->balance = (signed char)(rh - lh);                                                                 \
+        *height = 1 + ((lh > rh) ? lh : rh);                                                                    \
+        return root;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rebuild_##Name(ztree_##Name *t, ztree_node_##Name *list, size_t n)                \
+    {                                                                                                           \
+        /* `list` is chained through `left`; halving it recursively keeps every balance factor in -1..1. */     \
+        int height;                                                                                             \
+        t->leftmost = list;                                                                                     \
+        if (list)                                                                                               \
+        {                                                                                                       \
+            ZTREE__THREAD_ROOT(list);                                                                           \
+        }                                                                                                       \
+        t->root = ztree__build_##Name(&list, n, NULL, &height);                                                 \
+        t->rightmost = t->root;                                                                                 \
+        while (t->rightmost && t->rightmost->right)                                                             \
+        {                                                                                                       \
+            t->rightmost = t->rightmost->right;                                                                 \
+        }                                                                                                       \
+        t->size = n;                                                                                            \
+    }
+
+// Access-adaptive balancing: no shape invariant. A node is splayed to the root when it is found often
+// (ZTREE_SPLAY_HITS) or sits deeper than 2 log2 n + 2. Hot keys stay shallow and bad shapes repair themselves.
+#define ZTREE__GENERATE_SPLAY_BALANCE(Name)                                                                     \
+                                                                                                                \
+    static inline void ztree__lift_##Name(ztree_##Name *t, ztree_node_##Name *x)                                \
+    {                                                                                                           \
+        ztree_node_##Name *p = x->parent;                                                                       \
+        if (x == p->left)                                                                                       \
+        {                                                                                                       \
+            ztree__rot_r_##Name(t, p);                                                                          \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            ztree__rot_l_##Name(t, p);                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__splay_##Name(ztree_##Name *t, ztree_node_##Name *x)                               \
+    {                                                                                                           \
+        while (x->parent)                                                                                       \
+        {                                                                                                       \
+            ztree_node_##Name *p = x->parent, *g = p->parent;                                                   \
+            if (g)                                                                                              \
+            {                                                                                                   \
+                /* Zig-zig lifts the parent first, which roughly halves the depth of the whole path. */         \
+                ztree__lift_##Name(t, ((x == p->left) == (p == g->left)) ? p : x);                              \
+            }                                                                                                   \
+            ztree__lift_##Name(t, x);                                                                           \
+        }                                                                                                       \
+        x->hits = 0;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__too_deep_##Name(ztree_##Name *t, size_t depth)                                     \
+    {                                                                                                           \
+        /* Deeper than 2 * log2(size) + 2: never reached by a balanced tree. */                                 \
+        size_t limit = 2;                                                                                       \
+        for (size_t n = t->size; n; n >>= 1)                                                                    \
+        {                                                                                                       \
+            limit += 2;                                                                                         \
+        }                                                                                                       \
+        return depth > limit;                                                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_ins_##Name(ztree_##Name *t, ztree_node_##Name *z)                             \
+    {                                                                                                           \
+        size_t depth = 1;                                                                                       \
+        for (ztree_node_##Name *p = z->parent; p; p = p->parent)                                                \
+        {                                                                                                       \
+            depth++;                                                                                            \
+        }                                                                                                       \
+        if (ztree__too_deep_##Name(t, depth))                                                                   \
+        {                                                                                                       \
+            ztree__splay_##Name(t, z);                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__unlink_##Name(ztree_##Name *t, ztree_node_##Name *z)                              \
+    {                                                                                                           \
+        if (z == t->leftmost)                                                                                   \
+        {                                                                                                       \
+            t->leftmost = ztree_next_##Name(z);                                                                 \
+        }                                                                                                       \
+        if (z == t->rightmost)                                                                                  \
+        {                                                                                                       \
+            t->rightmost = ztree_prev_##Name(z);                                                                \
+        }                                                                                                       \
+        ZTREE__THREAD_DETACH(z);                                                                                \
+        if (!z->left || !z->right)                                                                              \
+        {                                                                                                       \
+            ztree__transplant_##Name(t, z, z->left ? z->left : z->right);                                       \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            ztree_node_##Name *y = z->right;                                                                    \
+            while (y->left)                                                                                     \
+            {                                                                                                   \
+                y = y->left;                                                                                    \
+            }                                                                                                   \
+            if (y->parent != z)                                                                                 \
+            {                                                                                                   \
+                ztree__transplant_##Name(t, y, y->right);                                                       \
+                y->right = z->right;                                                                            \
+                y->right->parent = y;                                                                           \
+            }                                                                                                   \
+            ztree__transplant_##Name(t, z, y);                                                                  \
+            y->left = z->left;                                                                                  \
+            y->left->parent = y;                                                                                \
+        }                                                                                                       \
+        t->size--;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__build_##Name(ztree_node_##Name **list, size_t n,                    \
+                                                         ztree_node_##Name *parent)                             \
+    {                                                                                                           \
+        if (0 == n)                                                                                             \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        size_t half = (n - 1) / 2;                                                                              \
+        ztree_node_##Name *left = ztree__build_##Name(list, half, NULL);                                        \
+        ztree_node_##Name *root = *list;                                                                        \
+        *list = root->left;                                                                                     \
+        ZTREE__THREAD_CHAIN(root, *list);                                                                       \
+        root->parent = parent;                                                                                  \
+        root->left = left;                                                                                      \
+        if (left)                                                                                               \
+        {                                                                                                       \
+            left->parent = root;                                                                                \
+        }                                                                                                       \
+        root->right = ztree__build_##Name(list, n - 1 - half, root);                                            \
+        root->hits = 0;                                                                                         \
+        return root;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rebuild_##Name(ztree_##Name *t, ztree_node_##Name *list, size_t n)                \
+    {                                                                                                           \
+        /* `list` is chained through `left`; a batch rebuild starts the tree balanced again. */                 \
+        t->leftmost = list;                                                                                     \
+        if (list)                                                                                               \
+        {                                                                                                       \
+            ZTREE__THREAD_ROOT(list);                                                                           \
+        }                                                                                                       \
+        t->root = ztree__build_##Name(&list, n, NULL);                                                          \
+        t->rightmost = t->root;                                                                                 \
+        while (t->rightmost && t->rightmost->right)                                                             \
+        {                                                                                                       \
+            t->rightmost = t->rightmost->right;                                                                 \
+        }                                                                                                       \
+        t->size = n;                                                                                            \
+    }
+
+// Structure shared by every parent-linked node layout: rotations, navigation and linking. The Balance token
+// (RB, AVL or SPLAY) picks the fixups, unlinking and rebuilds from ZTREE__GENERATE_<Balance>_BALANCE.
+#define ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, Layout, Balance)                                            \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name *root;                                                                                \
+        size_t size;                                                                                            \
+        ztree_node_##Name *leftmost, *rightmost;                                                                \
+        ztree_node_##Name *block, *block_end;                                                                   \
+        size_t block_live;                                                                                      \
+        ZTREE__##Layout##_FIELDS(Name)                                                                          \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t;                                                                                         \
+        t.root = t.leftmost = t.rightmost = NULL;                                                               \
+        t.block = t.block_end = NULL;                                                                           \
+        t.size = t.block_live = 0;                                                                              \
+        ZTREE__##Layout##_INIT(Name, &t);                                                                       \
+        return t;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__in_block_##Name(const ztree_##Name *t, const ztree_node_##Name *n)                 \
+    {                                                                                                           \
+        return (uintptr_t)n - (uintptr_t)t->block < (uintptr_t)t->block_end - (uintptr_t)t->block;              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__release_##Name(ztree_##Name *t, ztree_node_##Name *n)                             \
+    {                                                                                                           \
+        /* Nodes of a clone share one block, which is freed with the last of them: until then a removed node's  \
+         * slot stays allocated. Nodes never move, so callers compact by cloning again. */                      \
+        if (ztree__in_block_##Name(t, n))                                                                       \
+        {                                                                                                       \
+            ZTREE__DROP_NODE(ztree_node_##Name, n);                                                             \
+            if (0 == --t->block_live)                                                                           \
+            {                                                                                                   \
+                ZTREE_FREE(t->block);                                                                           \
+                t->block = t->block_end = NULL;                                                                 \
+            }                                                                                                   \
+            return;                                                                                             \
+        }                                                                                                       \
+        ZTREE_FREE_NODE(n);                                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__free_rec_##Name(ztree_##Name *t, ztree_node_##Name *n)                            \
+    {                                                                                                           \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__free_rec_##Name(t, n->left);                                                                     \
+        ztree__free_rec_##Name(t, n->right);                                                                    \
+        ztree__release_##Name(t, n);                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        /* Side storage goes first: freeing a large block right after many small frees can make the allocator   \
+         * sweep all of them. Releasing a node never touches it. */                                             \
+        ZTREE__##Layout##_RESET(Name, t);                                                                       \
+        ztree__free_rec_##Name(t, t->root);                                                                     \
+        t->root = t->leftmost = t->rightmost = NULL;                                                            \
+        t->size = 0;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__drop_##Name(ztree_##Name *t, ztree_node_##Name *n)                                \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+        ZTREE__##Layout##_DROP(Name, t, n);                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rot_l_##Name(ztree_##Name *t, ztree_node_##Name *x)                               \
+    {                                                                                                           \
+        ztree_node_##Name *y = x->right;                                                                        \
+        x->right = y->left;                                                                                     \
+        if (y->left)                                                                                            \
+        {                                                                                                       \
+            y->left->parent = x;                                                                                \
+            y->parent = x->parent;                                                                              \
+        }                                                                                                       \
+        y->parent = x->parent;                                                                                  \
+        if (!x->parent)                                                                                         \
+        {                                                                                                       \
+            t->root = y;                                                                                        \
+        }                                                                                                       \
+        else if (x == x->parent->left)                                                                          \
+        {                                                                                                       \
+            x->parent->left = y;                                                                                \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            x->parent->right = y;                                                                               \
+        }                                                                                                       \
+        y->left = x;                                                                                            \
+        x->parent = y;                                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rot_r_##Name(ztree_##Name *t, ztree_node_##Name *y)                               \
+    {                                                                                                           \
+        ztree_node_##Name *x = y->left;                                                                         \
+        y->left = x->right;                                                                                     \
+        if (x->right)                                                                                           \
+        {                                                                                                       \
+            x->right->parent = y;                                                                               \
+            x->parent = y->parent;                                                                              \
+        }                                                                                                       \
+        x->parent = y->parent;                                                                                  \
+        if (!y->parent)                                                                                         \
+        {                                                                                                       \
+            t->root = x;                                                                                        \
+        }                                                                                                       \
+        else if (y == y->parent->left)                                                                          \
+        {                                                                                                       \
+            y->parent->left = x;                                                                                \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            y->parent->right = x;                                                                               \
+        }                                                                                                       \
+        x->right = y;                                                                                           \
+        y->parent = x;                                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__transplant_##Name(ztree_##Name *t, ztree_node_##Name *u, ztree_node_##Name *v)    \
+    {                                                                                                           \
+        if (!u->parent)                                                                                         \
+        {                                                                                                       \
+            t->root = v;                                                                                        \
+        }                                                                                                       \
+        else if (u == u->parent->left)                                                                          \
+        {                                                                                                       \
+            u->parent->left = v;                                                                                \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            u->parent->right = v;                                                                               \
+        }                                                                                                       \
+        if (v)                                                                                                  \
+        {                                                                                                       \
+            v->parent = u->parent;                                                                              \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return t->leftmost;                                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_max_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return t->rightmost;                                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_next_##Name(ztree_node_##Name *n)                                    \
+    {                                                                                                           \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        if (ZTREE__THREAD_LINKS)                                                                                \
+        {                                                                                                       \
+            return ZTREE__THREAD_SUCC(n);                                                                       \
+        }                                                                                                       \
+        if (n->right)                                                                                           \
+        {                                                                                                       \
+            n = n->right;                                                                                       \
+            while (n->left)                                                                                     \
+            {                                                                                                   \
+                n = n->left;                                                                                    \
+            }                                                                                                   \
+            return n;                                                                                           \
+        }                                                                                                       \
+        ztree_node_##Name *p = n->parent;                                                                       \
+        while (p && n == p->right)                                                                              \
+        {                                                                                                       \
+            n = p;                                                                                              \
+            p = p->parent;                                                                                      \
+        }                                                                                                       \
+        return p;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_prev_##Name(ztree_node_##Name *n)                                    \
+    {                                                                                                           \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        if (ZTREE__THREAD_LINKS)                                                                                \
+        {                                                                                                       \
+            return ZTREE__THREAD_PRED(n);                                                                       \
+        }                                                                                                       \
+        if (n->left)                                                                                            \
+        {                                                                                                       \
+            n = n->left;                                                                                        \
+            while (n->right)                                                                                    \
+            {                                                                                                   \
+                n = n->right;                                                                                   \
+            }                                                                                                   \
+            return n;                                                                                           \
+        }                                                                                                       \
+        ztree_node_##Name *p = n->parent;                                                                       \
+        while (p && n == p->left)                                                                               \
+        {                                                                                                       \
+            n = p;                                                                                              \
+            p = p->parent;                                                                                      \
+        }                                                                                                       \
+        return p;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_##Balance##_BALANCE(Name)                                                                   \
+                                                                                                                \
+    static inline void ztree_remove_node_##Name(ztree_##Name *t, ztree_node_##Name *z)                          \
+    {                                                                                                           \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__link_##Name(ztree_##Name *t, ztree_node_##Name *y, ztree_node_##Name *z,          \
+                                          int left)                                                             \
+    {                                                                                                           \
+        /* Hangs a fresh node `z` under leaf parent `y` (NULL for an empty tree) and rebalances. */             \
+        z->parent = y;                                                                                          \
+        ZTREE__##Balance##_FRESH(z);                                                                            \
+        if (!y)                                                                                                 \
+        {                                                                                                       \
+            t->root = t->leftmost = t->rightmost = z;                                                           \
+            ZTREE__THREAD_ROOT(z);                                                                              \
+        }                                                                                                       \
+        else if (left)                                                                                          \
+        {                                                                                                       \
+            y->left = z;                                                                                        \
+            ZTREE__THREAD_LEFT_OF(y, z);                                                                        \
+            if (y == t->leftmost)                                                                               \
+            {                                                                                                   \
+                t->leftmost = z;                                                                                \
+            }                                                                                                   \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            y->right = z;                                                                                       \
+            ZTREE__THREAD_RIGHT_OF(y, z);                                                                       \
+            if (y == t->rightmost)                                                                              \
+            {                                                                                                   \
+                t->rightmost = z;                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        ztree__fix_ins_##Name(t, z);                                                                            \
+        t->size++;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_CLONE(Name, Layout)                                                                         \
+    ZTREE__GENERATE_PARTITION(Name)
+
+// Structure-preserving copy for the parent-linked core. Layout hooks copy what the tree owns besides its
+// nodes (slab, hash index, filter) before the nodes are placed.
+#define ZTREE__GENERATE_CLONE(Name, Layout)                                                                     \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__clone_child_##Name(ztree_##Name *t, ztree_node_##Name *slot,        \
+                                                                ztree_node_##Name *parent,                      \
+                                                                const ztree_node_##Name *from)                  \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+        ZTREE__COPY_NODE(ztree_node_##Name, slot, from);                                                        \
+        slot->parent = parent;                                                                                  \
+        slot->left = slot->right = NULL;                                                                        \
+        ZTREE__##Layout##_ADOPT(Name, t, slot);                                                                 \
+        return slot;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_clone_##Name(ztree_##Name *dst, const ztree_##Name *src)                            \
+    {                                                                                                           \
+        /* Replaces dst with a copy of src of the same shape and balance, built in one pass without comparing   \
+         * a key. The nodes are allocated together; on Z_ENOMEM dst is left empty. dst must not be src. */      \
+        ztree_clear_##Name(dst);                                                                                \
+        if (Z_OK != ZTREE__##Layout##_COPY(Name, dst, src))                                                     \
+        {                                                                                                       \
+            ztree_clear_##Name(dst);                                                                            \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        if (!src->root)                                                                                         \
+        {                                                                                                       \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        ztree_node_##Name *block = (ztree_node_##Name*)ZTREE_MALLOC(src->size * sizeof(ztree_node_##Name));     \
+        if (!block)                                                                                             \
+        {                                                                                                       \
+            ztree_clear_##Name(dst);                                                                            \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        /* Walks src through parent links, so even a degenerate adaptive tree needs no stack, and carries       \
+         * the matching copy along; `from` tells whether s was entered from above, its left or its right. */    \
+        const ztree_node_##Name *s = src->root, *from = NULL;                                                   \
+        ztree_node_##Name *d = ztree__clone_child_##Name(dst, block, NULL, s), *next = block + 1, *prev = NULL; \
+        dst->root = d;                                                                                          \
+        while (s)                                                                                               \
+        {                                                                                                       \
+            int down = (from == s->parent);                                                                     \
+            if (down)                                                                                           \
+            {                                                                                                   \
+                /* Both children are copied shortly; src's nodes are scattered, so start loading them now. */   \
+                ZTREE__PREFETCH(s->left);                                                                       \
+                ZTREE__PREFETCH(s->right);                                                                      \
+            }                                                                                                   \
+            if (down && s->left)                                                                                \
+            {                                                                                                   \
+                d->left = ztree__clone_child_##Name(dst, next++, d, s->left);                                   \
+                from = s;                                                                                       \
+                s = s->left;                                                                                    \
+                d = d->left;                                                                                    \
+                continue;                                                                                       \
+            }                                                                                                   \
+            if (down || from == s->left)                                                                        \
+            {                                                                                                   \
+                if (prev)                                                                                       \
+                {                                                                                               \
+                    ZTREE__THREAD_CHAIN(prev, d);                                                               \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    ZTREE__THREAD_ROOT(d);                                                                      \
+                    dst->leftmost = d;                                                                          \
+                }                                                                                               \
+                prev = d;                                                                                       \
+                if (s->right)                                                                                   \
+                {                                                                                               \
+                    d->right = ztree__clone_child_##Name(dst, next++, d, s->right);                             \
+                    from = s;                                                                                   \
+                    s = s->right;                                                                               \
+                    d = d->right;                                                                               \
+                    continue;                                                                                   \
+                }                                                                                               \
+            }                                                                                                   \
+            from = s;                                                                                           \
+            s = s->parent;                                                                                      \
+            d = d->parent;                                                                                      \
+        }                                                                                                       \
+        ZTREE__THREAD_CHAIN(prev, (ztree_node_##Name*)NULL);                                                    \
+        dst->rightmost = prev;                                                                                  \
+        dst->size = dst->block_live = src->size;                                                                \
+        dst->block = block;                                                                                     \
+        dst->block_end = block + src->size;                                                                     \
+        return Z_OK;                                                                                            \
+    }
+
+// Splits a parent-linked tree into contiguous in-order ranges of about equal size. The nodes down to a fixed
+// depth become the pieces: each one above it counts as itself and each subtree hanging below it is weighed
+// with Knuth's random-path estimator, so on a balanced tree the cost depends on k and the height, not on the
+// tree's size. Subtrees heavier than a range are split further, which costs up to O(n) on a degenerate tree.
+#define ZTREE__GENERATE_PARTITION(Name)                                                                         \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name *first, *end;                                                                         \
+    } ztree_range_##Name;                                                                                       \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_range_##Name *ranges;                                                                             \
+        size_t k, emitted, total, seen, limit;                                                                  \
+        uint64_t seed;                                                                                          \
+    } ztree__partition_##Name;                                                                                  \
+                                                                                                                \
+    static inline size_t ztree__estimate_##Name(ztree_node_##Name *n, uint64_t *seed)                           \
+    {                                                                                                           \
+        /* Each random descent sums the widths it would see if every level branched like the path taken;        \
+         * the average over a few descents is an unbiased estimate of the node count. */                        \
+        size_t sum = 0;                                                                                         \
+        for (int s = 0; s < ZTREE_PARTITION_SAMPLES; s++)                                                       \
+        {                                                                                                       \
+            size_t width = 1;                                                                                   \
+            for (ztree_node_##Name *x = n; x;)                                                                  \
+            {                                                                                                   \
+                sum += width;                                                                                   \
+                if (x->left && x->right)                                                                        \
+                {                                                                                               \
+                    width *= 2;                                                                                 \
+                    *seed ^= *seed << 13;                                                                       \
+                    *seed ^= *seed >> 7;                                                                        \
+                    *seed ^= *seed << 17;                                                                       \
+                    x = (*seed & 1) ? x->left : x->right;                                                       \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    x = x->left ? x->left : x->right;                                                           \
+                }                                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        return sum / ZTREE_PARTITION_SAMPLES;                                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__partition_piece_##Name(ztree__partition_##Name *p, ztree_node_##Name *first,      \
+                                                     size_t weight)                                             \
+    {                                                                                                           \
+        /* The first pass only totals the weights; the second starts a range at every piece that reaches the    \
+         * next k-th of the total, so a range is never empty. */                                                \
+        if (p->ranges && p->emitted < p->k && p->seen * p->k >= p->emitted * p->total)                          \
+        {                                                                                                       \
+            if (p->emitted)                                                                                     \
+            {                                                                                                   \
+                p->ranges[p->emitted - 1].end = first;                                                          \
+            }                                                                                                   \
+            p->ranges[p->emitted++].first = first;                                                              \
+        }                                                                                                       \
+        p->seen += weight;                                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__partition_split_##Name(ztree__partition_##Name *p, ztree_node_##Name *top,        \
+                                                     size_t weight)                                             \
+    {                                                                                                           \
+        /* A subtree heavier than one range is opened up: its root counts as itself and each child is weighed   \
+         * in turn, so a degenerate tree still yields about k ranges. An only child weighs its parent less one  \
+         * without another descent, which keeps a long spine O(n) rather than O(n^2). The in-order walk climbs  \
+         * parent links instead of recursing, so spines of any length fit on the stack. */                      \
+        ztree_node_##Name *x = top;                                                                             \
+        for (;;)                                                                                                \
+        {                                                                                                       \
+            if (weight > p->limit && (x->left || x->right))                                                     \
+            {                                                                                                   \
+                if (x->left)                                                                                    \
+                {                                                                                               \
+                    weight = x->right ? ztree__estimate_##Name(x->left, &p->seed) : weight - 1;                 \
+                    x = x->left;                                                                                \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    ztree__partition_piece_##Name(p, x, 1);                                                     \
+                    weight--;                                                                                   \
+                    x = x->right;                                                                               \
+                }                                                                                               \
+                continue;                                                                                       \
+            }                                                                                                   \
+            ztree_node_##Name *first = x;                                                                       \
+            while (first->left)                                                                                 \
+            {                                                                                                   \
+                first = first->left;                                                                            \
+            }                                                                                                   \
+            ztree__partition_piece_##Name(p, first, weight);                                                    \
+            for (;;)                                                                                            \
+            {                                                                                                   \
+                if (x == top)                                                                                   \
+                {                                                                                               \
+                    return;                                                                                     \
+                }                                                                                               \
+                ztree_node_##Name *up = x->parent;                                                              \
+                if (x == up->left)                                                                              \
+                {                                                                                               \
+                    ztree__partition_piece_##Name(p, up, 1);                                                    \
+                    if (up->right)                                                                              \
+                    {                                                                                           \
+                        x = up->right;                                                                          \
+                        weight = ztree__estimate_##Name(x, &p->seed);                                           \
+                        break;                                                                                  \
+                    }                                                                                           \
+                }                                                                                               \
+                x = up;                                                                                         \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__partition_walk_##Name(ztree__partition_##Name *p, ztree_node_##Name *x,           \
+                                                    int depth)                                                  \
+    {                                                                                                           \
+        if (!x)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        if (0 == depth)                                                                                         \
+        {                                                                                                       \
+            ztree__partition_split_##Name(p, x, ztree__estimate_##Name(x, &p->seed));                           \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__partition_walk_##Name(p, x->left, depth - 1);                                                    \
+        ztree__partition_piece_##Name(p, x, 1);                                                                 \
+        ztree__partition_walk_##Name(p, x->right, depth - 1);                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree_partition_##Name(ztree_##Name *t, size_t k, ztree_range_##Name *ranges)          \
+    {                                                                                                           \
+        /* Fills up to k ranges [first, end) that cover the tree in order and returns how many it used: k       \
+         * unless the tree has fewer than k nodes, or, rarely, the estimates leave some piece heavier than a    \
+         * range. Walk one with ztree_next until it reaches `end`. */                                           \
+        ztree__partition_##Name p;                                                                              \
+        int depth = 3;                                                                                          \
+        while (depth < 30 && ((size_t)1 << depth) < 8 * k)                                                      \
+        {                                                                                                       \
+            depth++;                                                                                            \
+        }                                                                                                       \
+        if (0 == k || !t->root)                                                                                 \
+        {                                                                                                       \
+            return 0;                                                                                           \
+        }                                                                                                       \
+        p.ranges = NULL;                                                                                        \
+        p.k = k;                                                                                                \
+        p.emitted = p.total = p.seen = 0;                                                                       \
+        p.limit = t->size / k;                                                                                  \
+        p.seed = 0x9E3779B97F4A7C15ull;                                                                         \
+        ztree__partition_walk_##Name(&p, t->root, depth);                                                       \
+        /* Same seed, same estimates: the second pass sees exactly the weights the first one summed. */         \
+        p.ranges = ranges;                                                                                      \
+        p.total = p.seen;                                                                                       \
+        p.seen = 0;                                                                                             \
+        p.seed = 0x9E3779B97F4A7C15ull;                                                                         \
+        ztree__partition_walk_##Name(&p, t->root, depth);                                                       \
+        ranges[p.emitted - 1].end = NULL;                                                                       \
+        return p.emitted;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PARALLEL(Name)
+
+#define ZTREE__GENERATE_PARALLEL_FOREACH(Name)                                                                  \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_range_##Name *ranges;                                                                             \
+        size_t nranges, next;                                                                                   \
+        void (*fn)(ztree_node_##Name *, void *);                                                                \
+        void *ctx;                                                                                              \
+    } ztree__pool_##Name;                                                                                       \
+                                                                                                                \
+    static inline void *ztree__parallel_worker_##Name(void *arg)                                                \
+    {                                                                                                           \
+        /* Ranges are handed out one at a time, so a thread that drew cheap entries simply takes more. */       \
+        ztree__pool_##Name *p = (ztree__pool_##Name*)arg;                                                       \
+        size_t i;                                                                                               \
+        while ((i = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED)) < p->nranges)                            \
+        {                                                                                                       \
+            for (ztree_node_##Name *n = p->ranges[i].first; n != p->ranges[i].end; n = ztree_next_##Name(n))    \
+            {                                                                                                   \
+                p->fn(n, p->ctx);                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_parallel_foreach_##Name(ztree_##Name *t, void (*fn)(ztree_node_##Name *, void *),   \
+                                                    void *ctx, size_t nthreads)                                 \
+    {                                                                                                           \
+        /* Calls fn once per node on up to nthreads threads, the caller included; the order across threads is   \
+         * unspecified. The tree must not change until this returns. Falls back to fewer threads, down to a     \
+         * plain walk, when memory or threads run out; Z_EINVAL if nthreads is 0. */                            \
+        if (0 == nthreads)                                                                                      \
+        {                                                                                                       \
+            return Z_EINVAL;                                                                                    \
+        }                                                                                                       \
+        ztree__pool_##Name pool;                                                                                \
+        size_t k = nthreads * ZTREE_PARALLEL_GRAIN;                                                             \
+        pthread_t *threads = NULL;                                                                              \
+        pool.ranges = (ztree_range_##Name*)ZTREE_MALLOC(k * sizeof(ztree_range_##Name));                        \
+        if (pool.ranges && nthreads > 1)                                                                        \
+        {                                                                                                       \
+            threads = (pthread_t*)ZTREE_MALLOC((nthreads - 1) * sizeof(pthread_t));                             \
+        }                                                                                                       \
+        if (!pool.ranges)                                                                                       \
+        {                                                                                                       \
+            for (ztree_node_##Name *n = t->leftmost; n; n = ztree_next_##Name(n))                               \
+            {                                                                                                   \
+                fn(n, ctx);                                                                                     \
+            }                                                                                                   \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        pool.nranges = ztree_partition_##Name(t, k, pool.ranges);                                               \
+        pool.next = 0;                                                                                          \
+        pool.fn = fn;                                                                                           \
+        pool.ctx = ctx;                                                                                         \
+        size_t started = 0;                                                                                     \
+        while (threads && started + 1 < nthreads && started + 1 < pool.nranges &&                               \
+               0 == pthread_create(&threads[started], NULL, ztree__parallel_worker_##Name, &pool))              \
+        {                                                                                                       \
+            started++;                                                                                          \
+        }                                                                                                       \
+        ztree__parallel_worker_##Name(&pool);                                                                   \
+        for (size_t i = 0; i < started; i++)                                                                    \
+        {                                                                                                       \
+            pthread_join(threads[i], NULL);                                                                     \
+        }                                                                                                       \
+        ZTREE_FREE(threads);                                                                                    \
+        ZTREE_FREE(pool.ranges);                                                                                \
+        return Z_OK;                                                                                            \
+    }
+
+// Lookups for trees that hold each key at most once.
+#define ZTREE__GENERATE_UNIQUE_SEARCH(Key, Name, Cmp)                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return curr;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        } return res;                                                                                           \
+    }
+
+// Lookups for access-adaptive maps: the same API as ZTREE__GENERATE_UNIQUE_SEARCH, but finds may splay.
+#define ZTREE__GENERATE_ADAPTIVE_SEARCH(Key, Name, Cmp)                                                         \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        /* Every ZTREE_SPLAY_HITS-th hit on a node, and any hit found too deep, splays it to the root. */       \
+        ztree_node_##Name *x = t->root;                                                                         \
+        size_t depth = 1;                                                                                       \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                if (x != t->root && (++x->hits >= ZTREE_SPLAY_HITS || ztree__too_deep_##Name(t, depth)))        \
+                {                                                                                               \
+                    ztree__splay_##Name(t, x);                                                                  \
+                }                                                                                               \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+            depth++;                                                                                            \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = t->root;                                                                         \
+        while (z)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &z->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                ztree__unlink_##Name(t, z);                                                                     \
+                ztree__drop_##Name(t, z);                                                                       \
+                return;                                                                                         \
+            }                                                                                                   \
+            z = (cmp < 0) ? z->left : z->right;                                                                 \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        /* Bounds do not count as hits, but a search that ran too deep still splays its result. */              \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        size_t depth = 0;                                                                                       \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            depth++;                                                                                            \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                break;                                                                                          \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        if (res && res != t->root && ztree__too_deep_##Name(t, depth))                                          \
+        {                                                                                                       \
+            ztree__splay_##Name(t, res);                                                                        \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }
+
+#define ZTREE__GENERATE_PAIR_NODE(Key, Val, Name, Balance)                                                      \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ZTREE__##Balance##_NODE_FIELDS                                                                          \
+        struct ztree_node_##Name *parent, *left, *right;                                                        \
+        ZTREE__THREAD_FIELDS(ztree_node_##Name)                                                                 \
+    } ztree_node_##Name;
+
+// Key/value extraction shared by maps and multimaps.
+#define ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, Find)                                                          \
+                                                                                                                \
+    static inline Val *ztree_value_##Name(ztree_##Name *t, ztree_node_##Name *n)                                \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+        return &n->value;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__new_##Name(Key k, Val v)                                            \
+    {                                                                                                           \
+        ZTREE_NEW_NODE(ztree_node_##Name, n);                                                                   \
+        if(n)                                                                                                   \
+        {                                                                                                       \
+            n->key = k;                                                                                         \
+            n->value = v;                                                                                       \
+            n->parent = n->left = n->right = NULL;                                                              \
+        }                                                                                                       \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        ztree_node_##Name *z = Find(t, k);                                                                      \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOTFOUND;                                                                                 \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = z->value;                                                                                \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__pop_##Name(ztree_##Name *t, ztree_node_##Name *z, Key *out_key, Val *out_val)      \
+    {                                                                                                           \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_EEMPTY;                                                                                    \
+        }                                                                                                       \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = z->key;                                                                                  \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = z->value;                                                                                \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, t->leftmost, out_key, out_val);                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, t->rightmost, out_key, out_val);                                            \
+    }
+
+// Finger cursor for parent-linked maps: it holds one node and searches outward from it through parent links.
+#define ZTREE__GENERATE_FINGER_CURSOR(Key, Val, Name, Cmp)                                                      \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name *tree;                                                                                     \
+        ztree_node_##Name *node;                                                                                \
+    } ztree_cursor_##Name;                                                                                      \
+                                                                                                                \
+    static inline ztree_cursor_##Name ztree_cursor_init_##Name(ztree_##Name *t)                                 \
+    {                                                                                                           \
+        ztree_cursor_##Name c;                                                                                  \
+        c.tree = t;                                                                                             \
+        c.node = NULL;                                                                                          \
+        return c;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_get_##Name(ztree_cursor_##Name *c)                            \
+    {                                                                                                           \
+        return c->node;                                                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_first_##Name(ztree_cursor_##Name *c)                          \
+    {                                                                                                           \
+        return c->node = c->tree->leftmost;                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_last_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        return c->node = c->tree->rightmost;                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_next_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        return c->node = c->node ? ztree_next_##Name(c->node) : NULL;                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_prev_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        return c->node = c->node ? ztree_prev_##Name(c->node) : c->tree->rightmost;                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__finger_##Name(ztree_cursor_##Name *c, Key *k)                       \
+    {                                                                                                           \
+        /* Climb from the finger to the first ancestor whose subtree must contain k's position: one reached     \
+           through a left link when k lies to the right (and not past that ancestor), or mirrored. That is the  \
+           lowest common ancestor, so keys near the finger but across a high ancestor still climb that far. */  \
+        ztree_node_##Name *x = c->node;                                                                         \
+        if (!x)                                                                                                 \
+        {                                                                                                       \
+            return c->tree->root;                                                                               \
+        }                                                                                                       \
+        int dir = Cmp(k, &x->key);                                                                              \
+        if (0 == dir)                                                                                           \
+        {                                                                                                       \
+            return x;                                                                                           \
+        }                                                                                                       \
+        for (ztree_node_##Name *p = x->parent; p; x = p, p = p->parent)                                         \
+        {                                                                                                       \
+            if (dir > 0 && x == p->left && Cmp(k, &p->key) <= 0)                                                \
+            {                                                                                                   \
+                return p;                                                                                       \
+            }                                                                                                   \
+            if (dir < 0 && x == p->right && Cmp(k, &p->key) >= 0)                                               \
+            {                                                                                                   \
+                return p;                                                                                       \
+            }                                                                                                   \
+        }                                                                                                       \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_seek_##Name(ztree_cursor_##Name *c, Key k)                    \
+    {                                                                                                           \
+        ztree_node_##Name *curr = ztree__finger_##Name(c, &k), *res = NULL;                                     \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                break;                                                                                          \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        return c->node = res;                                                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_find_##Name(ztree_cursor_##Name *c, Key k)                    \
+    {                                                                                                           \
+        ztree_node_##Name *n = ztree_cursor_seek_##Name(c, k);                                                  \
+        return (n && 0 == Cmp(&k, &n->key)) ? n : NULL;                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_cursor_insert_##Name(ztree_cursor_##Name *c, Key k, Val v)                          \
+    {                                                                                                           \
+        ztree_node_##Name *y = NULL, *x = ztree__finger_##Name(c, &k);                                          \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                c->node = x;                                                                                    \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(c->tree, y, z, cmp < 0);                                                             \
+        c->node = z;                                                                                            \
+        return Z_OK;                                                                                            \
+    }
+
+// Node handles for parent-linked trees whose nodes carry everything they hold: an entry moves between trees
+// of the same type by relinking its node, with no allocation and no copy of the key or value.
+#define ZTREE__GENERATE_NODE_HANDLES(Key, Name, Cmp, Multi)                                                     \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_extract_node_##Name(ztree_##Name *t, ztree_node_##Name *z)           \
+    {                                                                                                           \
+        /* Unlinks z and hands it to the caller, who may link it into any tree of this type with                \
+         * ztree_insert_node or release it with ztree_free_node. A node in a clone's shared block first moves   \
+         * to an allocation of its own; if that fails, z stays in the tree and the result is NULL. */           \
+        ztree_node_##Name *n = z;                                                                               \
+        if (ztree__in_block_##Name(t, z))                                                                       \
+        {                                                                                                       \
+            ZTREE_NEW_NODE(ztree_node_##Name, own);                                                             \
+            if (!own)                                                                                           \
+            {                                                                                                   \
+                return NULL;                                                                                    \
+            }                                                                                                   \
+            n = own;                                                                                            \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        if (n != z)                                                                                             \
+        {                                                                                                       \
+            *n = *z;                                                                                            \
+            ztree__release_##Name(t, z);                                                                        \
+        }                                                                                                       \
+        n->parent = n->left = n->right = NULL;                                                                  \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_extract_##Name(ztree_##Name *t, Key k)                               \
+    {                                                                                                           \
+        /* Detaches the entry for k (the first one, if keys repeat); NULL if there is none. */                  \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        return z ? ztree_extract_node_##Name(t, z) : NULL;                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_node_##Name(ztree_##Name *t, ztree_node_##Name *z)                           \
+    {                                                                                                           \
+        /* Links a detached node at its key's place without allocating or copying. Where keys are unique and    \
+         * k is already present, returns Z_FOUND and the node stays with the caller; repeated keys go last. */  \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&z->key, &x->key);                                                                        \
+            if (!(Multi) && 0 == cmp)                                                                           \
+            {                                                                                                   \
+                return Z_FOUND;                                                                                 \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        z->left = z->right = NULL;                                                                              \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_free_node_##Name(ztree_node_##Name *n)                                             \
+    {                                                                                                           \
+        ZTREE_FREE_NODE(n);                                                                                     \
+    }
+
+#define ZTREE__GENERATE_MAP_IMPL(Key, Val, Name, Cmp, Balance)                                                  \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_NODE(Key, Val, Name, Balance)                                                          \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ztree_op_kind op;                                                                                       \
+        int status;                                                                                             \
+    } ztree_op_##Name;                                                                                          \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, PLAIN, Balance)                                                 \
+                                                                                                                \
+    ZTREE__##Balance##_SEARCH(Key, Name, Cmp)                                                                   \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, ztree_find_##Name)                                                 \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_op_##Name **ztree__sort_ops_##Name(ztree_op_##Name **a, ztree_op_##Name **tmp,          \
+                                                           size_t n)                                            \
+    {                                                                                                           \
+        /* Stable bottom-up merge sort: equal keys keep their submission order. */                              \
+        const size_t run = 16;                                                                                  \
+        size_t sorted = 1;                                                                                      \
+        while (sorted < n && Cmp(&a[sorted]->key, &a[sorted - 1]->key) >= 0)                                    \
+        {                                                                                                       \
+            sorted++;                                                                                           \
+        }                                                                                                       \
+        if (sorted >= n)                                                                                        \
+        {                                                                                                       \
+            return a;                                                                                           \
+        }                                                                                                       \
+        for (size_t lo = 0; lo < n; lo += run)                                                                  \
+        {                                                                                                       \
+            size_t hi = (lo + run < n) ? lo + run : n;                                                          \
+            for (size_t i = lo + 1; i < hi; i++)                                                                \
+            {                                                                                                   \
+                ztree_op_##Name *x = a[i];                                                                      \
+                size_t j = i;                                                                                   \
+                while (j > lo && Cmp(&x->key, &a[j - 1]->key) < 0)                                              \
+                {                                                                                               \
+                    a[j] = a[j - 1];                                                                            \
+                    j--;                                                                                        \
+                }                                                                                               \
+                a[j] = x;                                                                                       \
+            }                                                                                                   \
+        }                                                                                                       \
+        for (size_t width = run; width < n; width *= 2)                                                         \
+        {                                                                                                       \
+            for (size_t lo = 0; lo < n; lo += 2 * width)                                                        \
+            {                                                                                                   \
+                size_t mid = (lo + width < n) ? lo + width : n;                                                 \
+                size_t hi = (mid + width < n) ? mid + width : n;                                                \
+                size_t i = lo, j = mid, k = lo;                                                                 \
+                while (i < mid && j < hi)                                                                       \
+                {                                                                                               \
+                    tmp[k++] = (Cmp(&a[j]->key, &a[i]->key) < 0) ? a[j++] : a[i++];                             \
+                }                                                                                               \
+                while (i < mid)                                                                                 \
+                {                                                                                               \
+                    tmp[k++] = a[i++];                                                                          \
+                }                                                                                               \
+                while (j < hi)                                                                                  \
+                {                                                                                               \
+                    tmp[k++] = a[j++];                                                                          \
+                }                                                                                               \
+            }                                                                                                   \
+            ztree_op_##Name **swap = a;                                                                         \
+            a = tmp;                                                                                            \
+            tmp = swap;                                                                                         \
+        }                                                                                                       \
+        return a;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__apply_op_##Name(ztree_##Name *t, ztree_op_##Name *op)                              \
+    {                                                                                                           \
+        size_t before = t->size;                                                                                \
+        if (ZTREE_OP_REMOVE == op->op)                                                                          \
+        {                                                                                                       \
+            ztree_remove_##Name(t, op->key);                                                                    \
+            op->status = (t->size < before) ? Z_OK : Z_ENOTFOUND;                                               \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        op->status = ztree_insert_##Name(t, op->key, op->value);                                                \
+        if (Z_OK == op->status && t->size == before)                                                            \
+        {                                                                                                       \
+            op->status = Z_FOUND;                                                                               \
+        }                                                                                                       \
+        return (Z_ENOMEM == op->status) ? Z_ENOMEM : Z_OK;                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__merge_batch_##Name(ztree_##Name *t, ztree_op_##Name **order, size_t n)             \
+    {                                                                                                           \
+        /* One in-order walk merges ops into the node sequence. Visited nodes are never read through `left`     \
+           again, so it chains the output (and the dead nodes) until the tree is rebuilt without fixups. */     \
+        int rc = Z_OK;                                                                                          \
+        ztree_node_##Name *in = ztree_min_##Name(t);                                                            \
+        ztree_node_##Name *out = NULL, **tail = &out, *dead = NULL;                                             \
+        size_t count = 0, i = 0;                                                                                \
+        while (i < n)                                                                                           \
+        {                                                                                                       \
+            ztree_op_##Name *op = order[i];                                                                     \
+            int cmp = 1;                                                                                        \
+            while (in && (cmp = Cmp(&in->key, &op->key)) < 0)                                                   \
+            {                                                                                                   \
+                ztree_node_##Name *next = ztree_next_##Name(in);                                                \
+                *tail = in;                                                                                     \
+                tail = &in->left;                                                                               \
+                in = next;                                                                                      \
+                count++;                                                                                        \
+            }                                                                                                   \
+            ztree_node_##Name *cur = NULL;                                                                      \
+            if (in && 0 == cmp)                                                                                 \
+            {                                                                                                   \
+                cur = in;                                                                                       \
+                in = ztree_next_##Name(in);                                                                     \
+            }                                                                                                   \
+            do                                                                                                  \
+            {                                                                                                   \
+                op = order[i++];                                                                                \
+                if (ZTREE_OP_REMOVE == op->op)                                                                  \
+                {                                                                                               \
+                    op->status = cur ? Z_OK : Z_ENOTFOUND;                                                      \
+                    if (cur)                                                                                    \
+                    {                                                                                           \
+                        cur->left = dead;                                                                       \
+                        dead = cur;                                                                             \
+                        cur = NULL;                                                                             \
+                    }                                                                                           \
+                }                                                                                               \
+                else if (cur)                                                                                   \
+                {                                                                                               \
+                    cur->value = op->value;                                                                     \
+                    op->status = Z_FOUND;                                                                       \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    cur = ztree__new_##Name(op->key, op->value);                                                \
+                    op->status = cur ? Z_OK : Z_ENOMEM;                                                         \
+                    rc = cur ? rc : Z_ENOMEM;                                                                   \
+                }                                                                                               \
+            } while (i < n && 0 == Cmp(&order[i]->key, &op->key));                                              \
+            if (cur)                                                                                            \
+            {                                                                                                   \
+                *tail = cur;                                                                                    \
+                tail = &cur->left;                                                                              \
+                count++;                                                                                        \
+            }                                                                                                   \
+        }                                                                                                       \
+        while (in)                                                                                              \
+        {                                                                                                       \
+            ztree_node_##Name *next = ztree_next_##Name(in);                                                    \
+            *tail = in;                                                                                         \
+            tail = &in->left;                                                                                   \
+            in = next;                                                                                          \
+            count++;                                                                                            \
+        }                                                                                                       \
+        *tail = NULL;                                                                                           \
+        while (dead)                                                                                            \
+        {                                                                                                       \
+            ztree_node_##Name *next = dead->left;                                                               \
+            ztree__drop_##Name(t, dead);                                                                        \
+            dead = next;                                                                                        \
+        }                                                                                                       \
+        ztree__rebuild_##Name(t, out, count);                                                                   \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_apply_batch_##Name(ztree_##Name *t, ztree_op_##Name *ops, size_t n)                 \
+    {                                                                                                           \
+        int rc = Z_OK;                                                                                          \
+        ztree_op_##Name **order = (ztree_op_##Name **)ZTREE_MALLOC(2 * n * sizeof(*order));                     \
+        if (!order)                                                                                             \
+        {                                                                                                       \
+            for (size_t i = 0; i < n; i++)                                                                      \
+            {                                                                                                   \
+                rc = (Z_OK == ztree__apply_op_##Name(t, &ops[i])) ? rc : Z_ENOMEM;                              \
+            }                                                                                                   \
+            return rc;                                                                                          \
+        }                                                                                                       \
+        for (size_t i = 0; i < n; i++)                                                                          \
+        {                                                                                                       \
+            order[i] = &ops[i];                                                                                 \
+        }                                                                                                       \
+        ztree_op_##Name **sorted = ztree__sort_ops_##Name(order, order + n, n);                                 \
+        if (n * ZTREE_BATCH_REBUILD_RATIO >= t->size)                                                           \
+        {                                                                                                       \
+            rc = ztree__merge_batch_##Name(t, sorted, n);                                                       \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            /* Small batch: sorted order keeps consecutive descents on the same warm path. */                   \
+            for (size_t i = 0; i < n; i++)                                                                      \
+            {                                                                                                   \
+                rc = (Z_OK == ztree__apply_op_##Name(t, sorted[i])) ? rc : Z_ENOMEM;                            \
+            }                                                                                                   \
+        }                                                                                                       \
+        ZTREE_FREE(order);                                                                                      \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_FINGER_CURSOR(Key, Val, Name, Cmp)                                                          \
+    ZTREE__GENERATE_NODE_HANDLES(Key, Name, Cmp, 0)
+
+#define ZTREE_GENERATE_IMPL(Key, Val, Name, Cmp)     ZTREE__GENERATE_MAP_IMPL(Key, Val, Name, Cmp, RB)
+
+// Same map API on AVL balancing: shallower trees for read-heavy maps, slightly more rotations on writes.
+#define ZTREE_GENERATE_AVL_IMPL(Key, Val, Name, Cmp) ZTREE__GENERATE_MAP_IMPL(Key, Val, Name, Cmp, AVL)
+
+// Same map API on splay-based access-adaptive balancing, for skewed lookups; ztree_find may rotate the tree.
+#define ZTREE_GENERATE_ADAPTIVE_IMPL(Key, Val, Name, Cmp) ZTREE__GENERATE_MAP_IMPL(Key, Val, Name, Cmp, SPLAY)
+
+// Map that keeps up to N entries in a sorted array inside the struct and moves them into a red-black tree
+// (the `tree` member) once an insert would exceed N. Small maps cost no heap nodes and no pointer chasing;
+// nodes are array slots until then, so an insert invalidates node pointers while the map is small. Removals
+// keep the following nodes in place, and a map that has grown stays a tree until it is emptied or cleared.
+#define ZTREE_GENERATE_SMALL_IMPL(Key, Val, Name, Cmp, N)                                                       \
+                                                                                                                \
+    ZTREE__GENERATE_MAP_IMPL(Key, Val, Name##_tree, Cmp, RB)                                                    \
+                                                                                                                \
+    typedef ztree_node_##Name##_tree ztree_node_##Name;                                                         \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name##_tree tree;                                                                               \
+        size_t size;                                                                                            \
+        ztree_node_##Name small[N];                                                                             \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t;                                                                                         \
+        t.tree = ztree_init_##Name##_tree();                                                                    \
+        t.size = 0;                                                                                             \
+        return t;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__small_base_##Name(ztree_##Name *t)                                  \
+    {                                                                                                           \
+        /* Inline entries are packed against the end of `small`, so removals never move their successors. */    \
+        return t->small + ((N) - t->size);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__small_link_##Name(ztree_##Name *t)                                                \
+    {                                                                                                           \
+        /* Chains the entries as a right spine, which ztree_next / ztree_prev walk like any other tree. */      \
+        ztree_node_##Name *a = ztree__small_base_##Name(t);                                                     \
+        for (size_t i = 0; i < t->size; i++)                                                                    \
+        {                                                                                                       \
+            a[i].parent = i ? &a[i - 1] : NULL;                                                                 \
+            a[i].left = NULL;                                                                                   \
+            a[i].right = (i + 1 < t->size) ? &a[i + 1] : NULL;                                                  \
+            ZTREE__THREAD_ROOT(&a[i]);                                                                          \
+            if (i)                                                                                              \
+            {                                                                                                   \
+                ZTREE__THREAD_CHAIN(&a[i - 1], &a[i]);                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__small_entries_##Name(ztree_##Name *t)                               \
+    {                                                                                                           \
+        /* The spine points into the struct itself; relink it if the map was copied or moved since. */          \
+        ztree_node_##Name *a = ztree__small_base_##Name(t);                                                     \
+        if (t->size > 1 && a->right != a + 1)                                                                   \
+        {                                                                                                       \
+            ztree__small_link_##Name(t);                                                                        \
+        }                                                                                                       \
+        return a;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree__small_search_##Name(ztree_##Name *t, const Key *k, int *found)                  \
+    {                                                                                                           \
+        /* Counts the smaller keys without branching on them, which the compiler can unroll or vectorize. */    \
+        ztree_node_##Name *a = ztree__small_entries_##Name(t);                                                  \
+        size_t i = 0;                                                                                           \
+        for (size_t j = 0; j < t->size; j++)                                                                    \
+        {                                                                                                       \
+            i += Cmp(&a[j].key, k) < 0;                                                                         \
+        }                                                                                                       \
+        *found = (i < t->size && 0 == Cmp(&a[i].key, k));                                                       \
+        return i;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        ztree_clear_##Name##_tree(&t->tree);                                                                    \
+        t->size = 0;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            return ztree_find_##Name##_tree(&t->tree, k);                                                       \
+        }                                                                                                       \
+        int found;                                                                                              \
+        size_t i = ztree__small_search_##Name(t, &k, &found);                                                   \
+        return found ? ztree__small_base_##Name(t) + i : NULL;                                                  \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            return ztree_lower_bound_##Name##_tree(&t->tree, k);                                                \
+        }                                                                                                       \
+        int found;                                                                                              \
+        size_t i = ztree__small_search_##Name(t, &k, &found);                                                   \
+        return (i < t->size) ? ztree__small_base_##Name(t) + i : NULL;                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            return t->tree.leftmost;                                                                            \
+        }                                                                                                       \
+        return t->size ? ztree__small_entries_##Name(t) : NULL;                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_max_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            return t->tree.rightmost;                                                                           \
+        }                                                                                                       \
+        return t->size ? ztree__small_entries_##Name(t) + (t->size - 1) : NULL;                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_next_##Name(ztree_node_##Name *n)                                    \
+    {                                                                                                           \
+        return ztree_next_##Name##_tree(n);                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_prev_##Name(ztree_node_##Name *n)                                    \
+    {                                                                                                           \
+        return ztree_prev_##Name##_tree(n);                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline Val *ztree_value_##Name(ztree_##Name *t, ztree_node_##Name *n)                                \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+        return &n->value;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__small_grow_##Name(ztree_##Name *t, size_t pos, Key k, Val v)                       \
+    {                                                                                                           \
+        /* Moves the full array and the new entry into heap nodes, then builds a balanced tree in one pass. */  \
+        ztree_node_##Name *a = ztree__small_base_##Name(t);                                                     \
+        ztree_node_##Name *list = NULL, **tail = &list;                                                         \
+        for (size_t i = 0; i <= t->size; i++)                                                                   \
+        {                                                                                                       \
+            ztree_node_##Name *n = (i == pos) ? ztree__new_##Name##_tree(k, v)                                  \
+                                              : ztree__new_##Name##_tree(a->key, a->value);                     \
+            a += (i != pos);                                                                                    \
+            if (!n)                                                                                             \
+            {                                                                                                   \
+                while (list)                                                                                    \
+                {                                                                                               \
+                    ztree_node_##Name *next = list->left;                                                       \
+                    ZTREE_FREE_NODE(list);                                                                      \
+                    list = next;                                                                                \
+                }                                                                                               \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            *tail = n;                                                                                          \
+            tail = &n->left;                                                                                    \
+        }                                                                                                       \
+        *tail = NULL;                                                                                           \
+        ztree__rebuild_##Name##_tree(&t->tree, list, t->size + 1);                                              \
+        t->size = t->tree.size;                                                                                 \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            int rc = ztree_insert_##Name##_tree(&t->tree, k, v);                                                \
+            t->size = t->tree.size;                                                                             \
+            return rc;                                                                                          \
+        }                                                                                                       \
+        int found;                                                                                              \
+        size_t pos = ztree__small_search_##Name(t, &k, &found);                                                 \
+        ztree_node_##Name *a = ztree__small_base_##Name(t);                                                     \
+        if (found)                                                                                              \
+        {                                                                                                       \
+            a[pos].value = v;                                                                                   \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        if ((N) == t->size)                                                                                     \
+        {                                                                                                       \
+            return ztree__small_grow_##Name(t, pos, k, v);                                                      \
+        }                                                                                                       \
+        memmove(a - 1, a, pos * sizeof(*a));                                                                    \
+        a[pos - 1].key = k;                                                                                     \
+        a[pos - 1].value = v;                                                                                   \
+        t->size++;                                                                                              \
+        ztree__small_link_##Name(t);                                                                            \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_node_##Name(ztree_##Name *t, ztree_node_##Name *n)                          \
+    {                                                                                                           \
+        if (t->tree.root)                                                                                       \
+        {                                                                                                       \
+            ztree_remove_node_##Name##_tree(&t->tree, n);                                                       \
+            t->size = t->tree.size;                                                                             \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree_node_##Name *a = ztree__small_base_##Name(t);                                                     \
+        memmove(a + 1, a, (size_t)(n - a) * sizeof(*a));                                                        \
+        t->size--;                                                                                              \
+        ztree__small_link_##Name(t);                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *n = ztree_find_##Name(t, k);                                                         \
+        if (n)                                                                                                  \
+        {                                                                                                       \
+            ztree_remove_node_##Name(t, n);                                                                     \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        ztree_node_##Name *n = ztree_find_##Name(t, k);                                                         \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOTFOUND;                                                                                 \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = n->value;                                                                                \
+        }                                                                                                       \
+        ztree_remove_node_##Name(t, n);                                                                         \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__small_pop_##Name(ztree_##Name *t, ztree_node_##Name *n, Key *out_key,              \
+                                              Val *out_val)                                                     \
+    {                                                                                                           \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return Z_EEMPTY;                                                                                    \
+        }                                                                                                       \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = n->key;                                                                                  \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = n->value;                                                                                \
+        }                                                                                                       \
+        ztree_remove_node_##Name(t, n);                                                                         \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__small_pop_##Name(t, ztree_min_##Name(t), out_key, out_val);                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__small_pop_##Name(t, ztree_max_##Name(t), out_key, out_val);                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_clone_##Name(ztree_##Name *dst, const ztree_##Name *src)                            \
+    {                                                                                                           \
+        ztree_clear_##Name(dst);                                                                                \
+        if (src->tree.root)                                                                                     \
+        {                                                                                                       \
+            int rc = ztree_clone_##Name##_tree(&dst->tree, &src->tree);                                         \
+            dst->size = dst->tree.size;                                                                         \
+            return rc;                                                                                          \
+        }                                                                                                       \
+        dst->size = src->size;                                                                                  \
+        memcpy(ztree__small_base_##Name(dst), src->small + ((N) - src->size), src->size * sizeof(*src->small)); \
+        ztree__small_link_##Name(dst);                                                                          \
+        return Z_OK;                                                                                            \
+    }
+
+// Thread-safe wrapper around a red-black map: lookups share a striped reader lock, updates take it exclusively.
+// Results are copied out under the lock, since nodes may be freed as soon as it is released.
+#define ZTREE__GENERATE_SYNC(Key, Val, Name)                                                                    \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_rwlock lock;                                                                                      \
+        ztree_##Name tree;                                                                                      \
+    } ztree_sync_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+    } ztree_sync_entry_##Name;                                                                                  \
+                                                                                                                \
+    static inline ztree_sync_##Name ztree_sync_init_##Name(void)                                                \
+    {                                                                                                           \
+        ztree_sync_##Name s;                                                                                    \
+        ztree__rw_init(&s.lock);                                                                                \
+        s.tree = ztree_init_##Name();                                                                           \
+        return s;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_sync_clear_##Name(ztree_sync_##Name *s)                                            \
+    {                                                                                                           \
+        ztree__rw_lock(&s->lock);                                                                               \
+        ztree_clear_##Name(&s->tree);                                                                           \
+        ztree__rw_unlock(&s->lock);                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree_sync_size_##Name(ztree_sync_##Name *s)                                           \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->lock);                                                   \
+        size_t n = s->tree.size;                                                                                \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_find_##Name(ztree_sync_##Name *s, Key k, Val *out_val)                         \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->lock);                                                   \
+        ztree_node_##Name *n = ztree_find_##Name(&s->tree, k);                                                  \
+        if (n && out_val)                                                                                       \
+        {                                                                                                       \
+            *out_val = n->value;                                                                                \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n ? Z_OK : Z_ENOTFOUND;                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_lower_bound_##Name(ztree_sync_##Name *s, Key k, Key *out_key, Val *out_val)    \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->lock);                                                   \
+        ztree_node_##Name *n = ztree_lower_bound_##Name(&s->tree, k);                                           \
+        if (n && out_key)                                                                                       \
+        {                                                                                                       \
+            *out_key = n->key;                                                                                  \
+        }                                                                                                       \
+        if (n && out_val)                                                                                       \
+        {                                                                                                       \
+            *out_val = n->value;                                                                                \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n ? Z_OK : Z_ENOTFOUND;                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_insert_##Name(ztree_sync_##Name *s, Key k, Val v)                              \
+    {                                                                                                           \
+        ztree__rw_lock(&s->lock);                                                                               \
+        int rc = ztree_insert_##Name(&s->tree, k, v);                                                           \
+        ztree__rw_unlock(&s->lock);                                                                             \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_remove_##Name(ztree_sync_##Name *s, Key k)                                     \
+    {                                                                                                           \
+        ztree__rw_lock(&s->lock);                                                                               \
+        int rc = ztree_take_##Name(&s->tree, k, NULL);                                                          \
+        ztree__rw_unlock(&s->lock);                                                                             \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_snapshot_##Name(ztree_sync_##Name *s, ztree_sync_entry_##Name **out,           \
+                                                 size_t *count)                                                 \
+    {                                                                                                           \
+        /* Copies every entry in key order under one read lock; the caller releases `*out` with ZTREE_FREE. */  \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->lock);                                                   \
+        size_t n = s->tree.size;                                                                                \
+        ztree_sync_entry_##Name *items = NULL;                                                                  \
+        if (n)                                                                                                  \
+        {                                                                                                       \
+            items = (ztree_sync_entry_##Name*)ZTREE_MALLOC(n * sizeof(*items));                                 \
+            if (!items)                                                                                         \
+            {                                                                                                   \
+                ztree__rw_read_unlock(r);                                                                       \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            size_t i = 0;                                                                                       \
+            for (ztree_node_##Name *x = ztree_min_##Name(&s->tree); x; x = ztree_next_##Name(x))                \
+            {                                                                                                   \
+                items[i].key = x->key;                                                                          \
+                items[i].value = x->value;                                                                      \
+                i++;                                                                                            \
+            }                                                                                                   \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        *out = items;                                                                                           \
+        *count = n;                                                                                             \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sync_foreach_##Name(ztree_sync_##Name *s,                                           \
+                                                int (*fn)(const Key *key, const Val *value, void *ctx),         \
+                                                void *ctx)                                                      \
+    {                                                                                                           \
+        /* Runs `fn` over a snapshot outside the lock, so it may call back into the map; non-zero stops. */     \
+        ztree_sync_entry_##Name *items;                                                                         \
+        size_t n;                                                                                               \
+        if (Z_OK != ztree_sync_snapshot_##Name(s, &items, &n))                                                  \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        for (size_t i = 0; i < n; i++)                                                                          \
+        {                                                                                                       \
+            if (fn(&items[i].key, &items[i].value, ctx))                                                        \
+            {                                                                                                   \
+                break;                                                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+        ZTREE_FREE(items);                                                                                      \
+        return Z_OK;                                                                                            \
+    }
+
+#define ZTREE_GENERATE_SYNC_IMPL(Key, Val, Name, Cmp) \
+    ZTREE_GENERATE_IMPL(Key, Val, Name, Cmp) \
+    ZTREE__GENERATE_SYNC(Key, Val, Name)
+
+// Red-black maps split by key range into independently locked shards, so writers to different ranges never
+// contend. A topology lock, taken shared by every call, lets ztree_sharded_rebalance split and merge shards.
+#define ZTREE__GENERATE_SHARDED(Key, Val, Name, Cmp)                                                            \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        int lock;                                                                                               \
+        Key lo;                                                                                                 \
+        ztree_##Name tree;                                                                                      \
+        char pad[64];                                                                                           \
+    } ztree_shard_##Name;                                                                                       \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_rwlock topology;                                                                                  \
+        int rebalancing;                                                                                        \
+        size_t nshards, target;                                                                                 \
+        ztree_shard_##Name shards[ZTREE_SHARDS_MAX];                                                            \
+    } ztree_sharded_##Name;                                                                                     \
+                                                                                                                \
+    static inline int ztree_sharded_init_##Name(ztree_sharded_##Name *s, const Key *bounds, size_t nbounds)     \
+    {                                                                                                           \
+        /* bounds[i] is the smallest key of shard i + 1; shard 0 takes everything below bounds[0]. Rebalancing  \
+         * aims for nbounds + 1 shards, or a quarter of ZTREE_SHARDS_MAX when no bounds are given. */           \
+        if (nbounds >= ZTREE_SHARDS_MAX)                                                                        \
+        {                                                                                                       \
+            return Z_EINVAL;                                                                                    \
+        }                                                                                                       \
+        for (size_t i = 1; i < nbounds; i++)                                                                    \
+        {                                                                                                       \
+            if (Cmp(&bounds[i - 1], &bounds[i]) >= 0)                                                           \
+            {                                                                                                   \
+                return Z_EINVAL;                                                                                \
+            }                                                                                                   \
+        }                                                                                                       \
+        ztree__rw_init(&s->topology);                                                                           \
+        s->rebalancing = 0;                                                                                     \
+        s->nshards = nbounds + 1;                                                                               \
+        s->target = nbounds ? s->nshards : ZTREE_SHARDS_MAX / 4;                                                \
+        for (size_t i = 0; i < s->nshards; i++)                                                                 \
+        {                                                                                                       \
+            s->shards[i].lock = 0;                                                                              \
+            if (i > 0)                                                                                          \
+            {                                                                                                   \
+                s->shards[i].lo = bounds[i - 1];                                                                \
+            }                                                                                                   \
+            s->shards[i].tree = ztree_init_##Name();                                                            \
+        }                                                                                                       \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_sharded_clear_##Name(ztree_sharded_##Name *s)                                      \
+    {                                                                                                           \
+        ztree__rw_lock(&s->topology);                                                                           \
+        for (size_t i = 0; i < s->nshards; i++)                                                                 \
+        {                                                                                                       \
+            ztree_clear_##Name(&s->shards[i].tree);                                                             \
+        }                                                                                                       \
+        ztree__rw_unlock(&s->topology);                                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_shard_##Name *ztree__shard_of_##Name(ztree_sharded_##Name *s, const Key *k)             \
+    {                                                                                                           \
+        /* Caller holds the topology lock. Binary search for the last shard whose lower bound is <= k. */       \
+        size_t lo = 0, hi = s->nshards - 1;                                                                     \
+        while (lo < hi)                                                                                         \
+        {                                                                                                       \
+            size_t mid = lo + (hi - lo + 1) / 2;                                                                \
+            if (Cmp(k, &s->shards[mid].lo) >= 0)                                                                \
+            {                                                                                                   \
+                lo = mid;                                                                                       \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                hi = mid - 1;                                                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+        return &s->shards[lo];                                                                                  \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_insert_##Name(ztree_sharded_##Name *s, Key k, Val v)                        \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        ztree_shard_##Name *sh = ztree__shard_of_##Name(s, &k);                                                 \
+        ztree__spin_lock(&sh->lock);                                                                            \
+        int rc = ztree_insert_##Name(&sh->tree, k, v);                                                          \
+        ztree__spin_unlock(&sh->lock);                                                                          \
+        ztree__rw_read_unlock(r);                                                                               \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_remove_##Name(ztree_sharded_##Name *s, Key k)                               \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        ztree_shard_##Name *sh = ztree__shard_of_##Name(s, &k);                                                 \
+        ztree__spin_lock(&sh->lock);                                                                            \
+        int rc = ztree_take_##Name(&sh->tree, k, NULL);                                                         \
+        ztree__spin_unlock(&sh->lock);                                                                          \
+        ztree__rw_read_unlock(r);                                                                               \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_find_##Name(ztree_sharded_##Name *s, Key k, Val *out_val)                   \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        ztree_shard_##Name *sh = ztree__shard_of_##Name(s, &k);                                                 \
+        ztree__spin_lock(&sh->lock);                                                                            \
+        ztree_node_##Name *n = ztree_find_##Name(&sh->tree, k);                                                 \
+        if (n && out_val)                                                                                       \
+        {                                                                                                       \
+            *out_val = n->value;                                                                                \
+        }                                                                                                       \
+        ztree__spin_unlock(&sh->lock);                                                                          \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n ? Z_OK : Z_ENOTFOUND;                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_lower_bound_##Name(ztree_sharded_##Name *s, Key k,                          \
+                                                       Key *out_key, Val *out_val)                              \
+    {                                                                                                           \
+        /* Falls through to the smallest key of the following shards when k's own shard has nothing above k. */ \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        ztree_shard_##Name *sh = ztree__shard_of_##Name(s, &k), *end = s->shards + s->nshards;                  \
+        ztree_node_##Name *n = NULL;                                                                            \
+        for (int first = 1; !n && sh < end; sh++, first = 0)                                                    \
+        {                                                                                                       \
+            ztree__spin_lock(&sh->lock);                                                                        \
+            n = first ? ztree_lower_bound_##Name(&sh->tree, k) : ztree_min_##Name(&sh->tree);                   \
+            if (n && out_key)                                                                                   \
+            {                                                                                                   \
+                *out_key = n->key;                                                                              \
+            }                                                                                                   \
+            if (n && out_val)                                                                                   \
+            {                                                                                                   \
+                *out_val = n->value;                                                                            \
+            }                                                                                                   \
+            ztree__spin_unlock(&sh->lock);                                                                      \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n ? Z_OK : Z_ENOTFOUND;                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree_sharded_size_##Name(ztree_sharded_##Name *s)                                     \
+    {                                                                                                           \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        size_t n = 0;                                                                                           \
+        for (size_t i = 0; i < s->nshards; i++)                                                                 \
+        {                                                                                                       \
+            ztree__spin_lock(&s->shards[i].lock);                                                               \
+            n += s->shards[i].tree.size;                                                                        \
+            ztree__spin_unlock(&s->shards[i].lock);                                                             \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_foreach_##Name(ztree_sharded_##Name *s,                                     \
+                                                   int (*fn)(const Key *key, const Val *value, void *ctx),      \
+                                                   void *ctx)                                                   \
+    {                                                                                                           \
+        /* Visits shards in key order, each under its own lock, so fn must not call back into the map. */       \
+        ztree_sync_stripe *r = ztree__rw_read_lock(&s->topology);                                               \
+        int stop = 0;                                                                                           \
+        for (size_t i = 0; !stop && i < s->nshards; i++)                                                        \
+        {                                                                                                       \
+            ztree_shard_##Name *sh = &s->shards[i];                                                             \
+            ztree__spin_lock(&sh->lock);                                                                        \
+            for (ztree_node_##Name *n = ztree_min_##Name(&sh->tree); n && !stop; n = ztree_next_##Name(n))      \
+            {                                                                                                   \
+                stop = fn(&n->key, &n->value, ctx);                                                             \
+            }                                                                                                   \
+            ztree__spin_unlock(&sh->lock);                                                                      \
+        }                                                                                                       \
+        ztree__rw_read_unlock(r);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__shard_move_##Name(ztree_##Name *from, ztree_##Name *to, size_t n, int from_top)   \
+    {                                                                                                           \
+        /* Relinks n nodes without allocating: the top of `from` onto the bottom of `to`, or the reverse. */    \
+        while (n--)                                                                                             \
+        {                                                                                                       \
+            ztree_node_##Name *z = from_top ? from->rightmost : from->leftmost;                                 \
+            ztree__unlink_##Name(from, z);                                                                      \
+            z->left = z->right = NULL;                                                                          \
+            if (from_top)                                                                                       \
+            {                                                                                                   \
+                ztree__link_##Name(to, to->leftmost, z, 1);                                                     \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree__link_##Name(to, to->rightmost, z, 0);                                                    \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__shard_pause_##Name(ztree_sharded_##Name *s)                                       \
+    {                                                                                                           \
+        /* Lets the calls that queued behind one batch run before the next batch takes the lock again. */       \
+        ztree__rw_unlock(&s->topology);                                                                         \
+        sched_yield();                                                                                          \
+        ztree__rw_lock(&s->topology);                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__shard_split_##Name(ztree_sharded_##Name *s, size_t i, size_t share)                \
+    {                                                                                                           \
+        /* Moves the top half of shard i into a new shard i + 1, ZTREE_SHARD_MOVE_BATCH nodes at a time. After  \
+         * every batch the new shard's bound is its smallest key, so both shards are valid between batches. */  \
+        ztree_##Name *from = &s->shards[i].tree;                                                                \
+        if (s->nshards == ZTREE_SHARDS_MAX || from->size <= 2 * share + 1)                                      \
+        {                                                                                                       \
+            return 0;                                                                                           \
+        }                                                                                                       \
+        for (size_t j = s->nshards; j > i + 1; j--)                                                             \
+        {                                                                                                       \
+            s->shards[j] = s->shards[j - 1];                                                                    \
+        }                                                                                                       \
+        ztree_shard_##Name *hi = &s->shards[i + 1];                                                             \
+        hi->lock = 0;                                                                                           \
+        hi->tree = ztree_init_##Name();                                                                         \
+        s->nshards++;                                                                                           \
+        for (size_t left = from->size / 2; left && from->size;)                                                 \
+        {                                                                                                       \
+            size_t n = (left < ZTREE_SHARD_MOVE_BATCH) ? left : ZTREE_SHARD_MOVE_BATCH;                         \
+            n = (n < from->size) ? n : from->size;                                                              \
+            ztree__shard_move_##Name(from, &hi->tree, n, 1);                                                    \
+            hi->lo = hi->tree.leftmost->key;                                                                    \
+            left -= n;                                                                                          \
+            if (left)                                                                                           \
+            {                                                                                                   \
+                ztree__shard_pause_##Name(s);                                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+        return 1;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__shard_merge_##Name(ztree_sharded_##Name *s, size_t i, size_t share)                \
+    {                                                                                                           \
+        /* Drains shard i + 1 into shard i from the bottom in batches, raising its bound past every moved key.  \
+         * Stops early, leaving both shards valid, if inserts between batches push the pair past one share. */  \
+        for (;;)                                                                                                \
+        {                                                                                                       \
+            ztree_##Name *from = &s->shards[i + 1].tree;                                                        \
+            if (s->shards[i].tree.size + from->size >= share)                                                   \
+            {                                                                                                   \
+                return 0;                                                                                       \
+            }                                                                                                   \
+            size_t n = (from->size < ZTREE_SHARD_MOVE_BATCH) ? from->size : ZTREE_SHARD_MOVE_BATCH;             \
+            ztree__shard_move_##Name(from, &s->shards[i].tree, n, 0);                                           \
+            if (!from->size)                                                                                    \
+            {                                                                                                   \
+                for (size_t j = i + 1; j + 1 < s->nshards; j++)                                                 \
+                {                                                                                               \
+                    s->shards[j] = s->shards[j + 1];                                                            \
+                }                                                                                               \
+                s->nshards--;                                                                                   \
+                return 1;                                                                                       \
+            }                                                                                                   \
+            s->shards[i + 1].lo = from->leftmost->key;                                                          \
+            ztree__shard_pause_##Name(s);                                                                       \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_sharded_rebalance_##Name(ztree_sharded_##Name *s)                                   \
+    {                                                                                                           \
+        /* A share is the size over the target shard count. Splits shards holding over twice their share        \
+         * at the median, then merges neighbours that together hold less than one share. Nodes move in          \
+         * batches, and other calls run between batches. Maps with fewer keys than target shards are not        \
+         * split. Concurrent rebalances run one at a time. Returns the splits plus merges. */                   \
+        ztree__spin_lock(&s->rebalancing);                                                                      \
+        ztree__rw_lock(&s->topology);                                                                           \
+        size_t total = 0;                                                                                       \
+        int changed = 0;                                                                                        \
+        for (size_t i = 0; i < s->nshards; i++)                                                                 \
+        {                                                                                                       \
+            total += s->shards[i].tree.size;                                                                    \
+        }                                                                                                       \
+        size_t share = total / s->target;                                                                       \
+        for (size_t i = 0; share && i < s->nshards; i++)                                                        \
+        {                                                                                                       \
+            while (ztree__shard_split_##Name(s, i, share))                                                      \
+            {                                                                                                   \
+                changed++;                                                                                      \
+            }                                                                                                   \
+        }                                                                                                       \
+        share += !share;                                                                                        \
+        for (size_t i = 0; i + 1 < s->nshards;)                                                                 \
+        {                                                                                                       \
+            if (ztree__shard_merge_##Name(s, i, share))                                                         \
+            {                                                                                                   \
+                changed++;                                                                                      \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                i++;                                                                                            \
+            }                                                                                                   \
+        }                                                                                                       \
+        ztree__rw_unlock(&s->topology);                                                                         \
+        ztree__spin_unlock(&s->rebalancing);                                                                    \
+        return changed;                                                                                         \
+    }
+
+
+#define ZTREE_GENERATE_SHARDED_IMPL(Key, Val, Name, Cmp) \
+    ZTREE_GENERATE_IMPL(Key, Val, Name, Cmp) \
+    ZTREE__GENERATE_SHARDED(Key, Val, Name, Cmp)
+
+// Bounded map that keeps the K greatest keys, for top-K selection over a stream. The cached minimum lets a
+// full map turn away smaller keys with one comparison. Accepted keys evict it, so the tree stays at K nodes.
+#define ZTREE__GENERATE_TOPK(Key, Val, Name, Cmp)                                                               \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name tree;                                                                                      \
+        size_t cap;                                                                                             \
+    } ztree_topk_##Name;                                                                                        \
+                                                                                                                \
+    static inline ztree_topk_##Name ztree_topk_init_##Name(size_t k)                                            \
+    {                                                                                                           \
+        ztree_topk_##Name b;                                                                                    \
+        b.tree = ztree_init_##Name();                                                                           \
+        b.cap = k;                                                                                              \
+        return b;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_topk_insert_##Name(ztree_topk_##Name *b, Key k, Val v)                              \
+    {                                                                                                           \
+        /* Returns Z_OK if the entry is kept (a present key gets the new value) and ZTREE_REJECTED if the map   \
+           is full and k sorts before its minimum. A full map recycles the evicted minimum's node for the new   \
+           entry. Negative codes are errors only. */                                                            \
+        if (b->tree.size < b->cap)                                                                              \
+        {                                                                                                       \
+            return ztree_insert_##Name(&b->tree, k, v);                                                         \
+        }                                                                                                       \
+        if (!b->cap || Cmp(&k, &b->tree.leftmost->key) < 0)                                                     \
+        {                                                                                                       \
+            return ZTREE_REJECTED;                                                                              \
+        }                                                                                                       \
+        ztree_node_##Name *n = ztree_find_##Name(&b->tree, k);                                                  \
+        if (n)                                                                                                  \
+        {                                                                                                       \
+            n->value = v;                                                                                       \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        n = ztree_extract_node_##Name(&b->tree, b->tree.leftmost);                                              \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        n->key = k;                                                                                             \
+        n->value = v;                                                                                           \
+        return ztree_insert_node_##Name(&b->tree, n);                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_topk_clear_##Name(ztree_topk_##Name *b)                                            \
+    {                                                                                                           \
+        ztree_clear_##Name(&b->tree);                                                                           \
+    }
+
+#define ZTREE_GENERATE_TOPK_IMPL(Key, Val, Name, Cmp) \
+    ZTREE_GENERATE_IMPL(Key, Val, Name, Cmp) \
+    ZTREE__GENERATE_TOPK(Key, Val, Name, Cmp)
+
+// Set layout: key-only nodes on the same core as maps.
+#define ZTREE_GENERATE_SET_IMPL(Key, Name, Cmp)                                                                 \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *parent, *left, *right;                                                        \
+        ZTREE__THREAD_FIELDS(ztree_node_##Name)                                                                 \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, PLAIN, RB)                                                      \
+                                                                                                                \
+    ZTREE__GENERATE_UNIQUE_SEARCH(Key, Name, Cmp)                                                               \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__new_##Name(Key k)                                                   \
+    {                                                                                                           \
+        ZTREE_NEW_NODE(ztree_node_##Name, n);                                                                   \
+        if (n)                                                                                                  \
+        {                                                                                                       \
+            n->key = k;                                                                                         \
+            n->color = ZTREE_RED;                                                                               \
+            n->parent = n->left = n->right = NULL;                                                              \
+        }                                                                                                       \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline bool ztree_contains_##Name(ztree_##Name *t, Key k)                                            \
+    {                                                                                                           \
+        return NULL != ztree_find_##Name(t, k);                                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k)                                               \
+    {                                                                                                           \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return Z_FOUND;                                                                                 \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k);                                                            \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_erase_##Name(ztree_##Name *t, Key k)                                                \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOTFOUND;                                                                                 \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__pop_##Name(ztree_##Name *t, ztree_node_##Name *z, Key *out_key)                    \
+    {                                                                                                           \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_EEMPTY;                                                                                    \
+        }                                                                                                       \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = z->key;                                                                                  \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key)                                       \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, t->leftmost, out_key);                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key)                                       \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, t->rightmost, out_key);                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_NODE_HANDLES(Key, Name, Cmp, 0)
+
+// Multimap layout: equal keys are kept, in insertion order, on the same core as maps.
+#define ZTREE_GENERATE_MULTI_IMPL(Key, Val, Name, Cmp)                                                          \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_NODE(Key, Val, Name, RB)                                                               \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, PLAIN, RB)                                                      \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__bound_##Name(ztree_##Name *t, Key k, int upper)                     \
+    {                                                                                                           \
+        /* First node with key >= k (lower) or > k (upper); no early exit, duplicates may sit on both sides. */ \
+        ztree_node_##Name *x = t->root, *res = NULL;                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&x->key, &k);                                                                         \
+            if (upper ? cmp > 0 : cmp >= 0)                                                                     \
+            {                                                                                                   \
+                res = x;                                                                                        \
+                x = x->left;                                                                                    \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                x = x->right;                                                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        return ztree__bound_##Name(t, k, 0);                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_upper_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        return ztree__bound_##Name(t, k, 1);                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *n = ztree__bound_##Name(t, k, 0);                                                    \
+        return (n && 0 == Cmp(&n->key, &k)) ? n : NULL;                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_equal_range_##Name(ztree_##Name *t, Key k, ztree_node_##Name **first,              \
+                                                ztree_node_##Name **last)                                       \
+    {                                                                                                           \
+        *first = ztree__bound_##Name(t, k, 0);                                                                  \
+        *last = ztree__bound_##Name(t, k, 1);                                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree_count_##Name(ztree_##Name *t, Key k)                                             \
+    {                                                                                                           \
+        size_t n = 0;                                                                                           \
+        ztree_node_##Name *x = ztree_find_##Name(t, k);                                                         \
+        while (x && 0 == Cmp(&x->key, &k))                                                                      \
+        {                                                                                                       \
+            n++;                                                                                                \
+            x = ztree_next_##Name(x);                                                                           \
+        }                                                                                                       \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        while (z && 0 == Cmp(&z->key, &k))                                                                      \
+        {                                                                                                       \
+            ztree_node_##Name *next = ztree_next_##Name(z);                                                     \
+            ztree__unlink_##Name(t, z);                                                                         \
+            ztree__drop_##Name(t, z);                                                                           \
+            z = next;                                                                                           \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, ztree_find_##Name)                                                 \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        /* Equal keys descend right, so a duplicate lands after every existing copy (insertion order). */       \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_NODE_HANDLES(Key, Name, Cmp, 1)
+
+// Split-layout slabs grow by whole chunks that never move. Chunk c holds ZTREE__SLAB_LEN(c) slots, so slot i sits
+// in chunk log2(i / 16 + 1), and 28 chunks hold just under 2^32 slots.
+#define ZTREE__SLAB_SHIFT  4
+#define ZTREE__SLAB_CHUNKS 28
+#define ZTREE__SLAB_LEN(c) ((size_t)1 << (ZTREE__SLAB_SHIFT + (c)))
+
+static inline uint32_t ztree__slab_chunk(uint32_t i, uint32_t *off)
+{
+    uint32_t q = (i >> ZTREE__SLAB_SHIFT) + 1;
+#if defined(__GNUC__) || defined(__clang__)
+    uint32_t c = 31 - (uint32_t)__builtin_clz(q);
+#else
+    uint32_t c = 0;
+    while (q >> (c + 1))
+    {
+        c++;
+    }
+#endif
+    *off = i - (uint32_t)(ZTREE__SLAB_LEN(c) - ZTREE__SLAB_LEN(0));
+    return c;
+}
+
+// Hot/cold split layout: search nodes hold key, links and a slot handle; values sit in a per-tree slab.
+#define ZTREE_GENERATE_SPLIT_IMPL(Key, Val, Name, Cmp)                                                          \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        uint32_t slot;                                                                                          \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *parent, *left, *right;                                                        \
+        ZTREE__THREAD_FIELDS(ztree_node_##Name)                                                                 \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef union                                                                                               \
+    {                                                                                                           \
+        Val value;                                                                                              \
+        uint32_t next_free;                                                                                     \
+    } ztree_slot_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_slot_##Name *chunks[ZTREE__SLAB_CHUNKS];                                                          \
+        uint32_t cap, used, free_list, nchunks;                                                                 \
+    } ztree_slab_##Name;                                                                                        \
+                                                                                                                \
+    static inline void ztree__slab_init_##Name(ztree_slab_##Name *s)                                            \
+    {                                                                                                           \
+        memset(s->chunks, 0, sizeof(s->chunks));                                                                \
+        s->cap = s->used = s->nchunks = 0;                                                                      \
+        s->free_list = ZTREE_NIL;                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__slab_reset_##Name(ztree_slab_##Name *s)                                           \
+    {                                                                                                           \
+        for (uint32_t c = 0; c < s->nchunks; c++)                                                               \
+        {                                                                                                       \
+            ZTREE_FREE(s->chunks[c]);                                                                           \
+        }                                                                                                       \
+        ztree__slab_init_##Name(s);                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_slot_##Name *ztree__slab_at_##Name(const ztree_slab_##Name *s, uint32_t i)              \
+    {                                                                                                           \
+        uint32_t off;                                                                                           \
+        uint32_t c = ztree__slab_chunk(i, &off);                                                                \
+        return &s->chunks[c][off];                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__slab_grow_##Name(ztree_slab_##Name *s)                                             \
+    {                                                                                                           \
+        /* Adds the next chunk; the ones already there never move, so value pointers stay put. */               \
+        if (ZTREE__SLAB_CHUNKS == s->nchunks)                                                                   \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        size_t len = ZTREE__SLAB_LEN(s->nchunks);                                                               \
+        ztree_slot_##Name *chunk = (ztree_slot_##Name*)ZTREE_MALLOC(len * sizeof(ztree_slot_##Name));           \
+        if (!chunk)                                                                                             \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        s->chunks[s->nchunks++] = chunk;                                                                        \
+        s->cap += (uint32_t)len;                                                                                \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline uint32_t ztree__slab_alloc_##Name(ztree_slab_##Name *s)                                       \
+    {                                                                                                           \
+        uint32_t i = s->free_list;                                                                              \
+        if (ZTREE_NIL != i)                                                                                     \
+        {                                                                                                       \
+            s->free_list = ztree__slab_at_##Name(s, i)->next_free;                                              \
+            return i;                                                                                           \
+        }                                                                                                       \
+        if (s->used == s->cap && Z_OK != ztree__slab_grow_##Name(s))                                            \
+        {                                                                                                       \
+            return ZTREE_NIL;                                                                                   \
+        }                                                                                                       \
+        return s->used++;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__slab_free_##Name(ztree_slab_##Name *s, uint32_t i)                                \
+    {                                                                                                           \
+        ztree__slab_at_##Name(s, i)->next_free = s->free_list;                                                  \
+        s->free_list = i;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__slab_copy_##Name(ztree_slab_##Name *s, const ztree_slab_##Name *src)               \
+    {                                                                                                           \
+        /* Slots and the free list carry over unchanged, so copied nodes keep their slot handles. */            \
+        ztree__slab_init_##Name(s);                                                                             \
+        for (uint32_t c = 0; s->cap < src->used; c++)                                                           \
+        {                                                                                                       \
+            uint32_t start = s->cap;                                                                            \
+            if (Z_OK != ztree__slab_grow_##Name(s))                                                             \
+            {                                                                                                   \
+                ztree__slab_reset_##Name(s);                                                                    \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            size_t n = (src->used - start < s->cap - start) ? src->used - start : s->cap - start;               \
+            memcpy(s->chunks[c], src->chunks[c], n * sizeof(ztree_slot_##Name));                                \
+        }                                                                                                       \
+        s->used = src->used;                                                                                    \
+        s->free_list = src->free_list;                                                                          \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, SPLIT, RB)                                                      \
+                                                                                                                \
+    ZTREE__GENERATE_UNIQUE_SEARCH(Key, Name, Cmp)                                                               \
+                                                                                                                \
+    static inline Val *ztree_value_##Name(ztree_##Name *t, ztree_node_##Name *n)                                \
+    {                                                                                                           \
+        return &ztree__slab_at_##Name(&t->slab, n->slot)->value;                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__new_##Name(ztree_##Name *t, Key k, Val v)                           \
+    {                                                                                                           \
+        uint32_t slot = ztree__slab_alloc_##Name(&t->slab);                                                     \
+        if (ZTREE_NIL == slot)                                                                                  \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        ZTREE_NEW_NODE(ztree_node_##Name, n);                                                                   \
+        if (!n)                                                                                                 \
+        {                                                                                                       \
+            ztree__slab_free_##Name(&t->slab, slot);                                                            \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        n->key = k;                                                                                             \
+        n->slot = slot;                                                                                         \
+        n->color = ZTREE_RED;                                                                                   \
+        n->parent = n->left = n->right = NULL;                                                                  \
+        ztree__slab_at_##Name(&t->slab, slot)->value = v;                                                       \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                ztree__slab_at_##Name(&t->slab, x->slot)->value = v;                                            \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(t, k, v);                                                      \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__detach_##Name(ztree_##Name *t, ztree_node_##Name *z, Key *out_key, Val *out_val)   \
+    {                                                                                                           \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = z->key;                                                                                  \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = ztree__slab_at_##Name(&t->slab, z->slot)->value;                                         \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        return z ? ztree__detach_##Name(t, z, NULL, out_val) : Z_ENOTFOUND;                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return t->leftmost ? ztree__detach_##Name(t, t->leftmost, out_key, out_val) : Z_EEMPTY;                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return t->rightmost ? ztree__detach_##Name(t, t->rightmost, out_key, out_val) : Z_EEMPTY;               \
+    }
+
+// Prefix-cached layout: each node also stores Prefix(&key), an order-preserving 64-bit image of the key's
+// leading bytes. Descents compare those inline and only call Cmp (touching out-of-node key memory) on ties.
+#define ZTREE_GENERATE_PREFIX_IMPL(Key, Val, Name, Cmp, Prefix)                                                 \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        uint64_t prefix;                                                                                        \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *parent, *left, *right;                                                        \
+        ZTREE__THREAD_FIELDS(ztree_node_##Name)                                                                 \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, PLAIN, RB)                                                      \
+                                                                                                                \
+    static inline int ztree__probe_##Name(Key *k, uint64_t p, ztree_node_##Name *x)                             \
+    {                                                                                                           \
+        if (p != x->prefix)                                                                                     \
+        {                                                                                                       \
+            return (p < x->prefix) ? -1 : 1;                                                                    \
+        }                                                                                                       \
+        return Cmp(k, &x->key);                                                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        uint64_t p = Prefix(&k);                                                                                \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = ztree__probe_##Name(&k, p, x);                                                            \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        uint64_t p = Prefix(&k);                                                                                \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = ztree__probe_##Name(&k, p, curr);                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return curr;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, ztree_find_##Name)                                                 \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        uint64_t p = Prefix(&k);                                                                                \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = ztree__probe_##Name(&k, p, x);                                                                \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        z->prefix = p;                                                                                          \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        return Z_OK;                                                                                            \
+    }
+
+// Hashed layout: a regular tree plus an open-addressing index from key hash to node. Exact-match lookups
+// go through the index in O(1); ordered queries and iteration still use the tree.
+#define ZTREE_GENERATE_HASHED_IMPL(Key, Val, Name, Cmp, Hash)                                                   \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        uint64_t hash;                                                                                          \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *parent, *left, *right;                                                        \
+        ZTREE__THREAD_FIELDS(ztree_node_##Name)                                                                 \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name **slots;                                                                              \
+        size_t mask, count;                                                                                     \
+    } ztree_hidx_##Name;                                                                                        \
+                                                                                                                \
+    static inline void ztree__hidx_init_##Name(ztree_hidx_##Name *h)                                            \
+    {                                                                                                           \
+        h->slots = NULL;                                                                                        \
+        h->mask = h->count = 0;                                                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__hidx_reset_##Name(ztree_hidx_##Name *h)                                           \
+    {                                                                                                           \
+        ZTREE_FREE(h->slots);                                                                                   \
+        ztree__hidx_init_##Name(h);                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__hidx_place_##Name(ztree_hidx_##Name *h, ztree_node_##Name *n)                     \
+    {                                                                                                           \
+        size_t i = (size_t)n->hash & h->mask;                                                                   \
+        while (h->slots[i])                                                                                     \
+        {                                                                                                       \
+            i = (i + 1) & h->mask;                                                                              \
+        }                                                                                                       \
+        h->slots[i] = n;                                                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__hidx_reserve_##Name(ztree_hidx_##Name *h)                                          \
+    {                                                                                                           \
+        /* Linear probing stays short below 3/4 load; double the table before crossing it. */                   \
+        if (h->slots && (h->count + 1) * 4 <= (h->mask + 1) * 3)                                                \
+        {                                                                                                       \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        size_t cap = h->slots ? (h->mask + 1) * 2 : 16;                                                         \
+        ztree_node_##Name **old = h->slots;                                                                     \
+        size_t old_cap = old ? h->mask + 1 : 0;                                                                 \
+        h->slots = (ztree_node_##Name **)ZTREE_CALLOC(cap, sizeof(*h->slots));                                  \
+        if (!h->slots)                                                                                          \
+        {                                                                                                       \
+            h->slots = old;                                                                                     \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        h->mask = cap - 1;                                                                                      \
+        for (size_t i = 0; i < old_cap; i++)                                                                    \
+        {                                                                                                       \
+            if (old[i])                                                                                         \
+            {                                                                                                   \
+                ztree__hidx_place_##Name(h, old[i]);                                                            \
+            }                                                                                                   \
+        }                                                                                                       \
+        ZTREE_FREE(old);                                                                                        \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__hidx_size_like_##Name(ztree_hidx_##Name *h, const ztree_hidx_##Name *src)          \
+    {                                                                                                           \
+        /* An empty table as large as src's, for a clone to place its copied nodes in. */                       \
+        ztree__hidx_init_##Name(h);                                                                             \
+        if (src->slots)                                                                                         \
+        {                                                                                                       \
+            h->slots = (ztree_node_##Name **)ZTREE_CALLOC(src->mask + 1, sizeof(*h->slots));                    \
+            if (!h->slots)                                                                                      \
+            {                                                                                                   \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            h->mask = src->mask;                                                                                \
+        }                                                                                                       \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__hidx_find_##Name(ztree_hidx_##Name *h, Key *k, uint64_t hash)       \
+    {                                                                                                           \
+        if (!h->slots)                                                                                          \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        for (size_t i = (size_t)hash & h->mask; h->slots[i]; i = (i + 1) & h->mask)                             \
+        {                                                                                                       \
+            ztree_node_##Name *n = h->slots[i];                                                                 \
+            if (n->hash == hash && 0 == Cmp(k, &n->key))                                                        \
+            {                                                                                                   \
+                return n;                                                                                       \
+            }                                                                                                   \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__hidx_erase_##Name(ztree_hidx_##Name *h, ztree_node_##Name *n)                     \
+    {                                                                                                           \
+        size_t i = (size_t)n->hash & h->mask;                                                                   \
+        while (h->slots[i] != n)                                                                                \
+        {                                                                                                       \
+            i = (i + 1) & h->mask;                                                                              \
+        }                                                                                                       \
+        /* Backward-shift deletion: pull later entries of the probe run into the hole, so no tombstones. */     \
+        for (size_t j = (i + 1) & h->mask; h->slots[j]; j = (j + 1) & h->mask)                                  \
+        {                                                                                                       \
+            size_t home = (size_t)h->slots[j]->hash & h->mask;                                                  \
+            if (((j - home) & h->mask) >= ((j - i) & h->mask))                                                  \
+            {                                                                                                   \
+                h->slots[i] = h->slots[j];                                                                      \
+                i = j;                                                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+        h->slots[i] = NULL;                                                                                     \
+        h->count--;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, HASH, RB)                                                       \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        return ztree__hidx_find_##Name(&t->index, &k, Hash(&k));                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return curr;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, ztree_find_##Name)                                                 \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        uint64_t hash = Hash(&k);                                                                               \
+        ztree_node_##Name *x = ztree__hidx_find_##Name(&t->index, &k, hash);                                    \
+        if (x)                                                                                                  \
+        {                                                                                                       \
+            x->value = v;                                                                                       \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        if (Z_OK != ztree__hidx_reserve_##Name(&t->index))                                                      \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree_node_##Name *y = NULL;                                                                            \
+        int cmp = 0;                                                                                            \
+        x = t->root;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        z->hash = hash;                                                                                         \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        ztree__hidx_place_##Name(&t->index, z);                                                                 \
+        t->index.count++;                                                                                       \
+        return Z_OK;                                                                                            \
+    }
+
+// Filtered layout: a counting Bloom filter over key hashes rejects most absent keys before any descent.
+#define ZTREE_GENERATE_FILTERED_IMPL(Key, Val, Name, Cmp, Hash)                                                 \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_NODE(Key, Val, Name, RB)                                                               \
+                                                                                                                \
+    static inline void ztree__filter_drop_##Name(ztree_filter *f, ztree_node_##Name *n)                         \
+    {                                                                                                           \
+        ztree__filter_sub(f, Hash(&n->key));                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_LINKED_CORE(Key, Name, Cmp, FILTER, RB)                                                     \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__descend_##Name(const ztree_##Name *t, Key k)                        \
+    {                                                                                                           \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    /* Filtered lookup that leaves the stats alone, for removals and takes. */                                  \
+    static inline ztree_node_##Name *ztree__find_##Name(ztree_##Name *t, Key k)                                 \
+    {                                                                                                           \
+        return (t->root && ztree__filter_test(&t->filter, Hash(&k))) ? ztree__descend_##Name(t, k) : NULL;      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        t->filter.stats.lookups++;                                                                              \
+        if (!t->root || !ztree__filter_test(&t->filter, Hash(&k)))                                              \
+        {                                                                                                       \
+            t->filter.stats.rejected++;                                                                         \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        ztree_node_##Name *x = ztree__descend_##Name(t, k);                                                     \
+        if (!x)                                                                                                 \
+        {                                                                                                       \
+            t->filter.stats.false_positives++;                                                                  \
+        }                                                                                                       \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_node_##Name *z = ztree__find_##Name(t, k);                                                        \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        ztree__drop_##Name(t, z);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return curr;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PAIR_OPS(Key, Val, Name, ztree__find_##Name)                                                \
+                                                                                                                \
+    static inline ztree_filter_stats ztree_stats_##Name(const ztree_##Name *t)                                  \
+    {                                                                                                           \
+        return t->filter.stats;                                                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__filter_note_##Name(ztree_##Name *t, ztree_node_##Name *z)                         \
+    {                                                                                                           \
+        /* Growing re-adds every key from the tree, so a failed allocation only costs precision. */             \
+        ztree_filter *f = &t->filter;                                                                           \
+        if (ztree__filter_wants_grow(f, t->size) && Z_OK == ztree__filter_alloc(f, t->size))                    \
+        {                                                                                                       \
+            for (ztree_node_##Name *n = t->leftmost; n; n = ztree_next_##Name(n))                               \
+            {                                                                                                   \
+                ztree__filter_add(f, Hash(&n->key));                                                            \
+            }                                                                                                   \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__filter_add(f, Hash(&z->key));                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_tune_filter_##Name(ztree_##Name *t, unsigned bits_per_key)                          \
+    {                                                                                                           \
+        /* Sets the counters per key of this tree (1..64) and rebuilds its filter at the new rate. On Z_ENOMEM  \
+         * the tree keeps its old filter and rate. */                                                           \
+        ztree_filter *f = &t->filter;                                                                           \
+        unsigned old = f->bits_per_key;                                                                         \
+        if (bits_per_key < 1 || bits_per_key > 64)                                                              \
+        {                                                                                                       \
+            return Z_EINVAL;                                                                                    \
+        }                                                                                                       \
+        f->bits_per_key = bits_per_key;                                                                         \
+        if (!f->counters)                                                                                       \
+        {                                                                                                       \
+            return Z_OK;                                                                                        \
+        }                                                                                                       \
+        if (Z_OK != ztree__filter_alloc(f, t->size))                                                            \
+        {                                                                                                       \
+            f->bits_per_key = old;                                                                              \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        for (ztree_node_##Name *n = t->leftmost; n; n = ztree_next_##Name(n))                                   \
+        {                                                                                                       \
+            ztree__filter_add(f, Hash(&n->key));                                                                \
+        }                                                                                                       \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        int cmp = 0;                                                                                            \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            y = x;                                                                                              \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree__link_##Name(t, y, z, cmp < 0);                                                                   \
+        ztree__filter_note_##Name(t, z);                                                                        \
+        return Z_OK;                                                                                            \
+    }
+
+#define ZTREE__GENERATE_STACK_CURSOR(Key, Name, Cmp)                                                            \
+                                                                                                                \
+    static inline ztree_cursor_##Name ztree_cursor_init_##Name(ztree_##Name *t)                                 \
+    {                                                                                                           \
+        ztree_cursor_##Name c;                                                                                  \
+        c.tree = t;                                                                                             \
+        c.depth = 0;                                                                                            \
+        return c;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_get_##Name(ztree_cursor_##Name *c)                            \
+    {                                                                                                           \
+        return c->depth ? c->stack[c->depth - 1] : NULL;                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cursor_descend_##Name(ztree_cursor_##Name *c,                       \
+                                                                  ztree_node_##Name *n, int right)              \
+    {                                                                                                           \
+        while (n)                                                                                               \
+        {                                                                                                       \
+            c->stack[c->depth++] = n;                                                                           \
+            n = right ? n->right : n->left;                                                                     \
+        }                                                                                                       \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_first_##Name(ztree_cursor_##Name *c)                          \
+    {                                                                                                           \
+        c->depth = 0;                                                                                           \
+        return ztree__cursor_descend_##Name(c, c->tree->root, 0);                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_last_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        c->depth = 0;                                                                                           \
+        return ztree__cursor_descend_##Name(c, c->tree->root, 1);                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_next_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        if (!c->depth)                                                                                          \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        ztree_node_##Name *n = c->stack[c->depth - 1];                                                          \
+        if (n->right)                                                                                           \
+        {                                                                                                       \
+            return ztree__cursor_descend_##Name(c, n->right, 0);                                                \
+        }                                                                                                       \
+        do                                                                                                      \
+        {                                                                                                       \
+            n = c->stack[--c->depth];                                                                           \
+        } while (c->depth && c->stack[c->depth - 1]->right == n);                                               \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_prev_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        if (!c->depth)                                                                                          \
+        {                                                                                                       \
+            return ztree_cursor_last_##Name(c);                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *n = c->stack[c->depth - 1];                                                          \
+        if (n->left)                                                                                            \
+        {                                                                                                       \
+            return ztree__cursor_descend_##Name(c, n->left, 1);                                                 \
+        }                                                                                                       \
+        do                                                                                                      \
+        {                                                                                                       \
+            n = c->stack[--c->depth];                                                                           \
+        } while (c->depth && c->stack[c->depth - 1]->left == n);                                                \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_seek_##Name(ztree_cursor_##Name *c, Key k)                    \
+    {                                                                                                           \
+        ztree_node_##Name *n = c->tree->root;                                                                   \
+        int best = 0;                                                                                           \
+        c->depth = 0;                                                                                           \
+        while (n)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &n->key);                                                                         \
+            c->stack[c->depth++] = n;                                                                           \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return n;                                                                                       \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                best = c->depth;                                                                                \
+                n = n->left;                                                                                    \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                n = n->right;                                                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+        c->depth = best;                                                                                        \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }
+
+
+// Rotations and red-black fixups for trees without parent links, driven by an explicit root-to-node path.
+// Every node written goes through Own first (see ZTREE__KEEP_NODE), so copy-on-write trees reuse them.
+#define ZTREE__GENERATE_PATH_BALANCE(Name, Own)                                                                 \
+                                                                                                                \
+    static inline void ztree__relink_##Name(ztree_##Name *t, ztree_node_##Name *parent,                         \
+                                            ztree_node_##Name *old, ztree_node_##Name *n)                       \
+    {                                                                                                           \
+        if (!parent)                                                                                            \
+        {                                                                                                       \
+            t->root = n;                                                                                        \
+        }                                                                                                       \
+        else if (parent->left == old)                                                                           \
+        {                                                                                                       \
+            parent->left = n;                                                                                   \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            parent->right = n;                                                                                  \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__rot_l_##Name(ztree_##Name *t, ztree_node_##Name *parent,            \
+                                                         ztree_node_##Name *x)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *y = x->right;                                                                        \
+        x->right = y->left;                                                                                     \
+        y->left = x;                                                                                            \
+        ztree__relink_##Name(t, parent, x, y);                                                                  \
+        return y;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__rot_r_##Name(ztree_##Name *t, ztree_node_##Name *parent,            \
+                                                         ztree_node_##Name *y)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *x = y->left;                                                                         \
+        y->left = x->right;                                                                                     \
+        x->right = y;                                                                                           \
+        ztree__relink_##Name(t, parent, y, x);                                                                  \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_ins_##Name(ztree_##Name *t, ztree_node_##Name **path, int i)                  \
+    {                                                                                                           \
+        /* path[i] is the new red node and path[0..i-1] its ancestors; a red parent is never the root. */       \
+        while (i > 0 && ZTREE_RED == path[i - 1]->color)                                                        \
+        {                                                                                                       \
+            ztree_node_##Name *z = path[i], *p = path[i - 1], *g = path[i - 2];                                 \
+            ztree_node_##Name *gg = (i > 2) ? path[i - 3] : NULL;                                               \
+            if (p == g->left)                                                                                   \
+            {                                                                                                   \
+                ztree_node_##Name *u = g->right;                                                                \
+                if (u && ZTREE_RED == u->color)                                                                 \
+                {                                                                                               \
+                    u = Own(Name, t, g, u);                                                                     \
+                    p->color = ZTREE_BLACK;                                                                     \
+                    u->color = ZTREE_BLACK;                                                                     \
+                    g->color = ZTREE_RED;                                                                       \
+                    i -= 2;                                                                                     \
+                    continue;                                                                                   \
+                }                                                                                               \
+                if (z == p->right)                                                                              \
+                {                                                                                               \
+                    p = ztree__rot_l_##Name(t, g, p);                                                           \
+                }                                                                                               \
+                p->color = ZTREE_BLACK;                                                                         \
+                g->color = ZTREE_RED;                                                                           \
+                ztree__rot_r_##Name(t, gg, g);                                                                  \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree_node_##Name *u = g->left;                                                                 \
+                if (u && ZTREE_RED == u->color)                                                                 \
+                {                                                                                               \
+                    u = Own(Name, t, g, u);                                                                     \
+                    p->color = ZTREE_BLACK;                                                                     \
+                    u->color = ZTREE_BLACK;                                                                     \
+                    g->color = ZTREE_RED;                                                                       \
+                    i -= 2;                                                                                     \
+                    continue;                                                                                   \
+                }                                                                                               \
+                if (z == p->left)                                                                               \
+                {                                                                                               \
+                    p = ztree__rot_r_##Name(t, g, p);                                                           \
+                }                                                                                               \
+                p->color = ZTREE_BLACK;                                                                         \
+                g->color = ZTREE_RED;                                                                           \
+                ztree__rot_l_##Name(t, gg, g);                                                                  \
+            }                                                                                                   \
+            break;                                                                                              \
+        }                                                                                                       \
+        t->root->color = ZTREE_BLACK;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_del_##Name(ztree_##Name *t, ztree_node_##Name **path, int top,                \
+                                             ztree_node_##Name *x)                                              \
+    {                                                                                                           \
+        /* path[0..top-1] are the ancestors of x's (possibly empty) position. */                                \
+        while (top > 0 && (!x || ZTREE_BLACK == x->color))                                                      \
+        {                                                                                                       \
+            ztree_node_##Name *p = path[top - 1];                                                               \
+            ztree_node_##Name *g = (top > 1) ? path[top - 2] : NULL;                                            \
+            if (x == p->left)                                                                                   \
+            {                                                                                                   \
+                ztree_node_##Name *w = Own(Name, t, p, p->right);                                               \
+                if (ZTREE_RED == w->color)                                                                      \
+                {                                                                                               \
+                    w->color = ZTREE_BLACK;                                                                     \
+                    p->color = ZTREE_RED;                                                                       \
+                    ztree__rot_l_##Name(t, g, p);                                                               \
+                    path[top - 1] = g = w;                                                                      \
+                    path[top++] = p;                                                                            \
+                    w = Own(Name, t, p, p->right);                                                              \
+                }                                                                                               \
+                if ((!w->left || ZTREE_BLACK == w->left->color) &&                                              \
+                    (!w->right || ZTREE_BLACK == w->right->color))                                              \
+                {                                                                                               \
+                    w->color = ZTREE_RED;                                                                       \
+                    x = p;                                                                                      \
+                    top--;                                                                                      \
+                    continue;                                                                                   \
+                }                                                                                               \
+                if (!w->right || ZTREE_BLACK == w->right->color)                                                \
+                {                                                                                               \
+                    Own(Name, t, w, w->left)->color = ZTREE_BLACK;                                              \
+                    w->color = ZTREE_RED;                                                                       \
+                    w = ztree__rot_r_##Name(t, p, w);                                                           \
+                }                                                                                               \
+                w->color = p->color;                                                                            \
+                p->color = ZTREE_BLACK;                                                                         \
+                if (w->right)                                                                                   \
+                {                                                                                               \
+                    Own(Name, t, w, w->right)->color = ZTREE_BLACK;                                             \
+                }                                                                                               \
+                ztree__rot_l_##Name(t, g, p);                                                                   \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree_node_##Name *w = Own(Name, t, p, p->left);                                                \
+                if (ZTREE_RED == w->color)                                                                      \
+                {                                                                                               \
+                    w->color = ZTREE_BLACK;                                                                     \
+                    p->color = ZTREE_RED;                                                                       \
+                    ztree__rot_r_##Name(t, g, p);                                                               \
+                    path[top - 1] = g = w;                                                                      \
+                    path[top++] = p;                                                                            \
+                    w = Own(Name, t, p, p->left);                                                               \
+                }                                                                                               \
+                if ((!w->right || ZTREE_BLACK == w->right->color) &&                                            \
+                    (!w->left || ZTREE_BLACK == w->left->color))                                                \
+                {                                                                                               \
+                    w->color = ZTREE_RED;                                                                       \
+                    x = p;                                                                                      \
+                    top--;                                                                                      \
+                    continue;                                                                                   \
+                }                                                                                               \
+                if (!w->left || ZTREE_BLACK == w->left->color)                                                  \
+                {                                                                                               \
+                    Own(Name, t, w, w->right)->color = ZTREE_BLACK;                                             \
+                    w->color = ZTREE_RED;                                                                       \
+                    w = ztree__rot_l_##Name(t, p, w);                                                           \
+                }                                                                                               \
+                w->color = p->color;                                                                            \
+                p->color = ZTREE_BLACK;                                                                         \
+                if (w->left)                                                                                    \
+                {                                                                                               \
+                    Own(Name, t, w, w->left)->color = ZTREE_BLACK;                                              \
+                }                                                                                               \
+                ztree__rot_r_##Name(t, g, p);                                                                   \
+            }                                                                                                   \
+            /* The rotated-in root of this subtree took p's color, so nothing is left to repaint. */            \
+            return;                                                                                             \
+        }                                                                                                       \
+        if (x && ZTREE_RED == x->color)                                                                         \
+        {                                                                                                       \
+            Own(Name, t, (top > 0) ? path[top - 1] : NULL, x)->color = ZTREE_BLACK;                             \
+        }                                                                                                       \
+    }
+
+// Update side of a copy-on-write red-black tree: nodes a reader might still see are copied before being
+// written, and the Policy hooks say which nodes those are and what becomes of the replaced ones.
+#define ZTREE__GENERATE_COW_CORE(Key, Val, Name, Cmp, Policy)                                                   \
+                                                                                                                \
+    static inline int ztree__cow_reserve_##Name(ztree_##Name *t)                                                \
+    {                                                                                                           \
+        /* Tops up the spare nodes so one update can never run out halfway: a red-black path is at most         \
+         * 2 log2(n + 1) long, and an update copies that path plus about one sibling per level. */              \
+        size_t need = 8;                                                                                        \
+        for (size_t n = t->size + 1; n; n >>= 1)                                                                \
+        {                                                                                                       \
+            need += 4;                                                                                          \
+        }                                                                                                       \
+        while (t->nspare < need)                                                                                \
+        {                                                                                                       \
+            ZTREE_NEW_NODE(ztree_node_##Name, n);                                                               \
+            if (!n)                                                                                             \
+            {                                                                                                   \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            n->left = t->spare;                                                                                 \
+            t->spare = n;                                                                                       \
+            t->nspare++;                                                                                        \
+        }                                                                                                       \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cow_spare_##Name(ztree_##Name *t)                                   \
+    {                                                                                                           \
+        ztree_node_##Name *n = t->spare;                                                                        \
+        t->spare = n->left;                                                                                     \
+        t->nspare--;                                                                                            \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__cow_drain_##Name(ztree_##Name *t)                                                 \
+    {                                                                                                           \
+        while (t->spare)                                                                                        \
+        {                                                                                                       \
+            ZTREE_FREE_NODE(ztree__cow_spare_##Name(t));                                                        \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cow_own_##Name(ztree_##Name *t, ztree_node_##Name *parent,          \
+                                                           ztree_node_##Name *n);                               \
+                                                                                                                \
+    ZTREE__GENERATE_PATH_BALANCE(Name, ZTREE__COW_OWN)                                                          \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cow_own_##Name(ztree_##Name *t, ztree_node_##Name *parent,          \
+                                                           ztree_node_##Name *n)                                \
+    {                                                                                                           \
+        /* Returns `n` if this update may write to it, otherwise a private copy linked in its place. */         \
+        if (!ZTREE__##Policy##_SHARED(t, n))                                                                    \
+        {                                                                                                       \
+            return n;                                                                                           \
+        }                                                                                                       \
+        ztree_node_##Name *c = ztree__cow_spare_##Name(t);                                                      \
+        /* Field by field: a struct copy would also read the policy's own fields, which PERSIST readers         \
+         * update concurrently. The COPIED hook sets those. */                                                  \
+        c->key = n->key;                                                                                        \
+        c->value = n->value;                                                                                    \
+        c->color = n->color;                                                                                    \
+        c->left = n->left;                                                                                      \
+        c->right = n->right;                                                                                    \
+        ZTREE__##Policy##_COPIED(Name, t, n, c);                                                                \
+        ztree__relink_##Name(t, parent, n, c);                                                                  \
+        return c;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cow_find_##Name(ztree_node_##Name *x, Key k)                        \
+    {                                                                                                           \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__cow_lower_bound_##Name(ztree_node_##Name *x, Key k)                 \
+    {                                                                                                           \
+        ztree_node_##Name *res = NULL;                                                                          \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = x;                                                                                        \
+                x = x->left;                                                                                    \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                x = x->right;                                                                                   \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__cow_insert_##Name(ztree_##Name *t, Key k, Val v)                                   \
+    {                                                                                                           \
+        /* Copies the search path on the way down, so every node the fixups may rotate is already private. */   \
+        if (Z_OK != ztree__cow_reserve_##Name(t))                                                               \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree_node_##Name *path[ZTREE_CURSOR_DEPTH];                                                            \
+        ztree_node_##Name *x = t->root, *parent = NULL;                                                         \
+        int d = 0, cmp = 0;                                                                                     \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            x = ztree__cow_own_##Name(t, parent, x);                                                            \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            path[d++] = parent = x;                                                                             \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__cow_spare_##Name(t);                                                      \
+        z->key = k;                                                                                             \
+        z->value = v;                                                                                           \
+        z->color = ZTREE_RED;                                                                                   \
+        z->left = z->right = NULL;                                                                              \
+        ZTREE__##Policy##_FRESH(t, z);                                                                          \
+        if (!parent)                                                                                            \
+        {                                                                                                       \
+            t->root = z;                                                                                        \
+        }                                                                                                       \
+        else if (cmp < 0)                                                                                       \
+        {                                                                                                       \
+            parent->left = z;                                                                                   \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            parent->right = z;                                                                                  \
+        }                                                                                                       \
+        path[d] = z;                                                                                            \
+        ztree__fix_ins_##Name(t, path, d);                                                                      \
+        t->size++;                                                                                              \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__cow_take_##Name(ztree_##Name *t, Key k, Val *out_val)                              \
+    {                                                                                                           \
+        /* Searches read-only first, so a miss copies nothing. */                                               \
+        if (!ztree__cow_find_##Name(t->root, k))                                                                \
+        {                                                                                                       \
+            return Z_ENOTFOUND;                                                                                 \
+        }                                                                                                       \
+        if (Z_OK != ztree__cow_reserve_##Name(t))                                                               \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree_node_##Name *path[ZTREE_CURSOR_DEPTH];                                                            \
+        ztree_node_##Name *z = t->root, *zp = NULL, *x;                                                         \
+        int d = 0, top;                                                                                         \
+        for (;;)                                                                                                \
+        {                                                                                                       \
+            z = ztree__cow_own_##Name(t, zp, z);                                                                \
+            path[d++] = z;                                                                                      \
+            int cmp = Cmp(&k, &z->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                break;                                                                                          \
+            }                                                                                                   \
+            zp = z;                                                                                             \
+            z = (cmp < 0) ? z->left : z->right;                                                                 \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = z->value;                                                                                \
+        }                                                                                                       \
+        int zi = d - 1;                                                                                         \
+        ztree_color removed = z->color;                                                                         \
+        if (!z->left || !z->right)                                                                              \
+        {                                                                                                       \
+            x = z->left ? z->left : z->right;                                                                   \
+            ztree__relink_##Name(t, zp, z, x);                                                                  \
+            top = zi;                                                                                           \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            path[d] = ztree__cow_own_##Name(t, z, z->right);                                                    \
+            d++;                                                                                                \
+            while (path[d - 1]->left)                                                                           \
+            {                                                                                                   \
+                path[d] = ztree__cow_own_##Name(t, path[d - 1], path[d - 1]->left);                             \
+                d++;                                                                                            \
+            }                                                                                                   \
+            ztree_node_##Name *y = path[d - 1];                                                                 \
+            removed = y->color;                                                                                 \
+            x = y->right;                                                                                       \
+            if (y != z->right)                                                                                  \
+            {                                                                                                   \
+                path[d - 2]->left = x;                                                                          \
+                y->right = z->right;                                                                            \
+            }                                                                                                   \
+            y->left = z->left;                                                                                  \
+            y->color = z->color;                                                                                \
+            ztree__relink_##Name(t, zp, z, y);                                                                  \
+            path[zi] = y;                                                                                       \
+            top = d - 1;                                                                                        \
+        }                                                                                                       \
+        if (ZTREE_BLACK == removed)                                                                             \
+        {                                                                                                       \
+            ztree__fix_del_##Name(t, path, top, x);                                                             \
+        }                                                                                                       \
+        ZTREE__##Policy##_DISCARD(Name, t, z);                                                                  \
+        t->size--;                                                                                              \
+        return Z_OK;                                                                                            \
+    }
+
+#define ZTREE_GENERATE_COMPACT_IMPL(Key, Val, Name, Cmp)                                                        \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *left, *right;                                                                 \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name *root;                                                                                \
+        size_t size;                                                                                            \
+        ztree_node_##Name *leftmost, *rightmost;                                                                \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name *tree;                                                                                     \
+        int depth;                                                                                              \
+        ztree_node_##Name *stack[ZTREE_CURSOR_DEPTH];                                                           \
+    } ztree_cursor_##Name;                                                                                      \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t = {NULL, 0, NULL, NULL};                                                                 \
+        return t;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__new_##Name(Key k, Val v)                                            \
+    {                                                                                                           \
+        ZTREE_NEW_NODE(ztree_node_##Name, n);                                                                   \
+        if (n)                                                                                                  \
+        {                                                                                                       \
+            n->key = k;                                                                                         \
+            n->value = v;                                                                                       \
+            n->color = ZTREE_RED;                                                                               \
+            n->left = n->right = NULL;                                                                          \
+        }                                                                                                       \
+        return n;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__free_rec_##Name(ztree_node_##Name *n)                                             \
+    {                                                                                                           \
+        while (n)                                                                                               \
+        {                                                                                                       \
+            ztree__free_rec_##Name(n->left);                                                                    \
+            ztree_node_##Name *right = n->right;                                                                \
+            ZTREE_FREE_NODE(n);                                                                                 \
+            n = right;                                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        ztree__free_rec_##Name(t->root);                                                                        \
+        t->root = t->leftmost = t->rightmost = NULL;                                                            \
+        t->size = 0;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_PATH_BALANCE(Name, ZTREE__KEEP_NODE)                                                        \
+                                                                                                                \
+    static inline void ztree__unlink_##Name(ztree_##Name *t, ztree_node_##Name **path, int d)                   \
+    {                                                                                                           \
+        /* path[0..d-1] runs from the root to the node being removed. */                                        \
+        int zi = d - 1, top;                                                                                    \
+        ztree_node_##Name *z = path[zi], *x;                                                                    \
+        ztree_node_##Name *zp = (zi > 0) ? path[zi - 1] : NULL;                                                 \
+        ztree_color removed = z->color;                                                                         \
+        if (z == t->leftmost)                                                                                   \
+        {                                                                                                       \
+            ztree_node_##Name *n = z->right;                                                                    \
+            while (n && n->left)                                                                                \
+            {                                                                                                   \
+                n = n->left;                                                                                    \
+            }                                                                                                   \
+            t->leftmost = n ? n : zp;                                                                           \
+        }                                                                                                       \
+        if (z == t->rightmost)                                                                                  \
+        {                                                                                                       \
+            ztree_node_##Name *n = z->left;                                                                     \
+            while (n && n->right)                                                                               \
+            {                                                                                                   \
+                n = n->right;                                                                                   \
+            }                                                                                                   \
+            t->rightmost = n ? n : zp;                                                                          \
+        }                                                                                                       \
+        if (!z->left || !z->right)                                                                              \
+        {                                                                                                       \
+            x = z->left ? z->left : z->right;                                                                   \
+            ztree__relink_##Name(t, zp, z, x);                                                                  \
+            top = zi;                                                                                           \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            path[d++] = z->right;                                                                               \
+            while (path[d - 1]->left)                                                                           \
+            {                                                                                                   \
+                path[d] = path[d - 1]->left;                                                                    \
+                d++;                                                                                            \
+            }                                                                                                   \
+            ztree_node_##Name *y = path[d - 1];                                                                 \
+            removed = y->color;                                                                                 \
+            x = y->right;                                                                                       \
+            if (y != z->right)                                                                                  \
+            {                                                                                                   \
+                path[d - 2]->left = x;                                                                          \
+                y->right = z->right;                                                                            \
+            }                                                                                                   \
+            y->left = z->left;                                                                                  \
+            y->color = z->color;                                                                                \
+            ztree__relink_##Name(t, zp, z, y);                                                                  \
+            path[zi] = y;                                                                                       \
+            top = d - 1;                                                                                        \
+        }                                                                                                       \
+        if (ZTREE_BLACK == removed)                                                                             \
+        {                                                                                                       \
+            ztree__fix_del_##Name(t, path, top, x);                                                             \
+        }                                                                                                       \
+        t->size--;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return NULL;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
+        while (curr)                                                                                            \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &curr->key);                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return curr;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                res = curr;                                                                                     \
+                curr = curr->left;                                                                              \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                curr = curr->right;                                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        return res;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return t->leftmost;                                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_max_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return t->rightmost;                                                                                    \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        ztree_node_##Name *path[ZTREE_CURSOR_DEPTH];                                                            \
+        ztree_node_##Name *x = t->root;                                                                         \
+        int d = 0, cmp = 0;                                                                                     \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            cmp = Cmp(&k, &x->key);                                                                             \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                x->value = v;                                                                                   \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            path[d++] = x;                                                                                      \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
+        if (!z)                                                                                                 \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        if (0 == d)                                                                                             \
+        {                                                                                                       \
+            t->root = t->leftmost = t->rightmost = z;                                                           \
+        }                                                                                                       \
+        else if (cmp < 0)                                                                                       \
+        {                                                                                                       \
+            path[d - 1]->left = z;                                                                              \
+            if (path[d - 1] == t->leftmost)                                                                     \
+            {                                                                                                   \
+                t->leftmost = z;                                                                                \
+            }                                                                                                   \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            path[d - 1]->right = z;                                                                             \
+            if (path[d - 1] == t->rightmost)                                                                    \
+            {                                                                                                   \
+                t->rightmost = z;                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+        path[d] = z;                                                                                            \
+        ztree__fix_ins_##Name(t, path, d);                                                                      \
+        t->size++;                                                                                              \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        ztree_node_##Name *path[ZTREE_CURSOR_DEPTH];                                                            \
+        ztree_node_##Name *x = t->root;                                                                         \
+        int d = 0;                                                                                              \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &x->key);                                                                         \
+            path[d++] = x;                                                                                      \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                if (out_val)                                                                                    \
+                {                                                                                               \
+                    *out_val = x->value;                                                                        \
+                }                                                                                               \
+                ztree__unlink_##Name(t, path, d);                                                               \
+                ZTREE_FREE_NODE(x);                                                                             \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            x = (cmp < 0) ? x->left : x->right;                                                                 \
+        }                                                                                                       \
+        return Z_ENOTFOUND;                                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_take_##Name(t, k, NULL);                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__pop_##Name(ztree_##Name *t, int right, Key *out_key, Val *out_val)                 \
+    {                                                                                                           \
+        ztree_node_##Name *path[ZTREE_CURSOR_DEPTH];                                                            \
+        ztree_node_##Name *x = t->root;                                                                         \
+        int d = 0;                                                                                              \
+        if (!x)                                                                                                 \
+        {                                                                                                       \
+            return Z_EEMPTY;                                                                                    \
+        }                                                                                                       \
+        while (x)                                                                                               \
+        {                                                                                                       \
+            path[d++] = x;                                                                                      \
+            x = right ? x->right : x->left;                                                                     \
+        }                                                                                                       \
+        x = path[d - 1];                                                                                        \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = x->key;                                                                                  \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = x->value;                                                                                \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, path, d);                                                                       \
+        ZTREE_FREE_NODE(x);                                                                                     \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, 0, out_key, out_val);                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, 1, out_key, out_val);                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_STACK_CURSOR(Key, Name, Cmp)
+
+#define ZTREE__GENERATE_INDEX_TYPES(Key, Val, Name, Storage)                                                    \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        uint32_t parent, left, right;                                                                           \
+        unsigned char color;                                                                                    \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        size_t size;                                                                                            \
+        uint32_t root, leftmost, rightmost;                                                                     \
+        uint32_t used, free_list, cap;                                                                          \
+        ztree_node_##Name Storage;                                                                              \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name *tree;                                                                                     \
+        uint32_t at;                                                                                            \
+    } ztree_cursor_##Name;
+
+#define ZTREE__GENERATE_INDEX_CORE(Key, Val, Name, Cmp)                                                         \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t;                                                                                         \
+        t.size = 0;                                                                                             \
+        t.root = t.leftmost = t.rightmost = ZTREE_NIL;                                                          \
+        t.used = 0;                                                                                             \
+        t.free_list = ZTREE_NIL;                                                                                \
+        ztree__storage_init_##Name(&t);                                                                         \
+        return t;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        /* Nodes own nothing, so dropping the whole pool is the entire teardown. */                             \
+        ztree__storage_release_##Name(t);                                                                       \
+        t->size = 0;                                                                                            \
+        t->root = t->leftmost = t->rightmost = ZTREE_NIL;                                                       \
+        t->used = 0;                                                                                            \
+        t->free_list = ZTREE_NIL;                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_reserve_##Name(ztree_##Name *t, size_t n)                                           \
+    {                                                                                                           \
+        return (n <= t->cap) ? Z_OK : ztree__storage_grow_##Name(t, n);                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline uint32_t ztree__alloc_##Name(ztree_##Name *t)                                                 \
+    {                                                                                                           \
+        uint32_t i = t->free_list;                                                                              \
+        if (ZTREE_NIL != i)                                                                                     \
+        {                                                                                                       \
+            t->free_list = t->nodes[i].left;                                                                    \
+            return i;                                                                                           \
+        }                                                                                                       \
+        if (t->used == t->cap && Z_OK != ztree__storage_grow_##Name(t, (size_t)t->used + 1))                    \
+        {                                                                                                       \
+            return ZTREE_NIL;                                                                                   \
+        }                                                                                                       \
+        return t->used++;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__release_##Name(ztree_##Name *t, uint32_t i)                                       \
+    {                                                                                                           \
+        t->nodes[i].left = t->free_list;                                                                        \
+        t->free_list = i;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__at_##Name(ztree_##Name *t, uint32_t i)                              \
+    {                                                                                                           \
+        return (ZTREE_NIL == i) ? NULL : &t->nodes[i];                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__replace_child_##Name(ztree_##Name *t, uint32_t p, uint32_t old, uint32_t now)     \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        if (ZTREE_NIL == p)                                                                                     \
+        {                                                                                                       \
+            t->root = now;                                                                                      \
+        }                                                                                                       \
+        else if (old == nd[p].left)                                                                             \
+        {                                                                                                       \
+            nd[p].left = now;                                                                                   \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            nd[p].right = now;                                                                                  \
+        }                                                                                                       \
+        if (ZTREE_NIL != now)                                                                                   \
+        {                                                                                                       \
+            nd[now].parent = p;                                                                                 \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rot_l_##Name(ztree_##Name *t, uint32_t x)                                         \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        uint32_t y = nd[x].right;                                                                               \
+        nd[x].right = nd[y].left;                                                                               \
+        if (ZTREE_NIL != nd[y].left)                                                                            \
+        {                                                                                                       \
+            nd[nd[y].left].parent = x;                                                                          \
+        }                                                                                                       \
+        ztree__replace_child_##Name(t, nd[x].parent, x, y);                                                     \
+        nd[y].left = x;                                                                                         \
+        nd[x].parent = y;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rot_r_##Name(ztree_##Name *t, uint32_t y)                                         \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        uint32_t x = nd[y].left;                                                                                \
+        nd[y].left = nd[x].right;                                                                               \
+        if (ZTREE_NIL != nd[x].right)                                                                           \
+        {                                                                                                       \
+            nd[nd[x].right].parent = y;                                                                         \
+        }                                                                                                       \
+        ztree__replace_child_##Name(t, nd[y].parent, y, x);                                                     \
+        nd[x].right = y;                                                                                        \
+        nd[y].parent = x;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__is_red_##Name(const ztree_node_##Name *nd, uint32_t i)                             \
+    {                                                                                                           \
+        return ZTREE_NIL != i && ZTREE_RED == nd[i].color;                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_ins_##Name(ztree_##Name *t, uint32_t z)                                       \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        while (ztree__is_red_##Name(nd, nd[z].parent))                                                          \
+        {                                                                                                       \
+            uint32_t p = nd[z].parent, g = nd[p].parent;                                                        \
+            int left = (p == nd[g].left);                                                                       \
+            uint32_t y = left ? nd[g].right : nd[g].left;                                                       \
+            if (ztree__is_red_##Name(nd, y))                                                                    \
+            {                                                                                                   \
+                nd[p].color = ZTREE_BLACK;                                                                      \
+                nd[y].color = ZTREE_BLACK;                                                                      \
+                nd[g].color = ZTREE_RED;                                                                        \
+                z = g;                                                                                          \
+                continue;                                                                                       \
+            }                                                                                                   \
+            if (z == (left ? nd[p].right : nd[p].left))                                                         \
+            {                                                                                                   \
+                z = p;                                                                                          \
+                if (left)                                                                                       \
+                {                                                                                               \
+                    ztree__rot_l_##Name(t, z);                                                                  \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    ztree__rot_r_##Name(t, z);                                                                  \
+                }                                                                                               \
+                p = nd[z].parent;                                                                               \
+            }                                                                                                   \
+            nd[p].color = ZTREE_BLACK;                                                                          \
+            nd[g].color = ZTREE_RED;                                                                            \
+            if (left)                                                                                           \
+            {                                                                                                   \
+                ztree__rot_r_##Name(t, g);                                                                      \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree__rot_l_##Name(t, g);                                                                      \
+            }                                                                                                   \
+        }                                                                                                       \
+        nd[t->root].color = ZTREE_BLACK;                                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__fix_del_##Name(ztree_##Name *t, uint32_t x, uint32_t p)                           \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        while (x != t->root && !ztree__is_red_##Name(nd, x))                                                    \
+        {                                                                                                       \
+            int left = (x == nd[p].left);                                                                       \
+            uint32_t w = left ? nd[p].right : nd[p].left;                                                       \
+            if (ZTREE_RED == nd[w].color)                                                                       \
+            {                                                                                                   \
+                nd[w].color = ZTREE_BLACK;                                                                      \
+                nd[p].color = ZTREE_RED;                                                                        \
+                if (left)                                                                                       \
+                {                                                                                               \
+                    ztree__rot_l_##Name(t, p);                                                                  \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    ztree__rot_r_##Name(t, p);                                                                  \
+                }                                                                                               \
+                w = left ? nd[p].right : nd[p].left;                                                            \
+            }                                                                                                   \
+            uint32_t nephew_in = left ? nd[w].left : nd[w].right;                                               \
+            uint32_t nephew_out = left ? nd[w].right : nd[w].left;                                              \
+            if (!ztree__is_red_##Name(nd, nephew_in) && !ztree__is_red_##Name(nd, nephew_out))                  \
+            {                                                                                                   \
+                nd[w].color = ZTREE_RED;                                                                        \
+                x = p;                                                                                          \
+                p = nd[x].parent;                                                                               \
+                continue;                                                                                       \
+            }                                                                                                   \
+            if (!ztree__is_red_##Name(nd, nephew_out))                                                          \
+            {                                                                                                   \
+                nd[nephew_in].color = ZTREE_BLACK;                                                              \
+                nd[w].color = ZTREE_RED;                                                                        \
+                if (left)                                                                                       \
+                {                                                                                               \
+                    ztree__rot_r_##Name(t, w);                                                                  \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    ztree__rot_l_##Name(t, w);                                                                  \
+                }                                                                                               \
+                w = left ? nd[p].right : nd[p].left;                                                            \
+                nephew_out = left ? nd[w].right : nd[w].left;                                                   \
+            }                                                                                                   \
+            nd[w].color = nd[p].color;                                                                          \
+            nd[p].color = ZTREE_BLACK;                                                                          \
+            nd[nephew_out].color = ZTREE_BLACK;                                                                 \
+            if (left)                                                                                           \
+            {                                                                                                   \
+                ztree__rot_l_##Name(t, p);                                                                      \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                ztree__rot_r_##Name(t, p);                                                                      \
+            }                                                                                                   \
+            x = t->root;                                                                                        \
+        }                                                                                                       \
+        if (ZTREE_NIL != x)                                                                                     \
+        {                                                                                                       \
+            nd[x].color = ZTREE_BLACK;                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline uint32_t ztree__step_##Name(const ztree_##Name *t, uint32_t i, int right)                     \
+    {                                                                                                           \
+        const ztree_node_##Name *nd = t->nodes;                                                                 \
+        uint32_t c = right ? nd[i].right : nd[i].left;                                                          \
+        if (ZTREE_NIL != c)                                                                                     \
+        {                                                                                                       \
+            while (ZTREE_NIL != (right ? nd[c].left : nd[c].right))                                             \
+            {                                                                                                   \
+                c = right ? nd[c].left : nd[c].right;                                                           \
+            }                                                                                                   \
+            return c;                                                                                           \
+        }                                                                                                       \
+        uint32_t p = nd[i].parent;                                                                              \
+        while (ZTREE_NIL != p && i == (right ? nd[p].right : nd[p].left))                                       \
+        {                                                                                                       \
+            i = p;                                                                                              \
+            p = nd[p].parent;                                                                                   \
+        }                                                                                                       \
+        return p;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline uint32_t ztree__find_idx_##Name(ztree_##Name *t, Key k)                                       \
+    {                                                                                                           \
+        uint32_t x = t->root;                                                                                   \
+        while (ZTREE_NIL != x)                                                                                  \
+        {                                                                                                       \
+            int cmp = Cmp(&k, &t->nodes[x].key);                                                                \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                return x;                                                                                       \
+            }                                                                                                   \
+            x = (cmp < 0) ? t->nodes[x].left : t->nodes[x].right;                                               \
+        }                                                                                                       \
+        return ZTREE_NIL;                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        return ztree__at_##Name(t, ztree__find_idx_##Name(t, k));                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline uint32_t ztree__lower_bound_idx_##Name(ztree_##Name *t, Key k)                                \
+    {                                                                                                           \
+        uint32_t x = t->root, best = ZTREE_NIL;                                                                 \
+        while (ZTREE_NIL != x)                                                                                  \
+        {                                                                                                       \
+            if (Cmp(&t->nodes[x].key, &k) >= 0)                                                                 \
+            {                                                                                                   \
+                best = x;                                                                                       \
+                x = t->nodes[x].left;                                                                           \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                x = t->nodes[x].right;                                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+        return best;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        return ztree__at_##Name(t, ztree__lower_bound_idx_##Name(t, k));                                        \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return ztree__at_##Name(t, t->leftmost);                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_max_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        return ztree__at_##Name(t, t->rightmost);                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    {                                                                                                           \
+        uint32_t p = ZTREE_NIL, x = t->root;                                                                    \
+        int cmp = 0, is_min = 1, is_max = 1;                                                                    \
+        while (ZTREE_NIL != x)                                                                                  \
+        {                                                                                                       \
+            p = x;                                                                                              \
+            cmp = Cmp(&k, &t->nodes[x].key);                                                                    \
+            if (0 == cmp)                                                                                       \
+            {                                                                                                   \
+                t->nodes[x].value = v;                                                                          \
+                return Z_OK;                                                                                    \
+            }                                                                                                   \
+            if (cmp < 0)                                                                                        \
+            {                                                                                                   \
+                is_max = 0;                                                                                     \
+                x = t->nodes[x].left;                                                                           \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                is_min = 0;                                                                                     \
+                x = t->nodes[x].right;                                                                          \
+            }                                                                                                   \
+        }                                                                                                       \
+        /* Allocation may move the pool, so only indices survive across it. */                                  \
+        uint32_t z = ztree__alloc_##Name(t);                                                                    \
+        if (ZTREE_NIL == z)                                                                                     \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        nd[z].key = k;                                                                                          \
+        nd[z].value = v;                                                                                        \
+        nd[z].color = ZTREE_RED;                                                                                \
+        nd[z].parent = p;                                                                                       \
+        nd[z].left = nd[z].right = ZTREE_NIL;                                                                   \
+        if (ZTREE_NIL == p)                                                                                     \
+        {                                                                                                       \
+            t->root = z;                                                                                        \
+        }                                                                                                       \
+        else if (cmp < 0)                                                                                       \
+        {                                                                                                       \
+            nd[p].left = z;                                                                                     \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            nd[p].right = z;                                                                                    \
+        }                                                                                                       \
+        if (is_min)                                                                                             \
+        {                                                                                                       \
+            t->leftmost = z;                                                                                    \
+        }                                                                                                       \
+        if (is_max)                                                                                             \
+        {                                                                                                       \
+            t->rightmost = z;                                                                                   \
+        }                                                                                                       \
+        ztree__fix_ins_##Name(t, z);                                                                            \
+        t->size++;                                                                                              \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__unlink_##Name(ztree_##Name *t, uint32_t z)                                        \
+    {                                                                                                           \
+        ztree_node_##Name *nd = t->nodes;                                                                       \
+        if (z == t->leftmost)                                                                                   \
+        {                                                                                                       \
+            t->leftmost = ztree__step_##Name(t, z, 1);                                                          \
+        }                                                                                                       \
+        if (z == t->rightmost)                                                                                  \
+        {                                                                                                       \
+            t->rightmost = ztree__step_##Name(t, z, 0);                                                         \
+        }                                                                                                       \
+        uint32_t x, x_parent;                                                                                   \
+        unsigned char removed_color = nd[z].color;                                                              \
+        if (ZTREE_NIL == nd[z].left || ZTREE_NIL == nd[z].right)                                                \
+        {                                                                                                       \
+            x = (ZTREE_NIL == nd[z].left) ? nd[z].right : nd[z].left;                                           \
+            x_parent = nd[z].parent;                                                                            \
+            ztree__replace_child_##Name(t, nd[z].parent, z, x);                                                 \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            uint32_t y = nd[z].right;                                                                           \
+            while (ZTREE_NIL != nd[y].left)                                                                     \
+            {                                                                                                   \
+                y = nd[y].left;                                                                                 \
+            }                                                                                                   \
+            removed_color = nd[y].color;                                                                        \
+            x = nd[y].right;                                                                                    \
+            if (nd[y].parent == z)                                                                              \
+            {                                                                                                   \
+                x_parent = y;                                                                                   \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                x_parent = nd[y].parent;                                                                        \
+                ztree__replace_child_##Name(t, nd[y].parent, y, x);                                             \
+                nd[y].right = nd[z].right;                                                                      \
+                nd[nd[y].right].parent = y;                                                                     \
+            }                                                                                                   \
+            ztree__replace_child_##Name(t, nd[z].parent, z, y);                                                 \
+            nd[y].left = nd[z].left;                                                                            \
+            nd[nd[y].left].parent = y;                                                                          \
+            nd[y].color = nd[z].color;                                                                          \
+        }                                                                                                       \
+        if (ZTREE_BLACK == removed_color)                                                                       \
+        {                                                                                                       \
+            ztree__fix_del_##Name(t, x, x_parent);                                                              \
+        }                                                                                                       \
+        ztree__release_##Name(t, z);                                                                            \
+        t->size--;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        uint32_t z = ztree__find_idx_##Name(t, k);                                                              \
+        if (ZTREE_NIL != z)                                                                                     \
+        {                                                                                                       \
+            ztree__unlink_##Name(t, z);                                                                         \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        uint32_t z = ztree__find_idx_##Name(t, k);                                                              \
+        if (ZTREE_NIL == z)                                                                                     \
+        {                                                                                                       \
+            return Z_ENOTFOUND;                                                                                 \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = t->nodes[z].value;                                                                       \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__pop_##Name(ztree_##Name *t, int max, Key *out_key, Val *out_val)                   \
+    {                                                                                                           \
+        uint32_t z = max ? t->rightmost : t->leftmost;                                                          \
+        if (ZTREE_NIL == z)                                                                                     \
+        {                                                                                                       \
+            return Z_EEMPTY;                                                                                    \
+        }                                                                                                       \
+        if (out_key)                                                                                            \
+        {                                                                                                       \
+            *out_key = t->nodes[z].key;                                                                         \
+        }                                                                                                       \
+        if (out_val)                                                                                            \
+        {                                                                                                       \
+            *out_val = t->nodes[z].value;                                                                       \
+        }                                                                                                       \
+        ztree__unlink_##Name(t, z);                                                                             \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, 0, out_key, out_val);                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, 1, out_key, out_val);                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_cursor_##Name ztree_cursor_init_##Name(ztree_##Name *t)                                 \
+    {                                                                                                           \
+        ztree_cursor_##Name c;                                                                                  \
+        c.tree = t;                                                                                             \
+        c.at = ZTREE_NIL;                                                                                       \
+        return c;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_get_##Name(ztree_cursor_##Name *c)                            \
+    {                                                                                                           \
+        return ztree__at_##Name(c->tree, c->at);                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_first_##Name(ztree_cursor_##Name *c)                          \
+    {                                                                                                           \
+        c->at = c->tree->leftmost;                                                                              \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_last_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        c->at = c->tree->rightmost;                                                                             \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_next_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        if (ZTREE_NIL != c->at)                                                                                 \
+        {                                                                                                       \
+            c->at = ztree__step_##Name(c->tree, c->at, 1);                                                      \
+        }                                                                                                       \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_prev_##Name(ztree_cursor_##Name *c)                           \
+    {                                                                                                           \
+        c->at = (ZTREE_NIL == c->at) ? c->tree->rightmost : ztree__step_##Name(c->tree, c->at, 0);              \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_cursor_seek_##Name(ztree_cursor_##Name *c, Key k)                    \
+    {                                                                                                           \
+        c->at = ztree__lower_bound_idx_##Name(c->tree, k);                                                      \
+        return ztree_cursor_get_##Name(c);                                                                      \
+    }
+
+#define ZTREE_GENERATE_INDEX_IMPL(Key, Val, Name, Cmp)                                                          \
+                                                                                                                \
+    ZTREE__GENERATE_INDEX_TYPES(Key, Val, Name, *nodes)                                                         \
+                                                                                                                \
+    static inline void ztree__storage_init_##Name(ztree_##Name *t)                                              \
+    {                                                                                                           \
+        t->nodes = NULL;                                                                                        \
+        t->cap = 0;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__storage_release_##Name(ztree_##Name *t)                                           \
+    {                                                                                                           \
+        ZTREE_FREE(t->nodes);                                                                                   \
+        t->nodes = NULL;                                                                                        \
+        t->cap = 0;                                                                                             \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__storage_grow_##Name(ztree_##Name *t, size_t need)                                  \
+    {                                                                                                           \
+        if (need > ZTREE_INDEX_MAX)                                                                             \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        size_t cap = t->cap ? t->cap : 16;                                                                      \
+        while (cap < need)                                                                                      \
+        {                                                                                                       \
+            cap *= 2;                                                                                           \
+        }                                                                                                       \
+        if (cap > ZTREE_INDEX_MAX)                                                                              \
+        {                                                                                                       \
+            cap = ZTREE_INDEX_MAX;                                                                              \
+        }                                                                                                       \
+        size_t bytes = cap * sizeof(ztree_node_##Name);                                                         \
+        ztree_node_##Name *nodes = (ztree_node_##Name*)ZTREE_REALLOC(t->nodes, bytes);                          \
+        if (!nodes)                                                                                             \
+        {                                                                                                       \
+            return Z_ENOMEM;                                                                                    \
+        }                                                                                                       \
+        t->nodes = nodes;                                                                                       \
+        t->cap = (uint32_t)cap;                                                                                 \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_INDEX_CORE(Key, Val, Name, Cmp)
+
+#define ZTREE_GENERATE_FIXED_IMPL(Key, Val, Name, Cmp, Cap)                                                     \
+                                                                                                                \
+    ZTREE__GENERATE_INDEX_TYPES(Key, Val, Name, nodes[Cap])                                                     \
+                                                                                                                \
+    static inline void ztree__storage_init_##Name(ztree_##Name *t)                                              \
+    {                                                                                                           \
+        t->cap = (Cap);                                                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__storage_release_##Name(ztree_##Name *t)                                           \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__storage_grow_##Name(ztree_##Name *t, size_t need)                                  \
+    {                                                                                                           \
+        (void)t;                                                                                                \
+        (void)need;                                                                                             \
+        return Z_ENOMEM;                                                                                        \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_INDEX_CORE(Key, Val, Name, Cmp)
+
+// Single-writer map whose readers take no locks: updates copy the nodes they touch into a new version and
+// publish its root with one atomic store, while replaced nodes wait for epoch-based reclamation. Readers
+// bracket their lookups with ztree_rcu_read_lock / ztree_rcu_read_unlock; returned nodes stay valid until then.
+#define ZTREE_GENERATE_RCU_IMPL(Key, Val, Name, Cmp)                                                            \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *left, *right;                                                                 \
+        uint64_t stamp;                                                                                         \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name *node;                                                                                \
+        uint64_t epoch;                                                                                         \
+    } ztree_retired_##Name;                                                                                     \
+                                                                                                                \
+    typedef struct                                                                                              \
     {                                                                                                           \
         ztree_node_##Name *root;                                                                                \
+        ztree_node_##Name *head;                                                                                \
         size_t size;                                                                                            \
+        ztree_node_##Name *spare;                                                                               \
+        size_t nspare;                                                                                          \
+        ztree_retired_##Name *retired;                                                                          \
+        size_t nretired, cap;                                                                                   \
+        int writer;                                                                                             \
+        ztree_epoch epoch;                                                                                      \
     } ztree_##Name;                                                                                             \
                                                                                                                 \
     static inline ztree_##Name ztree_init_##Name(void)                                                          \
     {                                                                                                           \
-        ztree_##Name t = {NULL, 0};                                                                             \
+        ztree_##Name t;                                                                                         \
+        t.root = t.head = t.spare = NULL;                                                                       \
+        t.size = t.nspare = t.nretired = t.cap = 0;                                                             \
+        t.retired = NULL;                                                                                       \
+        t.writer = 0;                                                                                           \
+        ztree__epoch_init(&t.epoch);                                                                            \
         return t;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline ztree_node_##Name *ztree__new_##Name(Key k, Val v)                                            \
+    static inline void ztree__rcu_retire_##Name(ztree_##Name *t, ztree_node_##Name *n)                          \
     {                                                                                                           \
-        ZTREE_NEW_NODE(ztree_node_##Name, n);                                                                   \
-        if(n)                                                                                                   \
-        {                                                                                                       \
-            n->key = k;                                                                                         \
-            n->value = v;                                                                                       \
-            n->color = ZTREE_RED;                                                                               \
-            n->parent = n->left = n->right = NULL;                                                              \
-        }                                                                                                       \
-        return n;                                                                                               \
+        /* Capacity was reserved by ztree__rcu_begin, so this never fails mid-update. */                        \
+        t->retired[t->nretired].node = n;                                                                       \
+        t->retired[t->nretired].epoch = t->epoch.epoch;                                                         \
+        t->nretired++;                                                                                          \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__free_rec_##Name(ztree_node_##Name *n)                                             \
+    ZTREE__GENERATE_COW_CORE(Key, Val, Name, Cmp, RCU)                                                          \
+                                                                                                                \
+    static inline int ztree__rcu_begin_##Name(ztree_##Name *t)                                                  \
     {                                                                                                           \
-        if (!n)                                                                                                 \
+        ztree__spin_lock(&t->writer);                                                                           \
+        size_t need = t->nretired + 8;                                                                          \
+        for (size_t n = t->size + 1; n; n >>= 1)                                                                \
         {                                                                                                       \
-            return;                                                                                             \
+            need += 4;                                                                                          \
         }                                                                                                       \
-        ztree__free_rec_##Name(n->left);                                                                        \
-        ztree__free_rec_##Name(n->right);                                                                       \
-        ZTREE_FREE_NODE(n);                                                                                     \
+        if (need > t->cap)                                                                                      \
+        {                                                                                                       \
+            size_t cap = (need > 2 * t->cap) ? need : 2 * t->cap;                                               \
+            ztree_retired_##Name *r = (ztree_retired_##Name*)ZTREE_REALLOC(t->retired, cap * sizeof(*r));       \
+            if (!r)                                                                                             \
+            {                                                                                                   \
+                ztree__spin_unlock(&t->writer);                                                                 \
+                return Z_ENOMEM;                                                                                \
+            }                                                                                                   \
+            t->retired = r;                                                                                     \
+            t->cap = cap;                                                                                       \
+        }                                                                                                       \
+        return Z_OK;                                                                                            \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    static inline void ztree__rcu_publish_##Name(ztree_##Name *t)                                               \
     {                                                                                                           \
-        ztree__free_rec_##Name(t->root);                                                                        \
-        t->root = NULL;                                                                                         \
-        t->size = 0;                                                                                            \
+        /* Swap in the new version, then free whatever no reader can still be looking at. */                    \
+        __atomic_store_n(&t->head, t->root, __ATOMIC_RELEASE);                                                  \
+        uint64_t oldest = ztree__epoch_advance(&t->epoch);                                                      \
+        size_t kept = 0;                                                                                        \
+        for (size_t i = 0; i < t->nretired; i++)                                                                \
+        {                                                                                                       \
+            if (t->retired[i].epoch < oldest)                                                                   \
+            {                                                                                                   \
+                ZTREE_FREE_NODE(t->retired[i].node);                                                            \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                t->retired[kept++] = t->retired[i];                                                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        t->nretired = kept;                                                                                     \
+        ztree__spin_unlock(&t->writer);                                                                         \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__rot_l_##Name(ztree_##Name *t, ztree_node_##Name *x)                               \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
     {                                                                                                           \
-        ztree_node_##Name *y = x->right;                                                                        \
-        x->right = y->left;                                                                                     \
-        if (y->left)                                                                                            \
-        {                                                                                                       \
-            y->left->parent = x;                                                                                \
-            y->parent = x->parent;                                                                              \
-        }                                                                                                       \
-        y->parent = x->parent;                                                                                  \
-        if (!x->parent)                                                                                         \
+        if (Z_OK != ztree__rcu_begin_##Name(t))                                                                 \
         {                                                                                                       \
-            t->root = y;                                                                                        \
+            return Z_ENOMEM;                                                                                    \
         }                                                                                                       \
-        else if (x == x->parent->left)                                                                          \
+        int rc = ztree__cow_insert_##Name(t, k, v);                                                             \
+        ztree__rcu_publish_##Name(t);                                                                           \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        if (Z_OK != ztree__rcu_begin_##Name(t))                                                                 \
         {                                                                                                       \
-            x->parent->left = y;                                                                                \
+            return Z_ENOMEM;                                                                                    \
         }                                                                                                       \
-        else                                                                                                    \
+        int rc = ztree__cow_take_##Name(t, k, out_val);                                                         \
+        ztree__rcu_publish_##Name(t);                                                                           \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_take_##Name(t, k, NULL);                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        return ztree__cow_find_##Name(__atomic_load_n(&t->head, __ATOMIC_ACQUIRE), k);                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        return ztree__cow_lower_bound_##Name(__atomic_load_n(&t->head, __ATOMIC_ACQUIRE), k);                   \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        ztree_node_##Name *x = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);                                     \
+        while (x && x->left)                                                                                    \
         {                                                                                                       \
-            x->parent->right = y;                                                                               \
+            x = x->left;                                                                                        \
         }                                                                                                       \
-        y->left = x;                                                                                            \
-        x->parent = y;                                                                                          \
+        return x;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__rot_r_##Name(ztree_##Name *t, ztree_node_##Name *y)                               \
+    static inline ztree_node_##Name *ztree_max_##Name(ztree_##Name *t)                                          \
     {                                                                                                           \
-        ztree_node_##Name *x = y->left;                                                                         \
-        y->left = x->right;                                                                                     \
-        if (x->right)                                                                                           \
+        ztree_node_##Name *x = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);                                     \
+        while (x && x->right)                                                                                   \
         {                                                                                                       \
-            x->right->parent = y;                                                                               \
-            x->parent = y->parent;                                                                              \
+            x = x->right;                                                                                       \
         }                                                                                                       \
-        x->parent = y->parent;                                                                                  \
-        if (!y->parent)                                                                                         \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_rcu_reader *ztree_rcu_register_##Name(ztree_##Name *t)                                  \
+    {                                                                                                           \
+        return ztree__epoch_register(&t->epoch);                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__rcu_free_rec_##Name(ztree_node_##Name *n)                                         \
+    {                                                                                                           \
+        while (n)                                                                                               \
         {                                                                                                       \
-            t->root = x;                                                                                        \
+            ztree__rcu_free_rec_##Name(n->left);                                                                \
+            ztree_node_##Name *right = n->right;                                                                \
+            ZTREE_FREE_NODE(n);                                                                                 \
+            n = right;                                                                                          \
         }                                                                                                       \
-        else if (y == y->parent->left)                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        /* Teardown: frees everything at once, so no reader may be inside a read section. */                    \
+        ztree__rcu_free_rec_##Name(t->root);                                                                    \
+        for (size_t i = 0; i < t->nretired; i++)                                                                \
         {                                                                                                       \
-            y->parent->left = x;                                                                                \
+            ZTREE_FREE_NODE(t->retired[i].node);                                                                \
         }                                                                                                       \
-        else                                                                                                    \
+        ZTREE_FREE(t->retired);                                                                                 \
+        ztree__cow_drain_##Name(t);                                                                             \
+        t->root = t->head = NULL;                                                                               \
+        t->retired = NULL;                                                                                      \
+        t->size = t->nretired = t->cap = 0;                                                                     \
+    }
+
+// Lock-free skiplist map: every operation is a CAS on one link, so any number of threads may insert, remove
+// and read at once. Links carry a deletion mark in their low bit (Harris/Fraser style). Threads bracket their
+// calls with ztree_rcu_read_lock / ztree_rcu_read_unlock, and a deleted tower is freed once it is unlinked
+// and every reader that could have seen it has left its section, so returned nodes stay valid until then.
+#define ZTREE_GENERATE_SKIPLIST_IMPL(Key, Val, Name, Cmp)                                                       \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        int level;                                                                                              \
+        int owners;                                                                                             \
+        uint64_t stamp;                                                                                         \
+        struct ztree_node_##Name *retired;                                                                      \
+        uintptr_t *next;                                                                                        \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        uintptr_t head[ZTREE_SKIPLIST_LEVELS];                                                                  \
+        size_t size;                                                                                            \
+        ztree_node_##Name *retired;                                                                             \
+        size_t nretired, collect_at;                                                                            \
+        ztree_epoch epoch;                                                                                      \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t;                                                                                         \
+        for (int i = 0; i < ZTREE_SKIPLIST_LEVELS; i++)                                                         \
         {                                                                                                       \
-            y->parent->right = x;                                                                               \
+            t.head[i] = 0;                                                                                      \
         }                                                                                                       \
-        x->right = y;                                                                                           \
-        y->parent = x;                                                                                          \
+        t.size = t.nretired = 0;                                                                                \
+        t.collect_at = ZTREE_SKIPLIST_COLLECT;                                                                  \
+        t.retired = NULL;                                                                                       \
+        ztree__epoch_init(&t.epoch);                                                                            \
+        return t;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__fix_ins_##Name(ztree_##Name *t, ztree_node_##Name *z)                             \
+    static inline ztree_node_##Name *ztree__skip_ptr_##Name(uintptr_t link)                                     \
     {                                                                                                           \
-        while (z->parent && ZTREE_RED == z->parent->color)                                                      \
+        /* The low bit of a link marks its owner as deleted at that level. */                                   \
+        return (ztree_node_##Name*)(link & ~(uintptr_t)1);                                                      \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree__skip_new_##Name(Key k, Val v, int level)                            \
+    {                                                                                                           \
+        void *mem = ZTREE_MALLOC(sizeof(ztree_node_##Name) + (size_t)level * sizeof(uintptr_t));                \
+        ztree_node_##Name *n = ZTREE__NEW_SIZED(ztree_node_##Name, mem);                                        \
+        if (!n)                                                                                                 \
         {                                                                                                       \
-            if (z->parent == z->parent->parent->left)                                                           \
-            {                                                                                                   \
-                ztree_node_##Name *y = z->parent->parent->right;                                                \
-                if (y && ZTREE_RED == y->color)                                                                 \
-                {                                                                                               \
-                    z->parent->color = ZTREE_BLACK;                                                             \
-                    y->color = ZTREE_BLACK;                                                                     \
-                    z->parent->parent->color = ZTREE_RED;                                                       \
-                    z = z->parent->parent;                                                                      \
-                }                                                                                               \
-                else                                                                                            \
-                {                                                                                               \
-                    if (z == z->parent->right)                                                                  \
-                    {                                                                                           \
-                        z = z->parent;                                                                          \
-                        ztree__rot_l_##Name(t, z);                                                              \
-                    }                                                                                           \
-                    z->parent->color = ZTREE_BLACK;                                                             \
-                    z->parent->parent->color = ZTREE_RED;                                                       \
-                    ztree__rot_r_##Name(t, z->parent->parent);                                                  \
-                }                                                                                               \
-            }                                                                                                   \
-            else                                                                                                \
-            {                                                                                                   \
-                ztree_node_##Name *y = z->parent->parent->left;                                                 \
-                if (y && ZTREE_RED == y->color)                                                                 \
-                {                                                                                               \
-                    z->parent->color = ZTREE_BLACK;                                                             \
-                    y->color = ZTREE_BLACK;                                                                     \
-                    z->parent->parent->color = ZTREE_RED;                                                       \
-                    z = z->parent->parent;                                                                      \
-                }                                                                                               \
-                else                                                                                            \
-                {                                                                                               \
-                    if (z == z->parent->left)                                                                   \
-                    {                                                                                           \
-                        z = z->parent;                                                                          \
-                        ztree__rot_r_##Name(t, z);                                                              \
-                    }                                                                                           \
-                    z->parent->color = ZTREE_BLACK;                                                             \
-                    z->parent->parent->color = ZTREE_RED;                                                       \
-                    ztree__rot_l_##Name(t, z->parent->parent);                                                  \
-                }                                                                                               \
-            }                                                                                                   \
+            return NULL;                                                                                        \
         }                                                                                                       \
-        t->root->color = ZTREE_BLACK;                                                                           \
+        n->key = k;                                                                                             \
+        n->value = v;                                                                                           \
+        n->level = level;                                                                                       \
+        n->owners = 2;                                                                                          \
+        n->retired = NULL;                                                                                      \
+        n->next = (uintptr_t*)(n + 1);                                                                          \
+        return n;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__fix_del_##Name(ztree_##Name *t, ztree_node_##Name *x, ztree_node_##Name *p)       \
+    static inline int ztree__skip_find_##Name(ztree_##Name *t, const Key *k, uintptr_t **preds,                 \
+                                              ztree_node_##Name **succs)                                        \
     {                                                                                                           \
-        while (x != t->root && (!x || x->color == ZTREE_BLACK))                                                 \
+        /* Records the last link before k and the first live node at or after it on every level, unlinking      \
+         * deleted nodes on the way. Starts over when a neighbour changes under it; returns whether k is        \
+         * there. */                                                                                            \
+        for (;;)                                                                                                \
         {                                                                                                       \
-            if (x == p->left)                                                                                   \
+            uintptr_t *pred = t->head;                                                                          \
+            ztree_node_##Name *curr = NULL;                                                                     \
+            int retry = 0;                                                                                      \
+            for (int l = ZTREE_SKIPLIST_LEVELS - 1; l >= 0 && !retry; l--)                                      \
             {                                                                                                   \
-                ztree_node_##Name *w = p->right;                                                                \
-                if (ZTREE_RED == w->color)                                                                      \
-                {                                                                                               \
-                    w->color = ZTREE_BLACK;                                                                     \
-                    p->color = ZTREE_RED;                                                                       \
-                    ztree__rot_l_##Name(t, p);                                                                  \
-                    w = p->right;                                                                               \
-                }                                                                                               \
-                if ((!w->left || ZTREE_BLACK == w->left->color) &&                                              \
-                    (!w->right || ZTREE_BLACK == w->right->color))                                              \
-                    {                                                                                           \
-                    w->color = ZTREE_RED;                                                                       \
-                    x = p;                                                                                      \
-                    p = x->parent;                                                                              \
-                }                                                                                               \
-                else                                                                                            \
+                curr = ztree__skip_ptr_##Name(__atomic_load_n(&pred[l], __ATOMIC_ACQUIRE));                     \
+                while (curr)                                                                                    \
                 {                                                                                               \
-                    if (!w->right || ZTREE_BLACK == w->right->color)                                            \
+                    uintptr_t succ = __atomic_load_n(&curr->next[l], __ATOMIC_ACQUIRE);                         \
+                    if (succ & 1)                                                                               \
                     {                                                                                           \
-                        if (w->left)                                                                            \
+                        uintptr_t expect = (uintptr_t)curr;                                                     \
+                        if (!__atomic_compare_exchange_n(&pred[l], &expect, succ & ~(uintptr_t)1, 0,            \
+                                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))                   \
                         {                                                                                       \
-                            w->left->color = ZTREE_BLACK;                                                       \
+                            retry = 1;                                                                          \
+                            break;                                                                              \
                         }                                                                                       \
-                        w->color = ZTREE_RED;                                                                   \
-                        ztree__rot_r_##Name(t, w);                                                              \
-                        w = p->right;                                                                           \
+                        curr = ztree__skip_ptr_##Name(succ);                                                    \
+                        continue;                                                                               \
                     }                                                                                           \
-                    w->color = p->color;                                                                        \
-                    p->color = ZTREE_BLACK;                                                                     \
-                    if (w->right)                                                                               \
+                    if (Cmp(&curr->key, k) >= 0)                                                                \
                     {                                                                                           \
-                        w->right->color = ZTREE_BLACK;                                                          \
+                        break;                                                                                  \
                     }                                                                                           \
-                    ztree__rot_l_##Name(t, p);                                                                  \
-                    x = t->root;                                                                                \
+                    pred = curr->next;                                                                          \
+                    curr = ztree__skip_ptr_##Name(succ);                                                        \
                 }                                                                                               \
+                preds[l] = pred;                                                                                \
+                succs[l] = curr;                                                                                \
             }                                                                                                   \
-            else                                                                                                \
+            if (!retry)                                                                                         \
             {                                                                                                   \
-                ztree_node_##Name *w = p->left;                                                                 \
-                if (ZTREE_RED == w->color)                                                                      \
-                {                                                                                               \
-                    w->color = ZTREE_BLACK;                                                                     \
-                    p->color = ZTREE_RED;                                                                       \
-                    ztree__rot_r_##Name(t, p);                                                                  \
-                    w = p->left;                                                                                \
-                }                                                                                               \
-                if ((!w->right || ZTREE_BLACK == w->right->color) &&                                            \
-                    (!w->left || ZTREE_BLACK == w->left->color))                                                \
-                {                                                                                               \
-                    w->color = ZTREE_RED;                                                                       \
-                    x = p;                                                                                      \
-                    p = x->parent;                                                                              \
-                }                                                                                               \
-                else                                                                                            \
+                return curr && 0 == Cmp(&curr->key, k);                                                         \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__skip_free_##Name(ztree_node_##Name *n)                                            \
+    {                                                                                                           \
+        ZTREE__FREE_SIZED(ztree_node_##Name, n);                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__skip_unlink_##Name(ztree_##Name *t, ztree_node_##Name *n)                         \
+    {                                                                                                           \
+        /* Walks every level to n's key, unlinking each marked node on the way, the deleted n included.         \
+         * pred stays before every copy of the key so the next level down still reaches n; q scans the          \
+         * copies themselves. A pass without a failed CAS leaves n unreachable, and nothing links it again. */  \
+        for (;;)                                                                                                \
+        {                                                                                                       \
+            uintptr_t *pred = t->head;                                                                          \
+            int retry = 0;                                                                                      \
+            for (int l = ZTREE_SKIPLIST_LEVELS - 1; l >= 0 && !retry; l--)                                      \
+            {                                                                                                   \
+                uintptr_t *q = pred;                                                                            \
+                ztree_node_##Name *x = ztree__skip_ptr_##Name(__atomic_load_n(&q[l], __ATOMIC_ACQUIRE));        \
+                while (x)                                                                                       \
                 {                                                                                               \
-                    if (!w->left || ZTREE_BLACK == w->left->color)                                              \
+                    uintptr_t succ = __atomic_load_n(&x->next[l], __ATOMIC_ACQUIRE);                            \
+                    if (succ & 1)                                                                               \
                     {                                                                                           \
-                        if (w->right)                                                                           \
+                        uintptr_t expect = (uintptr_t)x;                                                        \
+                        if (!__atomic_compare_exchange_n(&q[l], &expect, succ & ~(uintptr_t)1, 0,               \
+                                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))                   \
                         {                                                                                       \
-                            w->right->color = ZTREE_BLACK;                                                      \
+                            retry = 1;                                                                          \
+                            break;                                                                              \
                         }                                                                                       \
-                        w->color = ZTREE_RED;                                                                   \
-                        ztree__rot_l_##Name(t, w);                                                              \
-                        w = p->left;                                                                            \
+                        x = ztree__skip_ptr_##Name(succ);                                                       \
+                        continue;                                                                               \
                     }                                                                                           \
-                    w->color = p->color;                                                                        \
-                    p->color = ZTREE_BLACK;                                                                     \
-                    if (w->left)                                                                                \
+                    int cmp = Cmp(&x->key, &n->key);                                                            \
+                    if (cmp > 0)                                                                                \
                     {                                                                                           \
-                        w->left->color = ZTREE_BLACK;                                                           \
+                        break;                                                                                  \
                     }                                                                                           \
-                    ztree__rot_r_##Name(t, p);                                                                  \
-                    x = t->root;                                                                                \
+                    q = x->next;                                                                                \
+                    pred = (cmp < 0) ? q : pred;                                                                \
+                    x = ztree__skip_ptr_##Name(succ);                                                           \
                 }                                                                                               \
             }                                                                                                   \
-        }                                                                                                       \
-        if (x)                                                                                                  \
-        {                                                                                                       \
-            x->color = ZTREE_BLACK;                                                                             \
+            if (!retry)                                                                                         \
+            {                                                                                                   \
+                return;                                                                                         \
+            }                                                                                                   \
         }                                                                                                       \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree__transplant_##Name(ztree_##Name *t, ztree_node_##Name *u, ztree_node_##Name *v)    \
+    static inline size_t ztree__skip_collect_##Name(ztree_##Name *t)                                            \
     {                                                                                                           \
-        if (!u->parent)                                                                                         \
+        /* Takes the whole retired list, so concurrent collectors never share a node, frees every tower         \
+         * retired before the oldest reader's epoch and puts the rest back. The next collection waits for       \
+         * half as many retirements as were kept, and at least ZTREE_SKIPLIST_COLLECT: a stalled reader then    \
+         * costs amortized O(1) per removal, and the backlog shrinks back once the reader moves on. */          \
+        ztree_node_##Name *n = __atomic_exchange_n(&t->retired, NULL, __ATOMIC_ACQ_REL);                        \
+        if (!n)                                                                                                 \
         {                                                                                                       \
-            t->root = v;                                                                                        \
+            return 0;                                                                                           \
         }                                                                                                       \
-        else if (u == u->parent->left)                                                                          \
+        uint64_t oldest = ztree__epoch_advance(&t->epoch);                                                      \
+        ztree_node_##Name *keep = NULL, *tail = NULL;                                                           \
+        size_t freed = 0;                                                                                       \
+        while (n)                                                                                               \
         {                                                                                                       \
-            u->parent->left = v;                                                                                \
+            ztree_node_##Name *next = n->retired;                                                               \
+            if (n->stamp < oldest)                                                                              \
+            {                                                                                                   \
+                ztree__skip_free_##Name(n);                                                                     \
+                freed++;                                                                                        \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                n->retired = keep;                                                                              \
+                tail = keep ? tail : n;                                                                         \
+                keep = n;                                                                                       \
+            }                                                                                                   \
+            n = next;                                                                                           \
         }                                                                                                       \
-        else                                                                                                    \
+        size_t left = __atomic_sub_fetch(&t->nretired, freed, __ATOMIC_RELAXED);                                \
+        size_t wait = (left / 2 > ZTREE_SKIPLIST_COLLECT) ? left / 2 : ZTREE_SKIPLIST_COLLECT;                  \
+        __atomic_store_n(&t->collect_at, left + wait, __ATOMIC_RELAXED);                                        \
+        if (keep)                                                                                               \
         {                                                                                                       \
-            u->parent->right = v;                                                                               \
+            tail->retired = __atomic_load_n(&t->retired, __ATOMIC_RELAXED);                                     \
+            while (!__atomic_compare_exchange_n(&t->retired, &tail->retired, keep, 1, __ATOMIC_RELEASE,         \
+                                                __ATOMIC_RELAXED))                                              \
+            {                                                                                                   \
+            }                                                                                                   \
         }                                                                                                       \
-        if (v)                                                                                                  \
+        return freed;                                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__skip_release_##Name(ztree_##Name *t, ztree_node_##Name *n)                        \
+    {                                                                                                           \
+        /* A tower has two owners: its inserter until every level is linked, and whoever deletes it. The        \
+         * last one to let go unlinks it for good, stamps the epoch and retires it. */                          \
+        if (1 != __atomic_fetch_sub(&n->owners, 1, __ATOMIC_ACQ_REL))                                           \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        ztree__skip_unlink_##Name(t, n);                                                                        \
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);                                                                \
+        n->stamp = __atomic_load_n(&t->epoch.epoch, __ATOMIC_ACQUIRE);                                          \
+        n->retired = __atomic_load_n(&t->retired, __ATOMIC_RELAXED);                                            \
+        while (!__atomic_compare_exchange_n(&t->retired, &n->retired, n, 1, __ATOMIC_RELEASE,                   \
+                                            __ATOMIC_RELAXED))                                                  \
         {                                                                                                       \
-            v->parent = u->parent;                                                                              \
         }                                                                                                       \
+        __atomic_add_fetch(&t->nretired, 1, __ATOMIC_RELAXED);                                                  \
     }                                                                                                           \
                                                                                                                 \
-    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    static inline void ztree__skip_settle_##Name(ztree_##Name *t)                                               \
     {                                                                                                           \
-        ztree_node_##Name *x = t->root;                                                                         \
-        while (x)                                                                                               \
+        /* Runs at the end of every update, once it no longer touches any node, so a caller without a read      \
+         * section never has a node freed under it mid-call. */                                                 \
+        size_t due = __atomic_load_n(&t->collect_at, __ATOMIC_RELAXED);                                         \
+        if (__atomic_load_n(&t->nretired, __ATOMIC_RELAXED) >= due)                                             \
         {                                                                                                       \
-            int cmp = Cmp(&k, &x->key);                                                                         \
-            if (0 == cmp)                                                                                       \
+            ztree__skip_collect_##Name(t);                                                                      \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__skip_delete_##Name(ztree_##Name *t, ztree_node_##Name *n)                          \
+    {                                                                                                           \
+        /* Marks the tower top-down. Whoever marks level 0 owns the deletion: it counts it and releases the     \
+         * node, which is freed once no reader can still reach it. */                                           \
+        for (int l = n->level - 1; l >= 0; l--)                                                                 \
+        {                                                                                                       \
+            uintptr_t next = __atomic_load_n(&n->next[l], __ATOMIC_ACQUIRE);                                    \
+            while (!(next & 1))                                                                                 \
             {                                                                                                   \
-                return x;                                                                                       \
+                if (!__atomic_compare_exchange_n(&n->next[l], &next, next | 1, 1, __ATOMIC_ACQ_REL,             \
+                                                 __ATOMIC_ACQUIRE))                                             \
+                {                                                                                               \
+                    continue;                                                                                   \
+                }                                                                                               \
+                if (l > 0)                                                                                      \
+                {                                                                                               \
+                    break;                                                                                      \
+                }                                                                                               \
+                __atomic_fetch_sub(&t->size, 1, __ATOMIC_RELAXED);                                              \
+                ztree__skip_release_##Name(t, n);                                                               \
+                return 1;                                                                                       \
             }                                                                                                   \
-            x = (cmp < 0) ? x->left : x->right;                                                                 \
         }                                                                                                       \
-        return NULL;                                                                                            \
+        return 0;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
     {                                                                                                           \
-        ztree_node_##Name *z = ztree_find_##Name(t, k);                                                         \
-        if (!z)                                                                                                 \
+        /* An existing key is replaced rather than written in place: the new node is linked in front of the     \
+         * old one, which is then deleted. Readers therefore never see a half-written value. */                 \
+        uintptr_t *preds[ZTREE_SKIPLIST_LEVELS];                                                                \
+        ztree_node_##Name *succs[ZTREE_SKIPLIST_LEVELS];                                                        \
+        ztree_node_##Name *n = ztree__skip_new_##Name(k, v, ztree__skip_level());                               \
+        if (!n)                                                                                                 \
         {                                                                                                       \
-            return;                                                                                             \
+            return Z_ENOMEM;                                                                                    \
         }                                                                                                       \
-        ztree_node_##Name *y = z, *x;                                                                           \
-        ztree_node_##Name *x_parent = NULL;                                                                     \
-        ztree_color y_orig_color = y->color;                                                                    \
-        if (!z->left)                                                                                           \
+        ztree_node_##Name *old;                                                                                 \
+        for (;;)                                                                                                \
         {                                                                                                       \
-            x = z->right;                                                                                       \
-            x_parent = z->parent;                                                                               \
-            ztree__transplant_##Name(t, z, z->right);                                                           \
+            old = ztree__skip_find_##Name(t, &k, preds, succs) ? succs[0] : NULL;                               \
+            for (int l = 0; l < n->level; l++)                                                                  \
+            {                                                                                                   \
+                n->next[l] = (uintptr_t)succs[l];                                                               \
+            }                                                                                                   \
+            uintptr_t expect = (uintptr_t)succs[0];                                                             \
+            if (__atomic_compare_exchange_n(&preds[0][0], &expect, (uintptr_t)n, 0, __ATOMIC_RELEASE,           \
+                                            __ATOMIC_RELAXED))                                                  \
+            {                                                                                                   \
+                break;                                                                                          \
+            }                                                                                                   \
         }                                                                                                       \
-        else if (!z->right)                                                                                     \
+        __atomic_fetch_add(&t->size, 1, __ATOMIC_RELAXED);                                                      \
+        for (int l = 1; l < n->level; l++)                                                                      \
         {                                                                                                       \
-            x = z->left;                                                                                        \
-            x_parent = z->parent;                                                                               \
-            ztree__transplant_##Name(t, z, z->left);                                                            \
+            for (;;)                                                                                            \
+            {                                                                                                   \
+                uintptr_t next = __atomic_load_n(&n->next[l], __ATOMIC_ACQUIRE);                                \
+                if (next & 1)                                                                                   \
+                {                                                                                               \
+                    /* Deleted while still going up: the remaining levels stay unlinked. */                     \
+                    l = n->level;                                                                               \
+                    break;                                                                                      \
+                }                                                                                               \
+                if (next != (uintptr_t)succs[l] &&                                                              \
+                    !__atomic_compare_exchange_n(&n->next[l], &next, (uintptr_t)succs[l], 0, __ATOMIC_RELEASE,  \
+                                                 __ATOMIC_RELAXED))                                             \
+                {                                                                                               \
+                    continue;                                                                                   \
+                }                                                                                               \
+                uintptr_t expect = (uintptr_t)succs[l];                                                         \
+                if (__atomic_compare_exchange_n(&preds[l][l], &expect, (uintptr_t)n, 0, __ATOMIC_RELEASE,       \
+                                                __ATOMIC_RELAXED))                                              \
+                {                                                                                               \
+                    break;                                                                                      \
+                }                                                                                               \
+                ztree__skip_find_##Name(t, &k, preds, succs);                                                   \
+            }                                                                                                   \
         }                                                                                                       \
-        else                                                                                                    \
+        ztree__skip_release_##Name(t, n);                                                                       \
+        if (old)                                                                                                \
         {                                                                                                       \
-            y = z->right;                                                                                       \
-            while (y->left)                                                                                     \
+            ztree__skip_delete_##Name(t, old);                                                                  \
+        }                                                                                                       \
+        ztree__skip_settle_##Name(t);                                                                           \
+        return Z_OK;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
+    {                                                                                                           \
+        /* Wait-free: descends without unlinking anything, then steps over deleted nodes at the bottom. */      \
+        uintptr_t *pred = t->head;                                                                              \
+        ztree_node_##Name *curr = NULL;                                                                         \
+        for (int l = ZTREE_SKIPLIST_LEVELS - 1; l >= 0; l--)                                                    \
+        {                                                                                                       \
+            curr = ztree__skip_ptr_##Name(__atomic_load_n(&pred[l], __ATOMIC_ACQUIRE));                         \
+            while (curr && Cmp(&curr->key, &k) < 0)                                                             \
             {                                                                                                   \
-                y = y->left;                                                                                    \
+                pred = curr->next;                                                                              \
+                curr = ztree__skip_ptr_##Name(__atomic_load_n(&pred[l], __ATOMIC_ACQUIRE));                     \
             }                                                                                                   \
-            y_orig_color = y->color;                                                                            \
-            x = y->right;                                                                                       \
-            if (y->parent == z)                                                                                 \
+        }                                                                                                       \
+        while (curr && (__atomic_load_n(&curr->next[0], __ATOMIC_ACQUIRE) & 1))                                 \
+        {                                                                                                       \
+            curr = ztree__skip_ptr_##Name(__atomic_load_n(&curr->next[0], __ATOMIC_ACQUIRE));                   \
+        }                                                                                                       \
+        return curr;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        ztree_node_##Name *n = ztree_lower_bound_##Name(t, k);                                                  \
+        return (n && 0 == Cmp(&n->key, &k)) ? n : NULL;                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
+    {                                                                                                           \
+        /* Also deletes the older copies of k that replacements still in flight leave right behind the live     \
+         * node, so none of them can resurface afterwards. */                                                   \
+        uintptr_t *preds[ZTREE_SKIPLIST_LEVELS];                                                                \
+        ztree_node_##Name *succs[ZTREE_SKIPLIST_LEVELS];                                                        \
+        int rc = Z_ENOTFOUND;                                                                                   \
+        if (!ztree__skip_find_##Name(t, &k, preds, succs))                                                      \
+        {                                                                                                       \
+            return rc;                                                                                          \
+        }                                                                                                       \
+        for (ztree_node_##Name *x = succs[0]; x && 0 == Cmp(&x->key, &k);                                       \
+             x = ztree__skip_ptr_##Name(__atomic_load_n(&x->next[0], __ATOMIC_ACQUIRE)))                        \
+        {                                                                                                       \
+            if (ztree__skip_delete_##Name(t, x) && Z_OK != rc)                                                  \
             {                                                                                                   \
-                x_parent = y;                                                                                   \
+                if (out_val)                                                                                    \
+                {                                                                                               \
+                    *out_val = x->value;                                                                        \
+                }                                                                                               \
+                rc = Z_OK;                                                                                      \
             }                                                                                                   \
-            else                                                                                                \
+        }                                                                                                       \
+        ztree__skip_settle_##Name(t);                                                                           \
+        return rc;                                                                                              \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree_take_##Name(t, k, NULL);                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_next_##Name(ztree_node_##Name *n)                                    \
+    {                                                                                                           \
+        /* Skips deleted nodes and the older copy of a key whose replacement is still in flight. */             \
+        ztree_node_##Name *x = ztree__skip_ptr_##Name(__atomic_load_n(&n->next[0], __ATOMIC_ACQUIRE));          \
+        while (x && ((__atomic_load_n(&x->next[0], __ATOMIC_ACQUIRE) & 1) || 0 == Cmp(&x->key, &n->key)))       \
+        {                                                                                                       \
+            x = ztree__skip_ptr_##Name(__atomic_load_n(&x->next[0], __ATOMIC_ACQUIRE));                         \
+        }                                                                                                       \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_min_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        ztree_node_##Name *x = ztree__skip_ptr_##Name(__atomic_load_n(&t->head[0], __ATOMIC_ACQUIRE));          \
+        while (x && (__atomic_load_n(&x->next[0], __ATOMIC_ACQUIRE) & 1))                                       \
+        {                                                                                                       \
+            x = ztree__skip_ptr_##Name(__atomic_load_n(&x->next[0], __ATOMIC_ACQUIRE));                         \
+        }                                                                                                       \
+        return x;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name *ztree_max_##Name(ztree_##Name *t)                                          \
+    {                                                                                                           \
+        /* Descends to the last node. If that one is deleted, the largest live key may sit anywhere before it,  \
+         * so fall back to a scan from the head. */                                                             \
+        uintptr_t *pred = t->head;                                                                              \
+        ztree_node_##Name *at = NULL, *best = NULL;                                                             \
+        for (int l = ZTREE_SKIPLIST_LEVELS - 1; l >= 0; l--)                                                    \
+        {                                                                                                       \
+            ztree_node_##Name *x;                                                                               \
+            while ((x = ztree__skip_ptr_##Name(__atomic_load_n(&pred[l], __ATOMIC_ACQUIRE))))                   \
             {                                                                                                   \
-                x_parent = y->parent;                                                                           \
-                ztree__transplant_##Name(t, y, y->right);                                                       \
-                y->right = z->right;                                                                            \
-                y->right->parent = y;                                                                           \
+                at = x;                                                                                         \
+                pred = x->next;                                                                                 \
             }                                                                                                   \
-            ztree__transplant_##Name(t, z, y);                                                                  \
-            y->left = z->left;                                                                                  \
-            y->left->parent = y;                                                                                \
-            y->color = z->color;                                                                                \
         }                                                                                                       \
-        if (ZTREE_BLACK == y_orig_color)                                                                        \
+        if (at && !(__atomic_load_n(&at->next[0], __ATOMIC_ACQUIRE) & 1))                                       \
         {                                                                                                       \
-            ztree__fix_del_##Name(t, x, x_parent);                                                              \
+            return at;                                                                                          \
         }                                                                                                       \
-        ZTREE_FREE_NODE(z);                                                                                     \
-        t->size--;                                                                                              \
+        for (ztree_node_##Name *x = ztree_min_##Name(t); x; x = ztree_next_##Name(x))                           \
+        {                                                                                                       \
+            best = x;                                                                                           \
+        }                                                                                                       \
+        return best;                                                                                            \
     }                                                                                                           \
                                                                                                                 \
-    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
+    static inline ztree_rcu_reader *ztree_rcu_register_##Name(ztree_##Name *t)                                  \
     {                                                                                                           \
-        ztree_node_##Name *y = NULL, *x = t->root;                                                              \
+        return ztree__epoch_register(&t->epoch);                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    static inline size_t ztree_skiplist_reclaim_##Name(ztree_##Name *t)                                         \
+    {                                                                                                           \
+        /* Teardown only: no other thread may be inside the map. Frees every retired tower without waiting      \
+         * for epochs; returns how many were freed. */                                                          \
+        size_t freed = 0;                                                                                       \
+        while (t->retired)                                                                                      \
+        {                                                                                                       \
+            ztree_node_##Name *n = t->retired;                                                                  \
+            t->retired = n->retired;                                                                            \
+            ztree__skip_free_##Name(n);                                                                         \
+            freed++;                                                                                            \
+        }                                                                                                       \
+        t->nretired = 0;                                                                                        \
+        t->collect_at = ZTREE_SKIPLIST_COLLECT;                                                                 \
+        return freed;                                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        /* Teardown, like reclaim: no other thread may be inside the map. */                                    \
+        ztree_skiplist_reclaim_##Name(t);                                                                       \
+        ztree_node_##Name *x = ztree__skip_ptr_##Name(t->head[0]);                                              \
         while (x)                                                                                               \
         {                                                                                                       \
-            y = x;                                                                                              \
-            int cmp = Cmp(&k, &x->key);                                                                         \
-            if (0 == cmp)                                                                                       \
-            {                                                                                                   \
-                x->value = v;                                                                                   \
-                return Z_OK;                                                                                    \
-            }                                                                                                   \
-            x = (cmp < 0) ? x->left : x->right;                                                                 \
+            ztree_node_##Name *next = ztree__skip_ptr_##Name(x->next[0]);                                       \
+            ztree__skip_free_##Name(x);                                                                         \
+            x = next;                                                                                           \
         }                                                                                                       \
-        ztree_node_##Name *z = ztree__new_##Name(k, v);                                                         \
-        if (!z)                                                                                                 \
+        for (int i = 0; i < ZTREE_SKIPLIST_LEVELS; i++)                                                         \
         {                                                                                                       \
-            return Z_ENOMEM;                                                                                    \
+            t->head[i] = 0;                                                                                     \
         }                                                                                                       \
-        z->parent = y;                                                                                          \
-        if (!y)                                                                                                 \
+        t->size = 0;                                                                                            \
+    }
+
+// Persistent map: ztree_snapshot is O(1) and shares every node, and each update copies only the nodes it
+// changes (O(log n)). Snapshots are full maps of their own and may be scanned or cleared on any thread.
+#define ZTREE_GENERATE_PERSISTENT_IMPL(Key, Val, Name, Cmp)                                                     \
+                                                                                                                \
+    typedef struct ztree_node_##Name                                                                            \
+    {                                                                                                           \
+        Key key;                                                                                                \
+        Val value;                                                                                              \
+        ztree_color color;                                                                                      \
+        struct ztree_node_##Name *left, *right;                                                                 \
+        unsigned refs;                                                                                          \
+    } ztree_node_##Name;                                                                                        \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_node_##Name *root;                                                                                \
+        size_t size;                                                                                            \
+        ztree_node_##Name *spare;                                                                               \
+        size_t nspare;                                                                                          \
+    } ztree_##Name;                                                                                             \
+                                                                                                                \
+    typedef struct                                                                                              \
+    {                                                                                                           \
+        ztree_##Name *tree;                                                                                     \
+        int depth;                                                                                              \
+        ztree_node_##Name *stack[ZTREE_CURSOR_DEPTH];                                                           \
+    } ztree_cursor_##Name;                                                                                      \
+                                                                                                                \
+    static inline ztree_##Name ztree_init_##Name(void)                                                          \
+    {                                                                                                           \
+        ztree_##Name t = {NULL, 0, NULL, 0};                                                                    \
+        return t;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__unref_##Name(ztree_node_##Name *n)                                                \
+    {                                                                                                           \
+        /* Drops one reference; a node that loses its last one releases its children in turn. */                \
+        while (n && 1 == __atomic_fetch_sub(&n->refs, 1, __ATOMIC_ACQ_REL))                                     \
+        {                                                                                                       \
+            ztree__unref_##Name(n->left);                                                                       \
+            ztree_node_##Name *right = n->right;                                                                \
+            ZTREE_FREE_NODE(n);                                                                                 \
+            n = right;                                                                                          \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree__persist_copied_##Name(ztree_node_##Name *old, ztree_node_##Name *c)               \
+    {                                                                                                           \
+        c->refs = 1;                                                                                            \
+        if (c->left)                                                                                            \
         {                                                                                                       \
-            t->root = z;                                                                                        \
+            __atomic_fetch_add(&c->left->refs, 1, __ATOMIC_RELAXED);                                            \
         }                                                                                                       \
-        else if (Cmp(&k, &y->key) < 0)                                                                          \
+        if (c->right)                                                                                           \
         {                                                                                                       \
-            y->left = z;                                                                                        \
+            __atomic_fetch_add(&c->right->refs, 1, __ATOMIC_RELAXED);                                           \
         }                                                                                                       \
-        else                                                                                                    \
+        ztree__unref_##Name(old);                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_COW_CORE(Key, Val, Name, Cmp, PERSIST)                                                      \
+                                                                                                                \
+    static inline void ztree_clear_##Name(ztree_##Name *t)                                                      \
+    {                                                                                                           \
+        ztree__unref_##Name(t->root);                                                                           \
+        ztree__cow_drain_##Name(t);                                                                             \
+        t->root = NULL;                                                                                         \
+        t->size = 0;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_##Name ztree_snapshot_##Name(const ztree_##Name *t)                                     \
+    {                                                                                                           \
+        ztree_##Name s = {t->root, t->size, NULL, 0};                                                           \
+        if (s.root)                                                                                             \
         {                                                                                                       \
-            y->right = z;                                                                                       \
+            __atomic_fetch_add(&s.root->refs, 1, __ATOMIC_RELAXED);                                             \
         }                                                                                                       \
-        ztree__fix_ins_##Name(t, z);                                                                            \
-        t->size++;                                                                                              \
-        return Z_OK;                                                                                            \
+        return s;                                                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    static inline ztree_node_##Name* ztree_find_##Name(ztree_##Name *t, Key k)                                  \
+    {                                                                                                           \
+        return ztree__cow_find_##Name(t->root, k);                                                              \
     }                                                                                                           \
                                                                                                                 \
     static inline ztree_node_##Name* ztree_lower_bound_##Name(ztree_##Name *t, Key k)                           \
     {                                                                                                           \
-        ztree_node_##Name *curr = t->root, *res = NULL;                                                         \
-        while (curr)                                                                                            \
-        {                                                                                                       \
-            int cmp = Cmp(&k, &curr->key);                                                                      \
-            if (0 == cmp)                                                                                       \
-            {                                                                                                   \
-                return curr;                                                                                    \
-            }                                                                                                   \
-            if (cmp < 0)                                                                                        \
-            {                                                                                                   \
-                res = curr;                                                                                     \
-                curr = curr->left;                                                                              \
-            }                                                                                                   \
-            else                                                                                                \
-            {                                                                                                   \
-                curr = curr->right;                                                                             \
-            }                                                                                                   \
-        } return res;                                                                                           \
+        return ztree__cow_lower_bound_##Name(t->root, k);                                                       \
     }                                                                                                           \
                                                                                                                 \
     static inline ztree_node_##Name* ztree_min_##Name(ztree_##Name *t)                                          \
     {                                                                                                           \
-        ztree_node_##Name *n = t->root;                                                                         \
-        while (n && n->left)                                                                                    \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x && x->left)                                                                                    \
         {                                                                                                       \
-            n = n->left;                                                                                        \
+            x = x->left;                                                                                        \
         }                                                                                                       \
-        return n;                                                                                               \
+        return x;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
     static inline ztree_node_##Name* ztree_max_##Name(ztree_##Name *t)                                          \
     {                                                                                                           \
-        ztree_node_##Name *n = t->root;                                                                         \
-        while (n && n->right)                                                                                   \
+        ztree_node_##Name *x = t->root;                                                                         \
+        while (x && x->right)                                                                                   \
         {                                                                                                       \
-            n = n->right;                                                                                       \
+            x = x->right;                                                                                       \
         }                                                                                                       \
-        return n;                                                                                               \
+        return x;                                                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline ztree_node_##Name* ztree_next_##Name(ztree_node_##Name *n)                                    \
+    static inline int ztree_insert_##Name(ztree_##Name *t, Key k, Val v)                                        \
     {                                                                                                           \
-        if (!n)                                                                                                 \
-        {                                                                                                       \
-            return NULL;                                                                                        \
-        }                                                                                                       \
-        if (n->right)                                                                                           \
-        {                                                                                                       \
-            n = n->right;                                                                                       \
-            while (n->left)                                                                                     \
-            {                                                                                                   \
-                n = n->left;                                                                                    \
-            }                                                                                                   \
-            return n;                                                                                           \
-        }                                                                                                       \
-        ztree_node_##Name *p = n->parent;                                                                       \
-        while (p && n == p->right)                                                                              \
-        {                                                                                                       \
-            n = p;                                                                                              \
-            p = p->parent;                                                                                      \
-        }                                                                                                       \
-        return p;                                                                                               \
+        return ztree__cow_insert_##Name(t, k, v);                                                               \
     }                                                                                                           \
                                                                                                                 \
-    static inline ztree_node_##Name* ztree_prev_##Name(ztree_node_##Name *n)                                    \
+    static inline int ztree_take_##Name(ztree_##Name *t, Key k, Val *out_val)                                   \
     {                                                                                                           \
-        if (!n)                                                                                                 \
-        {                                                                                                       \
-            return NULL;                                                                                        \
-        }                                                                                                       \
-        if (n->left)                                                                                            \
+        return ztree__cow_take_##Name(t, k, out_val);                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline void ztree_remove_##Name(ztree_##Name *t, Key k)                                              \
+    {                                                                                                           \
+        ztree__cow_take_##Name(t, k, NULL);                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree__pop_##Name(ztree_##Name *t, ztree_node_##Name *x, Key *out_key, Val *out_val)      \
+    {                                                                                                           \
+        if (!x)                                                                                                 \
         {                                                                                                       \
-            n = n->left;                                                                                        \
-            while (n->right)                                                                                    \
-            {                                                                                                   \
-                n = n->right;                                                                                   \
-            }                                                                                                   \
-            return n;                                                                                           \
+            return Z_EEMPTY;                                                                                    \
         }                                                                                                       \
-        ztree_node_##Name *p = n->parent;                                                                       \
-        while (p && n == p->left)                                                                               \
+        Key k = x->key;                                                                                         \
+        if (out_key)                                                                                            \
         {                                                                                                       \
-            n = p;                                                                                              \
-            p = p->parent;                                                                                      \
+            *out_key = k;                                                                                       \
         }                                                                                                       \
-        return p;                                                                                               \
+        return ztree__cow_take_##Name(t, k, out_val);                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_min_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, ztree_min_##Name(t), out_key, out_val);                                     \
+    }                                                                                                           \
+                                                                                                                \
+    static inline int ztree_pop_max_##Name(ztree_##Name *t, Key *out_key, Val *out_val)                         \
+    {                                                                                                           \
+        return ztree__pop_##Name(t, ztree_max_##Name(t), out_key, out_val);                                     \
+    }                                                                                                           \
+                                                                                                                \
+    ZTREE__GENERATE_STACK_CURSOR(Key, Name, Cmp)
+
+
+#ifndef REGISTER_ZTREE_TYPES
+#   if defined(__has_include) && __has_include("z_registry.h")
+#       include "z_registry.h"
+#   endif
+#endif
+
+#ifndef REGISTER_ZTREE_TYPES
+#   define REGISTER_ZTREE_TYPES(X)
+#endif
+
+#ifndef Z_AUTOGEN_TREES
+#   define Z_AUTOGEN_TREES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_COMPACT_TYPES
+#   define REGISTER_ZTREE_COMPACT_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_PERSISTENT_TYPES
+#   define REGISTER_ZTREE_PERSISTENT_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_MULTIMAP_TYPES
+#   define REGISTER_ZTREE_MULTIMAP_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_SPLIT_TYPES
+#   define REGISTER_ZTREE_SPLIT_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_PREFIX_TYPES
+#   define REGISTER_ZTREE_PREFIX_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_HASHED_TYPES
+#   define REGISTER_ZTREE_HASHED_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_FILTERED_TYPES
+#   define REGISTER_ZTREE_FILTERED_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_AVL_TYPES
+#   define REGISTER_ZTREE_AVL_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_ADAPTIVE_TYPES
+#   define REGISTER_ZTREE_ADAPTIVE_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_SMALL_TYPES
+#   define REGISTER_ZTREE_SMALL_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_TOPK_TYPES
+#   define REGISTER_ZTREE_TOPK_TYPES(X)
+#endif
+
+// Concurrent maps need atomics and sched_yield, so the primitives below are only compiled when one is registered.
+#if defined(REGISTER_ZTREE_SYNC_TYPES) || defined(REGISTER_ZTREE_RCU_TYPES) || defined(REGISTER_ZTREE_SHARDED_TYPES) \
+    || defined(REGISTER_ZTREE_SKIPLIST_TYPES)
+#   define ZTREE__CONCURRENT
+#endif
+
+#ifndef REGISTER_ZTREE_SYNC_TYPES
+#   define REGISTER_ZTREE_SYNC_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_RCU_TYPES
+#   define REGISTER_ZTREE_RCU_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_SHARDED_TYPES
+#   define REGISTER_ZTREE_SHARDED_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_SKIPLIST_TYPES
+#   define REGISTER_ZTREE_SKIPLIST_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZSET_TYPES
+#   define REGISTER_ZSET_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_INDEX_TYPES
+#   define REGISTER_ZTREE_INDEX_TYPES(X)
+#endif
+
+#ifndef REGISTER_ZTREE_FIXED_TYPES
+#   define REGISTER_ZTREE_FIXED_TYPES(X)
+#endif
+
+#ifdef ZTREE__CONCURRENT
+#include <sched.h>
+
+// Reader stripes per sync map lock. Readers on different stripes never write the same cache line, so
+// read-mostly workloads scale with cores; a writer has to wait for every stripe to drain.
+#ifndef ZTREE_SYNC_STRIPES
+#   define ZTREE_SYNC_STRIPES 16
+#endif
+
+typedef struct
+{
+    long readers;
+    char pad[64 - sizeof(long)];
+} ztree_sync_stripe;
+
+// Writer-preferring reader-writer lock: readers back off while `writer` is set, so updates never starve.
+typedef struct
+{
+    ztree_sync_stripe stripes[ZTREE_SYNC_STRIPES];
+    int writer;
+} ztree_rwlock;
+
+static inline void ztree__rw_init(ztree_rwlock *l)
+{
+    for (int i = 0; i < ZTREE_SYNC_STRIPES; i++)
+    {
+        l->stripes[i].readers = 0;
+    }
+    l->writer = 0;
+}
+
+static inline ztree_sync_stripe *ztree__rw_read_lock(ztree_rwlock *l)
+{
+    /* Threads run on separate stacks, so a stack address spreads them over the stripes without TLS. */
+    char probe;
+    uint64_t h = (uint64_t)((uintptr_t)&probe >> 16) * 0x9E3779B97F4A7C15ULL;
+    ztree_sync_stripe *s = &l->stripes[(h >> 32) % ZTREE_SYNC_STRIPES];
+    for (;;)
+    {
+        __atomic_fetch_add(&s->readers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&l->writer, __ATOMIC_SEQ_CST))
+        {
+            return s;
+        }
+        __atomic_fetch_sub(&s->readers, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&l->writer, __ATOMIC_RELAXED))
+        {
+            sched_yield();
+        }
+    }
+}
+
+static inline void ztree__rw_read_unlock(ztree_sync_stripe *s)
+{
+    __atomic_fetch_sub(&s->readers, 1, __ATOMIC_RELEASE);
+}
+
+static inline void ztree__rw_lock(ztree_rwlock *l)
+{
+    int idle = 0;
+    while (!__atomic_compare_exchange_n(&l->writer, &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    {
+        idle = 0;
+        sched_yield();
+    }
+    for (int i = 0; i < ZTREE_SYNC_STRIPES; i++)
+    {
+        while (__atomic_load_n(&l->stripes[i].readers, __ATOMIC_SEQ_CST))
+        {
+            sched_yield();
+        }
+    }
+}
+
+static inline void ztree__rw_unlock(ztree_rwlock *l)
+{
+    __atomic_store_n(&l->writer, 0, __ATOMIC_RELEASE);
+}
+
+// Serializes the writers of an RCU map (readers never touch it) and guards each shard of a sharded map.
+static inline void ztree__spin_lock(int *flag)
+{
+    int idle = 0;
+    while (!__atomic_compare_exchange_n(flag, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        idle = 0;
+        sched_yield();
+    }
+}
+
+static inline void ztree__spin_unlock(int *flag)
+{
+    __atomic_store_n(flag, 0, __ATOMIC_RELEASE);
+}
+
+// Upper bound on shards per sharded map; ztree_sharded_rebalance never splits past it.
+#ifndef ZTREE_SHARDS_MAX
+#   define ZTREE_SHARDS_MAX 64
+#endif
+
+// Nodes ztree_sharded_rebalance moves per hold of the topology lock; other calls run between batches.
+#ifndef ZTREE_SHARD_MOVE_BATCH
+#   define ZTREE_SHARD_MOVE_BATCH 256
+#endif
+
+// Reader slots per RCU or skiplist map. A thread claims one with ztree_rcu_register and keeps it for as long as
+// it uses the map.
+#ifndef ZTREE_RCU_READERS
+#   define ZTREE_RCU_READERS 64
+#endif
+
+typedef struct
+{
+    uint64_t active;
+    const uint64_t *clock;
+    int claimed;
+    char pad[64 - 2 * sizeof(uint64_t) - sizeof(int)];
+} ztree_rcu_reader;
+
+// Epoch domain: `active` holds the epoch a reader entered in, or 0 while it is outside a read section. A node
+// retired in epoch e may be freed once every active reader entered after e.
+typedef struct
+{
+    uint64_t epoch;
+    ztree_rcu_reader readers[ZTREE_RCU_READERS];
+} ztree_epoch;
+
+static inline void ztree__epoch_init(ztree_epoch *e)
+{
+    e->epoch = 1;
+    for (int i = 0; i < ZTREE_RCU_READERS; i++)
+    {
+        e->readers[i].active = 0;
+        e->readers[i].clock = NULL;
+        e->readers[i].claimed = 0;
+    }
+}
+
+static inline ztree_rcu_reader *ztree__epoch_register(ztree_epoch *e)
+{
+    for (int i = 0; i < ZTREE_RCU_READERS; i++)
+    {
+        int idle = 0;
+        if (__atomic_compare_exchange_n(&e->readers[i].claimed, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            /* Set here rather than at init, since maps are returned by value from ztree_init. */
+            e->readers[i].clock = &e->epoch;
+            return &e->readers[i];
+        }
+    }
+    return NULL;
+}
+
+static inline void ztree_rcu_unregister(ztree_rcu_reader *r)
+{
+    __atomic_store_n(&r->claimed, 0, __ATOMIC_RELEASE);
+}
+
+static inline void ztree_rcu_read_lock(ztree_rcu_reader *r)
+{
+    /* Announce first, then read the root: the fence pairs with the one in ztree__epoch_advance, so either the
+     * writer sees this reader or this reader sees the writer's newest root. Plain stores, no read-modify-write. */
+    __atomic_store_n(&r->active, __atomic_load_n(r->clock, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void ztree_rcu_read_unlock(ztree_rcu_reader *r)
+{
+    __atomic_store_n(&r->active, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t ztree__epoch_advance(ztree_epoch *e)
+{
+    /* Called by a writer after publishing; returns the oldest epoch a reader may still be in. Skiplist maps 
+     * advance from several threads at once, so the increment is atomic. */
+    uint64_t oldest = __atomic_add_fetch(&e->epoch, 1, __ATOMIC_ACQ_REL);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (int i = 0; i < ZTREE_RCU_READERS; i++)
+    {
+        uint64_t a = __atomic_load_n(&e->readers[i].active, __ATOMIC_ACQUIRE);
+        if (a && a < oldest)
+        {
+            oldest = a;
+        }
+    }
+    return oldest;
+}
+
+// Tower height cap for skiplist nodes. Heights are geometric with p = 1/2, so 24 levels stay logarithmic up
+// to about 16M keys; larger maps still work, with longer bottom-level walks.
+#ifndef ZTREE_SKIPLIST_LEVELS
+#   define ZTREE_SKIPLIST_LEVELS 24
+#endif
+
+// Retired towers a skiplist map lets pile up before an update frees the ones no reader can still see. While a
+// reader stalls, collections space out in proportion to the backlog they had to keep.
+#ifndef ZTREE_SKIPLIST_COLLECT
+#   define ZTREE_SKIPLIST_COLLECT 64
+#endif
+
+static inline int ztree__skip_level(void)
+{
+    /* Per-thread xorshift seeded from the thread's own slot, so concurrent inserts share no state. */
+    static __thread uint64_t seed;
+    if (0 == seed)
+    {
+        seed = (uint64_t)(uintptr_t)&seed | 1;
     }
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    int level = 1;
+    for (uint64_t bits = seed; (bits & 1) && level < ZTREE_SKIPLIST_LEVELS; bits >>= 1)
+    {
+        level++;
+    }
+    return level;
+}
+#endif
+
+#define Z_ALL_TREES(X) Z_AUTOGEN_TREES(X) REGISTER_ZTREE_TYPES(X)
+
+// Plain maps balanced as AVL trees instead of red-black; same API and entries as Z_ALL_TREES.
+#define Z_ALL_AVL_TREES(X) REGISTER_ZTREE_AVL_TYPES(X)
+
+// Plain maps that splay frequently found keys toward the root; same API and entries as Z_ALL_TREES.
+#define Z_ALL_ADAPTIVE_TREES(X) REGISTER_ZTREE_ADAPTIVE_TYPES(X)
+
+// Red-black maps with a ztree_sync_##Name wrapper; the wrapped tree is in the `tree` member.
+#define Z_ALL_SYNC_MAPS(X) REGISTER_ZTREE_SYNC_TYPES(X)
+
+// Copy-on-write maps with lock-free readers and one writer at a time (see ZTREE_GENERATE_RCU_IMPL).
+#define Z_ALL_RCU_MAPS(X) REGISTER_ZTREE_RCU_TYPES(X)
+
+// Red-black maps with a ztree_sharded_##Name container; each shard's tree is in `shards[i].tree`.
+#define Z_ALL_SHARDED_MAPS(X) REGISTER_ZTREE_SHARDED_TYPES(X)
+
+// Lock-free skiplists behind the map API; ztree_next walks them, ztree_prev does not.
+#define Z_ALL_SKIPLIST_MAPS(X) REGISTER_ZTREE_SKIPLIST_TYPES(X)
+
+// Red-black maps capped at K entries with a ztree_topk_##Name wrapper; the kept entries are in the `tree` member.
+#define Z_ALL_TOPK_MAPS(X) REGISTER_ZTREE_TOPK_TYPES(X)
+
+// Plain maps under any balancing policy.
+#define Z_ALL_PLAIN_MAPS(X) Z_ALL_TREES(X) Z_ALL_AVL_TREES(X) Z_ALL_ADAPTIVE_TREES(X) Z_ALL_SYNC_MAPS(X) \
+                            Z_ALL_SHARDED_MAPS(X) Z_ALL_TOPK_MAPS(X)
+
+// Index-linked trees; fixed registrations pass a trailing capacity, hence the variadic entries below.
+#define Z_ALL_INDEX_TREES(X) REGISTER_ZTREE_INDEX_TYPES(X) REGISTER_ZTREE_FIXED_TYPES(X)
+
+// Trees whose nodes cannot reach their parent: iterated with a cursor instead of ztree_next/ztree_prev.
+// Path-copying maps with O(1) snapshots; they keep the compact API and cursors (see ZTREE_GENERATE_PERSISTENT_IMPL).
+#define Z_ALL_PERSISTENT_MAPS(X) REGISTER_ZTREE_PERSISTENT_TYPES(X)
+
+#define Z_ALL_CURSOR_TREES(X) REGISTER_ZTREE_COMPACT_TYPES(X) Z_ALL_INDEX_TREES(X) Z_ALL_PERSISTENT_MAPS(X)
+
+// Parent-linked trees that keep duplicate keys.
+#define Z_ALL_MULTIMAPS(X) REGISTER_ZTREE_MULTIMAP_TYPES(X)
+
+// Parent-linked trees whose values live in a side slab; read them through ztree_value.
+#define Z_ALL_SPLIT_MAPS(X) REGISTER_ZTREE_SPLIT_TYPES(X)
+
+// Parent-linked maps that cache a key prefix in every node, registered as X(Key, Val, Name, Cmp, Prefix).
+#define Z_ALL_PREFIX_MAPS(X) REGISTER_ZTREE_PREFIX_TYPES(X)
+
+// Parent-linked maps with a side hash index for exact lookups, registered as X(Key, Val, Name, Cmp, Hash).
+#define Z_ALL_HASHED_MAPS(X) REGISTER_ZTREE_HASHED_TYPES(X)
+
+// Parent-linked maps with a Bloom filter in front of ztree_find, registered as X(Key, Val, Name, Cmp, Hash).
+#define Z_ALL_FILTERED_MAPS(X) REGISTER_ZTREE_FILTERED_TYPES(X)
+
+#define Z_ALL_LINKED_MAPS(X) Z_ALL_PLAIN_MAPS(X) Z_ALL_MULTIMAPS(X) Z_ALL_SPLIT_MAPS(X) Z_ALL_PREFIX_MAPS(X) \
+                             Z_ALL_HASHED_MAPS(X) Z_ALL_FILTERED_MAPS(X)
+
+// Maps kept in an inline sorted array until they outgrow it, registered as X(Key, Val, Name, Cmp, N).
+#define Z_ALL_SMALL_MAPS(X) REGISTER_ZTREE_SMALL_TYPES(X)
+
+#define Z_ALL_MAPS(X) Z_ALL_LINKED_MAPS(X) Z_ALL_CURSOR_TREES(X) Z_ALL_SMALL_MAPS(X)
+
+// Parent-linked maps with a finger cursor (one node, no stack) that searches outward from its position.
+#define Z_ALL_FINGER_TREES(X) Z_ALL_PLAIN_MAPS(X)
+
+// Parent-linked maps whose nodes hold the whole entry, so ztree_extract / ztree_insert_node move it as is.
+#define Z_ALL_HANDLE_MAPS(X) Z_ALL_PLAIN_MAPS(X) Z_ALL_MULTIMAPS(X)
+
+// Every tree with a cursor API.
+#define Z_ALL_CURSORS(X) Z_ALL_CURSOR_TREES(X) Z_ALL_FINGER_TREES(X)
+
+// Key-only trees, registered as X(Key, Name, Cmp); they dispatch through the S_* entries below.
+#define Z_ALL_SETS(X) REGISTER_ZSET_TYPES(X)
+
+Z_ALL_TREES(ZTREE_GENERATE_IMPL)
+Z_ALL_AVL_TREES(ZTREE_GENERATE_AVL_IMPL)
+Z_ALL_ADAPTIVE_TREES(ZTREE_GENERATE_ADAPTIVE_IMPL)
+Z_ALL_SMALL_MAPS(ZTREE_GENERATE_SMALL_IMPL)
+Z_ALL_SYNC_MAPS(ZTREE_GENERATE_SYNC_IMPL)
+Z_ALL_RCU_MAPS(ZTREE_GENERATE_RCU_IMPL)
+Z_ALL_SHARDED_MAPS(ZTREE_GENERATE_SHARDED_IMPL)
+Z_ALL_TOPK_MAPS(ZTREE_GENERATE_TOPK_IMPL)
+Z_ALL_SKIPLIST_MAPS(ZTREE_GENERATE_SKIPLIST_IMPL)
+REGISTER_ZTREE_COMPACT_TYPES(ZTREE_GENERATE_COMPACT_IMPL)
+Z_ALL_PERSISTENT_MAPS(ZTREE_GENERATE_PERSISTENT_IMPL)
+Z_ALL_SETS(ZTREE_GENERATE_SET_IMPL)
+Z_ALL_MULTIMAPS(ZTREE_GENERATE_MULTI_IMPL)
+Z_ALL_SPLIT_MAPS(ZTREE_GENERATE_SPLIT_IMPL)
+Z_ALL_PREFIX_MAPS(ZTREE_GENERATE_PREFIX_IMPL)
+Z_ALL_HASHED_MAPS(ZTREE_GENERATE_HASHED_IMPL)
+Z_ALL_FILTERED_MAPS(ZTREE_GENERATE_FILTERED_IMPL)
+REGISTER_ZTREE_INDEX_TYPES(ZTREE_GENERATE_INDEX_IMPL)
+REGISTER_ZTREE_FIXED_TYPES(ZTREE_GENERATE_FIXED_IMPL)
+
+#define T_INSERT_ENTRY(K, V, Name, ...)      ztree_##Name*: ztree_insert_##Name,
+#define T_FIND_ENTRY(K, V, Name, ...)        ztree_##Name*: ztree_find_##Name,
+#define T_LB_ENTRY(K, V, Name, ...)          ztree_##Name*: ztree_lower_bound_##Name,
+#define T_REM_ENTRY(K, V, Name, ...)         ztree_##Name*: ztree_remove_##Name,
+#define T_CLEAR_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_clear_##Name,
+#define T_MIN_ENTRY(K, V, Name, ...)         ztree_##Name*: ztree_min_##Name,
+#define T_MAX_ENTRY(K, V, Name, ...)         ztree_##Name*: ztree_max_##Name,
+#define T_NEXT_ENTRY(K, V, Name, ...)        ztree_node_##Name*: ztree_next_##Name,
+#define T_PREV_ENTRY(K, V, Name, ...)        ztree_node_##Name*: ztree_prev_##Name,
+#define T_REM_NODE_ENTRY(K, V, Name, ...)    ztree_##Name*: ztree_remove_node_##Name,
+#define T_TAKE_ENTRY(K, V, Name, ...)        ztree_##Name*: ztree_take_##Name,
+#define T_BATCH_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_apply_batch_##Name,
+#define T_PART_ENTRY(K, V, Name, ...)        ztree_##Name*: ztree_partition_##Name,
+#define T_CLONE_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_clone_##Name,
+#define T_EXTRACT_ENTRY(K, V, Name, ...)     ztree_##Name*: ztree_extract_##Name,
+#define T_EXTRACT_NODE_ENTRY(K, V, Name, ...) ztree_##Name*: ztree_extract_node_##Name,
+#define T_INS_NODE_ENTRY(K, V, Name, ...)    ztree_##Name*: ztree_insert_node_##Name,
+#define T_FREE_NODE_ENTRY(K, V, Name, ...)   ztree_node_##Name*: ztree_free_node_##Name,
+#define T_PAR_EACH_ENTRY(K, V, Name, ...)    ztree_##Name*: ztree_parallel_foreach_##Name,
+#define T_POP_MIN_ENTRY(K, V, Name, ...)     ztree_##Name*: ztree_pop_min_##Name,
+#define T_POP_MAX_ENTRY(K, V, Name, ...)     ztree_##Name*: ztree_pop_max_##Name,
+#define T_RESERVE_ENTRY(K, V, Name, ...)     ztree_##Name*: ztree_reserve_##Name,
+#define T_UB_ENTRY(K, V, Name, ...)          ztree_##Name*: ztree_upper_bound_##Name,
+#define T_RANGE_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_equal_range_##Name,
+#define T_COUNT_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_count_##Name,
+#define T_VALUE_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_value_##Name,
+#define T_STATS_ENTRY(K, V, Name, ...)       ztree_##Name*: ztree_stats_##Name,
+#define T_TUNE_ENTRY(K, V, Name, ...)        ztree_##Name*: ztree_tune_filter_##Name,
+#define T_SNAPSHOT_ENTRY(K, V, Name, ...)    ztree_##Name*: ztree_snapshot_##Name,
+
+#define T_SYNC_FIND_ENTRY(K, V, Name, ...)   ztree_sync_##Name*: ztree_sync_find_##Name,
+#define T_SYNC_LB_ENTRY(K, V, Name, ...)     ztree_sync_##Name*: ztree_sync_lower_bound_##Name,
+#define T_SYNC_INS_ENTRY(K, V, Name, ...)    ztree_sync_##Name*: ztree_sync_insert_##Name,
+#define T_SYNC_REM_ENTRY(K, V, Name, ...)    ztree_sync_##Name*: ztree_sync_remove_##Name,
+#define T_SYNC_CLEAR_ENTRY(K, V, Name, ...)  ztree_sync_##Name*: ztree_sync_clear_##Name,
+#define T_SYNC_SIZE_ENTRY(K, V, Name, ...)   ztree_sync_##Name*: ztree_sync_size_##Name,
+#define T_SYNC_SNAP_ENTRY(K, V, Name, ...)   ztree_sync_##Name*: ztree_sync_snapshot_##Name,
+#define T_SYNC_EACH_ENTRY(K, V, Name, ...)   ztree_sync_##Name*: ztree_sync_foreach_##Name,
+
+#define T_RCU_REG_ENTRY(K, V, Name, ...)     ztree_##Name*: ztree_rcu_register_##Name,
+
+#define T_SHARD_INIT_ENTRY(K, V, Name, ...)  ztree_sharded_##Name*: ztree_sharded_init_##Name,
+#define T_SHARD_FIND_ENTRY(K, V, Name, ...)  ztree_sharded_##Name*: ztree_sharded_find_##Name,
+#define T_SHARD_LB_ENTRY(K, V, Name, ...)    ztree_sharded_##Name*: ztree_sharded_lower_bound_##Name,
+#define T_SHARD_INS_ENTRY(K, V, Name, ...)   ztree_sharded_##Name*: ztree_sharded_insert_##Name,
+#define T_SHARD_REM_ENTRY(K, V, Name, ...)   ztree_sharded_##Name*: ztree_sharded_remove_##Name,
+#define T_SHARD_CLEAR_ENTRY(K, V, Name, ...) ztree_sharded_##Name*: ztree_sharded_clear_##Name,
+#define T_SHARD_SIZE_ENTRY(K, V, Name, ...)  ztree_sharded_##Name*: ztree_sharded_size_##Name,
+#define T_SHARD_EACH_ENTRY(K, V, Name, ...)  ztree_sharded_##Name*: ztree_sharded_foreach_##Name,
+#define T_SHARD_REBAL_ENTRY(K, V, Name, ...) ztree_sharded_##Name*: ztree_sharded_rebalance_##Name,
+#define T_SKIP_RECLAIM_ENTRY(K, V, Name, ...) ztree_##Name*: ztree_skiplist_reclaim_##Name,
+#define T_TOPK_INS_ENTRY(K, V, Name, ...)    ztree_topk_##Name*: ztree_topk_insert_##Name,
+#define T_TOPK_CLEAR_ENTRY(K, V, Name, ...)  ztree_topk_##Name*: ztree_topk_clear_##Name,
+
+#define S_INSERT_ENTRY(K, Name, Cmp)         ztree_##Name*: ztree_insert_##Name,
+#define S_FIND_ENTRY(K, Name, Cmp)           ztree_##Name*: ztree_find_##Name,
+#define S_LB_ENTRY(K, Name, Cmp)             ztree_##Name*: ztree_lower_bound_##Name,
+#define S_REM_ENTRY(K, Name, Cmp)            ztree_##Name*: ztree_remove_##Name,
+#define S_CLEAR_ENTRY(K, Name, Cmp)          ztree_##Name*: ztree_clear_##Name,
+#define S_MIN_ENTRY(K, Name, Cmp)            ztree_##Name*: ztree_min_##Name,
+#define S_MAX_ENTRY(K, Name, Cmp)            ztree_##Name*: ztree_max_##Name,
+#define S_NEXT_ENTRY(K, Name, Cmp)           ztree_node_##Name*: ztree_next_##Name,
+#define S_PREV_ENTRY(K, Name, Cmp)           ztree_node_##Name*: ztree_prev_##Name,
+#define S_REM_NODE_ENTRY(K, Name, Cmp)       ztree_##Name*: ztree_remove_node_##Name,
+#define S_POP_MIN_ENTRY(K, Name, Cmp)        ztree_##Name*: ztree_pop_min_##Name,
+#define S_POP_MAX_ENTRY(K, Name, Cmp)        ztree_##Name*: ztree_pop_max_##Name,
+#define S_CONTAINS_ENTRY(K, Name, Cmp)       ztree_##Name*: ztree_contains_##Name,
+#define S_ERASE_ENTRY(K, Name, Cmp)          ztree_##Name*: ztree_erase_##Name,
+#define S_PART_ENTRY(K, Name, Cmp)           ztree_##Name*: ztree_partition_##Name,
+#define S_CLONE_ENTRY(K, Name, Cmp)          ztree_##Name*: ztree_clone_##Name,
+#define S_EXTRACT_ENTRY(K, Name, Cmp)        ztree_##Name*: ztree_extract_##Name,
+#define S_EXTRACT_NODE_ENTRY(K, Name, Cmp)   ztree_##Name*: ztree_extract_node_##Name,
+#define S_INS_NODE_ENTRY(K, Name, Cmp)       ztree_##Name*: ztree_insert_node_##Name,
+#define S_FREE_NODE_ENTRY(K, Name, Cmp)      ztree_node_##Name*: ztree_free_node_##Name,
+#define S_PAR_EACH_ENTRY(K, Name, Cmp)       ztree_##Name*: ztree_parallel_foreach_##Name,
+
+#define T_CUR_INIT_ENTRY(K, V, Name, ...)    ztree_##Name*: ztree_cursor_init_##Name,
+#define T_CUR_GET_ENTRY(K, V, Name, ...)     ztree_cursor_##Name*: ztree_cursor_get_##Name,
+#define T_CUR_FIRST_ENTRY(K, V, Name, ...)   ztree_cursor_##Name*: ztree_cursor_first_##Name,
+#define T_CUR_LAST_ENTRY(K, V, Name, ...)    ztree_cursor_##Name*: ztree_cursor_last_##Name,
+#define T_CUR_NEXT_ENTRY(K, V, Name, ...)    ztree_cursor_##Name*: ztree_cursor_next_##Name,
+#define T_CUR_PREV_ENTRY(K, V, Name, ...)    ztree_cursor_##Name*: ztree_cursor_prev_##Name,
+#define T_CUR_SEEK_ENTRY(K, V, Name, ...)    ztree_cursor_##Name*: ztree_cursor_seek_##Name,
+#define T_CUR_FIND_ENTRY(K, V, Name, ...)    ztree_cursor_##Name*: ztree_cursor_find_##Name,
+#define T_CUR_INS_ENTRY(K, V, Name, ...)     ztree_cursor_##Name*: ztree_cursor_insert_##Name,
+
+#define ztree_init(Name)             ztree_init_##Name()
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define ztree_autofree(Name)     __attribute__((cleanup(ztree_clear_##Name))) ztree_##Name
+#endif
+
+// Maps take (t, k, v) and sets take (t, k), so the generic insert/pop forward their trailing arguments.
+#define ztree_insert(t, ...)    _Generic((t), Z_ALL_MAPS(T_INSERT_ENTRY) Z_ALL_RCU_MAPS(T_INSERT_ENTRY) Z_ALL_SKIPLIST_MAPS(T_INSERT_ENTRY) Z_ALL_SETS(S_INSERT_ENTRY) default: 0) (t, __VA_ARGS__)
+#define ztree_remove(t, k)      _Generic((t), Z_ALL_MAPS(T_REM_ENTRY) Z_ALL_RCU_MAPS(T_REM_ENTRY) Z_ALL_SKIPLIST_MAPS(T_REM_ENTRY) Z_ALL_SETS(S_REM_ENTRY) default: (void)0) (t, k)
+#define ztree_find(t, k)        _Generic((t), Z_ALL_MAPS(T_FIND_ENTRY) Z_ALL_RCU_MAPS(T_FIND_ENTRY) Z_ALL_SKIPLIST_MAPS(T_FIND_ENTRY) Z_ALL_SETS(S_FIND_ENTRY) default: NULL)  (t, k)
+#define ztree_lower_bound(t,k)  _Generic((t), Z_ALL_MAPS(T_LB_ENTRY) Z_ALL_RCU_MAPS(T_LB_ENTRY) Z_ALL_SKIPLIST_MAPS(T_LB_ENTRY) Z_ALL_SETS(S_LB_ENTRY) default: NULL)      (t, k)
+#define ztree_clear(t)          _Generic((t), Z_ALL_MAPS(T_CLEAR_ENTRY) Z_ALL_RCU_MAPS(T_CLEAR_ENTRY) Z_ALL_SKIPLIST_MAPS(T_CLEAR_ENTRY) Z_ALL_SETS(S_CLEAR_ENTRY) default: (void)0) (t)
+#define ztree_min(t)            _Generic((t), Z_ALL_MAPS(T_MIN_ENTRY) Z_ALL_RCU_MAPS(T_MIN_ENTRY) Z_ALL_SKIPLIST_MAPS(T_MIN_ENTRY) Z_ALL_SETS(S_MIN_ENTRY) default: NULL)    (t)
+#define ztree_max(t)            _Generic((t), Z_ALL_MAPS(T_MAX_ENTRY) Z_ALL_RCU_MAPS(T_MAX_ENTRY) Z_ALL_SKIPLIST_MAPS(T_MAX_ENTRY) Z_ALL_SETS(S_MAX_ENTRY) default: NULL)    (t)
+#define ztree_next(n)           _Generic((n), Z_ALL_LINKED_MAPS(T_NEXT_ENTRY) Z_ALL_SMALL_MAPS(T_NEXT_ENTRY) Z_ALL_SKIPLIST_MAPS(T_NEXT_ENTRY) Z_ALL_SETS(S_NEXT_ENTRY) default: NULL) (n)
+#define ztree_prev(n)           _Generic((n), Z_ALL_LINKED_MAPS(T_PREV_ENTRY) Z_ALL_SMALL_MAPS(T_PREV_ENTRY) Z_ALL_SETS(S_PREV_ENTRY) default: NULL) (n)
+#define ztree_remove_node(t, n) _Generic((t), Z_ALL_LINKED_MAPS(T_REM_NODE_ENTRY) Z_ALL_SMALL_MAPS(T_REM_NODE_ENTRY) Z_ALL_SETS(S_REM_NODE_ENTRY) default: (void)0) (t, n)
+#define ztree_take(t, k, v)     _Generic((t), Z_ALL_MAPS(T_TAKE_ENTRY) Z_ALL_RCU_MAPS(T_TAKE_ENTRY) Z_ALL_SKIPLIST_MAPS(T_TAKE_ENTRY)   default: 0)       (t, k, v)
+#define ztree_apply_batch(t, ops, n) _Generic((t), Z_ALL_PLAIN_MAPS(T_BATCH_ENTRY) default: 0)    (t, ops, n)
+#define ztree_pop_min(t, ...)   _Generic((t), Z_ALL_MAPS(T_POP_MIN_ENTRY) Z_ALL_SETS(S_POP_MIN_ENTRY) default: 0) (t, __VA_ARGS__)
+#define ztree_pop_max(t, ...)   _Generic((t), Z_ALL_MAPS(T_POP_MAX_ENTRY) Z_ALL_SETS(S_POP_MAX_ENTRY) default: 0) (t, __VA_ARGS__)
+#define ztree_contains(t, k)    _Generic((t), Z_ALL_SETS(S_CONTAINS_ENTRY) default: 0)   (t, k)
+#define ztree_erase(t, k)       _Generic((t), Z_ALL_SETS(S_ERASE_ENTRY)    default: 0)   (t, k)
+#define ztree_upper_bound(t, k) _Generic((t), Z_ALL_MULTIMAPS(T_UB_ENTRY)    default: NULL) (t, k)
+#define ztree_equal_range(t, k, first, last) _Generic((t), Z_ALL_MULTIMAPS(T_RANGE_ENTRY) default: 0) (t, k, first, last)
+#define ztree_count(t, k)       _Generic((t), Z_ALL_MULTIMAPS(T_COUNT_ENTRY) default: 0)    (t, k)
+#define ztree_value(t, n)       _Generic((t), Z_ALL_LINKED_MAPS(T_VALUE_ENTRY) Z_ALL_SMALL_MAPS(T_VALUE_ENTRY) default: NULL) (t, n)
+#define ztree_stats(t)          _Generic((t), Z_ALL_FILTERED_MAPS(T_STATS_ENTRY) default: 0)   (t)
+#define ztree_tune_filter(t, b) _Generic((t), Z_ALL_FILTERED_MAPS(T_TUNE_ENTRY) default: 0)    (t, b)
+#define ztree_snapshot(t)       _Generic((t), Z_ALL_PERSISTENT_MAPS(T_SNAPSHOT_ENTRY) default: 0) (t)
+#define ztree_extract(t, k)     _Generic((t), Z_ALL_HANDLE_MAPS(T_EXTRACT_ENTRY) Z_ALL_SETS(S_EXTRACT_ENTRY) default: NULL) (t, k)
+#define ztree_extract_node(t, n) \
+        _Generic((t), Z_ALL_HANDLE_MAPS(T_EXTRACT_NODE_ENTRY) Z_ALL_SETS(S_EXTRACT_NODE_ENTRY) default: NULL) (t, n)
+#define ztree_insert_node(t, n) _Generic((t), Z_ALL_HANDLE_MAPS(T_INS_NODE_ENTRY) Z_ALL_SETS(S_INS_NODE_ENTRY) default: 0) (t, n)
+#define ztree_free_node(n)      _Generic((n), Z_ALL_HANDLE_MAPS(T_FREE_NODE_ENTRY) Z_ALL_SETS(S_FREE_NODE_ENTRY) default: (void)0) (n)
+#define ztree_clone(dst, src)   _Generic((dst), Z_ALL_LINKED_MAPS(T_CLONE_ENTRY) Z_ALL_SMALL_MAPS(T_CLONE_ENTRY) Z_ALL_SETS(S_CLONE_ENTRY) default: 0) (dst, src)
+#define ztree_partition(t, k, ranges) \
+                                _Generic((t), Z_ALL_LINKED_MAPS(T_PART_ENTRY) Z_ALL_SETS(S_PART_ENTRY) default: 0) (t, k, ranges)
+#ifdef ZTREE_PARALLEL
+#   define ztree_parallel_foreach(t, fn, ctx, nthreads) \
+        _Generic((t), Z_ALL_LINKED_MAPS(T_PAR_EACH_ENTRY) Z_ALL_SETS(S_PAR_EACH_ENTRY) default: 0) (t, fn, ctx, nthreads)
+#endif
+
+#define ztree_reserve(t, n)      _Generic((t), Z_ALL_INDEX_TREES(T_RESERVE_ENTRY)    default: 0)    (t, n)
+
+#define ztree_cursor_init(t)     _Generic((t), Z_ALL_CURSORS(T_CUR_INIT_ENTRY)  default: 0)    (t)
+#define ztree_cursor_get(c)      _Generic((c), Z_ALL_CURSORS(T_CUR_GET_ENTRY)   default: NULL) (c)
+#define ztree_cursor_first(c)    _Generic((c), Z_ALL_CURSORS(T_CUR_FIRST_ENTRY) default: NULL) (c)
+#define ztree_cursor_last(c)     _Generic((c), Z_ALL_CURSORS(T_CUR_LAST_ENTRY)  default: NULL) (c)
+#define ztree_cursor_next(c)     _Generic((c), Z_ALL_CURSORS(T_CUR_NEXT_ENTRY)  default: NULL) (c)
+#define ztree_cursor_prev(c)     _Generic((c), Z_ALL_CURSORS(T_CUR_PREV_ENTRY)  default: NULL) (c)
+#define ztree_cursor_seek(c, k)  _Generic((c), Z_ALL_CURSORS(T_CUR_SEEK_ENTRY)  default: NULL) (c, k)
+#define ztree_cursor_find(c, k)  _Generic((c), Z_ALL_FINGER_TREES(T_CUR_FIND_ENTRY) default: NULL) (c, k)
+#define ztree_cursor_insert(c, k, v) _Generic((c), Z_ALL_FINGER_TREES(T_CUR_INS_ENTRY) default: 0) (c, k, v)
+
+#define ztree_sync_init(Name)             ztree_sync_init_##Name()
+#define ztree_sync_find(s, k, v)          _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_FIND_ENTRY)  default: 0) (s, k, v)
+#define ztree_sync_lower_bound(s, k, ok, ov) _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_LB_ENTRY) default: 0) (s, k, ok, ov)
+#define ztree_sync_insert(s, k, v)        _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_INS_ENTRY)   default: 0) (s, k, v)
+#define ztree_sync_remove(s, k)           _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_REM_ENTRY)   default: 0) (s, k)
+#define ztree_sync_clear(s)               _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_CLEAR_ENTRY) default: (void)0) (s)
+#define ztree_sync_size(s)                _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_SIZE_ENTRY)  default: 0) (s)
+#define ztree_sync_snapshot(s, out, n)    _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_SNAP_ENTRY)  default: 0) (s, out, n)
+#define ztree_sync_foreach(s, fn, ctx)    _Generic((s), Z_ALL_SYNC_MAPS(T_SYNC_EACH_ENTRY)  default: 0) (s, fn, ctx)
+
+#define ztree_rcu_register(t)             _Generic((t), Z_ALL_RCU_MAPS(T_RCU_REG_ENTRY) Z_ALL_SKIPLIST_MAPS(T_RCU_REG_ENTRY) default: NULL) (t)
+
+#define ztree_sharded_init(s, b, n)       _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_INIT_ENTRY)  default: 0) (s, b, n)
+#define ztree_sharded_find(s, k, v)       _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_FIND_ENTRY)  default: 0) (s, k, v)
+#define ztree_sharded_lower_bound(s, k, ok, ov) \
+                                          _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_LB_ENTRY)    default: 0) (s, k, ok, ov)
+#define ztree_sharded_insert(s, k, v)     _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_INS_ENTRY)   default: 0) (s, k, v)
+#define ztree_sharded_remove(s, k)        _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_REM_ENTRY)   default: 0) (s, k)
+#define ztree_sharded_clear(s)            _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_CLEAR_ENTRY) default: (void)0) (s)
+#define ztree_sharded_size(s)             _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_SIZE_ENTRY)  default: 0) (s)
+#define ztree_sharded_foreach(s, fn, ctx) _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_EACH_ENTRY)  default: 0) (s, fn, ctx)
+#define ztree_sharded_rebalance(s)        _Generic((s), Z_ALL_SHARDED_MAPS(T_SHARD_REBAL_ENTRY) default: 0) (s)
+
+#define ztree_skiplist_reclaim(t)         _Generic((t), Z_ALL_SKIPLIST_MAPS(T_SKIP_RECLAIM_ENTRY) default: 0) (t)
+
+#define ztree_topk_init(Name, k)          ztree_topk_init_##Name(k)
+#define ztree_topk_insert(b, k, v)        _Generic((b), Z_ALL_TOPK_MAPS(T_TOPK_INS_ENTRY)   default: 0) (b, k, v)
+#define ztree_topk_clear(b)               _Generic((b), Z_ALL_TOPK_MAPS(T_TOPK_CLEAR_ENTRY) default: (void)0) (b)
+
+// Iteration macros.
+#if defined(__GNUC__) || defined(__clang__)
+
+#   define ztree_foreach(t, iter) \
+        for (__typeof__(ztree_min(t)) iter = ztree_min(t); (iter) != NULL; (iter) = ztree_next(iter))
+
+#   define ztree_foreach_safe(t, iter, safe)                                        \
+        for (__typeof__(ztree_min(t)) iter = ztree_min(t), safe = ztree_next(iter); \
+             (iter) != NULL;                                                        \
+             (iter) = (safe), (safe) = (safe) ? ztree_next(safe) : NULL)
+
+#   define ztree_foreach_reverse(t, iter) \
+        for (__typeof__(ztree_max(t)) iter = ztree_max(t); (iter) != NULL; (iter) = ztree_prev(iter))
+
+#   define ztree_cursor_foreach(c, iter) \
+        for (__typeof__(ztree_cursor_first(c)) iter = ztree_cursor_first(c); (iter) != NULL; (iter) = ztree_cursor_next(c))
+
+#   define ztree_range_foreach(r, iter) \
+        for (__typeof__((r).first) iter = (r).first; (iter) != (r).end; (iter) = ztree_next(iter))
+#else
+
+#   define ztree_foreach(t, iter) \
+        for ((iter) = ztree_min(t); (iter) != NULL; (iter) = ztree_next(iter))
+
+#   define ztree_foreach_safe(t, iter, safe)                    \
+        for ((iter) = ztree_min(t), (safe) = ztree_next(iter);  \
+             (iter) != NULL;                                    \
+             (iter) = (safe), (safe) = (safe) ? ztree_next(safe) : NULL)
+
+#   define ztree_foreach_reverse(t, iter) \
+        for ((iter) = ztree_max(t); (iter) != NULL; (iter) = ztree_prev(iter))
+
+#   define ztree_cursor_foreach(c, iter) \
+        for ((iter) = ztree_cursor_first(c); (iter) != NULL; (iter) = ztree_cursor_next(c))
+
+#   define ztree_range_foreach(r, iter) \
+        for ((iter) = (r).first; (iter) != (r).end; (iter) = ztree_next(iter))
+#endif
+
+#ifdef ZTREE_SHORT_NAMES
+#   define tree(Name)              ztree_##Name
+#   define tree_init        ztree_init
+#   define tree_insert      ztree_insert
+#   define tree_remove      ztree_remove
+#   define tree_find        ztree_find
+#   define tree_lower_bound ztree_lower_bound
+#   define tree_clear       ztree_clear
+#   define tree_min         ztree_min
+#   define tree_max         ztree_max
+#   define tree_next        ztree_next
+#   define tree_prev        ztree_prev
+#   define tree_foreach     ztree_foreach
+#   define tree_foreach_safe ztree_foreach_safe
+#   define tree_remove_node ztree_remove_node
+#   define tree_take        ztree_take
+#   define tree_apply_batch ztree_apply_batch
+#   define tree_pop_min     ztree_pop_min
+#   define tree_pop_max     ztree_pop_max
+#   define tree_contains    ztree_contains
+#   define tree_erase       ztree_erase
+#   define tree_upper_bound ztree_upper_bound
+#   define tree_equal_range ztree_equal_range
+#   define tree_count       ztree_count
+#   define tree_value       ztree_value
+#   define tree_stats       ztree_stats
+#   define tree_tune_filter ztree_tune_filter
+#   define tree_snapshot    ztree_snapshot
+#   define tree_clone       ztree_clone
+#   define tree_extract     ztree_extract
+#   define tree_extract_node ztree_extract_node
+#   define tree_insert_node ztree_insert_node
+#   define tree_free_node   ztree_free_node
+#   define tree_range(Name)        ztree_range_##Name
+#   define tree_partition   ztree_partition
+#   define tree_range_foreach ztree_range_foreach
+#   define tree_parallel_foreach ztree_parallel_foreach
+#   define tree_reserve     ztree_reserve
+#   define tree_cursor(Name)       ztree_cursor_##Name
+#   define tree_cursor_init  ztree_cursor_init
+#   define tree_cursor_get   ztree_cursor_get
+#   define tree_cursor_first ztree_cursor_first
+#   define tree_cursor_last  ztree_cursor_last
+#   define tree_cursor_next  ztree_cursor_next
+#   define tree_cursor_prev  ztree_cursor_prev
+#   define tree_cursor_seek  ztree_cursor_seek
+#   define tree_cursor_find  ztree_cursor_find
+#   define tree_cursor_insert ztree_cursor_insert
+#   define tree_cursor_foreach ztree_cursor_foreach
+#   define tree_sync(Name)         ztree_sync_##Name
+#   define tree_sync_init    ztree_sync_init
+#   define tree_sync_find    ztree_sync_find
+#   define tree_sync_lower_bound ztree_sync_lower_bound
+#   define tree_sync_insert  ztree_sync_insert
+#   define tree_sync_remove  ztree_sync_remove
+#   define tree_sync_clear   ztree_sync_clear
+#   define tree_sync_size    ztree_sync_size
+#   define tree_sync_snapshot ztree_sync_snapshot
+#   define tree_sync_foreach ztree_sync_foreach
+#   define tree_rcu_register ztree_rcu_register
+#   define tree_rcu_unregister ztree_rcu_unregister
+#   define tree_rcu_read_lock ztree_rcu_read_lock
+#   define tree_rcu_read_unlock ztree_rcu_read_unlock
+#   define tree_sharded(Name)      ztree_sharded_##Name
+#   define tree_sharded_init ztree_sharded_init
+#   define tree_sharded_find ztree_sharded_find
+#   define tree_sharded_lower_bound ztree_sharded_lower_bound
+#   define tree_sharded_insert ztree_sharded_insert
+#   define tree_sharded_remove ztree_sharded_remove
+#   define tree_sharded_clear ztree_sharded_clear
+#   define tree_sharded_size ztree_sharded_size
+#   define tree_sharded_foreach ztree_sharded_foreach
+#   define tree_sharded_rebalance ztree_sharded_rebalance
+#   define tree_skiplist_reclaim ztree_skiplist_reclaim
+#   define tree_topk(Name)         ztree_topk_##Name
+#   define tree_topk_init ztree_topk_init
+#   define tree_topk_insert ztree_topk_insert
+#   define tree_topk_clear ztree_topk_clear
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+namespace z_tree 
+{
+#   ifdef ZTREE_PARALLEL
+#       define ZTREE__CPP_PARALLEL_MEMBER(Name)                             \
+            static constexpr auto parallel_foreach = ::ztree_parallel_foreach_##Name;
+#   else
+#       define ZTREE__CPP_PARALLEL_MEMBER(Name)
+#   endif
+
+#   define ZTREE_CPP_MAP_MEMBERS(Name)                                      \
+            using tree_type = ::ztree_##Name;                               \
+            using node_type = ::ztree_node_##Name;                          \
+            static constexpr auto init = ::ztree_init_##Name;               \
+            static constexpr auto insert = ::ztree_insert_##Name;           \
+            static constexpr auto remove = ::ztree_remove_##Name;           \
+            static constexpr auto remove_node = ::ztree_remove_node_##Name; \
+            static constexpr auto find = ::ztree_find_##Name;               \
+            static constexpr auto value = ::ztree_value_##Name;             \
+            static constexpr auto lower_bound = ::ztree_lower_bound_##Name; \
+            static constexpr auto clear = ::ztree_clear_##Name;             \
+            static constexpr auto min = ::ztree_min_##Name;                 \
+            static constexpr auto max = ::ztree_max_##Name;                 \
+            static constexpr auto next = ::ztree_next_##Name;               \
+            static constexpr auto prev = ::ztree_prev_##Name;               \
+            static constexpr auto pop_min = ::ztree_pop_min_##Name;         \
+            static constexpr auto pop_max = ::ztree_pop_max_##Name;         \
+            static constexpr auto clone = ::ztree_clone_##Name;             \
+            ZTREE__CPP_PARALLEL_MEMBER(Name)
+
+#   define ZTREE__CPP_HANDLE_MEMBERS(Name)                                    \
+            static constexpr auto extract = ::ztree_extract_##Name;           \
+            static constexpr auto extract_node = ::ztree_extract_node_##Name; \
+            static constexpr auto insert_node = ::ztree_insert_node_##Name;   \
+            static constexpr auto free_node = ::ztree_free_node_##Name;
+
+#   define ZTREE_CPP_TRAITS(Key, Val, Name, ...)                            \
+        template<> struct traits<Key, Val>                                  \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+            ZTREE__CPP_HANDLE_MEMBERS(Name)                                 \
+        };
+    Z_ALL_TREES(ZTREE_CPP_TRAITS)
+
+#   define ZTREE_CPP_MULTIMAP_TRAITS(Key, Val, Name, Cmp)                   \
+        template<> struct multimap_traits<Key, Val>                         \
+        {                                                                   \
+            using tree_type = ::ztree_##Name;                               \
+            using node_type = ::ztree_node_##Name;                          \
+            static constexpr auto init = ::ztree_init_##Name;               \
+            static constexpr auto insert = ::ztree_insert_##Name;           \
+            static constexpr auto remove = ::ztree_remove_##Name;           \
+            static constexpr auto remove_node = ::ztree_remove_node_##Name; \
+            static constexpr auto find = ::ztree_find_##Name;               \
+            static constexpr auto count = ::ztree_count_##Name;             \
+            static constexpr auto value = ::ztree_value_##Name;             \
+            static constexpr auto equal_range = ::ztree_equal_range_##Name; \
+            static constexpr auto lower_bound = ::ztree_lower_bound_##Name; \
+            static constexpr auto upper_bound = ::ztree_upper_bound_##Name; \
+            static constexpr auto clear = ::ztree_clear_##Name;             \
+            static constexpr auto min = ::ztree_min_##Name;                 \
+            static constexpr auto max = ::ztree_max_##Name;                 \
+            static constexpr auto next = ::ztree_next_##Name;               \
+            static constexpr auto prev = ::ztree_prev_##Name;               \
+            static constexpr auto pop_min = ::ztree_pop_min_##Name;         \
+            static constexpr auto pop_max = ::ztree_pop_max_##Name;         \
+        };
+    Z_ALL_MULTIMAPS(ZTREE_CPP_MULTIMAP_TRAITS)
+
+    // Slab slots share storage with the free list and are copied with memcpy, so values must be trivially copyable.
+#   define ZTREE_CPP_SPLIT_TRAITS(Key, Val, Name, Cmp)                       \
+        template<> struct split_traits<Key, Val>                             \
+        {                                                                    \
+            static_assert(std::is_trivially_copyable<Val>::value,            \
+                          "Split ztree values must be trivially copyable."); \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                      \
+        };
+    Z_ALL_SPLIT_MAPS(ZTREE_CPP_SPLIT_TRAITS)
+
+#   define ZTREE_CPP_PREFIX_TRAITS(Key, Val, Name, Cmp, Prefix)             \
+        template<> struct prefix_traits<Key, Val>                           \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+        };
+    Z_ALL_PREFIX_MAPS(ZTREE_CPP_PREFIX_TRAITS)
+
+#   define ZTREE_CPP_HASHED_TRAITS(Key, Val, Name, Cmp, Hash)               \
+        template<> struct hashed_traits<Key, Val>                           \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+        };
+    Z_ALL_HASHED_MAPS(ZTREE_CPP_HASHED_TRAITS)
+
+#   define ZTREE_CPP_FILTERED_TRAITS(Key, Val, Name, Cmp, Hash)             \
+        template<> struct filtered_traits<Key, Val>                         \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+        };
+    Z_ALL_FILTERED_MAPS(ZTREE_CPP_FILTERED_TRAITS)
+
+#   define ZTREE_CPP_AVL_TRAITS(Key, Val, Name, ...)                        \
+        template<> struct avl_traits<Key, Val>                              \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+            ZTREE__CPP_HANDLE_MEMBERS(Name)                                 \
+        };
+    Z_ALL_AVL_TREES(ZTREE_CPP_AVL_TRAITS)
+
+#   define ZTREE_CPP_ADAPTIVE_TRAITS(Key, Val, Name, ...)                   \
+        template<> struct adaptive_traits<Key, Val>                         \
+        {                                                                   \
+            ZTREE_CPP_MAP_MEMBERS(Name)                                     \
+            ZTREE__CPP_HANDLE_MEMBERS(Name)                                 \
+        };
+    Z_ALL_ADAPTIVE_TREES(ZTREE_CPP_ADAPTIVE_TRAITS)
+
+    // Inline entries are shifted with memmove, so they must be trivially copyable.
+#   define ZTREE_CPP_SMALL_TRAITS(Key, Val, Name, Cmp, N)                   \
+        template<> struct small_traits<Key, Val, N>                         \
+        {                                                                   \
+            static_assert(std::is_trivially_copyable<Key>::value &&         \
+                          std::is_trivially_copyable<Val>::value,           \
+                          "Small map entries must be trivially copyable."); \
+            using tree_type = ::ztree_##Name;                               \
+            using node_type = ::ztree_node_##Name;                          \
+            static constexpr auto init = ::ztree_init_##Name;               \
+            static constexpr auto insert = ::ztree_insert_##Name;           \
+            static constexpr auto remove = ::ztree_remove_##Name;           \
+            static constexpr auto remove_node = ::ztree_remove_node_##Name; \
+            static constexpr auto find = ::ztree_find_##Name;               \
+            static constexpr auto value = ::ztree_value_##Name;             \
+            static constexpr auto lower_bound = ::ztree_lower_bound_##Name; \
+            static constexpr auto clear = ::ztree_clear_##Name;             \
+            static constexpr auto min = ::ztree_min_##Name;                 \
+            static constexpr auto max = ::ztree_max_##Name;                 \
+            static constexpr auto next = ::ztree_next_##Name;               \
+            static constexpr auto prev = ::ztree_prev_##Name;               \
+            static constexpr auto pop_min = ::ztree_pop_min_##Name;         \
+            static constexpr auto pop_max = ::ztree_pop_max_##Name;         \
+            static constexpr auto clone = ::ztree_clone_##Name;             \
+        };
+    Z_ALL_SMALL_MAPS(ZTREE_CPP_SMALL_TRAITS)
+
+#   define ZTREE_CPP_SYNC_TRAITS(Key, Val, Name, ...)                            \
+        template<> struct sync_traits<Key, Val>                                  \
+        {                                                                        \
+            using sync_type = ::ztree_sync_##Name;                               \
+            using entry_type = ::ztree_sync_entry_##Name;                        \
+            static constexpr auto init = ::ztree_sync_init_##Name;               \
+            static constexpr auto clear = ::ztree_sync_clear_##Name;             \
+            static constexpr auto size = ::ztree_sync_size_##Name;               \
+            static constexpr auto find = ::ztree_sync_find_##Name;               \
+            static constexpr auto lower_bound = ::ztree_sync_lower_bound_##Name; \
+            static constexpr auto insert = ::ztree_sync_insert_##Name;           \
+            static constexpr auto remove = ::ztree_sync_remove_##Name;           \
+            static constexpr auto snapshot = ::ztree_sync_snapshot_##Name;       \
+        };
+    Z_ALL_SYNC_MAPS(ZTREE_CPP_SYNC_TRAITS)
+
+    // Thread-safe map: every member may be called concurrently. Reads return copies, never references.
+    template <typename K, typename V>
+    class concurrent_map
+    {
+        using Traits = sync_traits<K, V>;
+     public:
+        typename Traits::sync_type inner;
+
+        concurrent_map() : inner(Traits::init()) {}
+
+        ~concurrent_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        concurrent_map(const concurrent_map&) = delete;
+        concurrent_map &operator=(const concurrent_map&) = delete;
+
+        void insert(const K &k, const V &v)
+        {
+            if (Z_OK != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        bool erase(const K &k)
+        {
+            return Z_OK == Traits::remove(&inner, k);
+        }
+
+        bool find(const K &k, V *out = nullptr)
+        {
+            return Z_OK == Traits::find(&inner, k, out);
+        }
+
+        bool lower_bound(const K &k, K *out_key, V *out_value = nullptr)
+        {
+            return Z_OK == Traits::lower_bound(&inner, k, out_key, out_value);
+        }
+
+        // Calls f(key, value) over a copy taken under one read lock, in key order, outside the lock.
+        template <typename F>
+        void for_each(F f)
+        {
+            typename Traits::entry_type *items;
+            size_t n;
+            if (Z_OK != Traits::snapshot(&inner, &items, &n))
+            {
+                throw std::bad_alloc();
+            }
+            struct release
+            {
+                void *p;
+                ~release()
+                {
+                    ZTREE_FREE(p);
+                }
+            } guard{items};
+            for (size_t i = 0; i < n; i++)
+            {
+                f(items[i].key, items[i].value);
+            }
+        }
+
+        size_t size()
+        {
+            return Traits::size(&inner);
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+#   define ZTREE_CPP_TOPK_TRAITS(Key, Val, Name, ...)                       \
+        template<> struct topk_traits<Key, Val>                             \
+        {                                                                   \
+            using topk_type = ::ztree_topk_##Name;                          \
+            using tree_type = ::ztree_##Name;                               \
+            using node_type = ::ztree_node_##Name;                          \
+            static constexpr auto init = ::ztree_topk_init_##Name;          \
+            static constexpr auto insert = ::ztree_topk_insert_##Name;      \
+            static constexpr auto clear = ::ztree_topk_clear_##Name;        \
+            static constexpr auto take = ::ztree_take_##Name;               \
+            static constexpr auto find = ::ztree_find_##Name;               \
+            static constexpr auto value = ::ztree_value_##Name;             \
+            static constexpr auto min = ::ztree_min_##Name;                 \
+            static constexpr auto max = ::ztree_max_##Name;                 \
+            static constexpr auto next = ::ztree_next_##Name;               \
+            static constexpr auto prev = ::ztree_prev_##Name;               \
+        };
+    Z_ALL_TOPK_MAPS(ZTREE_CPP_TOPK_TRAITS)
+
+    // Keeps the k greatest keys seen. insert returns false for a key below the minimum of a full map.
+    template <typename K, typename V>
+    class topk_map
+    {
+        using Traits = topk_traits<K, V>;
+     public:
+        using iterator = map_iterator<K, V, Traits>;
+        typename Traits::topk_type inner;
+
+        explicit topk_map(size_t k) : inner(Traits::init(k)) {}
+
+        ~topk_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        topk_map(const topk_map&) = delete;
+        topk_map &operator=(const topk_map&) = delete;
+
+        bool insert(const K &k, const V &v)
+        {
+            int rc = Traits::insert(&inner, k, v);
+            if (Z_ENOMEM == rc)
+            {
+                throw std::bad_alloc();
+            }
+            return Z_OK == rc;
+        }
+
+        bool erase(const K &k)
+        {
+            return Z_OK == Traits::take(&inner.tree, k, nullptr);
+        }
+
+        V *find(const K &k)
+        {
+            auto *n = Traits::find(&inner.tree, k);
+            return n ? Traits::value(&inner.tree, n) : nullptr;
+        }
+
+        iterator begin()
+        {
+            return iterator(Traits::min(&inner.tree), &inner.tree);
+        }
+
+        iterator end()
+        {
+            return iterator(nullptr, &inner.tree);
+        }
+
+        size_t size() const
+        {
+            return inner.tree.size;
+        }
+
+        size_t capacity() const
+        {
+            return inner.cap;
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
 
-#ifndef REGISTER_ZTREE_TYPES
-#   if defined(__has_include) && __has_include("z_registry.h")
-#       include "z_registry.h"
-#   endif
-#endif
+#   define ZTREE_CPP_SHARDED_TRAITS(Key, Val, Name, ...)                            \
+        template<> struct sharded_traits<Key, Val>                                  \
+        {                                                                           \
+            using sharded_type = ::ztree_sharded_##Name;                            \
+            static constexpr auto init = ::ztree_sharded_init_##Name;               \
+            static constexpr auto clear = ::ztree_sharded_clear_##Name;             \
+            static constexpr auto size = ::ztree_sharded_size_##Name;               \
+            static constexpr auto find = ::ztree_sharded_find_##Name;               \
+            static constexpr auto lower_bound = ::ztree_sharded_lower_bound_##Name; \
+            static constexpr auto insert = ::ztree_sharded_insert_##Name;           \
+            static constexpr auto remove = ::ztree_sharded_remove_##Name;           \
+            static constexpr auto foreach = ::ztree_sharded_foreach_##Name;         \
+            static constexpr auto rebalance = ::ztree_sharded_rebalance_##Name;     \
+        };
+    Z_ALL_SHARDED_MAPS(ZTREE_CPP_SHARDED_TRAITS)
 
-#ifndef REGISTER_ZTREE_TYPES
-#   define REGISTER_ZTREE_TYPES(X)
-#endif
+    // Range-sharded map: every member may be called concurrently, and writers to different shards run in
+    // parallel. bounds[i] is the first key of shard i + 1; rebalance() re-partitions as the data shifts.
+    template <typename K, typename V>
+    class sharded_map
+    {
+        using Traits = sharded_traits<K, V>;
 
-#ifndef Z_AUTOGEN_TREES
-#   define Z_AUTOGEN_TREES(X)
-#endif
+        template <typename F>
+        static int visit(const K *k, const V *v, void *ctx)
+        {
+            (*static_cast<F*>(ctx))(*k, *v);
+            return 0;
+        }
 
-#define Z_ALL_TREES(X) Z_AUTOGEN_TREES(X) REGISTER_ZTREE_TYPES(X)
+     public:
+        typename Traits::sharded_type inner;
 
-Z_ALL_TREES(ZTREE_GENERATE_IMPL)
+        sharded_map(const K *bounds = nullptr, size_t nbounds = 0)
+        {
+            if (Z_OK != Traits::init(&inner, bounds, nbounds))
+            {
+                throw std::invalid_argument("z_tree::sharded_map: bounds must be ascending and fit ZTREE_SHARDS_MAX");
+            }
+        }
 
-#define T_INSERT_ENTRY(K, V, Name, Cmp)   ztree_##Name*: ztree_insert_##Name,
-#define T_FIND_ENTRY(K, V, Name, Cmp)     ztree_##Name*: ztree_find_##Name,
-#define T_LB_ENTRY(K, V, Name, Cmp)       ztree_##Name*: ztree_lower_bound_##Name,
-#define T_REM_ENTRY(K, V, Name, Cmp)      ztree_##Name*: ztree_remove_##Name,
-#define T_CLEAR_ENTRY(K, V, Name, Cmp)    ztree_##Name*: ztree_clear_##Name,
-#define T_MIN_ENTRY(K, V, Name, Cmp)      ztree_##Name*: ztree_min_##Name,
-#define T_MAX_ENTRY(K, V, Name, Cmp)      ztree_##Name*: ztree_max_##Name,
-#define T_NEXT_ENTRY(K, V, Name, Cmp)     ztree_node_##Name*: ztree_next_##Name,
-#define T_PREV_ENTRY(K, V, Name, Cmp)     ztree_node_##Name*: ztree_prev_##Name,
+        ~sharded_map()
+        {
+            Traits::clear(&inner);
+        }
 
-#define ztree_init(Name)             ztree_init_##Name()
+        sharded_map(const sharded_map&) = delete;
+        sharded_map &operator=(const sharded_map&) = delete;
 
-#if defined(__GNUC__) || defined(__clang__)
-#   define ztree_autofree(Name)     __attribute__((cleanup(ztree_clear_##Name))) ztree_##Name
-#endif
+        void insert(const K &k, const V &v)
+        {
+            if (Z_OK != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
 
-#define ztree_insert(t, k, v)   _Generic((t), Z_ALL_TREES(T_INSERT_ENTRY) default: 0)       (t, k, v)
-#define ztree_remove(t, k)      _Generic((t), Z_ALL_TREES(T_REM_ENTRY)    default: (void)0) (t, k)
-#define ztree_find(t, k)        _Generic((t), Z_ALL_TREES(T_FIND_ENTRY)   default: NULL)    (t, k)
-#define ztree_lower_bound(t,k)  _Generic((t), Z_ALL_TREES(T_LB_ENTRY)     default: NULL)    (t, k)
-#define ztree_clear(t)          _Generic((t), Z_ALL_TREES(T_CLEAR_ENTRY)  default: (void)0) (t)
-#define ztree_min(t)            _Generic((t), Z_ALL_TREES(T_MIN_ENTRY)    default: NULL)    (t)
-#define ztree_max(t)            _Generic((t), Z_ALL_TREES(T_MAX_ENTRY)    default: NULL)    (t)
-#define ztree_next(n)           _Generic((n), Z_ALL_TREES(T_NEXT_ENTRY)   default: NULL)    (n)
-#define ztree_prev(n)           _Generic((n), Z_ALL_TREES(T_PREV_ENTRY)   default: NULL)    (n)
+        bool erase(const K &k)
+        {
+            return Z_OK == Traits::remove(&inner, k);
+        }
 
-// Iteration macros.
-#if defined(__GNUC__) || defined(__clang__)
+        bool find(const K &k, V *out = nullptr)
+        {
+            return Z_OK == Traits::find(&inner, k, out);
+        }
 
-#   define ztree_foreach(t, iter) \
-        for (__typeof__(ztree_min(t)) iter = ztree_min(t); (iter) != NULL; (iter) = ztree_next(iter))
+        bool lower_bound(const K &k, K *out_key, V *out_value = nullptr)
+        {
+            return Z_OK == Traits::lower_bound(&inner, k, out_key, out_value);
+        }
 
-#   define ztree_foreach_safe(t, iter, safe)                                        \
-        for (__typeof__(ztree_min(t)) iter = ztree_min(t), safe = ztree_next(iter); \
-             (iter) != NULL;                                                        \
-             (iter) = (safe), (safe) = (safe) ? ztree_next(safe) : NULL)
+        // Calls f(key, value) in key order, one shard lock at a time; f must not call back into the map.
+        template <typename F>
+        void for_each(F f)
+        {
+            Traits::foreach(&inner, &visit<F>, &f);
+        }
 
-#   define ztree_foreach_reverse(t, iter) \
-        for (__typeof__(ztree_max(t)) iter = ztree_max(t); (iter) != NULL; (iter) = ztree_prev(iter))
-#else
+        // Splits overfull shards and merges underfull neighbours; returns how many of each it did.
+        int rebalance()
+        {
+            return Traits::rebalance(&inner);
+        }
 
-#   define ztree_foreach(t, iter) \
-        for ((iter) = ztree_min(t); (iter) != NULL; (iter) = ztree_next(iter))
+        size_t size()
+        {
+            return Traits::size(&inner);
+        }
 
-#   define ztree_foreach_safe(t, iter, safe)                    \
-        for ((iter) = ztree_min(t), (safe) = ztree_next(iter);  \
-             (iter) != NULL;                                    \
-             (iter) = (safe), (safe) = (safe) ? ztree_next(safe) : NULL)
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
 
-#   define ztree_foreach_reverse(t, iter) \
-        for ((iter) = ztree_max(t); (iter) != NULL; (iter) = ztree_prev(iter))
-#endif
+#   define ZTREE_CPP_RCU_TRAITS(Key, Val, Name, ...)                             \
+        template<> struct rcu_traits<Key, Val>                                   \
+        {                                                                        \
+            using tree_type = ::ztree_##Name;                                    \
+            static constexpr auto init = ::ztree_init_##Name;                    \
+            static constexpr auto clear = ::ztree_clear_##Name;                  \
+            static constexpr auto find = ::ztree_find_##Name;                    \
+            static constexpr auto lower_bound = ::ztree_lower_bound_##Name;      \
+            static constexpr auto insert = ::ztree_insert_##Name;                \
+            static constexpr auto take = ::ztree_take_##Name;                    \
+            static constexpr auto register_reader = ::ztree_rcu_register_##Name; \
+        };
+    Z_ALL_RCU_MAPS(ZTREE_CPP_RCU_TRAITS)
 
-#ifdef ZTREE_SHORT_NAMES
-#   define tree(Name)              ztree_##Name
-#   define tree_init        ztree_init
-#   define tree_insert      ztree_insert
-#   define tree_remove      ztree_remove
-#   define tree_find        ztree_find
-#   define tree_lower_bound ztree_lower_bound
-#   define tree_clear       ztree_clear
-#   define tree_min         ztree_min
-#   define tree_max         ztree_max
-#   define tree_next        ztree_next
-#   define tree_prev        ztree_prev
-#   define tree_foreach     ztree_foreach
-#   define tree_foreach_safe ztree_foreach_safe
-#endif
+    // Map with lock-free readers: writes may come from any thread and are serialized, while each reading
+    // thread looks values up through its own rcu_map::reader. Reads return copies, never references.
+    template <typename K, typename V>
+    class rcu_map
+    {
+        using Traits = rcu_traits<K, V>;
+     public:
+        typename Traits::tree_type inner;
 
-#ifdef __cplusplus
-} // extern "C"
-namespace z_tree 
-{
-#   define ZTREE_CPP_TRAITS(Key, Val, Name, Cmp)                            \
-        template<> struct traits<Key, Val>                                  \
+        rcu_map() : inner(Traits::init()) {}
+
+        ~rcu_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        rcu_map(const rcu_map&) = delete;
+        rcu_map &operator=(const rcu_map&) = delete;
+
+        // One reader slot, held by one thread for as long as it lives; every lookup is its own read section.
+        class reader
+        {
+            rcu_map &map;
+            ztree_rcu_reader *slot;
+
+            struct section
+            {
+                ztree_rcu_reader *slot;
+                explicit section(ztree_rcu_reader *s) : slot(s)
+                {
+                    ztree_rcu_read_lock(slot);
+                }
+                ~section()
+                {
+                    ztree_rcu_read_unlock(slot);
+                }
+            };
+
+         public:
+            explicit reader(rcu_map &m) : map(m), slot(Traits::register_reader(&m.inner))
+            {
+                if (!slot)
+                {
+                    throw std::length_error("z_tree::rcu_map::reader: all ZTREE_RCU_READERS slots are taken");
+                }
+            }
+
+            ~reader()
+            {
+                ztree_rcu_unregister(slot);
+            }
+
+            reader(const reader&) = delete;
+            reader &operator=(const reader&) = delete;
+
+            bool find(const K &k, V *out = nullptr)
+            {
+                section s(slot);
+                auto n = Traits::find(&map.inner, k);
+                if (n && out)
+                {
+                    *out = n->value;
+                }
+                return nullptr != n;
+            }
+
+            bool lower_bound(const K &k, K *out_key, V *out_value = nullptr)
+            {
+                section s(slot);
+                auto n = Traits::lower_bound(&map.inner, k);
+                if (n)
+                {
+                    *out_key = n->key;
+                    if (out_value)
+                    {
+                        *out_value = n->value;
+                    }
+                }
+                return nullptr != n;
+            }
+        };
+
+        void insert(const K &k, const V &v)
+        {
+            if (Z_OK != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        bool erase(const K &k)
+        {
+            return Z_OK == Traits::take(&inner, k, nullptr);
+        }
+
+        // Writer-side count; readers should not rely on it.
+        size_t size() const
+        {
+            return inner.size;
+        }
+
+        // Frees every node at once, so no reader may be inside a lookup.
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+#   define ZTREE_CPP_SKIPLIST_TRAITS(Key, Val, Name, ...)                        \
+        template<> struct skiplist_traits<Key, Val>                              \
+        {                                                                        \
+            using tree_type = ::ztree_##Name;                                    \
+            static constexpr auto init = ::ztree_init_##Name;                    \
+            static constexpr auto clear = ::ztree_clear_##Name;                  \
+            static constexpr auto find = ::ztree_find_##Name;                    \
+            static constexpr auto lower_bound = ::ztree_lower_bound_##Name;      \
+            static constexpr auto insert = ::ztree_insert_##Name;                \
+            static constexpr auto take = ::ztree_take_##Name;                    \
+            static constexpr auto min = ::ztree_min_##Name;                      \
+            static constexpr auto next = ::ztree_next_##Name;                    \
+            static constexpr auto reclaim = ::ztree_skiplist_reclaim_##Name;     \
+            static constexpr auto register_reader = ::ztree_rcu_register_##Name; \
+        };
+    Z_ALL_SKIPLIST_MAPS(ZTREE_CPP_SKIPLIST_TRAITS)
+
+    // Lock-free map: every member except clear and reclaim may be called from any number of threads at once.
+    // Reads return copies. Each thread should open one skiplist_map::session and make its calls through it, so
+    // erased and overwritten entries are freed as soon as no call can still see them.
+    template <typename K, typename V>
+    class skiplist_map
+    {
+        using Traits = skiplist_traits<K, V>;
+
+        struct section
+        {
+            ztree_rcu_reader *slot;
+            explicit section(ztree_rcu_reader *s) : slot(s)
+            {
+                ztree_rcu_read_lock(slot);
+            }
+            ~section()
+            {
+                ztree_rcu_read_unlock(slot);
+            }
+        };
+
+        // Slot for a call made on the map itself, held only for that call.
+        struct call_slot
+        {
+            ztree_rcu_reader *slot;
+            explicit call_slot(skiplist_map &m)
+            {
+                while (!(slot = Traits::register_reader(&m.inner)))
+                {
+                    sched_yield();
+                }
+            }
+            ~call_slot()
+            {
+                ztree_rcu_unregister(slot);
+            }
+        };
+
+        void insert_at(ztree_rcu_reader *slot, const K &k, const V &v)
+        {
+            section s(slot);
+            if (Z_OK != Traits::insert(&inner, k, v))
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        bool erase_at(ztree_rcu_reader *slot, const K &k)
+        {
+            section s(slot);
+            return Z_OK == Traits::take(&inner, k, nullptr);
+        }
+
+        bool find_at(ztree_rcu_reader *slot, const K &k, V *out)
+        {
+            section s(slot);
+            auto n = Traits::find(&inner, k);
+            if (n && out)
+            {
+                *out = n->value;
+            }
+            return nullptr != n;
+        }
+
+        bool lower_bound_at(ztree_rcu_reader *slot, const K &k, K *out_key, V *out_value)
+        {
+            section s(slot);
+            auto n = Traits::lower_bound(&inner, k);
+            if (n)
+            {
+                *out_key = n->key;
+                if (out_value)
+                {
+                    *out_value = n->value;
+                }
+            }
+            return nullptr != n;
+        }
+
+        template <typename F>
+        void for_each_at(ztree_rcu_reader *slot, F &f)
+        {
+            section s(slot);
+            for (auto n = Traits::min(&inner); n; n = Traits::next(n))
+            {
+                f(n->key, n->value);
+            }
+        }
+     public:
+        typename Traits::tree_type inner;
+
+        skiplist_map() : inner(Traits::init()) {}
+
+        ~skiplist_map()
+        {
+            Traits::clear(&inner);
+        }
+
+        skiplist_map(const skiplist_map&) = delete;
+        skiplist_map &operator=(const skiplist_map&) = delete;
+
+        // One reader slot, held by one thread for as long as it lives; every call is its own section.
+        class session
+        {
+            skiplist_map &map;
+            ztree_rcu_reader *slot;
+
+         public:
+            explicit session(skiplist_map &m) : map(m), slot(Traits::register_reader(&m.inner))
+            {
+                if (!slot)
+                {
+                    throw std::length_error("z_tree::skiplist_map::session: all reader slots are taken");
+                }
+            }
+
+            ~session()
+            {
+                ztree_rcu_unregister(slot);
+            }
+
+            session(const session&) = delete;
+            session &operator=(const session&) = delete;
+
+            void insert(const K &k, const V &v)
+            {
+                map.insert_at(slot, k, v);
+            }
+
+            bool erase(const K &k)
+            {
+                return map.erase_at(slot, k);
+            }
+
+            bool find(const K &k, V *out = nullptr)
+            {
+                return map.find_at(slot, k, out);
+            }
+
+            bool lower_bound(const K &k, K *out_key, V *out_value = nullptr)
+            {
+                return map.lower_bound_at(slot, k, out_key, out_value);
+            }
+
+            // Calls f(key, value) in key order. Concurrent updates may or may not show up; keys never repeat.
+            template <typename F>
+            void for_each(F f)
+            {
+                map.for_each_at(slot, f);
+            }
+        };
+
+        // Calls on the map itself register a slot for the call and give it back afterwards. That costs two more
+        // atomic updates on the shared slot array per call, and while all ZTREE_RCU_READERS slots are taken the
+        // call spins until one is free. Threads that make more than a few calls should use a session.
+        void insert(const K &k, const V &v)
+        {
+            call_slot c(*this);
+            insert_at(c.slot, k, v);
+        }
+
+        bool erase(const K &k)
+        {
+            call_slot c(*this);
+            return erase_at(c.slot, k);
+        }
+
+        bool find(const K &k, V *out = nullptr)
+        {
+            call_slot c(*this);
+            return find_at(c.slot, k, out);
+        }
+
+        bool lower_bound(const K &k, K *out_key, V *out_value = nullptr)
+        {
+            call_slot c(*this);
+            return lower_bound_at(c.slot, k, out_key, out_value);
+        }
+
+        template <typename F>
+        void for_each(F f)
+        {
+            call_slot c(*this);
+            for_each_at(c.slot, f);
+        }
+
+        size_t size() const
+        {
+            return __atomic_load_n(&inner.size, __ATOMIC_RELAXED);
+        }
+
+        // Teardown only: frees every retired entry at once, so no other thread may be using the map.
+        size_t reclaim()
+        {
+            return Traits::reclaim(&inner);
+        }
+
+        void clear()
+        {
+            Traits::clear(&inner);
+        }
+    };
+
+#   define ZTREE_CPP_SET_TRAITS(Key, Name, Cmp)                             \
+        template<> struct set_traits<Key>                                   \
         {                                                                   \
             using tree_type = ::ztree_##Name;                               \
             using node_type = ::ztree_node_##Name;                          \
             static constexpr auto init = ::ztree_init_##Name;               \
             static constexpr auto insert = ::ztree_insert_##Name;           \
-            static constexpr auto remove = ::ztree_remove_##Name;           \
+            static constexpr auto erase = ::ztree_erase_##Name;             \
+            static constexpr auto contains = ::ztree_contains_##Name;       \
+            static constexpr auto remove_node = ::ztree_remove_node_##Name; \
             static constexpr auto find = ::ztree_find_##Name;               \
             static constexpr auto lower_bound = ::ztree_lower_bound_##Name; \
             static constexpr auto clear = ::ztree_clear_##Name;             \
@@ -850,8 +8617,66 @@ namespace z_tree
             static constexpr auto max = ::ztree_max_##Name;                 \
             static constexpr auto next = ::ztree_next_##Name;               \
             static constexpr auto prev = ::ztree_prev_##Name;               \
+            static constexpr auto pop_min = ::ztree_pop_min_##Name;         \
+            static constexpr auto pop_max = ::ztree_pop_max_##Name;         \
         };
-    Z_ALL_TREES(ZTREE_CPP_TRAITS)
+    Z_ALL_SETS(ZTREE_CPP_SET_TRAITS)
+
+#   define ZTREE_CPP_CURSOR_MEMBERS(Name)                                        \
+            using tree_type = ::ztree_##Name;                                    \
+            using node_type = ::ztree_node_##Name;                               \
+            using cursor_type = ::ztree_cursor_##Name;                           \
+            static constexpr auto init = ::ztree_init_##Name;                    \
+            static constexpr auto insert = ::ztree_insert_##Name;                \
+            static constexpr auto remove = ::ztree_remove_##Name;                \
+            static constexpr auto find = ::ztree_find_##Name;                    \
+            static constexpr auto clear = ::ztree_clear_##Name;                  \
+            static constexpr auto pop_min = ::ztree_pop_min_##Name;              \
+            static constexpr auto pop_max = ::ztree_pop_max_##Name;              \
+            static constexpr auto cursor_init = ::ztree_cursor_init_##Name;      \
+            static constexpr auto cursor_get = ::ztree_cursor_get_##Name;        \
+            static constexpr auto cursor_first = ::ztree_cursor_first_##Name;    \
+            static constexpr auto cursor_next = ::ztree_cursor_next_##Name;      \
+            static constexpr auto cursor_prev = ::ztree_cursor_prev_##Name;      \
+            static constexpr auto cursor_seek = ::ztree_cursor_seek_##Name;
+
+#   define ZTREE_CPP_COMPACT_TRAITS(Key, Val, Name, Cmp)                         \
+        template<> struct compact_traits<Key, Val>                               \
+        {                                                                        \
+            ZTREE_CPP_CURSOR_MEMBERS(Name)                                       \
+        };
+    REGISTER_ZTREE_COMPACT_TYPES(ZTREE_CPP_COMPACT_TRAITS)
+
+#   define ZTREE_CPP_PERSISTENT_TRAITS(Key, Val, Name, Cmp)                      \
+        template<> struct persistent_traits<Key, Val>                            \
+        {                                                                        \
+            ZTREE_CPP_CURSOR_MEMBERS(Name)                                       \
+            static constexpr auto take = ::ztree_take_##Name;                    \
+            static constexpr auto snapshot = ::ztree_snapshot_##Name;            \
+        };
+    Z_ALL_PERSISTENT_MAPS(ZTREE_CPP_PERSISTENT_TRAITS)
+
+    // Index pools are grown with realloc and copied wholesale, so entries must be trivially copyable.
+#   define ZTREE_CPP_INDEX_CHECK(Key, Val)                                       \
+            static_assert(std::is_trivially_copyable<Key>::value &&              \
+                          std::is_trivially_copyable<Val>::value,                \
+                          "Index/fixed ztree entries must be trivially copyable.");
+
+#   define ZTREE_CPP_INDEX_TRAITS(Key, Val, Name, Cmp)                           \
+        template<> struct index_traits<Key, Val>                                 \
+        {                                                                        \
+            ZTREE_CPP_INDEX_CHECK(Key, Val)                                      \
+            ZTREE_CPP_CURSOR_MEMBERS(Name)                                       \
+        };
+    REGISTER_ZTREE_INDEX_TYPES(ZTREE_CPP_INDEX_TRAITS)
+
+#   define ZTREE_CPP_FIXED_TRAITS(Key, Val, Name, Cmp, Cap)                      \
+        template<> struct fixed_traits<Key, Val, Cap>                            \
+        {                                                                        \
+            ZTREE_CPP_INDEX_CHECK(Key, Val)                                      \
+            ZTREE_CPP_CURSOR_MEMBERS(Name)                                       \
+        };
+    REGISTER_ZTREE_FIXED_TYPES(ZTREE_CPP_FIXED_TRAITS)
 }
 #endif
 #endif // ZTREE_H
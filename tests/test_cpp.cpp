@@ -2,15 +2,85 @@
 #include <iostream>
 #include <string>
 #include <cassert>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <vector>
 
 int cmp_int(const int *a, const int *b) 
 {
     return (*a > *b) - (*a < *b);
 }
 
+uint64_t hash_int(const int *k)
+{
+    return (uint64_t)(unsigned)*k * 0x9E3779B97F4A7C15ULL;
+}
+
+int cmp_str(const char **a, const char **b)
+{
+    return strcmp(*a, *b);
+}
+
 #define REGISTER_ZTREE_TYPES(X) \
-    X(int, int, Int, cmp_int)
+    X(int, int, Int, cmp_int) \
+    X(int, std::string, IStr, cmp_int)
+
+#define REGISTER_ZTREE_MULTIMAP_TYPES(X) \
+    X(int, int, MInt, cmp_int)
+
+#define REGISTER_ZSET_TYPES(X) \
+    X(int, ISet, cmp_int)
+
+#define REGISTER_ZTREE_COMPACT_TYPES(X) \
+    X(int, int, CInt, cmp_int)
+
+#define REGISTER_ZTREE_INDEX_TYPES(X) \
+    X(int, int, IInt, cmp_int)
+
+#define REGISTER_ZTREE_FIXED_TYPES(X) \
+    X(int, int, FInt, cmp_int, 16)
+
+#define REGISTER_ZTREE_SPLIT_TYPES(X) \
+    X(int, int, SInt, cmp_int)
+
+#define REGISTER_ZTREE_PREFIX_TYPES(X) \
+    X(const char*, int, PStr, cmp_str, ztree_prefix_cstr)
 
+#define REGISTER_ZTREE_HASHED_TYPES(X) \
+    X(int, int, HInt, cmp_int, hash_int)
+
+#define REGISTER_ZTREE_FILTERED_TYPES(X) \
+    X(int, int, BInt, cmp_int, hash_int)
+
+#define REGISTER_ZTREE_AVL_TYPES(X) \
+    X(int, int, AInt, cmp_int)
+
+#define REGISTER_ZTREE_ADAPTIVE_TYPES(X) \
+    X(int, int, SpInt, cmp_int)
+
+#define REGISTER_ZTREE_SYNC_TYPES(X) \
+    X(int, int, SyInt, cmp_int)
+
+#define REGISTER_ZTREE_RCU_TYPES(X) \
+    X(int, int, RInt, cmp_int)
+
+#define REGISTER_ZTREE_SHARDED_TYPES(X) \
+    X(int, int, ShInt, cmp_int)
+
+#define REGISTER_ZTREE_SKIPLIST_TYPES(X) \
+    X(int, int, SkInt, cmp_int)
+
+#define REGISTER_ZTREE_PERSISTENT_TYPES(X) \
+    X(int, int, PInt, cmp_int)
+
+#define REGISTER_ZTREE_SMALL_TYPES(X) \
+    X(int, int, SmInt, cmp_int, 8)
+
+#define REGISTER_ZTREE_TOPK_TYPES(X) \
+    X(int, int, TopInt, cmp_int)
+
+#define ZTREE_PARALLEL
 #include "ztree.h"
 
 #define TEST(name) printf("[TEST] %-40s", name);
@@ -93,15 +163,723 @@ void test_lower_bound()
     assert(m.find(20) == nullptr);
     assert(m.size() == 2);
 
+    // Erase by iterator hands the node straight to the C side.
+    m[40] = 40;
+    it = m.erase(m.lower_bound(30));
+    assert(it.key() == 40);
+    assert(m.find(30) == nullptr);
+    assert(m.size() == 2);
+
+    PASS();
+}
+
+void test_pop()
+{
+    TEST("Pop Min/Max");
+
+    z_tree::map<int, int> m;
+    for (int i = 1; i <= 5; ++i) m[i * 10] = i;
+
+    std::pair<int, int> lo = m.pop_min();
+    assert(lo.first == 10 && lo.second == 1);
+    std::pair<int, int> hi = m.pop_max();
+    assert(hi.first == 50 && hi.second == 5);
+    assert(m.size() == 3);
+    assert(m.begin().key() == 20);
+    assert((--m.end()).key() == 40);
+
+    m.clear();
+    bool threw = false;
+    try { m.pop_min(); } catch (const std::out_of_range &) { threw = true; }
+    assert(threw);
+
+    PASS();
+}
+
+void test_set()
+{
+    TEST("Set (Insert, Contains, Erase)");
+
+    z_tree::set<int> s;
+    assert(s.insert(3) && s.insert(1) && s.insert(2));
+    assert(!s.insert(2) && s.size() == 3);
+    assert(s.contains(1) && s.count(4) == 0);
+
+    int expect = 1;
+    for (int k : s) assert(k == expect++);
+    assert(*s.lower_bound(2) == 2 && *--s.end() == 3);
+
+    assert(s.erase(1) && !s.erase(1));
+    auto it = s.erase(s.find(2));
+    assert(*it == 3 && s.pop_max() == 3 && s.empty());
+    PASS();
+}
+
+void test_multimap()
+{
+    TEST("Multimap (Equal Range, Count)");
+
+    z_tree::multimap<int, int> m;
+    m.insert(2, 20);
+    m.insert(1, 10);
+    m.insert(2, 21);
+    m.insert(2, 22);
+    assert(m.size() == 4 && m.count(2) == 3 && m.count(3) == 0);
+
+    auto range = m.equal_range(2);
+    int expect = 20;
+    for (auto it = range.first; it != range.second; ++it) assert(it.value() == expect++);
+    assert(range.second == m.end());
+
+    auto it = m.erase(m.find(2));
+    assert(it.value() == 21 && m.count(2) == 2);
+    assert(m.upper_bound(1).key() == 2);
+    assert(m.erase(2) == 2 && m.size() == 1);
+    PASS();
+}
+
+void test_compact_map()
+{
+    TEST("Compact Map (Cursor Iterators)");
+
+    z_tree::compact_map<int, int> m;
+    for (int i = 0; i < 50; ++i) m.insert(i * 2, i);
+    assert(m.size() == 50);
+    assert(*m.find(10) == 5 && m.find(11) == nullptr);
+    m[7] = 70;
+
+    int prev = -1, n = 0;
+    for (auto e : m)
+    {
+        assert(e.key() > prev);
+        prev = e.key();
+        n++;
+    }
+    assert(n == 51);
+
+    auto it = m.lower_bound(7);
+    assert(it.key() == 7 && it.value() == 70);
+    it = m.erase(it);
+    assert(it.key() == 8 && m.size() == 50);
+    --it;
+    assert(it.key() == 6);
+
+    // Erase every key below 20 through the iterator.
+    for (auto e = m.begin(); e != m.end() && e.key() < 20; ) e = m.erase(e);
+    assert(m.begin().key() == 20);
+    assert(m.pop_max().first == 98 && m.pop_min().first == 20);
+
+    m.clear();
+    assert(m.empty() && m.begin() == m.end());
+    PASS();
+}
+
+void test_index_maps()
+{
+    TEST("Index & Fixed Maps");
+
+    z_tree::index_map<int, int> m;
+    for (int i = 0; i < 1000; ++i) m.insert(i, i * i);
+    assert(m.size() == 1000 && *m.find(31) == 961);
+    int expect = 0;
+    for (auto e : m) assert(e.key() == expect++);
+
+    z_tree::fixed_map<int, int, 16> f;
+    for (int i = 0; i < 16; ++i) f.insert(i, i);
+    bool threw = false;
+    try
+    {
+        f.insert(99, 0);
+    }
+    catch (const std::bad_alloc&)
+    {
+        threw = true;
+    }
+    assert(threw && f.size() == 16);
+    f.erase(f.lower_bound(8));
+    f[99] = 1;
+    assert(f.find(8) == nullptr && (--f.end()).key() == 99);
+    PASS();
+}
+
+void test_split_map()
+{
+    TEST("Split Map (Slab Values)");
+
+    z_tree::split_map<int, int> m;
+    for (int i = 0; i < 100; ++i) m.insert(i, i + 1);
+    m[5] = 50;
+    m[200] = 7;
+    assert(m.size() == 101 && *m.find(5) == 50 && *m.find(200) == 7);
+
+    int expect = 0;
+    for (auto e : m)
+    {
+        if (e.key() < 100) assert(e.key() == expect++);
+        if (e.key() != 5) assert(e.value() == (e.key() < 100 ? e.key() + 1 : 7));
+    }
+    auto it = m.lower_bound(50);
+    it.value() = 0;
+    assert(*m.find(50) == 0);
+    m.erase(it);
+    assert(m.find(50) == nullptr && m.size() == 100);
+
+    // References stay valid while the slab grows, even across the insert that grows it.
+    int &five = m[5];
+    for (int i = 0; i < 2000; ++i) m[1000 + i] = m[5];
+    assert(&five == m.find(5) && *m.find(2999) == 50);
+    PASS();
+}
+
+void test_prefix_map()
+{
+    TEST("Prefix Map (String Keys)");
+
+    z_tree::prefix_map<const char*, int> m;
+    m.insert("configuration.b", 2);
+    m.insert("configuration.a", 1);
+    m.insert("alpha", 0);
+    m["zeta"] = 3;
+    assert(m.size() == 4 && *m.find("configuration.b") == 2 && m.find("config") == nullptr);
+
+    int expect = 0;
+    for (auto e : m) assert(e.value() == expect++);
+    assert(std::string(m.lower_bound("b").key()) == "configuration.a");
+    PASS();
+}
+
+void test_hashed_map()
+{
+    TEST("Hashed Map (Hash Index Find)");
+
+    z_tree::hashed_map<int, int> m;
+    for (int i = 0; i < 500; ++i) m.insert(i * 3, i);
+    assert(m.size() == 500 && *m.find(300) == 100 && m.find(301) == nullptr);
+    m[301] = 7;
+    m.erase(300);
+    assert(m.find(300) == nullptr && *m.find(301) == 7);
+    assert(m.lower_bound(299).key() == 301 && m.pop_min().first == 0);
+
+    int prev = -1;
+    for (auto e : m)
+    {
+        assert(e.key() > prev && *m.find(e.key()) == e.value());
+        prev = e.key();
+    }
+    PASS();
+}
+
+void test_filtered_map()
+{
+    TEST("Filtered Map (Bloom Rejects)");
+
+    z_tree::filtered_map<int, int> m;
+    for (int i = 0; i < 1000; ++i) m.insert(i * 2, i);
+    for (int i = 0; i < 2000; ++i) assert((m.find(i) != nullptr) == (i % 2 == 0));
+    m.erase(10);
+    assert(m.find(10) == nullptr && m.size() == 999);
+    assert(m.inner.filter.stats.rejected > 900);
+    PASS();
+}
+
+void test_avl_map()
+{
+    TEST("AVL Map (Sequential Inserts)");
+
+    z_tree::avl_map<int, int> m;
+    for (int i = 0; i < 1023; ++i) m.insert(i, i * 2);
+
+    // 1023 ascending keys fill a perfect tree of height 10; red-black would allow up to 18.
+    int height = 0;
+    for (auto *n = m.inner.root; n; n = n->left) height++;
+    assert(height == 10 && m.inner.root->balance == 0);
+
+    m.erase(500);
+    assert(m.find(500) == nullptr && *m.find(501) == 1002 && m.size() == 1022);
+    assert(m.lower_bound(500).key() == 501 && m.pop_max().first == 1022);
+    PASS();
+}
+
+void test_adaptive_map()
+{
+    TEST("Adaptive Map (Hot Key Splay)");
+
+    z_tree::adaptive_map<int, int> m;
+    for (int i = 0; i < 1000; ++i) m.insert(i, i);
+    for (int i = 0; i < ZTREE_SPLAY_HITS; ++i) assert(*m.find(321) == 321);
+    assert(m.inner.root->key == 321);
+
+    int prev = -1;
+    for (auto e : m)
+    {
+        assert(e.key() == prev + 1 && *m.find(e.key()) == e.value());
+        prev = e.key();
+    }
+    assert(prev == 999 && m.size() == 1000);
+    PASS();
+}
+
+void test_concurrent_map()
+{
+    TEST("Concurrent Map (Readers + Writers)");
+
+    z_tree::concurrent_map<int, int> m;
+    for (int i = 0; i < 256; ++i) m.insert(i, -i);
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < 4; ++w)
+    {
+        pool.emplace_back([&m, w]()
+        {
+            for (int i = 0; i < 5000; ++i)
+            {
+                int k = (i * 7 + w) % 512, v;
+                if (0 == w)
+                {
+                    (i % 2) ? m.insert(k, -k) : (void)m.erase(k);
+                }
+                else if (m.find(k, &v))
+                {
+                    assert(v == -k);
+                }
+            }
+        });
+    }
+    for (auto &t : pool) t.join();
+
+    int k = 0, v = 0, prev = -1;
+    assert(m.lower_bound(-5, &k, &v) && v == -k);
+    m.for_each([&](int key, int value)
+    {
+        assert(key > prev && value == -key);
+        prev = key;
+        m.find(key);
+    });
+    m.clear();
+    assert(m.size() == 0 && !m.find(3));
+    PASS();
+}
+
+void test_sharded_map()
+{
+    TEST("Sharded Map (Range Shards)");
+
+    const int bad[] = { 3, 1 }, bounds[] = { 1000, 2000, 3000 };
+    bool threw = false;
+    try
+    {
+        z_tree::sharded_map<int, int> broken(bad, 2);
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    z_tree::sharded_map<int, int> m(bounds, 3);
+    std::vector<std::thread> pool;
+    for (int w = 0; w < 4; ++w)
+    {
+        pool.emplace_back([&m, w]()
+        {
+            for (int i = 0; i < 2000; ++i)
+            {
+                int k = w * 1000 + i / 2;
+                m.insert(k, -k);
+                if (0 == i % 400) m.rebalance();
+            }
+        });
+    }
+    for (auto &t : pool) t.join();
+    assert(m.size() == 4000);
+
+    int k = 0, v = 0, prev = -1;
+    assert(m.find(2500, &v) && v == -2500);
+    assert(m.erase(2500) && !m.erase(2500) && !m.find(2500));
+    assert(m.lower_bound(2500, &k, &v) && k == 2501 && v == -2501);
+    assert(!m.lower_bound(4000, &k));
+    m.rebalance();
+    m.for_each([&](int key, int value)
+    {
+        assert(key > prev && value == -key);
+        prev = key;
+    });
+    assert(prev == 3999);
+    m.clear();
+    assert(m.size() == 0 && !m.find(3));
+    PASS();
+}
+
+void test_skiplist_map()
+{
+    TEST("Skiplist Map (Lock-Free)");
+
+    z_tree::skiplist_map<int, int> m;
+    std::vector<std::thread> pool;
+    for (int w = 0; w < 4; ++w)
+    {
+        pool.emplace_back([&m, w]()
+        {
+            z_tree::skiplist_map<int, int>::session s(m);
+            for (int i = 0; i < 3000; ++i)
+            {
+                int k = (i * 7 + w) % 1024, v;
+                if (0 == i % 3)
+                {
+                    s.erase(k);
+                }
+                else
+                {
+                    s.insert(k, -k);
+                }
+                if (s.find((k * 5) % 1024, &v))
+                {
+                    assert(v == -((k * 5) % 1024));
+                }
+            }
+        });
+    }
+    // Two threads keep calling the map itself, which borrows a slot per call.
+    for (int w = 0; w < 2; ++w)
+    {
+        pool.emplace_back([&m, w]()
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                int k = 2048 + (i + w) % 64, v;
+                m.insert(k, -k);
+                if (m.find(k, &v))
+                {
+                    assert(v == -k);
+                }
+                m.erase(k);
+            }
+        });
+    }
+    for (auto &t : pool) t.join();
+    assert(!m.find(2048));
+    // Sessions and per-call slots are all given back.
+    for (int i = 0; i < ZTREE_RCU_READERS; ++i)
+    {
+        assert(0 == m.inner.epoch.readers[i].claimed);
+    }
+
+    int k = 0, v = 0, prev = -1;
+    size_t seen = 0;
+    m.for_each([&](int key, int value)
+    {
+        assert(key > prev && value == -key);
+        prev = key;
+        seen++;
+    });
+    assert(seen == m.size());
+    assert(m.lower_bound(-5, &k, &v) && v == -k);
+    assert(m.erase(k) && !m.find(k) && !m.erase(k));
+    m.insert(k, 7);
+    m.insert(k, 8);
+    assert(m.find(k, &v) && v == 8 && m.size() == seen);
+    // Once the writers are gone, churn lets the collections shrink the backlog back to its floor.
+    for (size_t i = 0, n = 4 * m.inner.collect_at + 16 * ZTREE_SKIPLIST_COLLECT; i < n; ++i)
+    {
+        m.insert(5000, 1);
+        m.erase(5000);
+    }
+    // Each call is its own section, so a collection keeps what was retired since the previous one.
+    assert(m.inner.nretired < 2 * ZTREE_SKIPLIST_COLLECT);
+    m.reclaim();
+    assert(m.inner.retired == nullptr);
+    m.clear();
+    assert(m.size() == 0 && !m.find(3));
+    PASS();
+}
+
+void test_rcu_map()
+{
+    TEST("RCU Map (Lock-Free Readers)");
+
+    z_tree::rcu_map<int, int> m;
+    for (int i = 0; i < 256; ++i) m.insert(i, -i);
+
+    std::vector<std::thread> pool;
+    for (int w = 0; w < 3; ++w)
+    {
+        pool.emplace_back([&m, w]()
+        {
+            z_tree::rcu_map<int, int>::reader r(m);
+            for (int i = 0; i < 5000; ++i)
+            {
+                int k = (i * 7 + w) % 512, v, lk;
+                if (r.find(k, &v))
+                {
+                    assert(v == -k);
+                }
+                if (r.lower_bound(k, &lk, &v))
+                {
+                    assert(lk >= k && v == -lk);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 5000; ++i)
+    {
+        int k = (i * 13) % 512;
+        (i % 2) ? m.insert(k, -k) : (void)m.erase(k);
+    }
+    for (auto &t : pool) t.join();
+
+    z_tree::rcu_map<int, int>::reader r(m);
+    int k = 0, v = 0;
+    assert(r.lower_bound(-5, &k, &v) && v == -k);
+    assert(m.erase(k) && !r.find(k) && !m.erase(k));
+    m.clear();
+    assert(m.size() == 0 && !r.find(3));
+    PASS();
+}
+
+void test_persistent_map()
+{
+    TEST("Persistent Map (Copy = Snapshot)");
+
+    z_tree::persistent_map<int, int> m;
+    for (int i = 0; i < 100; ++i) m.insert(i, i * 2);
+
+    z_tree::persistent_map<int, int> snap = m.snapshot();
+    assert(snap.inner.root == m.inner.root);
+    m.insert(7, -1);
+    assert(m.erase(8) && !m.erase(8));
+    assert(*m.find(7) == -1 && !m.find(8));
+    assert(*snap.find(7) == 14 && *snap.find(8) == 16 && snap.size() == 100);
+
+    int prev = -1, n = 0;
+    snap.for_each([&](const int &k, const int &v)
+    {
+        assert(k > prev && v == k * 2);
+        prev = k;
+        n++;
+    });
+    assert(n == 100);
+
+    z_tree::persistent_map<int, int> copy;
+    copy = m;
+    m.clear();
+    assert(m.empty() && copy.size() == 99 && *copy.find(7) == -1);
+    PASS();
+}
+
+void test_copy()
+{
+    TEST("Copy Constructor & Assignment");
+
+    z_tree::map<int, int> m;
+    for (int i = 0; i < 1000; ++i)
+    {
+        m.insert(i, i * 2);
+    }
+    z_tree::map<int, int> c(m);
+    m.erase(10);
+    c[10] = 7;
+    assert(c.size() == 1000 && m.size() == 999 && *c.find(10) == 7 && m.find(10) == nullptr);
+    int expect = 0;
+    for (auto it = c.begin(); it != c.end(); ++it, ++expect)
+    {
+        assert(it.key() == expect);
+    }
+    assert(expect == 1000);
+
+    // Values are copy-constructed, and a copy outlives its source.
+    z_tree::map<int, std::string> s;
+    s.insert(1, std::string(64, 'a'));
+    s.insert(2, "b");
+    {
+        z_tree::map<int, std::string> t;
+        t.insert(9, "x");
+        z_tree::map<int, std::string> &self = t;
+        t = s;
+        t = self;
+        s = t;
+        *t.find(1) += "!";
+        s.erase(2);
+        assert(t.size() == 2 && *t.find(2) == "b" && t.find(1)->size() == 65);
+    }
+    assert(s.size() == 1 && *s.find(1) == std::string(64, 'a'));
+
+    z_tree::avl_map<int, int> a;
+    a.insert(1, 1);
+    z_tree::avl_map<int, int> b = a;
+    assert(b.size() == 1 && *b.find(1) == 1);
+    PASS();
+}
+
+void test_node_handles()
+{
+    TEST("Node Handles (Extract, Insert, Merge)");
+
+    z_tree::map<int, std::string> a, b;
+    for (int i = 0; i < 10; ++i)
+    {
+        a.insert(i, std::string(32, (char)('a' + i)));
+    }
+    auto nh = a.extract(3);
+    assert(nh && nh.key() == 3 && nh.mapped()[0] == 'd' && a.size() == 9);
+    assert(a.extract(42).empty());
+    nh.mapped() = "moved";
+    auto res = b.insert(std::move(nh));
+    assert(res.inserted && res.position.key() == 3 && res.node.empty() && *b.find(3) == "moved");
+
+    // A duplicate comes back in the result, still holding its entry.
+    b.insert(4, "kept");
+    res = b.insert(a.extract(a.lower_bound(4)));
+    assert(!res.inserted && res.position.key() == 4 && res.node.key() == 4 && res.node.mapped()[0] == 'e');
+    assert(*b.find(4) == "kept" && a.find(4) == nullptr);
+
+    // merge moves every key b lacks and leaves the clashes in a.
+    a.insert(3, "clash");
+    b.merge(a);
+    assert(b.size() == 10 && a.size() == 1 && *a.find(3) == "clash" && *b.find(3) == "moved");
+    int expect = 0;
+    for (auto it = b.begin(); it != b.end(); ++it, ++expect)
+    {
+        assert(it.key() == expect);
+    }
+
+    // Dropping a handle frees its node; copies made with clone hand out nodes of their own.
+    z_tree::map<int, std::string> c(b);
+    {
+        auto dropped = c.extract(0);
+        assert(dropped.mapped()[0] == 'a');
+    }
+    b.merge(c);
+    assert(c.size() == 9 && b.size() == 10);
+    PASS();
+}
+
+void test_parallel_for_each()
+{
+    TEST("Parallel For Each");
+
+    z_tree::map<int, int> m;
+    for (int i = 0; i < 5000; ++i)
+    {
+        m.insert(i, 1);
+    }
+    std::atomic<long> sum(0);
+    m.parallel_for_each([&](const int &k, int &v)
+    {
+        v += k;
+        sum += v;
+    }, 4);
+    assert(sum == 5000L * 4999 / 2 + 5000);
+    assert(*m.find(4999) == 5000 && *m.find(0) == 1);
+
+    bool threw = false;
+    try
+    {
+        m.parallel_for_each([](const int &, int &) {}, 0);
+    }
+    catch (const std::invalid_argument &)
+    {
+        threw = true;
+    }
+    assert(threw);
+    PASS();
+}
+
+void test_small_map()
+{
+    TEST("Small Map (Inline -> Tree)");
+
+    z_tree::small_map<int, int, 8> m;
+    for (int i = 7; i >= 0; --i)
+    {
+        m.insert(i, i * 10);
+    }
+    assert(m.size() == 8 && m.inner.tree.root == nullptr);
+
+    // Erasing through iterators keeps the next one valid while the map is inline.
+    for (auto it = m.begin(); it != m.end();)
+    {
+        it = (it.key() % 2) ? m.erase(it) : ++it;
+    }
+    assert(m.size() == 4 && m.find(3) == nullptr && *m.find(4) == 40);
+
+    z_tree::small_map<int, int, 8> moved(std::move(m));
+    int expect = 0;
+    for (auto it = moved.begin(); it != moved.end(); ++it, expect += 2)
+    {
+        assert(it.key() == expect && it.value() == expect * 10);
+    }
+    assert(expect == 8);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        moved[i] = i;
+    }
+    assert(moved.size() == 20 && moved.inner.tree.root != nullptr);
+    z_tree::small_map<int, int, 8> c(moved);
+    expect = 19;
+    for (auto it = c.end(); it != c.begin(); --expect)
+    {
+        --it;
+        assert(it.key() == expect && it.value() == expect);
+    }
+    assert(expect == -1 && c.pop_min().first == 0 && c.pop_max().first == 19);
+    PASS();
+}
+
+void test_topk_map()
+{
+    TEST("Top-K Map");
+
+    z_tree::topk_map<int, int> top(3);
+    int kept = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        kept += top.insert(i * 7 % 100, i);
+    }
+    assert(top.size() == 3 && top.capacity() == 3 && kept < 100);
+    int expect = 97;
+    for (auto it = top.begin(); it != top.end(); ++it)
+    {
+        assert(it.key() == expect++);
+    }
+    assert(!top.insert(50, 0) && top.insert(99, 5) && *top.find(99) == 5);
+    assert(top.erase(98) && !top.erase(98) && top.insert(1, 1) && top.begin().key() == 1);
+    top.clear();
+    assert(top.size() == 0 && top.insert(-5, 0));
     PASS();
 }
 
 int main() 
 {
+#ifdef ZTREE_THREADED
+    std::cout << "=> Running tests (ztree.h, C++, ZTREE_THREADED)\n";
+#else
     std::cout << "=> Running tests (ztree.h, C++)\n";
+#endif
     test_cpp_wrappers();
     test_iterators();
     test_lower_bound();
+    test_pop();
+    test_set();
+    test_multimap();
+    test_compact_map();
+    test_index_maps();
+    test_split_map();
+    test_prefix_map();
+    test_hashed_map();
+    test_filtered_map();
+    test_avl_map();
+    test_adaptive_map();
+    test_concurrent_map();
+    test_sharded_map();
+    test_skiplist_map();
+    test_rcu_map();
+    test_persistent_map();
+    test_copy();
+    test_node_handles();
+    test_parallel_for_each();
+    test_small_map();
+    test_topk_map();
     std::cout << "=> All tests passed successfully.\n";
     return 0;
 }
@@ -3,20 +3,160 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
 int cmp_int(const int *a, const int *b) 
 {
     return (*a > *b) - (*a < *b);
 }
 
+static int str_calls, int_calls;
+
+int cmp_int_counted(const int *a, const int *b)
+{
+    int_calls++;
+    return (*a > *b) - (*a < *b);
+}
+
+uint64_t hash_int(const int *k)
+{
+    return (uint64_t)(unsigned)*k * 0x9E3779B97F4A7C15ULL;
+}
+
+// Every key collides: exercises long probe runs and backward-shift deletion.
+uint64_t hash_bad(const int *k)
+{
+    return (uint64_t)(*k & 1);
+}
+
+int cmp_str(const char **a, const char **b)
+{
+    str_calls++;
+    return strcmp(*a, *b);
+}
+
 #define REGISTER_ZTREE_TYPES(X) \
     X(int, int, Int, cmp_int)
 
+#define REGISTER_ZTREE_MULTIMAP_TYPES(X) \
+    X(int, int, MInt, cmp_int)
+
+#define REGISTER_ZSET_TYPES(X) \
+    X(int, ISet, cmp_int)
+
+#define REGISTER_ZTREE_COMPACT_TYPES(X) \
+    X(int, int, CInt, cmp_int)
+
+#define REGISTER_ZTREE_INDEX_TYPES(X) \
+    X(int, int, IInt, cmp_int)
+
+#define REGISTER_ZTREE_FIXED_TYPES(X) \
+    X(int, int, FInt, cmp_int, 64)
+
+#define REGISTER_ZTREE_SPLIT_TYPES(X) \
+    X(int, int, SInt, cmp_int)
+
+#define REGISTER_ZTREE_PREFIX_TYPES(X) \
+    X(const char*, int, PStr, cmp_str, ztree_prefix_cstr)
+
+#define REGISTER_ZTREE_HASHED_TYPES(X) \
+    X(int, int, HInt, cmp_int, hash_int) \
+    X(int, int, HBad, cmp_int, hash_bad)
+
+#define REGISTER_ZTREE_FILTERED_TYPES(X) \
+    X(int, int, BInt, cmp_int, hash_int)
+
+#define REGISTER_ZTREE_AVL_TYPES(X) \
+    X(int, int, AInt, cmp_int)
+
+#define REGISTER_ZTREE_ADAPTIVE_TYPES(X) \
+    X(int, int, SpInt, cmp_int_counted)
+
+#define REGISTER_ZTREE_SYNC_TYPES(X) \
+    X(int, int, SyInt, cmp_int)
+
+#define REGISTER_ZTREE_RCU_TYPES(X) \
+    X(int, int, RInt, cmp_int)
+
+#define REGISTER_ZTREE_SHARDED_TYPES(X) \
+    X(int, int, ShInt, cmp_int)
+
+#define REGISTER_ZTREE_SKIPLIST_TYPES(X) \
+    X(int, int, SkInt, cmp_int)
+
+#define REGISTER_ZTREE_PERSISTENT_TYPES(X) \
+    X(int, int, PInt, cmp_int)
+
+#define REGISTER_ZTREE_SMALL_TYPES(X) \
+    X(int, int, SmInt, cmp_int, 8)
+
+#define REGISTER_ZTREE_TOPK_TYPES(X) \
+    X(int, int, TopInt, cmp_int)
+
+#define ZTREE_PARALLEL
 #include "ztree.h"
 
 #define TEST(name) printf("[TEST] %-35s", name);
 #define PASS() printf(" \033[0;32mPASS\033[0m\n")
 
+// Returns the black height of the subtree, asserting every red-black invariant on the way.
+static int check_rb(ztree_node_Int *n, ztree_node_Int *parent, size_t *count)
+{
+    if (!n)
+    {
+        return 1;
+    }
+    assert(n->parent == parent);
+    if (ZTREE_RED == n->color)
+    {
+        assert(!n->left || ZTREE_BLACK == n->left->color);
+        assert(!n->right || ZTREE_BLACK == n->right->color);
+    }
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    int lh = check_rb(n->left, n, count);
+    int rh = check_rb(n->right, n, count);
+    assert(lh == rh);
+    (*count)++;
+    return lh + (ZTREE_BLACK == n->color);
+}
+
+static void check_tree(ztree_Int *t)
+{
+    size_t count = 0;
+    assert(!t->root || ZTREE_BLACK == t->root->color);
+    check_rb(t->root, NULL, &count);
+    assert(count == t->size);
+
+    // Cached extremes must match a full descent.
+    ztree_node_Int *lo = t->root, *hi = t->root;
+    while (lo && lo->left)  lo = lo->left;
+    while (hi && hi->right) hi = hi->right;
+    assert(t->leftmost == lo && t->rightmost == hi);
+
+#ifdef ZTREE_THREADED
+    // Thread links must agree with the parent-pointer walk in both directions.
+    size_t walked = 0;
+    for (ztree_node_Int *n = lo; n; n = n->succ, walked++)
+    {
+        ztree_node_Int *up = n;
+        if (up->right)
+        {
+            for (up = up->right; up->left; up = up->left);
+        }
+        else
+        {
+            while (up->parent && up == up->parent->right) up = up->parent;
+            up = up->parent;
+        }
+        assert(n->succ == up);
+        assert(!n->succ || n->succ->pred == n);
+    }
+    assert(walked == t->size && (!lo || !lo->pred));
+#endif
+}
+
 void test_basic_ops(void) 
 {
     TEST("Init, Insert, Find, Size");
@@ -128,13 +268,2037 @@ void test_iteration(void)
     PASS();
 }
 
+void test_apply_batch(void)
+{
+    TEST("Apply Batch (Sorted Merge)");
+
+    enum { RANGE = 512 };
+    int ref[RANGE];
+    ztree_Int t = ztree_init(Int);
+    memset(ref, -1, sizeof(ref));
+
+    // Fresh trees of every small size must come out balanced and well colored.
+    for (int n = 0; n < 64; ++n)
+    {
+        ztree_op_Int ops[64];
+        for (int i = 0; i < n; ++i)
+        {
+            ops[i].key = n - i;
+            ops[i].value = i;
+            ops[i].op = ZTREE_OP_INSERT;
+        }
+        assert(ztree_apply_batch(&t, ops, n) == Z_OK);
+        assert(t.size == (size_t)n);
+        check_tree(&t);
+        ztree_clear(&t);
+    }
+
+    srand(7);
+    for (int round = 0; round < 40; ++round)
+    {
+        // Alternate large (rebuild) and small (per-op) batches, with duplicate keys inside a batch.
+        int n = (round % 2) ? 300 : 4;
+        ztree_op_Int ops[300];
+        for (int i = 0; i < n; ++i)
+        {
+            ops[i].key = rand() % RANGE;
+            ops[i].value = rand();
+            ops[i].op = (rand() % 3) ? ZTREE_OP_INSERT : ZTREE_OP_REMOVE;
+        }
+        assert(ztree_apply_batch(&t, ops, n) == Z_OK);
+
+        for (int i = 0; i < n; ++i)
+        {
+            int *slot = &ref[ops[i].key];
+            if (ZTREE_OP_INSERT == ops[i].op)
+            {
+                assert(ops[i].status == ((*slot < 0) ? Z_OK : Z_FOUND));
+                *slot = ops[i].value;
+            }
+            else
+            {
+                assert(ops[i].status == ((*slot < 0) ? Z_ENOTFOUND : Z_OK));
+                *slot = -1;
+            }
+        }
+
+        check_tree(&t);
+        size_t live = 0;
+        for (int k = 0; k < RANGE; ++k)
+        {
+            ztree_node_Int *n = ztree_find(&t, k);
+            assert((ref[k] < 0) == (n == NULL));
+            if (n)
+            {
+                assert(n->value == ref[k]);
+                live++;
+            }
+        }
+        assert(live == t.size);
+    }
+
+    ztree_clear(&t);
+    PASS();
+}
+
+void test_pop_min_max(void)
+{
+    TEST("Cached Min/Max, Pop Min/Max");
+
+    ztree_Int t = ztree_init(Int);
+    int k, v;
+    assert(ztree_pop_min(&t, &k, &v) == Z_EEMPTY);
+    assert(ztree_min(&t) == NULL && ztree_max(&t) == NULL);
+
+    srand(11);
+    for (int i = 0; i < 200; ++i)
+    {
+        int key = rand() % 1000;
+        ztree_insert(&t, key, -key);
+        if (i % 7 == 0)
+        {
+            ztree_remove(&t, ztree_max(&t)->key);
+        }
+        check_tree(&t);
+    }
+
+    // Drain from both ends: keys come out sorted and the cache never goes stale.
+    int lo = -1, hi = 1000;
+    while (t.size > 0)
+    {
+        if (t.size % 2)
+        {
+            assert(ztree_pop_min(&t, &k, &v) == Z_OK);
+            assert(k > lo && v == -k);
+            lo = k;
+        }
+        else
+        {
+            assert(ztree_pop_max(&t, &k, NULL) == Z_OK);
+            assert(k < hi);
+            hi = k;
+        }
+        check_tree(&t);
+    }
+    assert(lo < hi);
+    assert(ztree_pop_max(&t, NULL, NULL) == Z_EEMPTY);
+    PASS();
+}
+
+void test_remove_node_take(void)
+{
+    TEST("Remove Node, Take");
+
+    ztree_Int t = ztree_init(Int);
+    for (int i = 0; i < 100; ++i) ztree_insert(&t, i, i * 2);
+
+    // Delete every odd key during a safe scan without searching again.
+    ztree_node_Int *it, *safe;
+    ztree_foreach_safe(&t, it, safe)
+    {
+        if (it->key % 2)
+        {
+            ztree_remove_node(&t, it);
+        }
+    }
+    (void)it; (void)safe;
+    assert(t.size == 50);
+    check_tree(&t);
+    assert(ztree_find(&t, 31) == NULL && ztree_find(&t, 30) != NULL);
+
+    int v = 0;
+    assert(ztree_take(&t, 40, &v) == Z_OK && v == 80);
+    assert(ztree_take(&t, 40, &v) == Z_ENOTFOUND);
+    assert(ztree_take(&t, 0, NULL) == Z_OK);
+    assert(t.size == 48);
+    check_tree(&t);
+
+    ztree_clear(&t);
+    PASS();
+}
+
+void test_set(void)
+{
+    TEST("Set (Key-Only Nodes)");
+
+    assert(sizeof(ztree_node_ISet) < sizeof(ztree_node_Int));
+    ztree_ISet s = ztree_init(ISet);
+    for (int i = 0; i < 200; ++i)
+    {
+        assert(ztree_insert(&s, (i * 37) % 200) == Z_OK);
+    }
+    assert(ztree_insert(&s, 5) == Z_FOUND);
+    assert(s.size == 200 && ztree_contains(&s, 199) && !ztree_contains(&s, 200));
+
+    int expect = 0;
+    ztree_node_ISet *it, *safe;
+    ztree_foreach(&s, it)
+    {
+        assert(it->key == expect++);
+    }
+    assert(expect == 200);
+
+    assert(ztree_erase(&s, 10) == Z_OK);
+    assert(ztree_erase(&s, 10) == Z_ENOTFOUND);
+    assert(ztree_lower_bound(&s, 10)->key == 11);
+
+    int k = -1;
+    assert(ztree_pop_min(&s, &k) == Z_OK && k == 0);
+    assert(ztree_pop_max(&s, &k) == Z_OK && k == 199);
+    assert(ztree_min(&s)->key == 1 && ztree_max(&s)->key == 198);
+
+    ztree_foreach_safe(&s, it, safe)
+    {
+        if (it->key % 2)
+        {
+            ztree_remove_node(&s, it);
+        }
+    }
+    (void)it; (void)safe;
+    assert(s.size == 98 && !ztree_contains(&s, 3) && ztree_contains(&s, 4));
+
+    ztree_clear(&s);
+    assert(s.size == 0 && ztree_pop_min(&s, NULL) == Z_EEMPTY);
+    PASS();
+}
+
+void test_multimap(void)
+{
+    TEST("Multimap (Duplicates, Equal Range)");
+
+    ztree_MInt m = ztree_init(MInt);
+    // Ten copies of each key in 0..19, inserted interleaved; values record arrival order.
+    for (int i = 0; i < 200; ++i)
+    {
+        assert(ztree_insert(&m, (i * 7) % 20, i) == Z_OK);
+    }
+    assert(m.size == 200 && ztree_count(&m, 3) == 10 && ztree_count(&m, 20) == 0);
+
+    // Equal keys come out in insertion order.
+    ztree_node_MInt *first, *last;
+    ztree_equal_range(&m, 3, &first, &last);
+    int seen = 0, prev = -1;
+    for (ztree_node_MInt *n = first; n != last; n = ztree_next(n), seen++)
+    {
+        assert(n->key == 3 && n->value > prev);
+        prev = n->value;
+    }
+    assert(seen == 10 && last->key == 4);
+    assert(ztree_find(&m, 3) == first && ztree_lower_bound(&m, 3) == first);
+    assert(ztree_upper_bound(&m, 19) == NULL);
+
+    ztree_equal_range(&m, 25, &first, &last);
+    assert(first == NULL && last == NULL);
+
+    // Per-node erase removes a single copy.
+    ztree_remove_node(&m, ztree_find(&m, 5));
+    assert(ztree_count(&m, 5) == 9);
+
+    int v = -1;
+    assert(ztree_take(&m, 6, &v) == Z_OK && ztree_count(&m, 6) == 9);
+    assert(ztree_find(&m, 6)->value > v);
+
+    ztree_remove(&m, 7);
+    assert(ztree_count(&m, 7) == 0 && m.size == 200 - 12);
+
+    int k = -1;
+    assert(ztree_pop_min(&m, &k, &v) == Z_OK && k == 0 && v == 0);
+    ztree_clear(&m);
+    PASS();
+}
+
+// Compact nodes carry no parent pointer, so the checker only walks downwards.
+static int check_compact_rb(ztree_node_CInt *n, size_t *count)
+{
+    if (!n)
+    {
+        return 1;
+    }
+    if (ZTREE_RED == n->color)
+    {
+        assert(!n->left || ZTREE_BLACK == n->left->color);
+        assert(!n->right || ZTREE_BLACK == n->right->color);
+    }
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    int lh = check_compact_rb(n->left, count);
+    int rh = check_compact_rb(n->right, count);
+    assert(lh == rh);
+    (*count)++;
+    return lh + (ZTREE_BLACK == n->color);
+}
+
+void test_compact_layout(void)
+{
+    TEST("Compact Layout (Path Stack, Cursor)");
+
+    enum { N = 512 };
+    char present[N] = {0};
+    ztree_CInt t = ztree_init(CInt);
+
+    unsigned seed = 12345;
+    for (int round = 0; round < 4000; ++round)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % N);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, k * 3) == Z_OK);
+            present[k] = 1;
+        }
+        else
+        {
+            ztree_remove(&t, k);
+            present[k] = 0;
+        }
+    }
+
+    size_t count = 0, expect = 0;
+    assert(!t.root || ZTREE_BLACK == t.root->color);
+    check_compact_rb(t.root, &count);
+    for (int k = 0; k < N; ++k) expect += present[k];
+    assert(count == t.size && count == expect);
+
+    // Forward scan visits exactly the present keys in order.
+    ztree_cursor_CInt c = ztree_cursor_init(&t);
+    int prev = -1;
+    size_t seen = 0;
+    ztree_node_CInt *it;
+    ztree_cursor_foreach(&c, it)
+    {
+        assert(it->key > prev && present[it->key] && it->value == it->key * 3);
+        prev = it->key;
+        seen++;
+    }
+    (void)it;
+    assert(seen == t.size);
+    assert(ztree_min(&t) == t.leftmost && ztree_max(&t)->key == prev);
+
+    // Backward from end lands on the max and walks down to the min.
+    prev = N;
+    seen = 0;
+    for (ztree_node_CInt *n = ztree_cursor_prev(&c); n; n = ztree_cursor_prev(&c), seen++)
+    {
+        assert(n->key < prev);
+        prev = n->key;
+    }
+    assert(seen == t.size);
+
+    // Seek is a lower bound and the cursor keeps going from there.
+    for (int k = 0; k < N; ++k)
+    {
+        int want = k;
+        while (want < N && !present[want]) want++;
+        ztree_node_CInt *n = ztree_cursor_seek(&c, k);
+        assert(want == N ? n == NULL : n->key == want);
+        assert(ztree_lower_bound(&t, k) == n);
+        if (n)
+        {
+            int after = want + 1;
+            while (after < N && !present[after]) after++;
+            n = ztree_cursor_next(&c);
+            assert(after == N ? n == NULL : n->key == after);
+        }
+    }
+
+    int lo = 0, hi = 0;
+    assert(ztree_pop_min(&t, &lo, NULL) == Z_OK);
+    assert(ztree_pop_max(&t, &hi, NULL) == Z_OK);
+    assert(lo < hi && ztree_find(&t, lo) == NULL && ztree_find(&t, hi) == NULL);
+
+    ztree_clear(&t);
+    assert(t.size == 0 && t.root == NULL && t.leftmost == NULL);
+    assert(ztree_cursor_first(&c) == NULL);
+    PASS();
+}
+
+// Index trees link through slots; parent slots are checked the same way as parent pointers.
+static int check_index_rb(const ztree_node_IInt *nd, uint32_t i, uint32_t parent, size_t *count)
+{
+    if (ZTREE_NIL == i)
+    {
+        return 1;
+    }
+    const ztree_node_IInt *n = &nd[i];
+    assert(n->parent == parent);
+    if (ZTREE_RED == n->color)
+    {
+        assert(ZTREE_NIL == n->left || ZTREE_BLACK == nd[n->left].color);
+        assert(ZTREE_NIL == n->right || ZTREE_BLACK == nd[n->right].color);
+    }
+    if (ZTREE_NIL != n->left)  assert(nd[n->left].key < n->key);
+    if (ZTREE_NIL != n->right) assert(nd[n->right].key > n->key);
+    int lh = check_index_rb(nd, n->left, i, count);
+    int rh = check_index_rb(nd, n->right, i, count);
+    assert(lh == rh);
+    (*count)++;
+    return lh + (ZTREE_BLACK == n->color);
+}
+
+void test_index_layout(void)
+{
+    TEST("Index Layout (32-bit Slots, Fixed)");
+
+    enum { N = 2048 };
+    static char present[N];
+    memset(present, 0, sizeof(present));
+    ztree_IInt t = ztree_init(IInt);
+    assert(ztree_reserve(&t, 100) == Z_OK && t.cap >= 100);
+
+    unsigned seed = 99;
+    for (int round = 0; round < 20000; ++round)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % N);
+        if ((seed >> 4) % 3)
+        {
+            assert(ztree_insert(&t, k, -k) == Z_OK);
+            present[k] = 1;
+        }
+        else
+        {
+            assert(ztree_take(&t, k, NULL) == (present[k] ? Z_OK : Z_ENOTFOUND));
+            present[k] = 0;
+        }
+    }
+
+    size_t count = 0, expect = 0;
+    assert(ZTREE_NIL == t.root || ZTREE_BLACK == t.nodes[t.root].color);
+    check_index_rb(t.nodes, t.root, ZTREE_NIL, &count);
+    for (int k = 0; k < N; ++k) expect += present[k];
+    assert(count == t.size && count == expect);
+    // Freed slots are recycled before the pool grows.
+    assert(t.used <= N);
+
+    ztree_cursor_IInt c = ztree_cursor_init(&t);
+    int prev = -1;
+    size_t seen = 0;
+    ztree_node_IInt *it;
+    ztree_cursor_foreach(&c, it)
+    {
+        assert(it->key > prev && present[it->key] && it->value == -it->key);
+        prev = it->key;
+        seen++;
+    }
+    (void)it;
+    assert(seen == t.size && ztree_max(&t)->key == prev);
+    assert(ztree_cursor_prev(&c)->key == prev);
+    assert(ztree_cursor_seek(&c, prev + 1) == NULL);
+
+    ztree_clear(&t);
+    assert(t.size == 0 && t.nodes == NULL && ztree_min(&t) == NULL);
+
+    // Fixed capacity: no heap at all, inserts fail cleanly once every slot is taken.
+    ztree_FInt f = ztree_init(FInt);
+    for (int i = 0; i < 64; ++i) assert(ztree_insert(&f, i, i) == Z_OK);
+    assert(ztree_insert(&f, 64, 64) == Z_ENOMEM);
+    assert(ztree_insert(&f, 10, 100) == Z_OK && ztree_find(&f, 10)->value == 100);
+    assert(ztree_reserve(&f, 65) == Z_ENOMEM);
+    int lo = -1;
+    assert(ztree_pop_min(&f, &lo, NULL) == Z_OK && lo == 0);
+    assert(ztree_insert(&f, 64, 64) == Z_OK && f.size == 64);
+    assert(ztree_lower_bound(&f, 0)->key == 1 && ztree_max(&f)->key == 64);
+    ztree_clear(&f);
+    assert(f.size == 0 && ztree_find(&f, 5) == NULL);
+    assert(ztree_insert(&f, 5, 5) == Z_OK && f.used == 1);
+    PASS();
+}
+
+void test_split_layout(void)
+{
+    TEST("Split Layout (Values in Slab)");
+
+    enum { N = 1024 };
+    static char present[N];
+    memset(present, 0, sizeof(present));
+    ztree_SInt t = ztree_init(SInt);
+
+    unsigned seed = 7;
+    for (int round = 0; round < 20000; ++round)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % N);
+        if ((seed >> 4) % 3)
+        {
+            assert(ztree_insert(&t, k, k * 3) == Z_OK);
+            present[k] = 1;
+        }
+        else
+        {
+            assert(ztree_take(&t, k, NULL) == (present[k] ? Z_OK : Z_ENOTFOUND));
+            present[k] = 0;
+        }
+    }
+
+    // Freed value slots are recycled, so the slab never outgrows the live key range.
+    assert(t.slab.used <= N);
+    int prev = -1;
+    size_t seen = 0;
+    for (ztree_node_SInt *it = ztree_min(&t); it; it = ztree_next(it))
+    {
+        assert(it->key > prev && present[it->key] && *ztree_value(&t, it) == it->key * 3);
+        prev = it->key;
+        seen++;
+    }
+    assert(seen == t.size);
+
+    ztree_node_SInt *lo = ztree_lower_bound(&t, 0);
+    *ztree_value(&t, lo) = -1;
+    int lo_key = lo->key, k = -1, v = 0;
+    assert(ztree_pop_min(&t, &k, &v) == Z_OK && k == lo_key && v == -1);
+    assert(ztree_take(&t, prev, &v) == Z_OK && v == prev * 3 && ztree_find(&t, prev) == NULL);
+
+    ztree_clear(&t);
+    assert(t.size == 0 && t.slab.chunks[0] == NULL && t.slab.cap == 0 && ztree_min(&t) == NULL);
+    assert(ztree_insert(&t, 1, 10) == Z_OK && *ztree_value(&t, ztree_find(&t, 1)) == 10);
+
+    // The slab grows by new chunks, so a value pointer survives inserts that outgrow the first ones.
+    int *one = ztree_value(&t, ztree_find(&t, 1));
+    for (int i = 2; i < 5000; ++i)
+    {
+        assert(ztree_insert(&t, i, i) == Z_OK);
+    }
+    assert(t.slab.nchunks > 4 && one == ztree_value(&t, ztree_find(&t, 1)) && *one == 10);
+    ztree_SInt copy = ztree_init(SInt);
+    assert(ztree_clone(&copy, &t) == Z_OK && *ztree_value(&copy, ztree_find(&copy, 4999)) == 4999);
+    ztree_clear(&copy);
+    ztree_clear(&t);
+    PASS();
+}
+
+void test_prefix_layout(void)
+{
+    TEST("Prefix Layout (Cached Key Prefix)");
+
+    static char words[300][16];
+    ztree_PStr t = ztree_init(PStr);
+    for (int i = 0; i < 300; ++i)
+    {
+        // Two thirds share an 8-byte prefix and need strcmp; the rest differ early (or are shorter than 8).
+        if (i % 3)
+        {
+            snprintf(words[i], sizeof(words[i]), "%c%d", 'a' + i % 26, i);
+        }
+        else
+        {
+            snprintf(words[i], sizeof(words[i]), "longname%03d", i);
+        }
+        assert(ztree_insert(&t, words[i], i) == Z_OK);
+    }
+    assert(t.size == 300);
+
+    const char *prev = "";
+    for (ztree_node_PStr *it = ztree_min(&t); it; it = ztree_next(it))
+    {
+        assert(strcmp(prev, it->key) < 0);
+        prev = it->key;
+    }
+
+    str_calls = 0;
+    const char *probe = "q42";
+    assert(ztree_find(&t, probe) == NULL);
+    assert(strcmp(ztree_lower_bound(&t, probe)->key, "q68") == 0);
+    // Keys with a distinct prefix are resolved without touching the strings.
+    assert(str_calls == 0);
+    probe = "longname150";
+    assert(ztree_find(&t, probe)->value == 150 && str_calls > 0);
+
+    assert(ztree_insert(&t, probe, -1) == Z_OK && t.size == 300 && ztree_find(&t, probe)->value == -1);
+    ztree_remove(&t, probe);
+    assert(ztree_find(&t, probe) == NULL && t.size == 299);
+
+    const char *a = "abc", *b = "abcd", *c = "abd";
+    assert(ztree_prefix_cstr(&a) < ztree_prefix_cstr(&b) && ztree_prefix_cstr(&b) < ztree_prefix_cstr(&c));
+    ztree_clear(&t);
+    PASS();
+}
+
+// Runs the same random workload on a hashed tree and checks tree, index and the reference array agree.
+#define CHECK_HASHED(Name, seed0)                                                            \
+    do                                                                                       \
+    {                                                                                        \
+        enum { N = 700 };                                                                    \
+        static char present[N];                                                              \
+        memset(present, 0, sizeof(present));                                                 \
+        ztree_##Name t = ztree_init(Name);                                                   \
+        unsigned seed = seed0;                                                               \
+        for (int round = 0; round < 6000; ++round)                                           \
+        {                                                                                    \
+            seed = seed * 1103515245u + 12345u;                                              \
+            int k = (int)((seed >> 8) % N);                                                  \
+            if ((seed >> 4) % 3)                                                             \
+            {                                                                                \
+                assert(ztree_insert(&t, k, k + 1) == Z_OK);                                  \
+                present[k] = 1;                                                              \
+            }                                                                                \
+            else if ((seed >> 6) & 1)                                                        \
+            {                                                                                \
+                ztree_remove(&t, k);                                                         \
+                present[k] = 0;                                                              \
+            }                                                                                \
+            else                                                                             \
+            {                                                                                \
+                assert(ztree_take(&t, k, NULL) == (present[k] ? Z_OK : Z_ENOTFOUND));        \
+                present[k] = 0;                                                              \
+            }                                                                                \
+        }                                                                                    \
+        assert(t.index.count == t.size);                                                     \
+        for (int k = 0; k < N; ++k)                                                          \
+        {                                                                                    \
+            ztree_node_##Name *n = ztree_find(&t, k);                                        \
+            assert(present[k] ? (n && n->key == k && n->value == k + 1) : !n);               \
+        }                                                                                    \
+        int lo = -1;                                                                         \
+        assert(ztree_pop_min(&t, &lo, NULL) == Z_OK && ztree_find(&t, lo) == NULL);          \
+        assert(ztree_lower_bound(&t, lo)->key > lo && t.index.count == t.size);              \
+        ztree_clear(&t);                                                                     \
+        assert(t.index.slots == NULL && ztree_find(&t, 3) == NULL);                          \
+        assert(ztree_insert(&t, 3, 4) == Z_OK && ztree_find(&t, 3)->value == 4);             \
+        ztree_clear(&t);                                                                     \
+    } while (0)
+
+void test_hashed_layout(void)
+{
+    TEST("Hashed Layout (Side Hash Index)");
+    CHECK_HASHED(HInt, 11);
+    CHECK_HASHED(HBad, 12);
+    PASS();
+}
+
+void test_filtered_layout(void)
+{
+    TEST("Filtered Layout (Counting Bloom)");
+
+    ztree_BInt t = ztree_init(BInt);
+    // Even keys only; every odd probe is a miss.
+    for (int i = 0; i < 4000; i += 2) assert(ztree_insert(&t, i, i) == Z_OK);
+    for (int i = 0; i < 4000; ++i) assert((ztree_find(&t, i) != NULL) == !(i & 1));
+
+    ztree_filter_stats st = ztree_stats(&t);
+    assert(st.lookups == 4000 && st.rejected + st.false_positives == 2000);
+    // 10 counters per key targets ~1% false positives; allow generous slack.
+    assert(st.false_positives < 100);
+
+    // Deletes keep the counters exact: removed keys are rejected again, survivors are still found.
+    // Removals and takes consult the filter without touching the lookup counters.
+    for (int i = 0; i < 4000; i += 4) ztree_remove(&t, i);
+    assert(ztree_take(&t, 1, NULL) == Z_ENOTFOUND);
+    ztree_filter_stats before = st;
+    st = ztree_stats(&t);
+    assert(st.lookups == before.lookups && st.rejected == before.rejected);
+    assert(st.false_positives == before.false_positives);
+    int k = -1;
+    assert(ztree_pop_max(&t, &k, NULL) == Z_OK && k == 3998);
+    size_t found = 0;
+    for (int i = 0; i < 4000; ++i) found += NULL != ztree_find(&t, i);
+    assert(found == t.size && t.size == 999);
+    st = ztree_stats(&t);
+    assert(st.rejected > 2 * 2000);
+
+    ztree_clear(&t);
+    before = ztree_stats(&t);
+    assert(ztree_find(&t, 2) == NULL && t.filter.counters == NULL);
+    st = ztree_stats(&t);
+    assert(st.rejected == before.rejected + 1 && st.false_positives == before.false_positives);
+    assert(ztree_insert(&t, 2, 2) == Z_OK && ztree_find(&t, 2)->value == 2);
+
+    // A tighter per-tree rate rebuilds the filter in place and survives clear.
+    assert(ztree_tune_filter(&t, 0) == Z_EINVAL && ztree_tune_filter(&t, 65) == Z_EINVAL);
+    for (int i = 0; i < 4000; i += 2) assert(ztree_insert(&t, i, i) == Z_OK);
+    assert(ztree_tune_filter(&t, 16) == Z_OK && t.filter.bits_per_key == 16);
+    assert(t.filter.mask + 1 >= 2 * 16 * t.size);
+    before = ztree_stats(&t);
+    for (int i = 0; i < 4000; ++i) assert((ztree_find(&t, i) != NULL) == !(i & 1));
+    st = ztree_stats(&t);
+    assert(st.false_positives - before.false_positives < 20);
+    ztree_clear(&t);
+    assert(t.filter.bits_per_key == 16);
+    ztree_clear(&t);
+    PASS();
+}
+
+// Returns the subtree height, asserting parent links, ordering and every cached balance factor.
+static int check_avl(ztree_node_AInt *n, ztree_node_AInt *parent, size_t *count)
+{
+    if (!n)
+    {
+        return 0;
+    }
+    assert(n->parent == parent);
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    int lh = check_avl(n->left, n, count);
+    int rh = check_avl(n->right, n, count);
+    assert(n->balance == rh - lh && n->balance >= -1 && n->balance <= 1);
+    (*count)++;
+    return 1 + ((lh > rh) ? lh : rh);
+}
+
+static void check_avl_tree(ztree_AInt *t)
+{
+    size_t count = 0;
+    check_avl(t->root, NULL, &count);
+    assert(count == t->size);
+    assert(t->leftmost == ztree_min(t) && t->rightmost == ztree_max(t));
+}
+
+void test_avl_layout(void)
+{
+    TEST("AVL Layout (Balance, Batch, Finger)");
+
+    enum { RANGE = 2048 };
+    int ref[RANGE];
+    ztree_AInt t = ztree_init(AInt);
+    memset(ref, -1, sizeof(ref));
+
+    // Sequential inserts are the worst case for a naive tree; AVL keeps them within 1.44 log2 n.
+    for (int k = 0; k < 1024; ++k)
+    {
+        assert(ztree_insert(&t, k, k) == Z_OK);
+        ref[k] = k;
+    }
+    check_avl_tree(&t);
+
+    srand(11);
+    for (int i = 0; i < 20000; ++i)
+    {
+        int k = rand() % RANGE;
+        if (rand() % 2)
+        {
+            assert(ztree_insert(&t, k, i) == Z_OK);
+            ref[k] = i;
+        }
+        else
+        {
+            assert(ztree_take(&t, k, NULL) == ((ref[k] < 0) ? Z_ENOTFOUND : Z_OK));
+            ref[k] = -1;
+        }
+        if (0 == i % 1000)
+        {
+            check_avl_tree(&t);
+        }
+    }
+    check_avl_tree(&t);
+
+    // Large batches go through the rebuild path, which must also set balance factors.
+    ztree_op_AInt ops[600];
+    for (int i = 0; i < 600; ++i)
+    {
+        ops[i].key = rand() % RANGE;
+        ops[i].value = i;
+        ops[i].op = (rand() % 3) ? ZTREE_OP_INSERT : ZTREE_OP_REMOVE;
+    }
+    assert(ztree_apply_batch(&t, ops, 600) == Z_OK);
+    for (int i = 0; i < 600; ++i)
+    {
+        ref[ops[i].key] = (ZTREE_OP_INSERT == ops[i].op) ? ops[i].value : -1;
+    }
+    check_avl_tree(&t);
+
+    ztree_cursor_AInt c = ztree_cursor_init(&t);
+    for (int k = 0; k < RANGE; k += 3)
+    {
+        assert(ztree_cursor_insert(&c, k, -k) == Z_OK && ztree_cursor_get(&c)->key == k);
+        ref[k] = -k;
+    }
+    check_avl_tree(&t);
+    for (int k = 0; k < RANGE; ++k)
+    {
+        ztree_node_AInt *n = ztree_find(&t, k);
+        assert((-1 == ref[k]) == (n == NULL));
+        assert(!n || n->value == ref[k]);
+    }
+
+    // Popping from both ends drains the tree in order.
+    int lo = -1, hi = RANGE, k, v;
+    while (t.size)
+    {
+        assert(ztree_pop_min(&t, &k, &v) == Z_OK && k > lo);
+        lo = k;
+        if (t.size && ztree_pop_max(&t, &k, &v) == Z_OK)
+        {
+            assert(k < hi);
+            hi = k;
+        }
+        if (0 == t.size % 31)
+        {
+            check_avl_tree(&t);
+        }
+    }
+    assert(0 == t.size && NULL == t.root);
+    ztree_clear(&t);
+    PASS();
+}
+
+// Returns the subtree height, asserting parent links and ordering; adaptive trees have no shape invariant.
+static int check_bst(ztree_node_SpInt *n, ztree_node_SpInt *parent, size_t *count)
+{
+    if (!n)
+    {
+        return 0;
+    }
+    assert(n->parent == parent);
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    int lh = check_bst(n->left, n, count);
+    int rh = check_bst(n->right, n, count);
+    (*count)++;
+    return 1 + ((lh > rh) ? lh : rh);
+}
+
+static int check_adaptive_tree(ztree_SpInt *t)
+{
+    size_t count = 0;
+    int height = check_bst(t->root, NULL, &count);
+    assert(count == t->size);
+    assert(t->leftmost == ztree_min(t) && t->rightmost == ztree_max(t));
+    return height;
+}
+
+void test_adaptive_layout(void)
+{
+    TEST("Adaptive Layout (Splay, Depth Bound)");
+
+    enum { RANGE = 4096 };
+    int ref[RANGE];
+    ztree_SpInt t = ztree_init(SpInt);
+    memset(ref, -1, sizeof(ref));
+
+    // Ascending inserts would build a list. Splaying whatever lands too deep keeps inserts logarithmic, and
+    // a scan of finds over the result costs a small multiple of n log2 n comparisons (a list would take n^2 / 2).
+    int_calls = 0;
+    for (int k = 0; k < RANGE; ++k)
+    {
+        assert(ztree_insert(&t, k, k) == Z_OK);
+        ref[k] = k;
+    }
+    assert(int_calls < 2 * RANGE * 12);
+    check_adaptive_tree(&t);
+    int_calls = 0;
+    for (int k = 0; k < RANGE; ++k)
+    {
+        assert(ztree_find(&t, k)->value == k);
+    }
+    assert(int_calls < 2 * RANGE * 12);
+
+    // A key found ZTREE_SPLAY_HITS times moves to the root. Rotations leave nodes and iteration intact.
+    for (int i = 0; i < ZTREE_SPLAY_HITS; ++i)
+    {
+        assert(ztree_find(&t, 1234)->value == 1234);
+    }
+    assert(t.root->key == 1234);
+    ztree_node_SpInt *it = ztree_find(&t, 77);
+    for (int i = 0; i < ZTREE_SPLAY_HITS; ++i)
+    {
+        assert(ztree_find(&t, 3000) && ztree_find(&t, 20));
+    }
+    assert(t.root->key == 20);
+    assert(ztree_next(it)->key == 78 && ztree_prev(it)->key == 76);
+    check_adaptive_tree(&t);
+
+    // Skewed random traffic: finds and bounds agree with a reference while the tree keeps rotating.
+    srand(13);
+    for (int i = 0; i < 40000; ++i)
+    {
+        int k = (i % 4) ? rand() % 64 : rand() % RANGE;
+        switch (rand() % 4)
+        {
+            case 0:
+                assert(ztree_insert(&t, k, i) == Z_OK);
+                ref[k] = i;
+                break;
+            case 1:
+                assert(ztree_take(&t, k, NULL) == ((ref[k] < 0) ? Z_ENOTFOUND : Z_OK));
+                ref[k] = -1;
+                break;
+            default:
+            {
+                ztree_node_SpInt *n = ztree_find(&t, k);
+                assert((ref[k] < 0) == (n == NULL) && (!n || n->value == ref[k]));
+                ztree_node_SpInt *lb = ztree_lower_bound(&t, k);
+                int want = k;
+                while (want < RANGE && ref[want] < 0)
+                {
+                    want++;
+                }
+                assert(want == RANGE ? lb == NULL : lb->key == want);
+            }
+        }
+        if (0 == i % 2000)
+        {
+            check_adaptive_tree(&t);
+        }
+    }
+
+    // Large batches rebuild the tree balanced.
+    ztree_op_SpInt ops[600];
+    for (int i = 0; i < 600; ++i)
+    {
+        ops[i].key = rand() % RANGE;
+        ops[i].value = i;
+        ops[i].op = ZTREE_OP_INSERT;
+    }
+    assert(ztree_apply_batch(&t, ops, 600) == Z_OK);
+    size_t n = t.size;
+    int height = check_adaptive_tree(&t);
+    while (n)
+    {
+        n >>= 1;
+        height--;
+    }
+    assert(height <= 0);
+    ztree_clear(&t);
+    PASS();
+}
+
+static int sum_entries(const int *key, const int *value, void *ctx)
+{
+    assert(*value == *key * 2);
+    *(long *)ctx += *key;
+    return 0;
+}
+
+// Writers keep the invariant value == 2 * key; readers check it on every hit and lower bound.
+static void *sync_worker(void *arg)
+{
+    ztree_sync_SyInt *s = (ztree_sync_SyInt *)arg;
+    unsigned seed = (unsigned)(uintptr_t)&seed;
+    for (int i = 0; i < 20000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % 1024), v, lk;
+        switch ((seed >> 20) % 8)
+        {
+            case 0:
+                assert(ztree_sync_insert(s, k, k * 2) == Z_OK);
+                break;
+            case 1:
+                ztree_sync_remove(s, k);
+                break;
+            default:
+                if (Z_OK == ztree_sync_find(s, k, &v))
+                {
+                    assert(v == k * 2);
+                }
+                if (Z_OK == ztree_sync_lower_bound(s, k, &lk, &v))
+                {
+                    assert(lk >= k && v == lk * 2);
+                }
+        }
+    }
+    return NULL;
+}
+
+void test_sync_map(void)
+{
+    TEST("Sync Map (Striped RW Lock)");
+
+    ztree_sync_SyInt s = ztree_sync_init(SyInt);
+    int v = 0, k = 0;
+    assert(ztree_sync_find(&s, 1, &v) == Z_ENOTFOUND && ztree_sync_remove(&s, 1) == Z_ENOTFOUND);
+    for (int i = 0; i < 100; ++i)
+    {
+        assert(ztree_sync_insert(&s, i * 2, i * 4) == Z_OK);
+    }
+    assert(ztree_sync_find(&s, 10, &v) == Z_OK && v == 20);
+    assert(ztree_sync_lower_bound(&s, 11, &k, &v) == Z_OK && k == 12 && v == 24);
+    assert(ztree_sync_lower_bound(&s, 199, &k, NULL) == Z_ENOTFOUND);
+    assert(ztree_sync_remove(&s, 10) == Z_OK && ztree_sync_size(&s) == 99);
+
+    long sum = 0;
+    assert(ztree_sync_foreach(&s, sum_entries, &sum) == Z_OK && sum == 99 * 100 - 10);
+    ztree_sync_entry_SyInt *items;
+    size_t n;
+    assert(ztree_sync_snapshot(&s, &items, &n) == Z_OK && n == 99);
+    for (size_t i = 1; i < n; ++i)
+    {
+        assert(items[i - 1].key < items[i].key);
+    }
+    ZTREE_FREE(items);
+
+    pthread_t th[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        assert(0 == pthread_create(&th[i], NULL, sync_worker, &s));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        pthread_join(th[i], NULL);
+    }
+    size_t count = 0;
+    for (ztree_node_SyInt *x = ztree_min(&s.tree); x; x = ztree_next(x), ++count)
+    {
+        assert(!ztree_next(x) || ztree_next(x)->key > x->key);
+    }
+    assert(count == s.tree.size);
+    sum = 0;
+    assert(ztree_sync_foreach(&s, sum_entries, &sum) == Z_OK);
+    ztree_sync_clear(&s);
+    assert(ztree_sync_size(&s) == 0);
+    PASS();
+}
+
+// Every shard holds only keys in [lo, next lo); returns the total count.
+static size_t check_shards(ztree_sharded_ShInt *s)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < s->nshards; ++i)
+    {
+        ztree_ShInt *t = &s->shards[i].tree;
+        if (t->size)
+        {
+            assert(i == 0 || ztree_min(t)->key >= s->shards[i].lo);
+            assert(i + 1 == s->nshards || ztree_max(t)->key < s->shards[i + 1].lo);
+        }
+        assert(i < 2 || s->shards[i - 1].lo < s->shards[i].lo);
+        total += t->size;
+    }
+    return total;
+}
+
+static int ordered_entries(const int *key, const int *value, void *ctx)
+{
+    int *prev = (int *)ctx;
+    assert(*key > *prev && *value == *key * 2);
+    *prev = *key;
+    return 0;
+}
+
+typedef struct
+{
+    ztree_sharded_ShInt *map;
+    int base;
+} shard_job;
+
+static void *shard_writer(void *arg)
+{
+    shard_job *job = (shard_job *)arg;
+    for (int i = 0; i < 3000; ++i)
+    {
+        assert(ztree_sharded_insert(job->map, job->base + i, (job->base + i) * 2) == Z_OK);
+        if (0 == i % 500)
+        {
+            ztree_sharded_rebalance(job->map);
+        }
+    }
+    return NULL;
+}
+
+void test_sharded_map(void)
+{
+    TEST("Sharded Map (Range Shards, Rebalance)");
+
+    static ztree_sharded_ShInt s;
+    const int bad[] = { 5, 5 }, bounds[] = { 256, 512, 768 };
+    assert(ztree_sharded_init(&s, bad, 2) == Z_EINVAL);
+    assert(ztree_sharded_init(&s, bounds, 3) == Z_OK && s.nshards == 4);
+    int k = 0, v = 0, prev = -1;
+    for (int i = 0; i < 256; ++i)
+    {
+        assert(ztree_sharded_insert(&s, i, i * 2) == Z_OK);
+        assert(ztree_sharded_insert(&s, 800 + i, (800 + i) * 2) == Z_OK);
+    }
+    assert(ztree_sharded_find(&s, 900, &v) == Z_OK && v == 1800);
+    assert(ztree_sharded_find(&s, 300, &v) == Z_ENOTFOUND);
+    // Shards 1 and 2 are empty, so the lower bound comes from shard 3.
+    assert(ztree_sharded_lower_bound(&s, 300, &k, &v) == Z_OK && k == 800 && v == 1600);
+    assert(ztree_sharded_lower_bound(&s, 2000, &k, NULL) == Z_ENOTFOUND);
+    assert(ztree_sharded_remove(&s, 0) == Z_OK && ztree_sharded_remove(&s, 0) == Z_ENOTFOUND);
+    assert(ztree_sharded_size(&s) == 511);
+    assert(ztree_sharded_foreach(&s, ordered_entries, &prev) == Z_OK && prev == 1055);
+
+    // Skewed ingest lands in the last shard; rebalancing splits it and merges the empty middle shards.
+    for (int i = 0; i < 4000; ++i)
+    {
+        assert(ztree_sharded_insert(&s, 2000 + i, (2000 + i) * 2) == Z_OK);
+    }
+    size_t share = 4511 / 4;
+    assert(ztree_sharded_rebalance(&s) > 0);
+    assert(check_shards(&s) == 4511);
+    for (size_t i = 0; i < s.nshards; ++i)
+    {
+        assert(s.shards[i].tree.size <= 2 * share + 1);
+    }
+    for (int i = 0; i < 256; ++i)
+    {
+        assert(ztree_sharded_remove(&s, 800 + i) == Z_OK);
+    }
+    for (int i = 0; i < 4000; ++i)
+    {
+        assert(ztree_sharded_remove(&s, 2000 + i) == Z_OK);
+    }
+    // Shard 0 now holds everything: it splits back to the target count while the emptied pair merges.
+    assert(ztree_sharded_rebalance(&s) == 3 && s.nshards == 4);
+    assert(check_shards(&s) == 255 && s.shards[3].tree.size == 0);
+    prev = -1;
+    ztree_sharded_foreach(&s, ordered_entries, &prev);
+    assert(prev == 255);
+    ztree_sharded_clear(&s);
+
+    // Fewer keys than target shards: nothing is worth splitting, but empty neighbours still merge.
+    assert(ztree_sharded_init(&s, NULL, 0) == Z_OK && s.target == ZTREE_SHARDS_MAX / 4);
+    for (int i = 0; i < 10; ++i)
+    {
+        assert(ztree_sharded_insert(&s, i, i * 2) == Z_OK);
+    }
+    assert(ztree_sharded_rebalance(&s) == 0 && s.nshards == 1 && check_shards(&s) == 10);
+    ztree_sharded_clear(&s);
+    assert(ztree_sharded_init(&s, bounds, 3) == Z_OK);
+    assert(ztree_sharded_insert(&s, 5, 10) == Z_OK);
+    assert(ztree_sharded_rebalance(&s) == 2 && s.nshards == 2 && check_shards(&s) == 1);
+    ztree_sharded_clear(&s);
+
+    // Writers on disjoint ranges, rebalancing as they go.
+    assert(ztree_sharded_init(&s, bounds, 3) == Z_OK);
+    pthread_t th[4];
+    shard_job jobs[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        jobs[i] = (shard_job){ &s, i * 100000 };
+        assert(0 == pthread_create(&th[i], NULL, shard_writer, &jobs[i]));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        pthread_join(th[i], NULL);
+    }
+    assert(check_shards(&s) == 12000 && ztree_sharded_size(&s) == 12000);
+    prev = -1;
+    ztree_sharded_foreach(&s, ordered_entries, &prev);
+    assert(prev == 303000 - 1);
+    ztree_sharded_clear(&s);
+    PASS();
+}
+
+static int check_rcu_rb(ztree_node_RInt *n, size_t *count)
+{
+    if (!n)
+    {
+        return 1;
+    }
+    if (ZTREE_RED == n->color)
+    {
+        assert(!n->left || ZTREE_BLACK == n->left->color);
+        assert(!n->right || ZTREE_BLACK == n->right->color);
+    }
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    int lh = check_rcu_rb(n->left, count);
+    int rh = check_rcu_rb(n->right, count);
+    assert(lh == rh);
+    (*count)++;
+    return lh + (ZTREE_BLACK == n->color);
+}
+
+static int rcu_done;
+
+// Lock-free readers: every value they see was written as 2 * key, whatever version they land on.
+static void *rcu_reader(void *arg)
+{
+    ztree_RInt *t = (ztree_RInt *)arg;
+    ztree_rcu_reader *r = ztree_rcu_register(t);
+    assert(r);
+    unsigned seed = (unsigned)(uintptr_t)&seed;
+    while (!__atomic_load_n(&rcu_done, __ATOMIC_ACQUIRE))
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % 1024);
+        ztree_rcu_read_lock(r);
+        ztree_node_RInt *n = ztree_find(t, k);
+        assert(!n || n->value == k * 2);
+        n = ztree_lower_bound(t, k);
+        assert(!n || (n->key >= k && n->value == n->key * 2));
+        ztree_rcu_read_unlock(r);
+    }
+    ztree_rcu_unregister(r);
+    return NULL;
+}
+
+// Live keys on the bottom level are strictly ascending; returns how many there are.
+static size_t check_skiplist(ztree_SkInt *t)
+{
+    size_t count = 0;
+    ztree_node_SkInt *n;
+    ztree_foreach(t, n)
+    {
+        assert(0 == (n->next[0] & 1));
+        assert(!ztree_next(n) || ztree_next(n)->key > n->key);
+        count++;
+    }
+    (void)n;
+    return count;
+}
+
+typedef struct
+{
+    ztree_SkInt *map;
+    int lane;
+} skip_job;
+
+static void *skip_worker(void *arg)
+{
+    skip_job *job = (skip_job *)arg;
+    ztree_SkInt *t = job->map;
+    ztree_rcu_reader *r = ztree_rcu_register(t);
+    assert(r != NULL);
+    // Each thread owns the keys congruent to its lane, but reads and contends on everyone's.
+    ztree_rcu_read_lock(r);
+    for (int k = job->lane; k < 8000; k += 4)
+    {
+        assert(ztree_insert(t, k, k * 2) == Z_OK);
+    }
+    ztree_rcu_read_unlock(r);
+    for (int k = job->lane; k < 8000; k += 4)
+    {
+        ztree_rcu_read_lock(r);
+        if (k & 1)
+        {
+            ztree_remove(t, k);
+        }
+        else
+        {
+            assert(ztree_insert(t, k, k * 3) == Z_OK);
+        }
+        ztree_node_SkInt *n = ztree_find(t, (k * 7) % 8000);
+        assert(!n || n->value == n->key * 2 || n->value == n->key * 3);
+        n = ztree_lower_bound(t, k);
+        assert((k & 1) ? (!n || n->key > k) : (n && n->key == k && n->value == k * 3));
+        ztree_rcu_read_unlock(r);
+    }
+    for (int i = 0; i < 2000; ++i)
+    {
+        ztree_rcu_read_lock(r);
+        assert(ztree_insert(t, 8000 + i % 64, job->lane) == Z_OK);
+        ztree_rcu_read_unlock(r);
+    }
+    ztree_rcu_unregister(r);
+    return NULL;
+}
+
+void test_skiplist_map(void)
+{
+    TEST("Skiplist Map (Lock-Free)");
+
+    enum { N = 512 };
+    char present[N] = {0};
+    int values[N];
+    ztree_SkInt t = ztree_init(SkInt);
+    unsigned seed = 4242;
+    for (int round = 0; round < 6000; ++round)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % N);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, round) == Z_OK);
+            present[k] = 1;
+            values[k] = round;
+        }
+        else
+        {
+            int v = -1;
+            assert(ztree_take(&t, k, &v) == (present[k] ? Z_OK : Z_ENOTFOUND));
+            assert(!present[k] || v == values[k]);
+            present[k] = 0;
+        }
+    }
+    size_t expect = 0;
+    for (int k = 0; k < N; ++k)
+    {
+        ztree_node_SkInt *n = ztree_find(&t, k);
+        assert(present[k] ? (n && n->value == values[k]) : !n);
+        expect += present[k];
+    }
+    assert(check_skiplist(&t) == expect && t.size == expect);
+    assert(ztree_min(&t) == ztree_lower_bound(&t, -5));
+    assert(ztree_lower_bound(&t, ztree_max(&t)->key + 1) == NULL);
+
+    // Overwrites replace the node, so a value already handed out never changes under its reader, and the old
+    // node survives every collection until that reader leaves its section.
+    ztree_rcu_reader *r = ztree_rcu_register(&t);
+    ztree_rcu_read_lock(r);
+    assert(ztree_insert(&t, 1000, 1) == Z_OK);
+    ztree_node_SkInt *old = ztree_find(&t, 1000);
+    assert(ztree_insert(&t, 1000, 2) == Z_OK);
+    for (int i = 0; i < 4 * ZTREE_SKIPLIST_COLLECT; ++i)
+    {
+        assert(ztree_insert(&t, 2000 + i, i) == Z_OK);
+        ztree_remove(&t, 2000 + i);
+    }
+    assert(t.nretired > 4 * ZTREE_SKIPLIST_COLLECT);
+    assert(old->value == 1 && ztree_find(&t, 1000)->value == 2 && ztree_max(&t)->value == 2);
+    ztree_remove(&t, 1000);
+    assert(ztree_find(&t, 1000) == NULL && old->key == 1000);
+    ztree_rcu_read_unlock(r);
+    ztree_rcu_unregister(r);
+
+    // With no reader inside, removals free what they retire, so a hot map does not grow.
+    for (int i = 0; i < 64 * ZTREE_SKIPLIST_COLLECT; ++i)
+    {
+        assert(ztree_insert(&t, 2000 + i % 100, i) == Z_OK);
+        ztree_remove(&t, 2000 + i % 100);
+    }
+    assert(t.nretired < ZTREE_SKIPLIST_COLLECT);
+    size_t pending = t.nretired;
+    assert(ztree_skiplist_reclaim(&t) == pending && t.retired == NULL && t.nretired == 0);
+    assert(check_skiplist(&t) == expect && t.size == expect);
+    ztree_clear(&t);
+    assert(ztree_min(&t) == NULL && ztree_max(&t) == NULL && t.size == 0);
+
+    pthread_t th[4];
+    skip_job jobs[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        jobs[i] = (skip_job){ &t, i };
+        assert(0 == pthread_create(&th[i], NULL, skip_worker, &jobs[i]));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        pthread_join(th[i], NULL);
+    }
+    for (int k = 0; k < 8000; ++k)
+    {
+        ztree_node_SkInt *n = ztree_find(&t, k);
+        assert((k & 1) ? !n : (n && n->value == k * 3));
+    }
+    assert(check_skiplist(&t) == 4000 + 64 && t.size == 4000 + 64);
+    ztree_skiplist_reclaim(&t);
+    assert(check_skiplist(&t) == 4000 + 64 && t.size == 4000 + 64);
+    ztree_clear(&t);
+    PASS();
+}
+
+void test_rcu_map(void)
+{
+    TEST("RCU Map (Path Copying, Epochs)");
+
+    enum { N = 512 };
+    char present[N] = {0};
+    ztree_RInt t = ztree_init(RInt);
+    unsigned seed = 777;
+    for (int round = 0; round < 4000; ++round)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % N);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, k * 2) == Z_OK);
+            present[k] = 1;
+        }
+        else
+        {
+            int v = -1;
+            assert(ztree_take(&t, k, &v) == (present[k] ? Z_OK : Z_ENOTFOUND));
+            assert(!present[k] || v == k * 2);
+            present[k] = 0;
+        }
+    }
+    size_t count = 0, expect = 0;
+    assert(t.head == t.root && (!t.root || ZTREE_BLACK == t.root->color));
+    check_rcu_rb(t.root, &count);
+    for (int k = 0; k < N; ++k) expect += present[k];
+    assert(count == t.size && count == expect);
+    assert(t.nretired == 0);
+
+    // A reader inside a section keeps the version it started on, even across updates and removals.
+    ztree_rcu_reader *r = ztree_rcu_register(&t);
+    assert(ztree_insert(&t, 10, 20) == Z_OK && ztree_insert(&t, 11, 22) == Z_OK);
+    ztree_rcu_read_lock(r);
+    ztree_node_RInt *old = ztree_find(&t, 10), *gone = ztree_find(&t, 11);
+    assert(ztree_insert(&t, 10, 99) == Z_OK);
+    ztree_remove(&t, 11);
+    assert(old->value == 20 && gone->key == 11 && t.nretired > 0);
+    assert(ztree_find(&t, 10)->value == 99 && ztree_find(&t, 11) == NULL);
+    ztree_rcu_read_unlock(r);
+    assert(ztree_insert(&t, 10, 20) == Z_OK && t.nretired == 0);
+    ztree_rcu_unregister(r);
+
+    assert(ztree_min(&t)->key == ztree_lower_bound(&t, -5)->key);
+    assert(ztree_lower_bound(&t, ztree_max(&t)->key + 1) == NULL);
+
+    // One writer against three readers.
+    ztree_clear(&t);
+    pthread_t th[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        assert(0 == pthread_create(&th[i], NULL, rcu_reader, &t));
+    }
+    for (int i = 0; i < 20000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % 1024);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, k * 2) == Z_OK);
+        }
+        else
+        {
+            ztree_remove(&t, k);
+        }
+    }
+    __atomic_store_n(&rcu_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < 3; ++i)
+    {
+        pthread_join(th[i], NULL);
+    }
+    count = 0;
+    check_rcu_rb(t.root, &count);
+    assert(count == t.size);
+    ztree_clear(&t);
+    assert(t.size == 0 && ztree_find(&t, 1) == NULL);
+    PASS();
+}
+
+static int check_persistent_rb(ztree_node_PInt *n, size_t *count)
+{
+    if (!n)
+    {
+        return 1;
+    }
+    if (ZTREE_RED == n->color)
+    {
+        assert(!n->left || ZTREE_BLACK == n->left->color);
+        assert(!n->right || ZTREE_BLACK == n->right->color);
+    }
+    if (n->left)  assert(n->left->key < n->key);
+    if (n->right) assert(n->right->key > n->key);
+    assert(n->refs >= 1);
+    int lh = check_persistent_rb(n->left, count);
+    int rh = check_persistent_rb(n->right, count);
+    assert(lh == rh);
+    (*count)++;
+    return lh + (ZTREE_BLACK == n->color);
+}
+
+// Nodes only this version can reach: the top of the tree down to the first shared node on each branch.
+static size_t private_nodes(ztree_node_PInt *n)
+{
+    return (n && 1 == n->refs) ? 1 + private_nodes(n->left) + private_nodes(n->right) : 0;
+}
+
+static long snapshot_sum(ztree_PInt *t)
+{
+    long sum = 0;
+    ztree_cursor_PInt c = ztree_cursor_init(t);
+    for (ztree_node_PInt *n = ztree_cursor_first(&c); n; n = ztree_cursor_next(&c))
+    {
+        assert(n->value == n->key * 2);
+        sum += n->key;
+    }
+    return sum;
+}
+
+static void *persistent_scan(void *arg)
+{
+    ztree_PInt *snap = (ztree_PInt *)arg;
+    for (int i = 0; i < 20; ++i)
+    {
+        assert(snapshot_sum(snap) == 1023L * 1024 / 2);
+    }
+    ztree_clear(snap);
+    return NULL;
+}
+
+void test_persistent_map(void)
+{
+    TEST("Persistent Map (Snapshots)");
+
+    ztree_PInt t = ztree_init(PInt);
+    assert(ztree_pop_min(&t, NULL, NULL) == Z_EEMPTY);
+    for (int i = 0; i < 1024; ++i)
+    {
+        assert(ztree_insert(&t, i, i * 2) == Z_OK);
+    }
+    assert(private_nodes(t.root) == 1024);
+
+    // A snapshot shares everything; one update then copies a single path.
+    ztree_PInt snap = ztree_snapshot(&t);
+    assert(snap.root == t.root && snap.size == 1024 && private_nodes(t.root) == 0);
+    assert(ztree_insert(&t, 5, -1) == Z_OK);
+    size_t copied = private_nodes(t.root);
+    assert(copied >= 1 && copied <= 2 * 11);
+    assert(ztree_find(&snap, 5)->value == 10 && ztree_find(&t, 5)->value == -1);
+
+    // Churn the live map; the snapshot keeps its contents and both stay valid red-black trees.
+    unsigned seed = 99;
+    for (int i = 0; i < 4000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % 2048);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, k * 3) == Z_OK);
+        }
+        else
+        {
+            ztree_remove(&t, k);
+        }
+    }
+    assert(snapshot_sum(&snap) == 1023L * 1024 / 2);
+    size_t count = 0;
+    check_persistent_rb(snap.root, &count);
+    assert(count == 1024);
+    count = 0;
+    check_persistent_rb(t.root, &count);
+    assert(count == t.size);
+
+    // Snapshots are maps in their own right: they can be written and snapshotted again.
+    ztree_PInt branch = ztree_snapshot(&snap);
+    int k = 0, v = 0;
+    assert(ztree_pop_max(&branch, &k, &v) == Z_OK && k == 1023 && v == 2046);
+    assert(ztree_take(&branch, 0, &v) == Z_OK && v == 0 && branch.size == 1022);
+    assert(ztree_find(&snap, 1023) && ztree_find(&snap, 0) && snap.size == 1024);
+    ztree_clear(&branch);
+    ztree_clear(&t);
+    assert(snapshot_sum(&snap) == 1023L * 1024 / 2);
+
+    // Scans on other threads never block the writer.
+    for (int i = 0; i < 1024; ++i)
+    {
+        assert(ztree_insert(&t, i, i * 2) == Z_OK);
+    }
+    ztree_PInt snaps[2] = { ztree_snapshot(&t), ztree_snapshot(&t) };
+    pthread_t th[2];
+    for (int i = 0; i < 2; ++i)
+    {
+        assert(0 == pthread_create(&th[i], NULL, persistent_scan, &snaps[i]));
+    }
+    for (int i = 0; i < 20000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        k = (int)((seed >> 8) % 2048);
+        if ((seed >> 4) & 1)
+        {
+            assert(ztree_insert(&t, k, k * 2) == Z_OK);
+        }
+        else
+        {
+            ztree_remove(&t, k);
+        }
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        pthread_join(th[i], NULL);
+    }
+    ztree_clear(&snap);
+    ztree_clear(&t);
+    PASS();
+}
+
+void test_finger_cursor(void)
+{
+    TEST("Finger Cursor (Seek, Find, Insert)");
+
+    ztree_Int t = ztree_init(Int);
+    ztree_cursor_Int c = ztree_cursor_init(&t);
+    assert(ztree_cursor_seek(&c, 5) == NULL && ztree_cursor_find(&c, 5) == NULL);
+
+    // A random walk of nearby keys, inserted through the finger; every third key is skipped.
+    unsigned seed = 5;
+    int k = 5000;
+    for (int i = 0; i < 4000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        k += (int)((seed >> 8) % 21) - 10;
+        if (k % 3)
+        {
+            assert(ztree_cursor_insert(&c, k, k * 2) == Z_OK && ztree_cursor_get(&c)->key == k);
+        }
+    }
+    check_tree(&t);
+
+    // Seeks and finds from wherever the finger is agree with plain root descents.
+    for (int i = 0; i < 4000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int q = (i & 1) ? k + (int)((seed >> 8) % 41) - 20 : (int)((seed >> 8) % 12000) - 1000;
+        assert(ztree_cursor_seek(&c, q) == ztree_lower_bound(&t, q));
+        assert(ztree_cursor_find(&c, q) == ztree_find(&t, q));
+        k = ztree_cursor_get(&c) ? ztree_cursor_get(&c)->key : k;
+    }
+
+    // Adjacent keys on opposite sides of the root only share the root: the climb goes all the way up.
+    ztree_node_Int *lo = ztree_prev(t.root), *hi = ztree_next(t.root);
+    assert(ztree_cursor_seek(&c, lo->key) == lo && ztree_cursor_find(&c, hi->key) == hi);
+    assert(ztree_cursor_find(&c, lo->key) == lo && ztree_cursor_seek(&c, t.root->key) == t.root);
+    assert(ztree_cursor_seek(&c, lo->key) == lo && ztree_cursor_seek(&c, t.root->key + 1) == hi);
+    assert(ztree_cursor_seek(&c, lo->key) == lo && ztree_cursor_insert(&c, hi->key, 1) == Z_OK);
+    assert(ztree_cursor_get(&c) == hi && hi->value == 1);
+
+    // The cursor walks like the stack cursors do, and stays valid across inserts elsewhere.
+    ztree_cursor_first(&c);
+    assert(ztree_cursor_get(&c) == ztree_min(&t) && ztree_cursor_prev(&c) == NULL);
+    assert(ztree_cursor_prev(&c) == ztree_max(&t) && ztree_cursor_next(&c) == NULL);
+    ztree_node_Int *mid = ztree_cursor_seek(&c, 5000);
+    assert(ztree_insert(&t, -1, 0) == Z_OK && ztree_cursor_get(&c) == mid);
+    assert(ztree_cursor_insert(&c, mid->key, 7) == Z_OK && mid->value == 7);
+    ztree_clear(&t);
+    PASS();
+}
+
+// Asserts that b is a node-for-node copy of a: same keys, values, colors and shape, but no shared nodes.
+static void check_same_shape(ztree_node_Int *a, ztree_node_Int *b)
+{
+    assert(!a == !b);
+    if (!a)
+    {
+        return;
+    }
+    assert(a != b && a->key == b->key && a->value == b->value && a->color == b->color);
+    check_same_shape(a->left, b->left);
+    check_same_shape(a->right, b->right);
+}
+
+void test_clone(void)
+{
+    TEST("Clone (Shape-Preserving Copy)");
+
+    ztree_Int t = ztree_init(Int), c = ztree_init(Int);
+    assert(ztree_clone(&c, &t) == Z_OK && c.root == NULL && c.size == 0);
+    unsigned seed = 31;
+    for (int i = 0; i < 3000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)((seed >> 8) % 2000);
+        if (i % 3)
+        {
+            assert(ztree_insert(&t, k, i) == Z_OK);
+        }
+        else
+        {
+            ztree_remove(&t, k);
+        }
+    }
+    assert(ztree_insert(&c, 5, 5) == Z_OK);
+    assert(ztree_clone(&c, &t) == Z_OK);
+    check_tree(&c);
+    check_same_shape(t.root, c.root);
+    assert(c.size == t.size && c.block_live == t.size);
+
+    // The copies are independent, and the block goes back once its last node is gone.
+    size_t before = t.size;
+    assert(ztree_insert(&c, 5000, 1) == Z_OK && ztree_find(&t, 5000) == NULL);
+    while (ztree_pop_min(&c, NULL, NULL) == Z_OK)
+    {
+    }
+    assert(c.block == NULL && c.block_live == 0 && t.size == before);
+    check_tree(&t);
+    assert(ztree_clone(&c, &t) == Z_OK);
+    ztree_clear(&t);
+    check_tree(&c);
+    assert(c.size == before && c.block != NULL);
+    ztree_clear(&c);
+    assert(c.block == NULL);
+
+    // Layouts that own more than nodes hand their copies over too.
+    ztree_SInt st = ztree_init(SInt), sc = ztree_init(SInt);
+    ztree_HInt ht = ztree_init(HInt), hc = ztree_init(HInt);
+    ztree_BInt bt = ztree_init(BInt), bc = ztree_init(BInt);
+    ztree_AInt at = ztree_init(AInt), ac = ztree_init(AInt);
+    ztree_SpInt pt = ztree_init(SpInt), pc = ztree_init(SpInt);
+    ztree_ISet it = ztree_init(ISet), ic = ztree_init(ISet);
+    for (int i = 0; i < 1000; ++i)
+    {
+        assert(ztree_insert(&st, i, i * 2) == Z_OK && ztree_insert(&ht, i, i * 3) == Z_OK);
+        assert(ztree_insert(&bt, i * 2, i) == Z_OK && ztree_insert(&at, i, i) == Z_OK);
+        assert(ztree_insert(&pt, i, i) == Z_OK && ztree_insert(&it, i * 5) == Z_OK);
+    }
+    for (int i = 0; i < 1000; i += 3)
+    {
+        ztree_remove(&st, i);
+    }
+    assert(ztree_clone(&sc, &st) == Z_OK && ztree_clone(&hc, &ht) == Z_OK && ztree_clone(&bc, &bt) == Z_OK);
+    assert(ztree_clone(&ac, &at) == Z_OK && ztree_clone(&pc, &pt) == Z_OK && ztree_clone(&ic, &it) == Z_OK);
+    ztree_clear(&st);
+    assert(ztree_insert(&sc, 2000, 7) == Z_OK && *ztree_value(&sc, ztree_find(&sc, 2000)) == 7);
+    ztree_clear(&ht);
+    ztree_clear(&bt);
+    for (int i = 0; i < 1000; ++i)
+    {
+        ztree_node_SInt *sn = ztree_find(&sc, i);
+        assert((i % 3) ? (sn && *ztree_value(&sc, sn) == i * 2) : !sn);
+        assert(ztree_find(&hc, i)->value == i * 3);
+        assert(ztree_find(&bc, i * 2)->value == i && ztree_find(&bc, i * 2 + 1) == NULL);
+        assert(ztree_contains(&ic, i * 5) && !ztree_contains(&ic, i * 5 + 1));
+    }
+    assert(bc.filter.stats.lookups == 2000 && bc.filter.stats.rejected > 900);
+    check_avl_tree(&ac);
+    assert(check_adaptive_tree(&pc) == check_adaptive_tree(&pt) && pc.root->key == pt.root->key);
+    ztree_clear(&sc);
+    ztree_clear(&hc);
+    ztree_clear(&bc);
+    ztree_clear(&at);
+    ztree_clear(&ac);
+    ztree_clear(&pt);
+    ztree_clear(&pc);
+    ztree_clear(&it);
+    ztree_clear(&ic);
+    PASS();
+}
+
+void test_node_handles(void)
+{
+    TEST("Node Handles (Extract, Insert Node)");
+
+    ztree_Int a = ztree_init(Int), b = ztree_init(Int);
+    for (int i = 0; i < 500; ++i)
+    {
+        assert(ztree_insert(&a, i, i * 10) == Z_OK);
+    }
+    assert(ztree_extract(&a, 1000) == NULL);
+
+    // Odd keys move to b as the very same nodes.
+    for (int i = 1; i < 500; i += 2)
+    {
+        ztree_node_Int *held = ztree_find(&a, i);
+        ztree_node_Int *n = ztree_extract(&a, i);
+        assert(n == held && n->key == i && n->value == i * 10 && !n->parent && !n->left && !n->right);
+        assert(ztree_insert_node(&b, n) == Z_OK && ztree_find(&b, i) == held);
+    }
+    check_tree(&a);
+    check_tree(&b);
+    assert(a.size == 250 && b.size == 250 && ztree_find(&a, 1) == NULL);
+
+    // A key that is already there is refused, and the node stays with the caller.
+    ztree_node_Int *n = ztree_extract_node(&a, ztree_min(&a));
+    assert(n->key == 0 && a.size == 249);
+    assert(ztree_insert_node(&a, n) == Z_OK && ztree_insert(&b, 0, 7) == Z_OK);
+    n = ztree_extract(&a, 0);
+    assert(ztree_insert_node(&b, n) == Z_FOUND && ztree_find(&b, 0)->value == 7);
+    ztree_free_node(n);
+
+    // Nodes of a clone live in its shared block; extracting one moves it out first.
+    ztree_Int c = ztree_init(Int);
+    assert(ztree_clone(&c, &b) == Z_OK);
+    ztree_node_Int *inside = ztree_find(&c, 9);
+    n = ztree_extract(&c, 9);
+    assert(n && n != inside && n->key == 9 && n->value == 90 && c.block_live == b.size - 1);
+    assert(ztree_insert_node(&a, n) == Z_OK);
+    check_tree(&a);
+    check_tree(&c);
+    ztree_clear(&a);
+    ztree_clear(&b);
+    ztree_clear(&c);
+
+    // Multimaps keep repeated keys, appending a reinserted node after its equals.
+    ztree_MInt m = ztree_init(MInt);
+    for (int i = 0; i < 3; ++i)
+    {
+        assert(ztree_insert(&m, 5, i) == Z_OK);
+    }
+    ztree_node_MInt *first = ztree_extract(&m, 5);
+    assert(first->value == 0 && ztree_insert_node(&m, first) == Z_OK);
+    assert(ztree_count(&m, 5) == 3 && ztree_max(&m) == first);
+    ztree_clear(&m);
+
+    // AVL and adaptive trees rebalance relinked nodes; sets move bare keys.
+    ztree_AInt av = ztree_init(AInt), aw = ztree_init(AInt);
+    ztree_SpInt sp = ztree_init(SpInt), sq = ztree_init(SpInt);
+    ztree_ISet s1 = ztree_init(ISet), s2 = ztree_init(ISet);
+    for (int i = 0; i < 300; ++i)
+    {
+        assert(ztree_insert(&av, i, i) == Z_OK && ztree_insert(&sp, i, i) == Z_OK && ztree_insert(&s1, i) == Z_OK);
+    }
+    for (int i = 0; i < 300; i += 3)
+    {
+        assert(ztree_insert_node(&aw, ztree_extract(&av, i)) == Z_OK);
+        assert(ztree_insert_node(&sq, ztree_extract(&sp, i)) == Z_OK);
+        assert(ztree_insert_node(&s2, ztree_extract(&s1, i)) == Z_OK);
+    }
+    check_avl_tree(&av);
+    check_avl_tree(&aw);
+    check_adaptive_tree(&sp);
+    check_adaptive_tree(&sq);
+    assert(aw.size == 100 && sq.size == 100 && s2.size == 100 && s1.size == 200);
+    assert(ztree_contains(&s2, 297) && !ztree_contains(&s1, 297));
+    ztree_clear(&av);
+    ztree_clear(&aw);
+    ztree_clear(&sp);
+    ztree_clear(&sq);
+    ztree_clear(&s1);
+    ztree_clear(&s2);
+    PASS();
+}
+
+typedef struct
+{
+    long sum;
+    size_t count;
+} par_acc;
+
+static void par_visit(ztree_node_Int *n, void *ctx)
+{
+    par_acc *acc = (par_acc*)ctx;
+    __atomic_fetch_add(&acc->sum, (long)n->value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&acc->count, 1, __ATOMIC_RELAXED);
+}
+
+// Checks that the ranges tile the whole tree in order and returns the largest one.
+static size_t check_ranges(ztree_Int *t, ztree_range_Int *r, size_t n)
+{
+    ztree_node_Int *expect = ztree_min(t), *iter;
+    size_t largest = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t len = 0;
+        assert(r[i].first == expect && r[i].first != r[i].end);
+        ztree_range_foreach(r[i], iter)
+        {
+            assert(iter == r[i].first || ztree_prev(iter)->key < iter->key);
+            len++;
+        }
+        (void)iter;
+        expect = r[i].end;
+        largest = len > largest ? len : largest;
+    }
+    assert(expect == NULL);
+    return largest;
+}
+
+void test_partition(void)
+{
+    TEST("Partition & Parallel Foreach");
+
+    ztree_Int t = ztree_init(Int);
+    ztree_range_Int r[64];
+    assert(ztree_partition(&t, 4, r) == 0);
+    assert(ztree_insert(&t, 1, 1) == Z_OK && ztree_insert(&t, 2, 2) == Z_OK);
+    assert(ztree_partition(&t, 8, r) == 2 && check_ranges(&t, r, 2) == 1);
+    ztree_clear(&t);
+
+    // Random keys, so the shape is uneven; the ranges still come out within a small factor of n / k.
+    unsigned seed = 99;
+    long total = 0;
+    for (int i = 0; i < 20000; ++i)
+    {
+        seed = seed * 1103515245u + 12345u;
+        int k = (int)(seed >> 4);
+        if (!ztree_find(&t, k))
+        {
+            total += k & 0xFFFF;
+        }
+        assert(ztree_insert(&t, k, k & 0xFFFF) == Z_OK);
+    }
+    size_t k[] = { 1, 4, 8, 64 };
+    for (int i = 0; i < 4; ++i)
+    {
+        size_t n = ztree_partition(&t, k[i], r);
+        assert(n == k[i]);
+        assert(check_ranges(&t, r, n) < 2 * t.size / k[i] + 16);
+    }
+
+    // Splaying every key in ascending order leaves an adaptive tree that is one long left spine. Its pieces at
+    // the walk depth hold nearly everything, so they are split further and still give k even ranges.
+    ztree_SpInt sp = ztree_init(SpInt);
+    for (int i = 0; i < 4096; ++i)
+    {
+        assert(ztree_insert(&sp, i, i) == Z_OK);
+    }
+    for (int i = 0; i < 4096; ++i)
+    {
+        for (int h = 0; h < ZTREE_SPLAY_HITS; ++h) assert(ztree_find(&sp, i) != NULL);
+    }
+    assert(check_adaptive_tree(&sp) > 2048);
+    ztree_range_SpInt sr[64];
+    for (int i = 0; i < 4; ++i)
+    {
+        assert(ztree_partition(&sp, k[i], sr) == k[i]);
+        ztree_node_SpInt *expect = ztree_min(&sp), *iter;
+        for (size_t j = 0; j < k[i]; ++j)
+        {
+            size_t len = 0;
+            assert(sr[j].first == expect);
+            ztree_range_foreach(sr[j], iter) len++;
+            assert(len > 0 && len <= 4096 / k[i] + 1);
+            expect = sr[j].end;
+        }
+        (void)iter;
+        assert(expect == NULL);
+    }
+    ztree_clear(&sp);
+
+    for (size_t threads = 1; threads <= 4; threads += 3)
+    {
+        par_acc acc = { 0, 0 };
+        assert(ztree_parallel_foreach(&t, par_visit, &acc, threads) == Z_OK);
+        assert(acc.sum == total && acc.count == t.size);
+    }
+    par_acc acc = { 0, 0 };
+    assert(ztree_parallel_foreach(&t, par_visit, &acc, 0) == Z_EINVAL && acc.count == 0);
+    ztree_clear(&t);
+    assert(ztree_parallel_foreach(&t, par_visit, &acc, 4) == Z_OK && acc.count == 0);
+    PASS();
+}
+
+// Walks a small map both ways and checks it against the keys 0..n-1 scaled by `step`.
+static void check_small(ztree_SmInt *t, size_t n, int step)
+{
+    size_t i = 0;
+    ztree_node_SmInt *it;
+    ztree_foreach(t, it)
+    {
+        assert(it->key == (int)i * step && it->value == it->key * 10);
+        i++;
+    }
+    assert(i == n && t->size == n);
+    ztree_foreach_reverse(t, it)
+    {
+        assert(it->key == (int)--i * step);
+    }
+    (void)it;
+}
+
+void test_small_map(void)
+{
+    TEST("Small Map (Inline -> Tree)");
+
+    ztree_SmInt t = ztree_init(SmInt);
+    assert(ztree_min(&t) == NULL && ztree_max(&t) == NULL && ztree_find(&t, 1) == NULL);
+    assert(ztree_pop_min(&t, NULL, NULL) == Z_EEMPTY);
+    int order[] = { 10, 2, 14, 0, 6, 12, 4, 8 };
+    for (int i = 0; i < 8; ++i)
+    {
+        assert(ztree_insert(&t, order[i], order[i] * 10) == Z_OK);
+    }
+    assert(ztree_insert(&t, 6, 60) == Z_OK && t.tree.root == NULL);
+    check_small(&t, 8, 2);
+    assert(ztree_lower_bound(&t, 7)->key == 8 && ztree_lower_bound(&t, 15) == NULL);
+    assert(*ztree_value(&t, ztree_find(&t, 14)) == 140 && ztree_find(&t, 3) == NULL);
+
+    // Removing while walking: successors keep their slots.
+    ztree_node_SmInt *it, *safe;
+    ztree_foreach_safe(&t, it, safe)
+    {
+        if (it->key % 4)
+        {
+            ztree_remove_node(&t, it);
+        }
+    }
+    (void)it; (void)safe;
+    check_small(&t, 4, 4);
+
+    // A copied map relinks its inline entries on first use.
+    ztree_SmInt moved = t;
+    memset(&t, 0xAB, sizeof(t));
+    check_small(&moved, 4, 4);
+    int k, v;
+    assert(ztree_pop_max(&moved, &k, &v) == Z_OK && k == 12 && v == 120);
+    assert(ztree_take(&moved, 4, &v) == Z_OK && v == 40 && ztree_take(&moved, 4, &v) == Z_ENOTFOUND);
+
+    // The ninth entry moves everything into the tree; iteration carries on unchanged.
+    ztree_clear(&moved);
+    for (int i = 15; i >= 0; --i)
+    {
+        assert(ztree_insert(&moved, i, i * 10) == Z_OK);
+        assert((moved.tree.root != NULL) == (i < 8));
+    }
+    check_small(&moved, 16, 1);
+    assert(moved.tree.size == 16 && ztree_lower_bound(&moved, 9)->key == 9);
+
+    ztree_SmInt c = ztree_init(SmInt);
+    assert(ztree_clone(&c, &moved) == Z_OK && c.tree.root != NULL);
+    check_small(&c, 16, 1);
+    for (int i = 0; i < 16; ++i)
+    {
+        ztree_remove(&moved, i);
+    }
+    assert(moved.size == 0 && moved.tree.root == NULL && ztree_min(&moved) == NULL);
+    assert(ztree_insert(&moved, 0, 0) == Z_OK && moved.tree.root == NULL);
+    assert(ztree_pop_min(&c, &k, &v) == Z_OK && k == 0 && c.size == 15);
+
+    ztree_clear(&c);
+    assert(ztree_clone(&c, &moved) == Z_OK && c.tree.root == NULL);
+    check_small(&c, 1, 1);
+    ztree_clear(&c);
+    ztree_clear(&moved);
+    PASS();
+}
+
+void test_topk_map(void)
+{
+    TEST("Top-K Map (Bounded, Recycling)");
+
+    ztree_topk_TopInt b = ztree_topk_init(TopInt, 5);
+    for (int i = 0; i < 5; ++i)
+    {
+        assert(ztree_topk_insert(&b, i * 37 % 1000, i) == Z_OK);
+    }
+    ztree_node_TopInt *kept[5], *it;
+    int n = 0;
+    ztree_foreach(&b.tree, it)
+    {
+        kept[n++] = it;
+    }
+
+    // Keys 0..999 in scrambled order: only the five greatest survive, in the nodes allocated first.
+    int rejected = 0;
+    for (int i = 5; i < 1000; ++i)
+    {
+        int rc = ztree_topk_insert(&b, i * 37 % 1000, i);
+        assert(rc == Z_OK || rc == ZTREE_REJECTED);
+        rejected += (rc == ZTREE_REJECTED);
+        assert(b.tree.size == 5);
+    }
+    assert(rejected > 900);
+    int expect = 995;
+    ztree_foreach(&b.tree, it)
+    {
+        assert(it->key == expect++);
+        assert(it == kept[0] || it == kept[1] || it == kept[2] || it == kept[3] || it == kept[4]);
+    }
+    (void)it;
+    assert(expect == 1000);
+
+    // A present key only gets its new value, and the minimum itself is no exception.
+    assert(ztree_topk_insert(&b, 999, -1) == Z_OK && ztree_find(&b.tree, 999)->value == -1);
+    assert(ztree_topk_insert(&b, 995, -2) == Z_OK && ztree_min(&b.tree)->value == -2);
+    assert(ztree_topk_insert(&b, 994, 0) == ZTREE_REJECTED && b.tree.size == 5);
+    assert(ztree_take(&b.tree, 997, NULL) == Z_OK);
+    assert(ztree_topk_insert(&b, 10, 0) == Z_OK && ztree_min(&b.tree)->key == 10);
+
+    ztree_topk_clear(&b);
+    assert(b.tree.size == 0 && b.cap == 5 && ztree_topk_insert(&b, 1, 1) == Z_OK);
+    ztree_topk_clear(&b);
+
+    ztree_topk_TopInt none = ztree_topk_init(TopInt, 0);
+    assert(ztree_topk_insert(&none, 1, 1) == ZTREE_REJECTED && none.tree.size == 0);
+    PASS();
+}
+
 int main(void) 
 {
+#ifdef ZTREE_THREADED
+    printf("=> Running tests (ztree.h, C, ZTREE_THREADED)\n");
+#else
     printf("=> Running tests (ztree.h, C)\n");
+#endif
     test_basic_ops();
     test_ordering_and_bounds();
     test_removal();
     test_iteration();
+    test_apply_batch();
+    test_pop_min_max();
+    test_remove_node_take();
+    test_set();
+    test_multimap();
+    test_compact_layout();
+    test_index_layout();
+    test_split_layout();
+    test_prefix_layout();
+    test_hashed_layout();
+    test_filtered_layout();
+    test_avl_layout();
+    test_adaptive_layout();
+    test_sync_map();
+    test_sharded_map();
+    test_skiplist_map();
+    test_rcu_map();
+    test_persistent_map();
+    test_finger_cursor();
+    test_clone();
+    test_node_handles();
+    test_partition();
+    test_small_map();
+    test_topk_map();
     printf("=> All tests passed successfully.\n");
     return 0;
 }